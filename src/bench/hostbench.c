@@ -0,0 +1,263 @@
+// VirtualDisk Host Directory Benchmark
+// Dan Jackson, 2013
+
+// Compares the throughput of reading the files of a host directory tree through the virtual disk (each file's sectors, counting only
+// the file's bytes) with reading the same host files directly, in the same size of request. First, every file read through the disk,
+// from several threads at once (each with its own read context), is checked against the host file, and must be blank after its end.
+// Usage: hostbench <directory> [sectors-per-read] [passes] [mmap|uring|direct]
+
+#define _POSIX_C_SOURCE 200809L
+#define _FILE_OFFSET_BITS 64
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <pthread.h>
+
+#include "../virtualdisk/virtualdisk.h"
+#include "../virtualdisk/virtualdiskhost.h"
+#include "../virtualdisk/virtualdiskindex.h"
+#include "../virtualdisk/virtualdiskuring.h"
+
+#define SECTOR_SIZE 512
+#define SECTORS_PER_CLUSTER 8
+#define CHECK_THREADS 4
+#define CHECK_SECTORS 64
+
+static virtualdisk_t virtualdisk;
+static virtualdisk_partition_t partition;
+static virtualdisk_host_t host;
+
+// A file on the virtual disk: its scanned host entry, size, and first sector on the disk
+typedef struct
+{
+    unsigned long entry;
+    unsigned long size;
+    unsigned long firstSector;
+} bench_file_t;
+static bench_file_t *files;
+static unsigned long numFiles;
+
+// A thread checking every CHECK_THREADS-th file, through its own read context
+typedef struct
+{
+    pthread_t thread;
+    virtualdisk_t disk;
+    virtualdisk_partition_t partitions[VIRTUALDISK_MAX_PARTITIONS];
+    unsigned long first;
+    unsigned long mismatches;
+} bench_check_t;
+
+
+// Elapsed seconds since the specified start time
+static double Elapsed(const struct timespec *start)
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (now.tv_sec - start->tv_sec) + (now.tv_nsec - start->tv_nsec) / 1e9;
+}
+
+// File information: the scanned host tree
+static char HostFileInfo(virtualdisk_fileinfo_t *fileInfo)
+{
+    return VirtualDiskHostFileInfo(&host, fileInfo);
+}
+
+// Write the host path of a scanned entry
+static void HostPath(char *path, unsigned long entry)
+{
+    if (entry == 0xfffffffful) { strcpy(path, host.path); return; }
+    HostPath(path, host.entries[entry].parent);
+    strcat(path, "/");
+    strcat(path, host.names + host.entries[entry].name);
+}
+
+// Read every scanned host file directly (returns the number of bytes read)
+static unsigned long long ReadHostFiles(unsigned char *buffer, size_t length)
+{
+    static char path[8192];
+    unsigned long long total = 0;
+    unsigned long entry;
+
+    for (entry = 0; entry < host.numEntries; entry++)
+    {
+        ssize_t n;
+        int fd;
+        if (host.entries[entry].directory) { continue; }
+        HostPath(path, entry);
+        if ((fd = open(path, O_RDONLY)) < 0) { continue; }
+        while ((n = read(fd, buffer, length)) > 0) { total += (unsigned long long)n; }
+        close(fd);
+    }
+    return total;
+}
+
+// List the files of the virtual disk from its index (returns zero if out of memory)
+static char ListFiles(const virtualdisk_index_t *index)
+{
+    unsigned long i;
+
+    if ((files = (bench_file_t *)malloc((index->count + 1) * sizeof(bench_file_t))) == NULL) { return 0; }
+    for (i = 0; i < index->count; i++)
+    {
+        const unsigned char *c = index->entries[i].firstCluster;
+        virtualdisk_fileinfo_t fileInfo;
+        memset(&fileInfo, 0, sizeof(fileInfo));
+        if (!VirtualDiskIndexFileInfo(&partition, index, i, &fileInfo) || (fileInfo.attributes & VIRTUALDISK_ATTRIB_DIRECTORY)) { continue; }
+        files[numFiles].entry = host.dirFirst[fileInfo.parent] + (unsigned long)fileInfo.id;
+        files[numFiles].size = fileInfo.size;
+        files[numFiles].firstSector = partition.partitionStartSector + partition.regionData + ((c[0] | ((unsigned long)c[1] << 8) | ((unsigned long)c[2] << 16) | ((unsigned long)c[3] << 24)) - 2) * SECTORS_PER_CLUSTER;
+        numFiles++;
+    }
+    return 1;
+}
+
+// Read the sectors of every file through the virtual disk (returns the number of file bytes read)
+static unsigned long long ReadVirtualFiles(unsigned char *buffer, unsigned short count)
+{
+    unsigned long long total = 0;
+    unsigned long f, sector;
+
+    for (f = 0; f < numFiles; f++)
+    {
+        unsigned long sectors = (files[f].size + SECTOR_SIZE - 1) / SECTOR_SIZE;
+        for (sector = 0; sector < sectors; sector += count)
+        {
+            unsigned short n = (sectors - sector < count) ? (unsigned short)(sectors - sector) : count;
+            VirtualDiskReadSectors(&virtualdisk, files[f].firstSector + sector, n, buffer);
+        }
+        total += files[f].size;
+    }
+    return total;
+}
+
+// Check thread: compare each of its files, read through its read context, with the host file (and blank after its end)
+static void *CheckThread(void *arg)
+{
+    static char paths[CHECK_THREADS][8192];
+    bench_check_t *check = (bench_check_t *)arg;
+    unsigned char expected[CHECK_SECTORS * SECTOR_SIZE], actual[CHECK_SECTORS * SECTOR_SIZE];
+    char *path = paths[check->first];
+    unsigned long f;
+
+    for (f = check->first; f < numFiles; f += CHECK_THREADS)
+    {
+        unsigned long sectors = (files[f].size + SECTOR_SIZE - 1) / SECTOR_SIZE, sector;
+        int fd;
+        HostPath(path, files[f].entry);
+        if ((fd = open(path, O_RDONLY)) < 0) { check->mismatches++; continue; }
+        for (sector = 0; sector < sectors; sector += CHECK_SECTORS)
+        {
+            unsigned short n = (sectors - sector < CHECK_SECTORS) ? (unsigned short)(sectors - sector) : CHECK_SECTORS;
+            size_t length = (files[f].size - sector * SECTOR_SIZE < (unsigned long)n * SECTOR_SIZE) ? files[f].size - sector * SECTOR_SIZE : (size_t)n * SECTOR_SIZE;
+            memset(expected, 0, sizeof(expected));
+            if (pread(fd, expected, length, (off_t)sector * SECTOR_SIZE) != (ssize_t)length
+             || VirtualDiskReadSectors(&check->disk, files[f].firstSector + sector, n, actual) != n
+             || memcmp(expected, actual, (size_t)n * SECTOR_SIZE) != 0)
+            {
+                check->mismatches++;
+                break;
+            }
+        }
+        close(fd);
+    }
+    return NULL;
+}
+
+// Check every file read through the virtual disk, from several threads at once, matches its host file (returns the number of mismatched files)
+static unsigned long CheckVirtualFiles(void)
+{
+    static bench_check_t checks[CHECK_THREADS];
+    unsigned long mismatches = 0;
+    int i;
+
+    for (i = 0; i < CHECK_THREADS; i++)
+    {
+        checks[i].first = (unsigned long)i;
+        checks[i].mismatches = 0;
+        VirtualDiskCopy(&checks[i].disk, checks[i].partitions, &virtualdisk);
+        pthread_create(&checks[i].thread, NULL, CheckThread, &checks[i]);
+    }
+    for (i = 0; i < CHECK_THREADS; i++)
+    {
+        pthread_join(checks[i].thread, NULL);
+        VirtualDiskEndSession(&checks[i].disk);
+        mismatches += checks[i].mismatches;
+    }
+    return mismatches;
+}
+
+int main(int argc, char *argv[])
+{
+    unsigned short count = (argc > 2) ? (unsigned short)atoi(argv[2]) : 128;
+    int passes = (argc > 3) ? atoi(argv[3]) : 3, pass;
+    const char *mode = (argc > 4) ? argv[4] : "pread";
+    virtualdisk_uring_t ring;
+    virtualdisk_index_t fileIndex;
+    unsigned long clusters, mismatches;
+    unsigned char *buffer;
+    struct timespec start;
+    double seconds;
+
+    if (argc < 2 || count == 0) { fprintf(stderr, "Usage: hostbench <directory> [sectors-per-read] [passes] [mmap|uring|direct]\n"); return 1; }
+
+    // Scan the host directory
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    if (!VirtualDiskHostOpen(&host, argv[1], SECTOR_SIZE, 0)) { fprintf(stderr, "Problem scanning directory: %s\n", argv[1]); return 1; }
+    seconds = Elapsed(&start);
+    host.mapFiles = (strcmp(mode, "mmap") == 0);
+    if (strcmp(mode, "uring") == 0 || strcmp(mode, "direct") == 0)
+    {
+        if (!VirtualDiskUringInit(&ring, strcmp(mode, "direct") == 0)) { fprintf(stderr, "Problem creating ring\n"); return 1; }
+        if (ring.fd < 0) { printf("(io_uring not available, using synchronous reads)\n"); }
+        host.uring = &ring;
+    }
+    printf("Scanned %lu entries (%lu directories) in %.3f s\n", host.numEntries, host.numDirs, seconds);
+
+    // Create the virtual disk, with a complete index of the files
+    VirtualDiskInit(&virtualdisk, SECTOR_SIZE);
+    clusters = VirtualDiskHostCountClusters(&host, SECTOR_SIZE * SECTORS_PER_CLUSTER) + 16;
+    if (clusters < 4200) { clusters = 4200; }
+    if (!VirtualDiskAddPartition(&virtualdisk, &partition, HostFileInfo, SECTORS_PER_CLUSTER, clusters, 0xfff0)) { fprintf(stderr, "Problem adding partition\n"); return 1; }
+    fileIndex.capacity = host.numEntries + 1;
+    fileIndex.entries = (virtualdisk_index_entry_t *)malloc(fileIndex.capacity * sizeof(virtualdisk_index_entry_t));
+    buffer = (unsigned char *)malloc((size_t)count * SECTOR_SIZE);
+    if (fileIndex.entries == NULL || buffer == NULL) { fprintf(stderr, "Out of memory\n"); return 1; }
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    if (!VirtualDiskIndexBuildParallel(&partition, &fileIndex, 4)) { fprintf(stderr, "Index incomplete\n"); }
+    seconds = Elapsed(&start);
+    VirtualDiskPartitionSetIndex(&partition, &fileIndex);
+    printf("Indexed %lu entries in %.3f s, disk is %lu sectors\n", fileIndex.count, seconds, VirtualDiskSectorCount(&virtualdisk));
+
+    // Check the files' contents
+    if (!ListFiles(&fileIndex)) { fprintf(stderr, "Out of memory\n"); return 1; }
+    mismatches = CheckVirtualFiles();
+    printf("Checked %lu files against the host files (%d threads): %lu mismatched\n", numFiles, CHECK_THREADS, mismatches);
+
+    // Alternate passes, so both see a similar host page cache state
+    for (pass = 0; pass < passes; pass++)
+    {
+        unsigned long long bytes;
+
+        clock_gettime(CLOCK_MONOTONIC, &start);
+        bytes = ReadHostFiles(buffer, (size_t)count * SECTOR_SIZE);
+        seconds = Elapsed(&start);
+        printf("Pass %d: host files   %12llu bytes in %8.3f s = %8.1f MB/s\n", pass + 1, bytes, seconds, bytes / 1e6 / seconds);
+
+        clock_gettime(CLOCK_MONOTONIC, &start);
+        bytes = ReadVirtualFiles(buffer, count);
+        seconds = Elapsed(&start);
+        printf("Pass %d: virtual disk %12llu bytes in %8.3f s = %8.1f MB/s (%s)\n", pass + 1, bytes, seconds, bytes / 1e6 / seconds, mode);
+    }
+
+    VirtualDiskPartitionSetIndex(&partition, NULL);
+    VirtualDiskHostClose(&host);
+    if (host.uring != NULL) { VirtualDiskUringClose(&ring); }
+    free(fileIndex.entries);
+    free(files);
+    free(buffer);
+    return mismatches ? 1 : 0;
+}
@@ -0,0 +1,456 @@
+// VirtualDisk NBD Server Benchmark
+// Dan Jackson, 2013
+
+// Serves an exFAT volume of synthetic files (and some unused space) over a Unix socket, and connects to it with a minimal
+// in-process NBD client. First checks the protocol: both negotiation styles, reads of arbitrary alignment against the disk read
+// directly, single-chunk reads, block status extents, and a refused write. Then measures the throughput and latency of sequential
+// reads at several queue depths (requests in flight on each connection), with the disk divided between the connections.
+// Usage: nbdbench <files> <MiB-per-file> [request-KiB] [connections] [shared]
+
+#define _POSIX_C_SOURCE 200809L
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+#include "../virtualdisk/virtualdisk.h"
+#include "../virtualdisk/virtualdisknbd.h"
+#include "../virtualdisk/virtualdisksynth.h"
+
+#define SECTOR_SIZE 512
+#define SECTORS_PER_CLUSTER 64
+#define MAX_FILES 64
+#define MAX_CONNECTIONS 16
+#define MAX_DEPTH 64
+#define SOCKET_PATH "/tmp/nbdbench.sock"
+
+static virtualdisk_t virtualdisk;
+static virtualdisk_partition_t partition;
+static virtualdisk_t reference;                     // Separate read context to check against
+static virtualdisk_partition_t referencePartitions[VIRTUALDISK_MAX_PARTITIONS];
+static virtualdisk_synth_t synth[MAX_FILES];
+static int numFiles;
+static unsigned long fileMiB;
+
+// A client connection
+typedef struct
+{
+    int socket;
+    char structured;
+    unsigned long long size;
+    unsigned short flags;
+} client_t;
+
+
+static void SetBe(unsigned char *p, unsigned long long v, int bytes) { while (bytes-- > 0) { p[bytes] = (unsigned char)v; v >>= 8; } }
+static unsigned long long GetBe(const unsigned char *p, int bytes) { unsigned long long v = 0; while (bytes-- > 0) { v = (v << 8) | *p++; } return v; }
+
+static int Send(int s, const void *buffer, size_t length)
+{
+    const unsigned char *p = (const unsigned char *)buffer;
+    while (length > 0) { ssize_t n = send(s, p, length, MSG_NOSIGNAL); if (n <= 0) { return 0; } p += n; length -= (size_t)n; }
+    return 1;
+}
+
+static int Receive(int s, void *buffer, size_t length)
+{
+    unsigned char *p = (unsigned char *)buffer;
+    while (length > 0) { ssize_t n = recv(s, p, length, 0); if (n <= 0) { return 0; } p += n; length -= (size_t)n; }
+    return 1;
+}
+
+// Elapsed seconds since the specified start time
+static double Elapsed(const struct timespec *start)
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (now.tv_sec - start->tv_sec) + (now.tv_nsec - start->tv_nsec) / 1e9;
+}
+
+
+// File information: numbered files of synthetic contents (called from each connection's thread, so the names are made beforehand)
+static char filenames[MAX_FILES][16];
+static char SynthFileInfo(virtualdisk_fileinfo_t *fileInfo)
+{
+    if (fileInfo->parent != VIRTUALDISK_ROOT_DIRECTORY || fileInfo->id < 0 || fileInfo->id >= numFiles) { return 0; }
+    fileInfo->filename = filenames[fileInfo->id];
+    fileInfo->attributes = VIRTUALDISK_ATTRIB_ARCHIVE;
+    fileInfo->size = fileMiB << 20;
+    fileInfo->created = VIRTUALDISK_DATETIME_MIN;
+    fileInfo->modified = VIRTUALDISK_DATETIME_MIN;
+    fileInfo->accessed = VIRTUALDISK_DATETIME_MIN;
+    fileInfo->contents = VirtualDiskSynthContents;
+    fileInfo->reference = &synth[fileInfo->id];
+    return 1;
+}
+
+// Read a byte range of the disk directly (through the reference context)
+static void ReadReference(unsigned long long offset, unsigned long length, unsigned char *out)
+{
+    static unsigned char buffer[SECTOR_SIZE * 128];
+    while (length > 0)
+    {
+        unsigned long sector = (unsigned long)(offset / SECTOR_SIZE), skip = (unsigned long)(offset % SECTOR_SIZE);
+        unsigned long part = sizeof(buffer) - skip;
+        if (part > length) { part = length; }
+        VirtualDiskReadSectors(&reference, sector, (unsigned short)((skip + part + SECTOR_SIZE - 1) / SECTOR_SIZE), buffer);
+        memcpy(out, buffer + skip, part);
+        out += part; offset += part; length -= part;
+    }
+}
+
+
+// Send an option (returns non-zero if sent)
+static int SendOption(client_t *client, unsigned long option, const unsigned char *data, unsigned long length)
+{
+    unsigned char header[16];
+    SetBe(header, 0x49484156454f5054ull, 8);
+    SetBe(header + 8, option, 4);
+    SetBe(header + 12, length, 4);
+    return Send(client->socket, header, 16) && (length == 0 || Send(client->socket, data, length));
+}
+
+// Receive option replies until the final one (returns its reply type, or 0 on error); NBD_INFO_EXPORT fills in the size and flags
+static unsigned long ReceiveOptionReplies(client_t *client, int *contexts)
+{
+    for (;;)
+    {
+        unsigned char header[20], data[1024];
+        unsigned long type, length;
+        if (!Receive(client->socket, header, 20) || GetBe(header, 8) != 0x0003e889045565a9ull) { return 0; }
+        type = (unsigned long)GetBe(header + 12, 4);
+        length = (unsigned long)GetBe(header + 16, 4);
+        if (length > sizeof(data) || !Receive(client->socket, data, length)) { return 0; }
+        if (type == 3 && length >= 12 && GetBe(data, 2) == 0) { client->size = GetBe(data + 2, 8); client->flags = (unsigned short)GetBe(data + 10, 2); }
+        if (type == 4 && contexts != NULL) { (*contexts)++; }
+        if (type != 3 && type != 4 && type != 2) { return type; }
+    }
+}
+
+// Connect and negotiate (structured: NBD_OPT_STRUCTURED_REPLY, 'base:allocation' and NBD_OPT_GO; otherwise NBD_OPT_EXPORT_NAME)
+static int Connect(client_t *client, int structured)
+{
+    struct sockaddr_un address;
+    unsigned char buffer[256];
+
+    memset(client, 0, sizeof(client_t));
+    client->socket = socket(AF_UNIX, SOCK_STREAM, 0);
+    memset(&address, 0, sizeof(address));
+    address.sun_family = AF_UNIX;
+    strcpy(address.sun_path, SOCKET_PATH);
+    if (client->socket < 0 || connect(client->socket, (struct sockaddr *)&address, sizeof(address)) != 0) { return 0; }
+
+    if (!Receive(client->socket, buffer, 18) || GetBe(buffer, 8) != 0x4e42444d41474943ull || GetBe(buffer + 8, 8) != 0x49484156454f5054ull) { return 0; }
+    SetBe(buffer, 3, 4);      // Fixed newstyle, no zeroes
+    if (!Send(client->socket, buffer, 4)) { return 0; }
+
+    if (structured)
+    {
+        static const char query[] = "base:allocation";
+        int contexts = 0;
+        unsigned long n;
+
+        if (!SendOption(client, 8, NULL, 0) || ReceiveOptionReplies(client, NULL) != 1) { return 0; }
+        client->structured = 1;
+        n = 0;
+        SetBe(buffer + n, 0, 4); n += 4;                                // Default export
+        SetBe(buffer + n, 1, 4); n += 4;                                // One query
+        SetBe(buffer + n, sizeof(query) - 1, 4); n += 4;
+        memcpy(buffer + n, query, sizeof(query) - 1); n += sizeof(query) - 1;
+        if (!SendOption(client, 10, buffer, n) || ReceiveOptionReplies(client, &contexts) != 1 || contexts != 1) { return 0; }
+        SetBe(buffer, 0, 4);
+        SetBe(buffer + 4, 1, 2);                                        // Request the block size
+        SetBe(buffer + 6, 3, 2);
+        if (!SendOption(client, 7, buffer, 8) || ReceiveOptionReplies(client, NULL) != 1) { return 0; }
+    }
+    else
+    {
+        if (!SendOption(client, 1, NULL, 0) || !Receive(client->socket, buffer, 10)) { return 0; }
+        client->size = GetBe(buffer, 8);
+        client->flags = (unsigned short)GetBe(buffer + 8, 2);
+    }
+    return 1;
+}
+
+// Send a request
+static int SendRequest(client_t *client, unsigned short flags, unsigned short type, unsigned long long cookie, unsigned long long offset, unsigned long length)
+{
+    unsigned char request[28];
+    SetBe(request, 0x25609513, 4);
+    SetBe(request + 4, flags, 2);
+    SetBe(request + 6, type, 2);
+    SetBe(request + 8, cookie, 8);
+    SetBe(request + 16, offset, 8);
+    SetBe(request + 24, length, 4);
+    return Send(client->socket, request, 28);
+}
+
+// Receive the whole reply to a read at the specified offset (returns the error, or -1 on a protocol error; counts the chunks)
+static long ReceiveRead(client_t *client, unsigned long long *cookie, unsigned long long offset, unsigned long length, unsigned char *out, int *chunks)
+{
+    unsigned char header[20];
+    *chunks = 0;
+
+    if (!client->structured)
+    {
+        if (!Receive(client->socket, header, 16) || GetBe(header, 4) != 0x67446698) { return -1; }
+        *cookie = GetBe(header + 8, 8);
+        if (GetBe(header + 4, 4) != 0) { return (long)GetBe(header + 4, 4); }
+        *chunks = 1;
+        return Receive(client->socket, out, length) ? 0 : -1;
+    }
+
+    for (;;)
+    {
+        unsigned long flags, type, chunkLength;
+        unsigned char payload[12];
+        long error = 0;
+
+        if (!Receive(client->socket, header, 20) || GetBe(header, 4) != 0x668e33ef) { return -1; }
+        flags = (unsigned long)GetBe(header + 4, 2);
+        type = (unsigned long)GetBe(header + 6, 2);
+        *cookie = GetBe(header + 8, 8);
+        chunkLength = (unsigned long)GetBe(header + 16, 4);
+        (*chunks)++;
+        if (type == 1)                                  // Data
+        {
+            unsigned long long at;
+            if (chunkLength < 8 || !Receive(client->socket, payload, 8)) { return -1; }
+            at = GetBe(payload, 8);
+            if (at < offset || at + chunkLength - 8 > offset + length || !Receive(client->socket, out + (at - offset), chunkLength - 8)) { return -1; }
+        }
+        else if (type == 2)                             // Hole
+        {
+            unsigned long long at;
+            unsigned long size;
+            if (chunkLength != 12 || !Receive(client->socket, payload, 12)) { return -1; }
+            at = GetBe(payload, 8);
+            size = (unsigned long)GetBe(payload + 8, 4);
+            if (at < offset || at + size > offset + length) { return -1; }
+            memset(out + (at - offset), 0, size);
+        }
+        else if (type == 0x8001)                        // Error
+        {
+            unsigned char message[256];
+            if (chunkLength < 6 || chunkLength > sizeof(message) || !Receive(client->socket, message, chunkLength)) { return -1; }
+            error = (long)GetBe(message, 4);
+        }
+        else if (type != 0 || chunkLength != 0) { return -1; }
+        if (flags & 1) { return error; }
+    }
+}
+
+
+// Check the protocol on one connection (returns the number of problems)
+static int CheckProtocol(virtualdisk_nbd_t *server, int structured)
+{
+    unsigned char *data = (unsigned char *)malloc(2u << 20), *expected = (unsigned char *)malloc(2u << 20);
+    unsigned long long size, cookie, offset, holeBytes = 0, dataBytes = 0;
+    client_t client;
+    int errors = 0, i, chunks, extents = 0, holes = 0;
+    unsigned int seed = 1;
+
+    if (!Connect(&client, structured)) { printf("Connect failed\n"); free(data); free(expected); return 1; }
+    size = client.size;
+    if (size != (unsigned long long)VirtualDiskSectorCount(&virtualdisk) * SECTOR_SIZE || !(client.flags & 2)) { printf("Export size/flags wrong\n"); errors++; }
+
+    // Reads of arbitrary alignment and length
+    for (i = 0; i < 500; i++)
+    {
+        if (i == 250) { VirtualDiskNbdLock(server); VirtualDiskNbdUnlock(server); }     // As for a live update: a per-connection copy is made again
+        unsigned long length = (i % 10 == 0) ? (unsigned long)(rand_r(&seed) % (2u << 20)) : (unsigned long)(rand_r(&seed) % 70000);
+        offset = ((unsigned long long)rand_r(&seed) * RAND_MAX + rand_r(&seed)) % (size - length + 1);
+        if (i % 3 == 0) { offset -= offset % SECTOR_SIZE; }
+        if (!SendRequest(&client, (i % 7 == 0) ? 4 : 0, 0, 1000 + i, offset, length) || ReceiveRead(&client, &cookie, offset, length, data, &chunks) != 0 || cookie != (unsigned long long)(1000 + i)) { printf("Read %d failed\n", i); errors++; break; }
+        if (structured && i % 7 == 0 && length > 0 && chunks != 1) { printf("Read %d with DF flag in %d chunks\n", i, chunks); errors++; }
+        ReadReference(offset, length, expected);
+        if (memcmp(data, expected, length) != 0) { printf("Read %d at %llu (%lu bytes) differs\n", i, offset, length); errors++; }
+    }
+
+    // Reading past the end, and writing, are refused
+    if (!SendRequest(&client, 0, 0, 1, size - 512, 1024) || ReceiveRead(&client, &cookie, size - 512, 1024, data, &chunks) != 22) { printf("Read past the end not refused\n"); errors++; }
+    if (!SendRequest(&client, 0, 1, 2, 0, 512) || !Send(client.socket, data, 512) || ReceiveRead(&client, &cookie, 0, 0, data, &chunks) != 1) { printf("Write not refused\n"); errors++; }
+
+    // Block status over the whole disk: holes must read as zero
+    for (offset = 0; structured && offset < size; )
+    {
+        unsigned char header[20], payload[4 + 8 * 1024];
+        unsigned long length = (size - offset > 0xfffff000ull) ? 0xfffff000ul : (unsigned long)(size - offset), chunkLength, n;
+        if (!SendRequest(&client, 0, 7, 3, offset, length) || !Receive(client.socket, header, 20) || GetBe(header + 6, 2) != 5) { printf("Block status failed\n"); errors++; break; }
+        chunkLength = (unsigned long)GetBe(header + 16, 4);
+        if (chunkLength > sizeof(payload) || !Receive(client.socket, payload, chunkLength) || chunkLength < 12 || GetBe(payload, 4) != 1) { printf("Block status reply wrong\n"); errors++; break; }
+        for (n = 0; n < (chunkLength - 4) / 8; n++)
+        {
+            unsigned long extent = (unsigned long)GetBe(payload + 4 + 8 * n, 4), state = (unsigned long)GetBe(payload + 8 + 8 * n, 4);
+            extents++;
+            if (state == 3)
+            {
+                unsigned long checked = (extent < (2u << 20)) ? extent : (2u << 20);
+                holes++;
+                holeBytes += extent;
+                ReadReference(offset + extent - checked, checked, expected);
+                for (i = 0; i < (int)checked; i++) { if (expected[i] != 0) { printf("Hole at %llu is not blank\n", offset); errors++; break; } }
+            }
+            else { dataBytes += extent; }
+            offset += extent;
+        }
+    }
+    if (structured) { printf("Block status: %d extents, %d holes (%llu bytes), %llu data bytes\n", extents, holes, holeBytes, dataBytes); }
+    if (structured && holeBytes + dataBytes != size) { printf("Block status extents do not cover the disk\n"); errors++; }
+
+    SendRequest(&client, 0, 2, 0, 0, 0);
+    close(client.socket);
+    free(data);
+    free(expected);
+    return errors;
+}
+
+
+// Benchmark connection thread
+typedef struct
+{
+    unsigned long long start, end;                  // Byte range read
+    unsigned long requestSize;
+    int depth;
+    double *latencies;                              // One per request
+    unsigned long count;
+    int failed;
+} bench_t;
+
+static void *BenchThread(void *reference)
+{
+    bench_t *bench = (bench_t *)reference;
+    unsigned char *data = (unsigned char *)malloc(bench->requestSize);
+    struct timespec sent[MAX_DEPTH];
+    unsigned long long next = bench->start, cookie;
+    client_t client;
+    int inFlight = 0, chunks;
+
+    bench->count = 0;
+    if (data == NULL || !Connect(&client, 1)) { bench->failed = 1; free(data); return NULL; }
+    while (next < bench->end || inFlight > 0)
+    {
+        // Keep the queue full
+        while (next < bench->end && inFlight < bench->depth)
+        {
+            unsigned long length = (bench->end - next < bench->requestSize) ? (unsigned long)(bench->end - next) : bench->requestSize;
+            int slot = (int)(((next - bench->start) / bench->requestSize) % MAX_DEPTH);
+            clock_gettime(CLOCK_MONOTONIC, &sent[slot]);
+            if (!SendRequest(&client, 0, 0, next, next, length)) { bench->failed = 1; break; }
+            next += length;
+            inFlight++;
+        }
+        if (bench->failed) { break; }
+
+        // Replies arrive in order
+        {
+            unsigned long long offset = bench->start + (unsigned long long)bench->count * bench->requestSize;
+            unsigned long length = (bench->end - offset < bench->requestSize) ? (unsigned long)(bench->end - offset) : bench->requestSize;
+            if (ReceiveRead(&client, &cookie, offset, length, data, &chunks) != 0 || cookie != offset) { bench->failed = 1; break; }
+            bench->latencies[bench->count] = Elapsed(&sent[bench->count % MAX_DEPTH]);
+            bench->count++;
+            inFlight--;
+        }
+    }
+    SendRequest(&client, 0, 2, 0, 0, 0);
+    close(client.socket);
+    free(data);
+    return NULL;
+}
+
+static int CompareDouble(const void *a, const void *b) { double x = *(const double *)a, y = *(const double *)b; return (x > y) - (x < y); }
+
+static void *ServeThread(void *reference)
+{
+    VirtualDiskNbdServe((virtualdisk_nbd_t *)reference);
+    return NULL;
+}
+
+
+int main(int argc, char *argv[])
+{
+    static const int depths[] = { 1, 2, 4, 8, 16, 32, 64 };
+    unsigned long requestSize = ((argc > 3) ? strtoul(argv[3], NULL, 0) : 128) * 1024;
+    int connections = (argc > 4) ? atoi(argv[4]) : 1;
+    char shared = (argc > 5 && strcmp(argv[5], "shared") == 0);
+    virtualdisk_index_t fileIndex;
+    virtualdisk_index_entry_t entries[MAX_FILES + 1];
+    unsigned long long fileClusters, size;
+    virtualdisk_nbd_t server;
+    pthread_t serveThread;
+    int errors, d, i;
+
+    numFiles = (argc > 1) ? atoi(argv[1]) : 0;
+    fileMiB = (argc > 2) ? strtoul(argv[2], NULL, 0) : 0;
+    if (numFiles < 1 || numFiles > MAX_FILES || fileMiB < 1 || fileMiB > 4095 || requestSize == 0 || requestSize > VIRTUALDISKNBD_MAX_REQUEST || connections < 1 || connections > MAX_CONNECTIONS) { fprintf(stderr, "Usage: nbdbench <files> <MiB-per-file> [request-KiB] [connections] [shared]\n"); return 1; }
+
+    // Each file's contents differ (by seed); a quarter of the volume is left unused
+    for (i = 0; i < numFiles; i++)
+    {
+        VirtualDiskSynthInit(&synth[i], VIRTUALDISKSYNTH_RANDOM, SECTOR_SIZE, 0x5eed0000ull + i, NULL, 0);
+        sprintf(filenames[i], "SYNTH%03d.BIN", i + 1);
+    }
+    fileClusters = ((unsigned long long)fileMiB << 20) / (SECTOR_SIZE * SECTORS_PER_CLUSTER) * numFiles;
+    VirtualDiskInit(&virtualdisk, SECTOR_SIZE);
+    if (!VirtualDiskAddExFatPartition(&virtualdisk, &partition, SynthFileInfo, SECTORS_PER_CLUSTER, (unsigned long)(fileClusters + fileClusters / 3 + 1024), 512)) { fprintf(stderr, "Problem adding partition\n"); return 1; }
+    fileIndex.entries = entries;
+    fileIndex.capacity = MAX_FILES + 1;
+    fileIndex.count = 0;
+    fileIndex.complete = 0;
+    if (!VirtualDiskPartitionBuildIndex(&partition, &fileIndex)) { fprintf(stderr, "Index incomplete\n"); return 1; }
+    VirtualDiskPartitionSetIndex(&partition, &fileIndex);
+    VirtualDiskCopy(&reference, referencePartitions, &virtualdisk);
+    size = (unsigned long long)VirtualDiskSectorCount(&virtualdisk) * SECTOR_SIZE;
+    printf("%d files of %lu MiB, disk is %llu bytes, %s read contexts\n", numFiles, fileMiB, size, shared ? "one shared" : "per-connection");
+
+    // Serve on a Unix socket
+    if (!VirtualDiskNbdInit(&server, &virtualdisk, "synth", "Synthetic volume", shared) || !VirtualDiskNbdListenUnix(&server, SOCKET_PATH)) { fprintf(stderr, "Cannot listen on %s\n", SOCKET_PATH); return 1; }
+    pthread_create(&serveThread, NULL, ServeThread, &server);
+
+    errors = CheckProtocol(&server, 0) + CheckProtocol(&server, 1);
+    printf("Protocol checks: %d problems\n", errors);
+
+    // Sequential reads at each queue depth, the disk divided between the connections
+    for (d = 0; d < (int)(sizeof(depths) / sizeof(depths[0])) && errors == 0; d++)
+    {
+        bench_t bench[MAX_CONNECTIONS];
+        pthread_t threads[MAX_CONNECTIONS];
+        unsigned long total = 0;
+        double *all, seconds;
+        struct timespec start;
+
+        clock_gettime(CLOCK_MONOTONIC, &start);
+        for (i = 0; i < connections; i++)
+        {
+            bench[i].start = size / connections * i;
+            bench[i].end = (i == connections - 1) ? size : size / connections * (i + 1);
+            bench[i].requestSize = requestSize;
+            bench[i].depth = depths[d];
+            bench[i].latencies = (double *)malloc(sizeof(double) * (size_t)((bench[i].end - bench[i].start) / requestSize + 1));
+            bench[i].failed = 0;
+            pthread_create(&threads[i], NULL, BenchThread, &bench[i]);
+        }
+        for (i = 0; i < connections; i++) { pthread_join(threads[i], NULL); total += bench[i].count; errors += bench[i].failed; }
+        seconds = Elapsed(&start);
+
+        all = (double *)malloc(sizeof(double) * (total + 1));
+        total = 0;
+        for (i = 0; i < connections; i++) { memcpy(all + total, bench[i].latencies, sizeof(double) * bench[i].count); total += bench[i].count; free(bench[i].latencies); }
+        qsort(all, total, sizeof(double), CompareDouble);
+        printf("Depth %2d x %d: %8.1f MB/s, %7.0f requests/s, latency p50 %7.1f us, p99 %7.1f us, max %7.1f us\n", depths[d], connections, size / 1e6 / seconds, total / seconds, all[total / 2] * 1e6, all[total * 99 / 100] * 1e6, all[total - 1] * 1e6);
+        free(all);
+    }
+
+    VirtualDiskNbdStop(&server);
+    pthread_join(serveThread, NULL);
+    VirtualDiskNbdClose(&server);
+    printf("Server: %lu connections, %lu requests, %llu bytes sent, %lu disk reads\n", server.connections, server.requests, server.bytesRead, virtualdisk.stats.reads);
+    if (virtualdisk.stats.reads == 0) { printf("Disk statistics do not include the connections' reads\n"); errors++; }
+    VirtualDiskPartitionSetIndex(&partition, NULL);
+    return (errors != 0);
+}
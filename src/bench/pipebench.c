@@ -0,0 +1,260 @@
+// VirtualDisk Generation/Transport Pipeline Benchmark
+// Dan Jackson, 2013
+
+// Measures reading a disk through a pipeline of 1 (generate then send), 2 (ping-pong) and 4 buffers, to a simulated DMA transport:
+// a thread that takes each buffer's length at the bus rate to send, then calls VirtualDiskPipeComplete() as an interrupt handler
+// would. File contents are generated at a limited rate, as on a small device. Checks the data sent against whole-disk reads of a
+// separate context, and also reads through a synchronous transport that completes each buffer within its send function.
+// Usage: pipebench [bus-MB/s] [generate-MB/s] [sectors-per-buffer] [MiB-per-file]   (a rate of 0 is unlimited)
+
+#define _POSIX_C_SOURCE 200809L
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <sched.h>
+#include <pthread.h>
+
+#include "../virtualdisk/virtualdisk.h"
+#include "../virtualdisk/virtualdiskpipe.h"
+#include "../virtualdisk/virtualdisksynth.h"
+
+#define SECTOR_SIZE 512
+#define NUM_FILES 4
+#define MAX_DEPTH 4
+
+static virtualdisk_synth_t synth[NUM_FILES];
+static unsigned long fileMiB;
+static double generateRate;                         // Bytes per second of file contents generated (0 = unlimited)
+static int limitGeneration;
+static int failFirstSector;                         // Whether the first file's first sector cannot be generated (as a generator error)
+
+// Simulated DMA transport
+static struct
+{
+    pthread_t thread;
+    pthread_mutex_t mutex;
+    pthread_cond_t cond;
+    virtualdisk_pipe_t *pipe;
+    double rate;                                    // Bytes per second (0 = unlimited)
+    const unsigned char *data;                      // Buffer being sent (NULL when idle)
+    unsigned long length;
+    unsigned char *output;                          // Where the sent data is written
+    unsigned long received;
+    int quit;
+} dma;
+
+
+// Elapsed seconds since the specified start time
+static double Elapsed(const struct timespec *start)
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (now.tv_sec - start->tv_sec) + (now.tv_nsec - start->tv_nsec) / 1e9;
+}
+
+// Wait (busy, as a device generating data would be) for the time taken to handle the specified bytes at the specified rate
+static void Spin(unsigned long bytes, double rate)
+{
+    struct timespec start;
+    double duration = bytes / rate;
+
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    while (Elapsed(&start) < duration) { ; }
+}
+
+// File contents at a limited rate (or failing)
+static unsigned short SlowContents(void *reference, unsigned long sector, unsigned short count, unsigned char *buffer)
+{
+    const virtualdisk_fileinfo_t *fileInfo = (const virtualdisk_fileinfo_t *)reference;
+    unsigned short result;
+
+    if (failFirstSector && fileInfo->id == 0 && sector == 0) { return 0; }
+    result = VirtualDiskSynthContents(reference, sector, count, buffer);
+    if (limitGeneration && generateRate > 0) { Spin((unsigned long)count * SECTOR_SIZE, generateRate); }
+    return result;
+}
+
+// File information: numbered files of synthetic contents
+static char SynthFileInfo(virtualdisk_fileinfo_t *fileInfo)
+{
+    static char filenames[NUM_FILES][16];
+
+    if (fileInfo->parent != VIRTUALDISK_ROOT_DIRECTORY || fileInfo->id < 0 || fileInfo->id >= NUM_FILES) { return 0; }
+    sprintf(filenames[fileInfo->id], "PIPE%04d.BIN", fileInfo->id + 1);
+    fileInfo->filename = filenames[fileInfo->id];
+    fileInfo->attributes = VIRTUALDISK_ATTRIB_ARCHIVE;
+    fileInfo->size = fileMiB << 20;
+    fileInfo->created = fileInfo->modified = fileInfo->accessed = VIRTUALDISK_DATETIME(2013, 6, 1, 12, 0, 0);
+    fileInfo->contents = SlowContents;
+    fileInfo->reference = &synth[fileInfo->id];
+    return 1;
+}
+
+
+// DMA thread: sends each buffer it is given at the bus rate, then calls the completion handler (as its interrupt would)
+static void *DmaThread(void *arg)
+{
+    (void)arg;
+    pthread_mutex_lock(&dma.mutex);
+    for (;;)
+    {
+        const unsigned char *data;
+        unsigned long length;
+
+        while (dma.data == NULL && !dma.quit) { pthread_cond_wait(&dma.cond, &dma.mutex); }
+        if (dma.quit) { break; }
+        data = dma.data;
+        length = dma.length;
+        pthread_mutex_unlock(&dma.mutex);
+
+        if (dma.rate > 0)
+        {
+            struct timespec delay;
+            double duration = length / dma.rate;
+            delay.tv_sec = (time_t)duration;
+            delay.tv_nsec = (long)((duration - delay.tv_sec) * 1e9);
+            nanosleep(&delay, NULL);
+        }
+        memcpy(dma.output + dma.received, data, length);
+        dma.received += length;
+
+        pthread_mutex_lock(&dma.mutex);
+        dma.data = NULL;
+        pthread_mutex_unlock(&dma.mutex);
+        VirtualDiskPipeComplete(dma.pipe);          // (may start the next buffer)
+        pthread_mutex_lock(&dma.mutex);
+    }
+    pthread_mutex_unlock(&dma.mutex);
+    return NULL;
+}
+
+// Transport: start the DMA thread sending a buffer
+static void DmaSend(void *reference, const unsigned char *data, unsigned long length)
+{
+    (void)reference;
+    pthread_mutex_lock(&dma.mutex);
+    if (dma.data != NULL) { fprintf(stderr, "ERROR: Buffer sent while the transport was busy\n"); exit(1); }
+    dma.data = data;
+    dma.length = length;
+    pthread_cond_signal(&dma.cond);
+    pthread_mutex_unlock(&dma.mutex);
+}
+
+// Synchronous transport: sends the buffer and completes it before returning
+static void SyncSend(void *reference, const unsigned char *data, unsigned long length)
+{
+    virtualdisk_pipe_t *pipe = (virtualdisk_pipe_t *)reference;
+    memcpy(dma.output + dma.received, data, length);
+    dma.received += length;
+    VirtualDiskPipeComplete(pipe);
+}
+
+
+// Read the whole disk through a pipeline (returns the elapsed seconds)
+static double PipeRead(virtualdisk_pipe_t *pipe, unsigned long sectorCount)
+{
+    struct timespec start;
+
+    dma.received = 0;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    if (!VirtualDiskPipeStart(pipe, 0, sectorCount)) { fprintf(stderr, "ERROR: Problem starting the read\n"); exit(1); }
+    for (;;)
+    {
+        unsigned char generated = pipe->generated;
+        if (!VirtualDiskPipeService(pipe)) { break; }
+        if (pipe->generated == generated) { sched_yield(); }     // (nothing to do until the transport completes a buffer)
+    }
+    return Elapsed(&start);
+}
+
+
+int main(int argc, char *argv[])
+{
+    static const unsigned short depths[] = { 1, 2, MAX_DEPTH };
+    static unsigned char buffers[MAX_DEPTH * 128 * SECTOR_SIZE];
+    virtualdisk_t virtualdisk, reference;
+    virtualdisk_partition_t partition, referencePartitions[VIRTUALDISK_MAX_PARTITIONS];
+    virtualdisk_pipe_t pipe;
+    unsigned char *expected;
+    unsigned long sectorCount, sector, errors = 0;
+    unsigned short bufferSectors;
+    double busRate, seconds;
+    int d, i;
+
+    busRate = ((argc > 1) ? atof(argv[1]) : 8) * 1e6;
+    generateRate = ((argc > 2) ? atof(argv[2]) : 8) * 1e6;
+    bufferSectors = (unsigned short)((argc > 3) ? atoi(argv[3]) : 8);
+    fileMiB = (argc > 4) ? strtoul(argv[4], NULL, 0) : 1;
+    if (busRate < 0 || generateRate < 0 || bufferSectors < 1 || bufferSectors > 128 || fileMiB < 1 || fileMiB > 64) { fprintf(stderr, "Usage: pipebench [bus-MB/s] [generate-MB/s] [sectors-per-buffer] [MiB-per-file]\n"); return 1; }
+
+    for (i = 0; i < NUM_FILES; i++) { VirtualDiskSynthInit(&synth[i], VIRTUALDISKSYNTH_RANDOM, SECTOR_SIZE, 0x919e0000ull + i, NULL, 0); }
+    VirtualDiskInit(&virtualdisk, SECTOR_SIZE);
+    if (!VirtualDiskAddPartition(&virtualdisk, &partition, SynthFileInfo, 8, (NUM_FILES * (fileMiB << 20)) / (8 * SECTOR_SIZE) + 64, 512)) { fprintf(stderr, "ERROR: Problem adding partition\n"); return 1; }
+    sectorCount = VirtualDiskSectorCount(&virtualdisk);
+
+    // The expected contents, from a separate context at full speed
+    expected = (unsigned char *)malloc((size_t)sectorCount * SECTOR_SIZE);
+    dma.output = (unsigned char *)malloc((size_t)sectorCount * SECTOR_SIZE);
+    if (expected == NULL || dma.output == NULL) { fprintf(stderr, "ERROR: Out of memory\n"); return 1; }
+    VirtualDiskCopy(&reference, referencePartitions, &virtualdisk);
+    for (sector = 0; sector < sectorCount; sector += 128)
+    {
+        unsigned short n = (sectorCount - sector < 128) ? (unsigned short)(sectorCount - sector) : 128;
+        VirtualDiskReadSectors(&reference, sector, n, expected + (size_t)sector * SECTOR_SIZE);
+    }
+    printf("Disk: %lu sectors (%.1f MB), %u-sector buffers, bus %.1f MB/s, generation %.1f MB/s\n", sectorCount, (double)sectorCount * SECTOR_SIZE / 1e6, bufferSectors, busRate / 1e6, generateRate / 1e6);
+
+    // Argument checks
+    if (VirtualDiskPipeInit(&pipe, &virtualdisk, buffers, 0, bufferSectors, DmaSend, NULL)) { printf("ERROR: Pipeline of no buffers accepted\n"); errors++; }
+    if (VirtualDiskPipeInit(&pipe, &virtualdisk, buffers, 256, 1, DmaSend, NULL)) { printf("ERROR: Pipeline of more buffers than its counters hold accepted\n"); errors++; }
+    VirtualDiskPipeInit(&pipe, &virtualdisk, buffers, 1, bufferSectors, SyncSend, &pipe);
+    if (VirtualDiskPipeStart(&pipe, sectorCount - 1, 2)) { printf("ERROR: Read beyond the end of the disk accepted\n"); errors++; }
+
+    // Synchronous transport
+    for (d = 0; d < (int)(sizeof(depths) / sizeof(depths[0])); d++)
+    {
+        limitGeneration = 0;
+        VirtualDiskPipeInit(&pipe, &virtualdisk, buffers, depths[d], bufferSectors, SyncSend, &pipe);
+        PipeRead(&pipe, sectorCount);
+        if (dma.received != sectorCount * SECTOR_SIZE || memcmp(dma.output, expected, dma.received) != 0) { printf("ERROR: Synchronous transport, %u buffers: data differs\n", depths[d]); errors++; }
+    }
+    printf("Synchronous transport: checked\n");
+
+    // A sector that cannot be generated: the buffers before it are sent, and the read ends as failed
+    failFirstSector = 1;
+    for (sector = 0; sector < sectorCount && VirtualDiskReadSectors(&reference, sector, 1, buffers) == 1; sector++) { ; }
+    VirtualDiskPipeInit(&pipe, &virtualdisk, buffers, 2, bufferSectors, SyncSend, &pipe);
+    PipeRead(&pipe, sectorCount);
+    if (sector >= sectorCount || !pipe.failed || dma.received != sector / bufferSectors * bufferSectors * SECTOR_SIZE || memcmp(dma.output, expected, dma.received) != 0) { printf("ERROR: Read of a sector that cannot be generated: %lu bytes sent\n", dma.received); errors++; }
+    failFirstSector = 0;
+    PipeRead(&pipe, sectorCount);
+    if (pipe.failed || dma.received != sectorCount * SECTOR_SIZE) { printf("ERROR: Read after a failed one\n"); errors++; }
+    printf("Failed generation: checked\n");
+
+    // Simulated DMA transport
+    dma.rate = busRate;
+    pthread_mutex_init(&dma.mutex, NULL);
+    pthread_cond_init(&dma.cond, NULL);
+    dma.pipe = &pipe;
+    if (pthread_create(&dma.thread, NULL, DmaThread, NULL) != 0) { fprintf(stderr, "ERROR: Problem creating thread\n"); return 1; }
+    for (d = 0; d < (int)(sizeof(depths) / sizeof(depths[0])); d++)
+    {
+        limitGeneration = 1;
+        VirtualDiskPipeInit(&pipe, &virtualdisk, buffers, depths[d], bufferSectors, DmaSend, NULL);
+        seconds = PipeRead(&pipe, sectorCount);
+        printf("%u buffer%s: %.2f MB/s, %lu buffers generated, %lu stalls\n", depths[d], depths[d] == 1 ? " " : "s", (double)sectorCount * SECTOR_SIZE / seconds / 1e6, pipe.buffersGenerated, pipe.stalls);
+        if (dma.received != sectorCount * SECTOR_SIZE || memcmp(dma.output, expected, dma.received) != 0) { printf("ERROR: %u buffers: data differs\n", depths[d]); errors++; }
+    }
+    pthread_mutex_lock(&dma.mutex);
+    dma.quit = 1;
+    pthread_cond_signal(&dma.cond);
+    pthread_mutex_unlock(&dma.mutex);
+    pthread_join(dma.thread, NULL);
+
+    free(dma.output);
+    free(expected);
+    printf("%s (%lu errors)\n", errors ? "FAILED" : "OK", errors);
+    return errors ? 1 : 0;
+}
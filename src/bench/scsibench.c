@@ -0,0 +1,355 @@
+// VirtualDisk SCSI Command Processor Test and Benchmark
+// Dan Jackson, 2013
+
+// Drives the SCSI command processor as a USB mass storage (bulk-only transport) firmware would, without USB hardware: each
+// command is wrapped in a command block wrapper, its data-in phase is pulled through a transfer buffer of the firmware's size, and
+// a command status wrapper (with the residue) ends it. First checks each command's responses, sense data and errors, and reads of
+// every kind against the disk read directly. Then measures the throughput of reading the whole disk with the transfer buffer
+// holding one sector (a generator call per sector) up to many.
+// Usage: scsibench <files> <MiB-per-file> [sector-size]
+
+#define _POSIX_C_SOURCE 200809L
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "../virtualdisk/virtualdisk.h"
+#include "../virtualdisk/virtualdiskscsi.h"
+#include "../virtualdisk/virtualdisksynth.h"
+
+#define SECTORS_PER_CLUSTER 64
+#define MAX_FILES 64
+#define MAX_TRANSFER (128 * 4096)
+
+static unsigned short sectorSize;
+static virtualdisk_t virtualdisk;
+static virtualdisk_partition_t partition;
+static virtualdisk_t reference;                     // Separate read context to check against
+static virtualdisk_partition_t referencePartitions[VIRTUALDISK_MAX_PARTITIONS];
+static virtualdisk_synth_t synth[MAX_FILES];
+static char filenames[MAX_FILES][16];
+static int numFiles;
+static unsigned long fileMiB;
+static unsigned long tag;
+static int failFirstSector;                         // Whether the first file's first sector cannot be generated (as a generator error)
+
+
+static void SetBe(unsigned char *p, unsigned long long v, int bytes) { while (bytes-- > 0) { p[bytes] = (unsigned char)v; v >>= 8; } }
+static unsigned long long GetBe(const unsigned char *p, int bytes) { unsigned long long v = 0; while (bytes-- > 0) { v = (v << 8) | *p++; } return v; }
+static void SetLe(unsigned char *p, unsigned long v, int bytes) { int i; for (i = 0; i < bytes; i++) { p[i] = (unsigned char)v; v >>= 8; } }
+static unsigned long GetLe(const unsigned char *p, int bytes) { unsigned long v = 0; while (bytes-- > 0) { v = (v << 8) | p[bytes]; } return v; }
+
+// Elapsed seconds since the specified start time
+static double Elapsed(const struct timespec *start)
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (now.tv_sec - start->tv_sec) + (now.tv_nsec - start->tv_nsec) / 1e9;
+}
+
+
+// File contents: synthetic, unless failing
+static unsigned short SynthContents(void *reference, unsigned long sector, unsigned short count, unsigned char *buffer)
+{
+    const virtualdisk_fileinfo_t *fileInfo = (const virtualdisk_fileinfo_t *)reference;
+    if (failFirstSector && fileInfo->id == 0 && sector == 0) { return 0; }
+    return VirtualDiskSynthContents(reference, sector, count, buffer);
+}
+
+// File information: numbered files of synthetic contents
+static char SynthFileInfo(virtualdisk_fileinfo_t *fileInfo)
+{
+    if (fileInfo->parent != VIRTUALDISK_ROOT_DIRECTORY || fileInfo->id < 0 || fileInfo->id >= numFiles) { return 0; }
+    fileInfo->filename = filenames[fileInfo->id];
+    fileInfo->attributes = VIRTUALDISK_ATTRIB_ARCHIVE;
+    fileInfo->size = fileMiB << 20;
+    fileInfo->created = VIRTUALDISK_DATETIME_MIN;
+    fileInfo->modified = VIRTUALDISK_DATETIME_MIN;
+    fileInfo->accessed = VIRTUALDISK_DATETIME_MIN;
+    fileInfo->contents = SynthContents;
+    fileInfo->reference = &synth[fileInfo->id];
+    return 1;
+}
+
+
+// The device side of the bulk-only transport: takes a command block wrapper, sends the data-in phase (through a transfer buffer of the specified size) and returns the command status wrapper
+static unsigned long Device(virtualdisk_scsi_t *scsi, const unsigned char *cbw, unsigned char *data, unsigned long bufferSize, unsigned char *csw)
+{
+    static unsigned char buffer[MAX_TRANSFER];
+    unsigned long expected = GetLe(cbw + 8, 4), dataLength, sent = 0, length;
+    unsigned char status;
+
+    status = VirtualDiskScsiCommand(scsi, cbw + 15, cbw[14], &dataLength);
+    if (dataLength > expected) { dataLength = expected; }           // (the host expects less: send what it asked for, fail below)
+    while (sent < dataLength && (length = VirtualDiskScsiData(scsi, buffer, bufferSize)) > 0)
+    {
+        if (length > dataLength - sent) { length = dataLength - sent; }
+        memcpy(data + sent, buffer, length);                        // (an endpoint transfer)
+        sent += length;
+    }
+    if (scsi->status != VIRTUALDISKSCSI_STATUS_GOOD || sent < scsi->dataLength) { status = VIRTUALDISKSCSI_STATUS_CHECK_CONDITION; }
+
+    SetLe(csw + 0, 0x53425355ul, 4);                                // 'USBS'
+    memcpy(csw + 4, cbw + 4, 4);                                    // Tag
+    SetLe(csw + 8, expected - sent, 4);                             // Residue
+    csw[12] = (status == VIRTUALDISKSCSI_STATUS_GOOD) ? 0x00 : 0x01;   // Passed or failed
+    return sent;
+}
+
+// The host side: issues a command (returns the bytes received, with the CSW status and residue)
+static unsigned long Command(virtualdisk_scsi_t *scsi, const unsigned char *cdb, unsigned char cdbLength, unsigned long expected, unsigned char *data, unsigned long bufferSize, int *status, unsigned long *residue)
+{
+    unsigned char cbw[31], csw[13];
+    unsigned long received;
+
+    memset(cbw, 0, sizeof(cbw));
+    SetLe(cbw + 0, 0x43425355ul, 4);                                // 'USBC'
+    SetLe(cbw + 4, ++tag, 4);
+    SetLe(cbw + 8, expected, 4);
+    cbw[12] = 0x80;                                                 // Data-in
+    cbw[14] = cdbLength;
+    memcpy(cbw + 15, cdb, cdbLength);
+    received = Device(scsi, cbw, data, bufferSize, csw);
+    if (GetLe(csw, 4) != 0x53425355ul || GetLe(csw + 4, 4) != tag) { *status = -1; return received; }
+    *status = csw[12];
+    *residue = GetLe(csw + 8, 4);
+    return received;
+}
+
+// Issue REQUEST SENSE, returning the sense key, ASC and ASCQ as 0xKKAAQQ (or -1)
+static long Sense(virtualdisk_scsi_t *scsi)
+{
+    unsigned char cdb[6] = { 0x03, 0, 0, 0, 18, 0 }, data[18];
+    unsigned long residue;
+    int status;
+    if (Command(scsi, cdb, 6, 18, data, 64, &status, &residue) != 18 || status != 0 || data[0] != 0x70) { return -1; }
+    return ((long)(data[2] & 0x0f) << 16) | ((long)data[12] << 8) | data[13];
+}
+
+
+// Check a read command's data against the disk
+static int CheckRead(virtualdisk_scsi_t *scsi, unsigned char opcode, unsigned long long sector, unsigned long count, unsigned long bufferSize)
+{
+    static unsigned char data[256 * 4096], expected[256 * 4096];
+    unsigned char cdb[16];
+    unsigned long received, residue, calls = scsi->readCalls, perCall = bufferSize / sectorSize;
+    int status, length = 10;
+
+    memset(cdb, 0, sizeof(cdb));
+    cdb[0] = opcode;
+    switch (opcode)
+    {
+        case 0x08: SetBe(cdb + 1, sector, 3); cdb[4] = (unsigned char)count; length = 6; break;
+        case 0x28: SetBe(cdb + 2, sector, 4); SetBe(cdb + 7, count, 2); length = 10; break;
+        case 0xa8: SetBe(cdb + 2, sector, 4); SetBe(cdb + 6, count, 4); length = 12; break;
+        case 0x88: SetBe(cdb + 2, sector, 8); SetBe(cdb + 10, count, 4); length = 16; break;
+    }
+    if (opcode == 0x08 && count == 0) { count = 256; }
+    memset(data, 0xcc, count * sectorSize);
+    received = Command(scsi, cdb, (unsigned char)length, count * sectorSize, data, bufferSize, &status, &residue);
+    VirtualDiskReadSectors(&reference, (unsigned long)sector, (unsigned short)count, expected);
+    if (status != 0 || received != count * sectorSize || residue != 0 || memcmp(data, expected, received) != 0) { printf("Read 0x%02x of %lu at %llu: status %d, %lu bytes\n", opcode, count, sector, status, received); return 1; }
+    if (scsi->readCalls - calls != (count + perCall - 1) / perCall) { printf("Read of %lu sectors with %lu per transfer took %lu calls\n", count, perCall, scsi->readCalls - calls); return 1; }
+    return 0;
+}
+
+
+// Command checks (returns the number of problems found)
+static int CheckCommands(virtualdisk_scsi_t *scsi)
+{
+    const unsigned long sectorCount = VirtualDiskSectorCount(&virtualdisk);
+    unsigned char cdb[16], data[256];
+    unsigned long received, residue;
+    int problems = 0, status, i;
+    long sense = 0;
+
+    // Standard INQUIRY, and one truncated to its allocation length
+    memset(cdb, 0, sizeof(cdb)); cdb[0] = 0x12; cdb[4] = 36;
+    received = Command(scsi, cdb, 6, 36, data, 64, &status, &residue);
+    if (status != 0 || received != 36 || data[0] != 0x00 || data[1] != 0x80 || memcmp(data + 8, "VDISK   SCSIBENCH       0.1 ", 28) != 0) { printf("Inquiry\n"); problems++; }
+    cdb[4] = 5;
+    received = Command(scsi, cdb, 6, 36, data, 64, &status, &residue);
+    if (status != 0 || received != 5 || residue != 31 || data[4] != 31) { printf("Inquiry (truncated): %lu bytes, residue %lu\n", received, residue); problems++; }
+
+    // Vital product data pages
+    memset(cdb, 0, sizeof(cdb)); cdb[0] = 0x12; cdb[1] = 0x01; cdb[4] = 255;
+    received = Command(scsi, cdb, 6, 255, data, 64, &status, &residue);
+    if (status != 0 || received != 8 || data[1] != 0x00 || data[3] != 4 || data[4] != 0x00 || data[5] != 0x80 || data[6] != 0xb0 || data[7] != 0xb1) { printf("Supported VPD pages\n"); problems++; }
+    cdb[2] = 0x80;
+    received = Command(scsi, cdb, 6, 255, data, 64, &status, &residue);
+    if (status != 0 || received != 4 + 8 || memcmp(data + 4, "SN000001", 8) != 0) { printf("Unit serial number page\n"); problems++; }
+    cdb[2] = 0xb0;
+    received = Command(scsi, cdb, 6, 255, data, 64, &status, &residue);
+    if (status != 0 || received != 64 || GetBe(data + 2, 2) != 0x3c || GetBe(data + 6, 2) != scsi->transferSectors || GetBe(data + 12, 4) != scsi->transferSectors) { printf("Block limits page\n"); problems++; }
+    cdb[2] = 0xb1;
+    received = Command(scsi, cdb, 6, 255, data, 16, &status, &residue);     // (in pieces)
+    if (status != 0 || received != 64 || GetBe(data + 4, 2) != 1) { printf("Block device characteristics page\n"); problems++; }
+    cdb[2] = 0x83;
+    Command(scsi, cdb, 6, 255, data, 64, &status, &residue);
+    if (status != 1 || (sense = Sense(scsi)) != 0x052400) { printf("Unsupported VPD page: status %d, sense %06lx\n", status, sense); problems++; }
+    cdb[1] = 0; cdb[2] = 0x80;
+    Command(scsi, cdb, 6, 255, data, 64, &status, &residue);
+    if (status != 1 || (sense = Sense(scsi)) != 0x052400) { printf("Page without EVPD: status %d, sense %06lx\n", status, sense); problems++; }
+    if ((sense = Sense(scsi)) != 0) { printf("Sense not cleared: %06lx\n", sense); problems++; }
+
+    // Capacity
+    memset(cdb, 0, sizeof(cdb)); cdb[0] = 0x25;
+    received = Command(scsi, cdb, 10, 8, data, 64, &status, &residue);
+    if (status != 0 || received != 8 || GetBe(data, 4) != sectorCount - 1 || GetBe(data + 4, 4) != sectorSize) { printf("Read capacity (10)\n"); problems++; }
+    memset(cdb, 0, sizeof(cdb)); cdb[0] = 0x9e; cdb[1] = 0x10; SetBe(cdb + 10, 32, 4);
+    received = Command(scsi, cdb, 16, 32, data, 64, &status, &residue);
+    if (status != 0 || received != 32 || GetBe(data, 8) != sectorCount - 1 || GetBe(data + 8, 4) != sectorSize) { printf("Read capacity (16)\n"); problems++; }
+    cdb[1] = 0x11;
+    Command(scsi, cdb, 16, 32, data, 64, &status, &residue);
+    if (status != 1 || (sense = Sense(scsi)) != 0x052400) { printf("Unsupported service action\n"); problems++; }
+    memset(cdb, 0, sizeof(cdb)); cdb[0] = 0x23; SetBe(cdb + 7, 252, 2);
+    received = Command(scsi, cdb, 10, 252, data, 64, &status, &residue);
+    if (status != 0 || received != 12 || data[3] != 8 || GetBe(data + 4, 4) != sectorCount || data[8] != 0x02 || GetBe(data + 9, 3) != sectorSize) { printf("Read format capacities\n"); problems++; }
+
+    // Mode sense: write protected, the caching page
+    memset(cdb, 0, sizeof(cdb)); cdb[0] = 0x1a; cdb[2] = 0x3f; cdb[4] = 192;
+    received = Command(scsi, cdb, 6, 192, data, 64, &status, &residue);
+    if (status != 0 || received != 24 || data[0] != 23 || data[2] != 0x80 || data[4] != 0x08 || data[5] != 18) { printf("Mode sense (6)\n"); problems++; }
+    memset(cdb, 0, sizeof(cdb)); cdb[0] = 0x5a; cdb[2] = 0x08; SetBe(cdb + 7, 8, 2);
+    received = Command(scsi, cdb, 10, 8, data, 64, &status, &residue);
+    if (status != 0 || received != 8 || GetBe(data, 2) != 26 || data[3] != 0x80) { printf("Mode sense (10) header\n"); problems++; }
+    memset(cdb, 0, sizeof(cdb)); cdb[0] = 0x1a; cdb[2] = 0x1c; cdb[4] = 192;
+    Command(scsi, cdb, 6, 192, data, 64, &status, &residue);
+    if (status != 1 || (sense = Sense(scsi)) != 0x052400) { printf("Unsupported mode page\n"); problems++; }
+
+    // Commands without data, refused writes, unknown and short commands
+    memset(cdb, 0, sizeof(cdb));
+    Command(scsi, cdb, 6, 0, data, 64, &status, &residue);
+    if (status != 0 || Sense(scsi) != 0) { printf("Test unit ready\n"); problems++; }
+    cdb[0] = 0x35;
+    Command(scsi, cdb, 10, 0, data, 64, &status, &residue);
+    if (status != 0) { printf("Synchronize cache\n"); problems++; }
+    cdb[0] = 0x2a; SetBe(cdb + 7, 1, 2);
+    Command(scsi, cdb, 10, 0, data, 64, &status, &residue);
+    if (status != 1 || (sense = Sense(scsi)) != 0x072700) { printf("Write: status %d, sense %06lx\n", status, sense); problems++; }
+    cdb[0] = 0x5f;
+    Command(scsi, cdb, 10, 0, data, 64, &status, &residue);
+    if (status != 1 || (sense = Sense(scsi)) != 0x052000) { printf("Unknown command: sense %06lx\n", sense); problems++; }
+    cdb[0] = 0x28;
+    Command(scsi, cdb, 6, 0, data, 64, &status, &residue);
+    if (status != 1 || (sense = Sense(scsi)) != 0x052400) { printf("Short command: sense %06lx\n", sense); problems++; }
+
+    // Reads out of range, of nothing, and shorter than the host expects
+    memset(cdb, 0, sizeof(cdb)); cdb[0] = 0x28; SetBe(cdb + 2, sectorCount - 1, 4); SetBe(cdb + 7, 2, 2);
+    Command(scsi, cdb, 10, 2ul * sectorSize, data, 64, &status, &residue);
+    if (status != 1 || residue != 2ul * sectorSize || (sense = Sense(scsi)) != 0x052100) { printf("Read past end: sense %06lx\n", sense); problems++; }
+    memset(cdb, 0, sizeof(cdb)); cdb[0] = 0x88; SetBe(cdb + 2, 0x100000000ull, 8); SetBe(cdb + 10, 1, 4);
+    Command(scsi, cdb, 16, sectorSize, data, 64, &status, &residue);
+    if (status != 1 || (sense = Sense(scsi)) != 0x052100) { printf("Read (16) past end: sense %06lx\n", sense); problems++; }
+    memset(cdb, 0, sizeof(cdb)); cdb[0] = 0x28;
+    received = Command(scsi, cdb, 10, 0, data, 64, &status, &residue);
+    if (status != 0 || received != 0) { printf("Read of nothing\n"); problems++; }
+
+    // Reads of every kind, at random, through transfer buffers of different sizes (including a part sector more)
+    problems += CheckRead(scsi, 0x08, 0, 0, sectorSize * 16);
+    problems += CheckRead(scsi, 0x28, sectorCount - 8, 8, sectorSize);
+    for (i = 0; i < 400; i++)
+    {
+        static const unsigned char opcodes[] = { 0x08, 0x28, 0xa8, 0x88 };
+        unsigned long count = 1 + (unsigned long)rand() % 256, perCall = 1 + (unsigned long)rand() % 64;
+        unsigned long long sector = (unsigned long long)rand() * rand() % (sectorCount - count + 1);
+        unsigned char opcode = opcodes[i & 3];
+        if (opcode == 0x08) { sector &= 0x1fffff; if (count == 256) { count = 255; } }
+        problems += CheckRead(scsi, opcode, sector, count, perCall * sectorSize + (unsigned long)(i & 4) * 37);
+    }
+
+    // A sector that cannot be generated: a read of it reports a medium error, whether of whole sectors or streamed in parts
+    {
+        static unsigned char sector[4096], buffer[2 * 4096];
+        unsigned long failed;
+        failFirstSector = 1;
+        for (failed = 0; failed < sectorCount && VirtualDiskReadSectors(&reference, failed, 1, sector) == 1; failed++) { ; }
+        memset(cdb, 0, sizeof(cdb)); cdb[0] = 0x28; SetBe(cdb + 2, failed - 1, 4); SetBe(cdb + 7, 2, 2);
+        Command(scsi, cdb, 10, 2ul * sectorSize, buffer, 2ul * sectorSize, &status, &residue);
+        if (failed >= sectorCount || status != 1 || (sense = Sense(scsi)) != 0x031100) { printf("Read of a failing sector: status %d, sense %06lx\n", status, sense); problems++; }
+        Command(scsi, cdb, 10, 2ul * sectorSize, buffer, 64, &status, &residue);
+        if (status != 1 || (sense = Sense(scsi)) != 0x031100) { printf("Read of a failing sector in parts: status %d, sense %06lx\n", status, sense); problems++; }
+        failFirstSector = 0;
+    }
+
+    // A disk not ready
+    {
+        virtualdisk_t empty;
+        virtualdisk_scsi_t absent;
+        memset(&empty, 0, sizeof(empty));
+        VirtualDiskScsiInit(&absent, &empty, "VDISK", "ABSENT", "0.1", NULL);
+        memset(cdb, 0, sizeof(cdb));
+        Command(&absent, cdb, 6, 0, data, 64, &status, &residue);
+        if (status != 1 || (sense = Sense(&absent)) != 0x023a00) { printf("Not ready: sense %06lx\n", sense); problems++; }
+    }
+    return problems;
+}
+
+
+int main(int argc, char *argv[])
+{
+    static const unsigned long transfers[] = { 1, 8, 32, 128 };
+    static unsigned char data[MAX_TRANSFER];
+    virtualdisk_index_t fileIndex;
+    virtualdisk_index_entry_t entries[MAX_FILES + 1];
+    unsigned long long fileClusters, size;
+    virtualdisk_scsi_t scsi;
+    int errors, t, i;
+
+    numFiles = (argc > 1) ? atoi(argv[1]) : 0;
+    fileMiB = (argc > 2) ? strtoul(argv[2], NULL, 0) : 0;
+    sectorSize = (unsigned short)((argc > 3) ? atoi(argv[3]) : 512);
+    if (numFiles < 1 || numFiles > MAX_FILES || fileMiB < 1 || fileMiB > 4095 || (sectorSize != 512 && sectorSize != 1024 && sectorSize != 2048 && sectorSize != 4096)) { fprintf(stderr, "Usage: scsibench <files> <MiB-per-file> [sector-size]\n"); return 1; }
+
+    // Each file's contents differ (by seed); a quarter of the volume is left unused
+    for (i = 0; i < numFiles; i++)
+    {
+        VirtualDiskSynthInit(&synth[i], VIRTUALDISKSYNTH_RANDOM, sectorSize, 0x5eed0000ull + i, NULL, 0);
+        sprintf(filenames[i], "SYNTH%03d.BIN", i + 1);
+    }
+    fileClusters = ((unsigned long long)fileMiB << 20) / ((unsigned long)sectorSize * SECTORS_PER_CLUSTER) * numFiles;
+    VirtualDiskInit(&virtualdisk, sectorSize);
+    if (!VirtualDiskAddExFatPartition(&virtualdisk, &partition, SynthFileInfo, SECTORS_PER_CLUSTER, (unsigned long)(fileClusters + fileClusters / 3 + 1024), 512)) { fprintf(stderr, "Problem adding partition\n"); return 1; }
+    fileIndex.entries = entries;
+    fileIndex.capacity = MAX_FILES + 1;
+    fileIndex.count = 0;
+    fileIndex.complete = 0;
+    if (!VirtualDiskPartitionBuildIndex(&partition, &fileIndex)) { fprintf(stderr, "Index incomplete\n"); return 1; }
+    VirtualDiskPartitionSetIndex(&partition, &fileIndex);
+    VirtualDiskCopy(&reference, referencePartitions, &virtualdisk);
+    size = (unsigned long long)VirtualDiskSectorCount(&virtualdisk) * sectorSize;
+    printf("%d files of %lu MiB, disk is %llu bytes of %u-byte sectors\n", numFiles, fileMiB, size, sectorSize);
+
+    VirtualDiskScsiInit(&scsi, &virtualdisk, "VDISK", "SCSIBENCH", "0.1", "SN000001");
+    errors = CheckCommands(&scsi);
+    printf("Command checks: %d problems\n", errors);
+
+    // READ (10) of 64 KiB at a time over the whole disk, with transfer buffers of one sector up to many
+    for (t = 0; t < (int)(sizeof(transfers) / sizeof(transfers[0])) && errors == 0; t++)
+    {
+        const unsigned long perCommand = 65536ul / sectorSize, sectorCount = VirtualDiskSectorCount(&virtualdisk);
+        unsigned long sector, calls = scsi.readCalls, residue;
+        struct timespec start;
+        double seconds;
+        int status;
+
+        scsi.transferSectors = (unsigned short)transfers[t];
+        clock_gettime(CLOCK_MONOTONIC, &start);
+        for (sector = 0; sector < sectorCount; sector += perCommand)
+        {
+            unsigned long count = (sectorCount - sector < perCommand) ? sectorCount - sector : perCommand;
+            unsigned char cdb[10] = { 0x28, 0, 0, 0, 0, 0, 0, 0, 0, 0 };
+            SetBe(cdb + 2, sector, 4);
+            SetBe(cdb + 7, count, 2);
+            if (Command(&scsi, cdb, 10, count * sectorSize, data, transfers[t] * sectorSize, &status, &residue) != count * sectorSize || status != 0) { errors++; break; }
+        }
+        seconds = Elapsed(&start);
+        printf("Transfer %3lu sectors: %8.1f MB/s, %9lu generator calls\n", transfers[t], size / 1e6 / seconds, scsi.readCalls - calls);
+    }
+
+    printf("Processor: %lu commands (%lu failed), %lu sectors read in %lu calls\n", scsi.commands, scsi.failed, scsi.sectorsRead, scsi.readCalls);
+    VirtualDiskPartitionSetIndex(&partition, NULL);
+    return (errors != 0);
+}
@@ -0,0 +1,271 @@
+// VirtualDisk Partial Sector Streaming Test and Benchmark
+// Dan Jackson, 2013
+
+// Checks that streaming sectors in pieces with VirtualDiskReadPartial() gives exactly what whole-sector reads do, for every sector
+// of a FAT12, FAT16, FAT32 and exFAT disk (boot sectors, FATs, root and sub-directories with long filenames, the exFAT bitmap,
+// up-case table and boot checksum, file contents and blank space), through pieces of one byte up to a whole sector. Also checks
+// that a file without a partial generator fails to read in pieces (so a SCSI read of it through a packet reports a medium error)
+// but not as a whole sector, and a SCSI read through a USB full-speed packet. Then measures the throughput of streaming a disk of
+// synthetic files through pieces of each size.
+// Usage: streambench [sector-size] [MiB-per-file]
+
+#define _POSIX_C_SOURCE 200809L
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "../virtualdisk/virtualdisk.h"
+#include "../virtualdisk/virtualdiskscsi.h"
+#include "../virtualdisk/virtualdisksynth.h"
+
+#define ROOT_FILES 40                               // Files in the root directory (then a sub-directory)
+#define SUB_FILES 20                                // Files in the sub-directory
+#define BENCH_FILES 8                               // Files on the throughput disk
+#define MAX_FILES (ROOT_FILES + 1 + SUB_FILES)
+#define PACKET_SIZE 64                              // USB full-speed bulk packet
+
+static unsigned short sectorSize;
+static virtualdisk_synth_t synth[MAX_FILES];
+static char filenames[MAX_FILES][40];
+static unsigned long benchMiB;
+static int benchDisk;                               // Non-zero for the throughput disk's files
+
+
+// Elapsed seconds since the specified start time
+static double Elapsed(const struct timespec *start)
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (now.tv_sec - start->tv_sec) + (now.tv_nsec - start->tv_nsec) / 1e9;
+}
+
+
+// File information: files of synthetic contents of assorted sizes and names, then a sub-directory of more (the last file has no partial generator)
+static char SynthFileInfo(virtualdisk_fileinfo_t *fileInfo)
+{
+    int n;
+
+    if (benchDisk)
+    {
+        if (fileInfo->parent != VIRTUALDISK_ROOT_DIRECTORY || fileInfo->id < 0 || fileInfo->id >= BENCH_FILES) { return 0; }
+        n = fileInfo->id;
+        fileInfo->size = benchMiB << 20;
+    }
+    else if (fileInfo->parent == VIRTUALDISK_ROOT_DIRECTORY && fileInfo->id == ROOT_FILES)
+    {
+        fileInfo->filename = "Sub-directory of logs";
+        fileInfo->attributes = VIRTUALDISK_ATTRIB_DIRECTORY;
+        fileInfo->directory = 1;
+        fileInfo->created = fileInfo->modified = fileInfo->accessed = VIRTUALDISK_DATETIME(2013, 6, 1, 12, 0, 0);
+        return 1;
+    }
+    else
+    {
+        if (fileInfo->parent == VIRTUALDISK_ROOT_DIRECTORY && fileInfo->id >= 0 && fileInfo->id < ROOT_FILES) { n = fileInfo->id; }
+        else if (fileInfo->parent == 1 && fileInfo->id >= 0 && fileInfo->id < SUB_FILES) { n = ROOT_FILES + 1 + fileInfo->id; }
+        else { return 0; }
+        fileInfo->size = (unsigned long)n * 1371 + 5;
+    }
+
+    fileInfo->filename = filenames[n];
+    fileInfo->attributes = VIRTUALDISK_ATTRIB_ARCHIVE;
+    fileInfo->created = fileInfo->modified = fileInfo->accessed = VIRTUALDISK_DATETIME(2013, 6, 1, 12, 0, n % 60);
+    fileInfo->contents = VirtualDiskSynthContents;
+    fileInfo->reference = &synth[n];
+    if (benchDisk || n != MAX_FILES - 1) { fileInfo->partial = VirtualDiskSynthPartial; }
+    return 1;
+}
+
+
+// Set up a disk of the specified type (0-2 = FAT12/FAT16/FAT32 by cluster count, 3 = exFAT), with an index of its files and sub-directory
+static int SetupDisk(virtualdisk_t *disk, virtualdisk_partition_t *partition, virtualdisk_index_t *index, int type)
+{
+    static const unsigned long clusters[] = { 3000, 20000, 70000, 4000 };
+
+    VirtualDiskInit(disk, sectorSize);
+    if (type == 3)
+    {
+        if (!VirtualDiskAddExFatPartition(disk, partition, SynthFileInfo, 1, clusters[type], 512)) { return 0; }
+    }
+    else
+    {
+        if (!VirtualDiskAddPartition(disk, partition, SynthFileInfo, 1, clusters[type], 512)) { return 0; }
+    }
+    index->count = 0;
+    index->complete = 0;
+    if (!VirtualDiskPartitionBuildIndex(partition, index) || !VirtualDiskIndexBuildDirectories(partition, index)) { return 0; }
+    VirtualDiskPartitionSetIndex(partition, index);
+    return 1;
+}
+
+
+// Stream every sector of a disk in pieces of the specified size and compare them with whole-sector reads of a separate context
+static unsigned long CheckPieces(virtualdisk_t *disk, virtualdisk_t *reference, unsigned short piece, unsigned long fileStart, unsigned long fileSectors)
+{
+    static unsigned char expected[4096], streamed[4096];
+    unsigned long sector, problems = 0;
+
+    for (sector = 0; sector < VirtualDiskSectorCount(disk); sector++)
+    {
+        unsigned short offset;
+        char pieceable = !(sector >= fileStart && sector < fileStart + fileSectors);   // (the file without a partial generator)
+
+        VirtualDiskReadSectors(reference, sector, 1, expected);
+        if (pieceable || piece == sectorSize)
+        {
+            for (offset = 0; offset < sectorSize; offset += piece)
+            {
+                unsigned short length = (sectorSize - offset < piece) ? sectorSize - offset : piece;
+                if (VirtualDiskReadPartial(disk, sector, offset, length, streamed + offset) != length) { problems++; }
+            }
+            if (memcmp(expected, streamed, sectorSize) != 0)
+            {
+                if (problems++ < 5) { printf("Sector %lu differs when streamed in %u-byte pieces\n", sector, piece); }
+            }
+        }
+        else
+        {
+            // Without a partial generator, every piece fails (rather than passing off filler as data)
+            for (offset = 0; offset < sectorSize; offset += piece)
+            {
+                unsigned short length = (sectorSize - offset < piece) ? sectorSize - offset : piece;
+                if (VirtualDiskReadPartial(disk, sector, offset, length, streamed + offset) != 0) { problems++; break; }
+            }
+        }
+    }
+    return problems;
+}
+
+
+int main(int argc, char *argv[])
+{
+    static const char *types[] = { "FAT12", "FAT16", "FAT32", "exFAT" };
+    static const unsigned short pieces[] = { 1, 3, 32, 64, 100, 0 };
+    static virtualdisk_index_entry_t entries[MAX_FILES + 1];
+    static unsigned char data[65536];
+    virtualdisk_t virtualdisk, reference;
+    virtualdisk_partition_t partition, referencePartitions[VIRTUALDISK_MAX_PARTITIONS];
+    virtualdisk_index_t fileIndex;
+    unsigned long errors = 0;
+    int type, p, i;
+
+    sectorSize = (unsigned short)((argc > 1) ? atoi(argv[1]) : 512);
+    benchMiB = (argc > 2) ? strtoul(argv[2], NULL, 0) : 4;
+    if ((sectorSize != 512 && sectorSize != 1024 && sectorSize != 2048 && sectorSize != 4096) || benchMiB < 1 || benchMiB > 256) { fprintf(stderr, "Usage: streambench [sector-size] [MiB-per-file]\n"); return 1; }
+
+    // Each file's contents differ (by seed); names are a mix of short names and long filenames
+    for (i = 0; i < MAX_FILES; i++)
+    {
+        VirtualDiskSynthInit(&synth[i], VIRTUALDISKSYNTH_RANDOM, sectorSize, 0x5eed0000ull + i, NULL, 0);
+        if (i % 3 == 0) { sprintf(filenames[i], "FILE%04d.BIN", i); }
+        else { sprintf(filenames[i], "Streamed file number %d of many.dat", i); }
+    }
+    fileIndex.entries = entries;
+    fileIndex.capacity = MAX_FILES + 1;
+
+    // Every sector of each type of file system, in pieces of each size
+    for (type = 0; type < 4; type++)
+    {
+        unsigned long fileStart = 0, fileSectors = 0;
+        virtualdisk_fileinfo_t fileInfo;
+
+        if (!SetupDisk(&virtualdisk, &partition, &fileIndex, type)) { fprintf(stderr, "Problem setting up %s disk\n", types[type]); return 1; }
+        VirtualDiskCopy(&reference, referencePartitions, &virtualdisk);
+
+        // The sectors of the file without a partial generator (the last file in the sub-directory)
+        for (i = 0; i < (int)fileIndex.count; i++)
+        {
+            memset(&fileInfo, 0, sizeof(fileInfo));
+            if (VirtualDiskIndexFileInfo(&partition, &fileIndex, i, &fileInfo) && fileInfo.reference == &synth[MAX_FILES - 1])
+            {
+                unsigned long cluster = entries[i].firstCluster[0] | ((unsigned long)entries[i].firstCluster[1] << 8) | ((unsigned long)entries[i].firstCluster[2] << 16) | ((unsigned long)entries[i].firstCluster[3] << 24);
+                fileStart = partition.partitionStartSector + partition.regionData + (cluster - 2) * partition.sectorsPerCluster;
+                fileSectors = (fileInfo.size + sectorSize - 1) / sectorSize;
+            }
+        }
+        if (fileSectors == 0) { printf("%s: file without a partial generator not found\n", types[type]); errors++; }
+
+        for (p = 0; p < (int)(sizeof(pieces) / sizeof(pieces[0])); p++)
+        {
+            unsigned short piece = pieces[p] ? pieces[p] : sectorSize;
+            unsigned long problems = CheckPieces(&virtualdisk, &reference, piece, fileStart, fileSectors);
+            if (problems) { printf("%s: %lu problems streaming %u-byte pieces\n", types[type], problems, piece); }
+            errors += problems;
+        }
+        printf("%s: %lu sectors streamed in pieces of 1 to %u bytes\n", types[type], VirtualDiskSectorCount(&virtualdisk), sectorSize);
+
+        // A SCSI read of the start of the disk, through one packet at a time
+        if (type == 3)
+        {
+            virtualdisk_scsi_t scsi;
+            unsigned char cdb[10] = { 0x28, 0, 0, 0, 0, 0, 0, 0, 0, 0 };
+            unsigned long count = sizeof(data) / sectorSize, received = 0, length, calls;
+
+            VirtualDiskScsiInit(&scsi, &virtualdisk, "VDISK", "STREAMBENCH", "0.1", NULL);
+            cdb[7] = (unsigned char)(count >> 8); cdb[8] = (unsigned char)count;
+            if (VirtualDiskScsiCommand(&scsi, cdb, 10, &length) != VIRTUALDISKSCSI_STATUS_GOOD || length != count * sectorSize) { printf("SCSI read not started\n"); errors++; }
+            calls = scsi.readCalls;
+            while ((length = VirtualDiskScsiData(&scsi, data + received, PACKET_SIZE)) > 0) { received += length; }
+            for (i = 0; i < (int)count && received == count * sectorSize; i++)
+            {
+                static unsigned char expected[4096];
+                VirtualDiskReadSectors(&reference, i, 1, expected);
+                if (memcmp(expected, data + (unsigned long)i * sectorSize, sectorSize) != 0) { break; }
+            }
+            if (received != count * sectorSize || i != (int)count || scsi.readCalls - calls != count * (sectorSize / PACKET_SIZE)) { printf("SCSI read through %d-byte packets: %lu bytes, %lu calls\n", PACKET_SIZE, received, scsi.readCalls - calls); errors++; }
+            else { printf("SCSI read of %lu sectors through %d-byte packets: %lu calls\n", count, PACKET_SIZE, scsi.readCalls - calls); }
+        }
+
+        // A SCSI read of the file without a partial generator, through a packet, fails with a medium error (where the file fits on the disk)
+        if (fileSectors > 0 && fileStart + fileSectors <= VirtualDiskSectorCount(&virtualdisk))
+        {
+            virtualdisk_scsi_t scsi;
+            unsigned char cdb[10] = { 0x28, 0, 0, 0, 0, 0, 0, 0, 1, 0 };
+            unsigned long received = 0, length;
+
+            VirtualDiskScsiInit(&scsi, &virtualdisk, "VDISK", "STREAMBENCH", "0.1", NULL);
+            cdb[2] = (unsigned char)(fileStart >> 24); cdb[3] = (unsigned char)(fileStart >> 16); cdb[4] = (unsigned char)(fileStart >> 8); cdb[5] = (unsigned char)fileStart;
+            if (VirtualDiskScsiCommand(&scsi, cdb, 10, &length) != VIRTUALDISKSCSI_STATUS_GOOD) { printf("%s: SCSI read of the file without a partial generator not started\n", types[type]); errors++; }
+            while ((length = VirtualDiskScsiData(&scsi, data + received, PACKET_SIZE)) > 0) { received += length; }
+            if (received != 0 || scsi.status != VIRTUALDISKSCSI_STATUS_CHECK_CONDITION || scsi.senseKey != VIRTUALDISKSCSI_SENSE_MEDIUM_ERROR) { printf("%s: SCSI read of the file without a partial generator: %lu bytes, status 0x%02x\n", types[type], received, scsi.status); errors++; }
+            else { printf("%s: SCSI read of a file without a partial generator through %d-byte packets: medium error\n", types[type], PACKET_SIZE); }
+        }
+        VirtualDiskPartitionSetIndex(&partition, NULL);
+    }
+    printf("Streaming checks: %lu problems\n", errors);
+
+    // Throughput: the whole of a disk of synthetic files, in pieces of each size
+    benchDisk = 1;
+    VirtualDiskInit(&virtualdisk, sectorSize);
+    if (!VirtualDiskAddExFatPartition(&virtualdisk, &partition, SynthFileInfo, 8, (unsigned long)((benchMiB << 20) / (8ul * sectorSize) * BENCH_FILES + 64), 512)) { fprintf(stderr, "Problem adding partition\n"); return 1; }
+    fileIndex.count = 0;
+    fileIndex.complete = 0;
+    if (!VirtualDiskPartitionBuildIndex(&partition, &fileIndex)) { fprintf(stderr, "Index incomplete\n"); return 1; }
+    VirtualDiskPartitionSetIndex(&partition, &fileIndex);
+    for (p = 0; p < (int)(sizeof(pieces) / sizeof(pieces[0])) && errors == 0; p++)
+    {
+        unsigned short piece = pieces[p] ? pieces[p] : sectorSize;
+        unsigned long sector, sectorCount = VirtualDiskSectorCount(&virtualdisk);
+        struct timespec start;
+        double seconds;
+
+        if (piece < 32) { continue; }
+        clock_gettime(CLOCK_MONOTONIC, &start);
+        for (sector = 0; sector < sectorCount; sector++)
+        {
+            unsigned short offset;
+            for (offset = 0; offset < sectorSize; offset += piece)
+            {
+                unsigned short length = (sectorSize - offset < piece) ? sectorSize - offset : piece;
+                VirtualDiskReadPartial(&virtualdisk, sector, offset, length, data);
+            }
+        }
+        seconds = Elapsed(&start);
+        printf("Pieces of %4u bytes: %8.1f MB/s\n", piece, (double)sectorCount * sectorSize / 1e6 / seconds);
+    }
+    VirtualDiskPartitionSetIndex(&partition, NULL);
+
+    return (errors != 0);
+}
@@ -0,0 +1,172 @@
+// VirtualDisk Synthetic Volume Benchmark
+// Dan Jackson, 2013
+
+// Measures the throughput of reading every sector of a large exFAT volume of synthetic files, compared with generating the same
+// number of bytes directly, then reads each file back and verifies its contents.
+// Usage: synthbench <files> <GiB-per-file> [fill|pattern|stamp|random] [sectors-per-read] [passes]
+
+#define _POSIX_C_SOURCE 200809L
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "../virtualdisk/virtualdisk.h"
+#include "../virtualdisk/virtualdisksynth.h"
+
+#define SECTOR_SIZE 512
+#define SECTORS_PER_CLUSTER 128
+#define MAX_FILES 64
+
+static virtualdisk_t virtualdisk;
+static virtualdisk_partition_t partition;
+static virtualdisk_synth_t synth[MAX_FILES];
+static int numFiles;
+static unsigned long fileGiB;
+
+
+// Elapsed seconds since the specified start time
+static double Elapsed(const struct timespec *start)
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (now.tv_sec - start->tv_sec) + (now.tv_nsec - start->tv_nsec) / 1e9;
+}
+
+// File information: numbered files of synthetic contents
+static char SynthFileInfo(virtualdisk_fileinfo_t *fileInfo)
+{
+    static char filenames[MAX_FILES][16];
+
+    if (fileInfo->parent != VIRTUALDISK_ROOT_DIRECTORY || fileInfo->id < 0 || fileInfo->id >= numFiles) { return 0; }
+    sprintf(filenames[fileInfo->id], "SYNTH%03d.BIN", fileInfo->id + 1);
+    fileInfo->filename = filenames[fileInfo->id];
+    fileInfo->attributes = VIRTUALDISK_ATTRIB_ARCHIVE;
+    fileInfo->size = (fileGiB & 3) << 30;
+    fileInfo->sizeHigh = fileGiB >> 2;
+    fileInfo->created = VIRTUALDISK_DATETIME_MIN;
+    fileInfo->modified = VIRTUALDISK_DATETIME_MIN;
+    fileInfo->accessed = VIRTUALDISK_DATETIME_MIN;
+    fileInfo->contents = VirtualDiskSynthContents;
+    fileInfo->reference = &synth[fileInfo->id];
+    return 1;
+}
+
+// Read every sector of the virtual disk (returns the number of bytes read)
+static unsigned long long ReadVirtualDisk(unsigned char *buffer, unsigned short count)
+{
+    unsigned long sectorCount = VirtualDiskSectorCount(&virtualdisk);
+    unsigned long sector;
+
+    for (sector = 0; sector < sectorCount; sector += count)
+    {
+        unsigned short n = (sectorCount - sector < count) ? (unsigned short)(sectorCount - sector) : count;
+        VirtualDiskReadSectors(&virtualdisk, sector, n, buffer);
+    }
+    return (unsigned long long)sectorCount * SECTOR_SIZE;
+}
+
+// Generate the same number of sectors directly (returns the number of bytes generated)
+static unsigned long long GenerateDirect(unsigned char *buffer, unsigned short count)
+{
+    unsigned long sectorCount = VirtualDiskSectorCount(&virtualdisk);
+    unsigned long sector;
+
+    for (sector = 0; sector < sectorCount; sector += count)
+    {
+        unsigned short n = (sectorCount - sector < count) ? (unsigned short)(sectorCount - sector) : count;
+        VirtualDiskSynthRead(&synth[0], sector, n, buffer);
+    }
+    return (unsigned long long)sectorCount * SECTOR_SIZE;
+}
+
+// Read each file's sectors back from the disk and verify them (returns the number of sectors that did not match)
+static unsigned long VerifyFiles(const virtualdisk_index_t *fileIndex, unsigned char *buffer, unsigned short count)
+{
+    unsigned long fileSectors = (unsigned long)(((unsigned long long)fileGiB << 30) / SECTOR_SIZE);
+    unsigned long errors = 0, entry;
+
+    for (entry = 0; entry < fileIndex->count; entry++)
+    {
+        const unsigned char *c = fileIndex->entries[entry].firstCluster;
+        unsigned long firstCluster = (unsigned long)c[0] | ((unsigned long)c[1] << 8) | ((unsigned long)c[2] << 16) | ((unsigned long)c[3] << 24);
+        unsigned long firstSector = partition.partitionStartSector + partition.regionData + (firstCluster - 2) * SECTORS_PER_CLUSTER;
+        unsigned long sector;
+
+        for (sector = 0; sector < fileSectors; sector += count)
+        {
+            unsigned short n = (fileSectors - sector < count) ? (unsigned short)(fileSectors - sector) : count;
+            VirtualDiskReadSectors(&virtualdisk, firstSector + sector, n, buffer);
+            errors += n - VirtualDiskSynthVerify(&synth[entry], sector, n, buffer);
+        }
+    }
+    return errors;
+}
+
+
+int main(int argc, char *argv[])
+{
+    static const unsigned char pattern[] = "The quick brown fox jumps over the lazy dog. ";
+    const char *mode = (argc > 3) ? argv[3] : "random";
+    unsigned short count = (argc > 4) ? (unsigned short)atoi(argv[4]) : 128;
+    int passes = (argc > 5) ? atoi(argv[5]) : 3, pass, i;
+    VIRTUALDISKSYNTH_TYPE type;
+    virtualdisk_index_t fileIndex;
+    virtualdisk_index_entry_t entries[MAX_FILES + 1];
+    unsigned long long totalClusters;
+    unsigned long errors;
+    unsigned char *buffer;
+    struct timespec start;
+    double seconds;
+
+    numFiles = (argc > 1) ? atoi(argv[1]) : 0;
+    fileGiB = (argc > 2) ? strtoul(argv[2], NULL, 0) : 0;
+    if (strcmp(mode, "fill") == 0) { type = VIRTUALDISKSYNTH_FILL; }
+    else if (strcmp(mode, "pattern") == 0) { type = VIRTUALDISKSYNTH_PATTERN; }
+    else if (strcmp(mode, "stamp") == 0) { type = VIRTUALDISKSYNTH_STAMP; }
+    else { type = VIRTUALDISKSYNTH_RANDOM; }
+    if (numFiles < 1 || numFiles > MAX_FILES || fileGiB < 1 || fileGiB > 1024 || count == 0) { fprintf(stderr, "Usage: synthbench <files> <GiB-per-file> [fill|pattern|stamp|random] [sectors-per-read] [passes]\n"); return 1; }
+
+    // Each file's contents differ (by seed)
+    for (i = 0; i < numFiles; i++) { VirtualDiskSynthInit(&synth[i], type, SECTOR_SIZE, 0x5eed0000ull + i, pattern, (unsigned short)(sizeof(pattern) - 1)); }
+
+    // Create the virtual disk (the volume is limited by 32-bit sector numbers)
+    totalClusters = ((unsigned long long)fileGiB << 30) / (SECTOR_SIZE * SECTORS_PER_CLUSTER) * numFiles + 1024;
+    if (totalClusters * SECTORS_PER_CLUSTER >= 0xfff00000ull) { fprintf(stderr, "Volume too large (maximum 2 TiB)\n"); return 1; }
+    VirtualDiskInit(&virtualdisk, SECTOR_SIZE);
+    if (!VirtualDiskAddExFatPartition(&virtualdisk, &partition, SynthFileInfo, SECTORS_PER_CLUSTER, (unsigned long)totalClusters, 512)) { fprintf(stderr, "Problem adding partition\n"); return 1; }
+    fileIndex.entries = entries;
+    fileIndex.capacity = MAX_FILES + 1;
+    fileIndex.count = 0;
+    fileIndex.complete = 0;
+    if (!VirtualDiskPartitionBuildIndex(&partition, &fileIndex)) { fprintf(stderr, "Index incomplete\n"); return 1; }
+    VirtualDiskPartitionSetIndex(&partition, &fileIndex);
+    buffer = (unsigned char *)malloc((size_t)count * SECTOR_SIZE);
+    if (buffer == NULL) { fprintf(stderr, "Out of memory\n"); return 1; }
+    printf("%d files of %lu GiB (%s), disk is %lu sectors (%.1f GiB)\n", numFiles, fileGiB, mode, VirtualDiskSectorCount(&virtualdisk), VirtualDiskSectorCount(&virtualdisk) * (double)SECTOR_SIZE / (1 << 30));
+
+    for (pass = 0; pass < passes; pass++)
+    {
+        unsigned long long bytes;
+
+        clock_gettime(CLOCK_MONOTONIC, &start);
+        bytes = GenerateDirect(buffer, count);
+        seconds = Elapsed(&start);
+        printf("Pass %d: generator    %14llu bytes in %8.3f s = %8.1f MB/s\n", pass + 1, bytes, seconds, bytes / 1e6 / seconds);
+
+        clock_gettime(CLOCK_MONOTONIC, &start);
+        bytes = ReadVirtualDisk(buffer, count);
+        seconds = Elapsed(&start);
+        printf("Pass %d: virtual disk %14llu bytes in %8.3f s = %8.1f MB/s\n", pass + 1, bytes, seconds, bytes / 1e6 / seconds);
+    }
+
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    errors = VerifyFiles(&fileIndex, buffer, count);
+    seconds = Elapsed(&start);
+    printf("Verified %d files: %lu sectors differ (%.3f s)\n", numFiles, errors, seconds);
+
+    VirtualDiskPartitionSetIndex(&partition, NULL);
+    free(buffer);
+    return (errors != 0);
+}
@@ -0,0 +1,633 @@
+// VirtualDisk vhost-user Back-End Benchmark
+// Dan Jackson, 2013
+
+// Plays the part of the VMM (the vhost-user front-end) and the guest's virtio-blk driver, without a VM: the guest memory is a
+// memfd, shared with the back-end as two regions (at different guest addresses and file offsets), the back-end runs on a thread
+// over a socket pair, and requests are placed on a split virtqueue in the shared memory. First checks the protocol: negotiation,
+// the configuration space, reads split across arbitrary (direct and indirect) descriptors against the disk read directly, the
+// device ID, flushes, refused writes, out-of-range and malformed requests, and stopping and restarting the queue. Then measures
+// the throughput and latency of sequential reads at several queue depths, and how many bytes had to be bounced rather than
+// generated in place (none, for requests of whole sectors).
+// Usage: vhostbench <files> <MiB-per-file> [request-KiB] [sector-size]
+
+#define _GNU_SOURCE
+
+#include <errno.h>
+#include <poll.h>
+#include <sched.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/eventfd.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+
+#include "../virtualdisk/virtualdisk.h"
+#include "../virtualdisk/virtualdiskvhost.h"
+#include "../virtualdisk/virtualdisksynth.h"
+
+#define SECTORS_PER_CLUSTER 64
+#define MAX_FILES 64
+#define MAX_DEPTH 64
+#define QUEUE_SIZE 256
+#define DESCS_PER_SLOT (QUEUE_SIZE / MAX_DEPTH)
+
+// Guest memory layout: region 0 holds the rings, request headers and statuses, indirect tables, and check buffers; region 1 the benchmark buffers
+#define REGION0_GPA 0x0ull
+#define REGION0_SIZE (16ull << 20)
+#define REGION1_GPA 0x100000000ull
+#define REGION1_OFFSET (REGION0_SIZE + (1ull << 20))   // (a gap in the file before it)
+#define DESC_GPA 0x1000ull
+#define AVAIL_GPA 0x2000ull
+#define USED_GPA 0x3000ull
+#define HEADER_GPA 0x4000ull
+#define STATUS_GPA 0x5000ull
+#define INDIRECT_GPA 0x10000ull
+#define CHECK_GPA 0x100000ull
+
+// vhost-user messages and virtio values used
+#define GET_FEATURES 1
+#define SET_FEATURES 2
+#define SET_OWNER 3
+#define SET_MEM_TABLE 5
+#define SET_VRING_NUM 8
+#define SET_VRING_ADDR 9
+#define SET_VRING_BASE 10
+#define GET_VRING_BASE 11
+#define SET_VRING_KICK 12
+#define SET_VRING_CALL 13
+#define GET_PROTOCOL_FEATURES 15
+#define SET_PROTOCOL_FEATURES 16
+#define GET_QUEUE_NUM 17
+#define SET_VRING_ENABLE 18
+#define GET_CONFIG 24
+#define SET_CONFIG 25
+#define FLAG_VERSION 0x1
+#define FLAG_REPLY 0x4
+#define FLAG_NEED_REPLY 0x8
+#define F_PROTOCOL_FEATURES (1ull << 30)
+#define F_VERSION_1 (1ull << 32)
+#define F_RO (1ull << 5)
+#define F_INDIRECT_DESC (1ull << 28)
+#define PROTOCOL_F_REPLY_ACK (1ull << 3)
+#define PROTOCOL_F_CONFIG (1ull << 9)
+#define T_IN 0
+#define T_OUT 1
+#define T_FLUSH 4
+#define T_GET_ID 8
+#define DESC_NEXT 1
+#define DESC_WRITE 2
+#define DESC_INDIRECT 4
+
+typedef struct { unsigned long long addr; unsigned int len; unsigned short flags; unsigned short next; } desc_t;
+typedef struct { unsigned short flags; unsigned short idx; unsigned short ring[QUEUE_SIZE]; } avail_t;
+typedef struct { unsigned short flags; unsigned short idx; struct { unsigned int id; unsigned int len; } ring[QUEUE_SIZE]; } used_t;
+typedef struct { unsigned long long addr; unsigned long len; unsigned short flags; } segment_t;
+
+static unsigned short sectorSize;
+static virtualdisk_t virtualdisk;
+static virtualdisk_partition_t partition;
+static virtualdisk_t reference;                     // Separate read context to check against
+static virtualdisk_partition_t referencePartitions[VIRTUALDISK_MAX_PARTITIONS];
+static virtualdisk_synth_t synth[MAX_FILES];
+static char filenames[MAX_FILES][16];
+static int numFiles;
+static unsigned long fileMiB;
+static int failFirstSector;                         // Whether the first file's first sector cannot be generated (as a generator error)
+
+static int vmmSocket, backEndSocket;                // Each end of the socket pair
+static unsigned char *memory;                       // Guest memory (the whole memfd, mapped here)
+static unsigned long long region1Size;
+static int kickFd, callFd;
+static desc_t *descs;
+static avail_t *avail;
+static used_t *used;
+static unsigned short availIdx, usedIdx;
+
+
+static void SetLe(unsigned char *p, unsigned long long v, int bytes) { int i; for (i = 0; i < bytes; i++) { p[i] = (unsigned char)v; v >>= 8; } }
+static unsigned long long GetLe(const unsigned char *p, int bytes) { unsigned long long v = 0; while (bytes-- > 0) { v = (v << 8) | p[bytes]; } return v; }
+
+// Elapsed seconds since the specified start time
+static double Elapsed(const struct timespec *start)
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (now.tv_sec - start->tv_sec) + (now.tv_nsec - start->tv_nsec) / 1e9;
+}
+
+// Guest memory at a guest physical address
+static unsigned char *Guest(unsigned long long address)
+{
+    if (address >= REGION1_GPA) { return memory + REGION1_OFFSET + (address - REGION1_GPA); }
+    return memory + address;
+}
+
+
+// File contents: synthetic, unless failing
+static unsigned short SynthContents(void *reference, unsigned long sector, unsigned short count, unsigned char *buffer)
+{
+    const virtualdisk_fileinfo_t *fileInfo = (const virtualdisk_fileinfo_t *)reference;
+    if (failFirstSector && fileInfo->id == 0 && sector == 0) { return 0; }
+    return VirtualDiskSynthContents(reference, sector, count, buffer);
+}
+
+// File information: numbered files of synthetic contents
+static char SynthFileInfo(virtualdisk_fileinfo_t *fileInfo)
+{
+    if (fileInfo->parent != VIRTUALDISK_ROOT_DIRECTORY || fileInfo->id < 0 || fileInfo->id >= numFiles) { return 0; }
+    fileInfo->filename = filenames[fileInfo->id];
+    fileInfo->attributes = VIRTUALDISK_ATTRIB_ARCHIVE;
+    fileInfo->size = fileMiB << 20;
+    fileInfo->created = VIRTUALDISK_DATETIME_MIN;
+    fileInfo->modified = VIRTUALDISK_DATETIME_MIN;
+    fileInfo->accessed = VIRTUALDISK_DATETIME_MIN;
+    fileInfo->contents = SynthContents;
+    fileInfo->reference = &synth[fileInfo->id];
+    return 1;
+}
+
+// Read a byte range of the disk directly (through the reference context)
+static void ReadReference(unsigned long long offset, unsigned long length, unsigned char *out)
+{
+    static unsigned char buffer[4096 * 64];
+    while (length > 0)
+    {
+        unsigned long sector = (unsigned long)(offset / sectorSize), skip = (unsigned long)(offset % sectorSize);
+        unsigned long part = sizeof(buffer) - skip;
+        if (part > length) { part = length; }
+        VirtualDiskReadSectors(&reference, sector, (unsigned short)((skip + part + sectorSize - 1) / sectorSize), buffer);
+        memcpy(out, buffer + skip, part);
+        out += part; offset += part; length -= part;
+    }
+}
+
+
+// Send a message, with any file descriptors (returns non-zero if sent)
+static int SendMessage(unsigned long request, unsigned long flags, const unsigned char *payload, unsigned long size, const int *fds, int numFds)
+{
+    unsigned char message[12 + 512];
+    union { struct cmsghdr header; char buffer[CMSG_SPACE(sizeof(int) * VIRTUALDISKVHOST_MAX_REGIONS)]; } control;
+    struct msghdr msg;
+    struct iovec iov;
+
+    SetLe(message + 0, request, 4);
+    SetLe(message + 4, FLAG_VERSION | flags, 4);
+    SetLe(message + 8, size, 4);
+    memcpy(message + 12, payload, size);
+    memset(&msg, 0, sizeof(msg));
+    iov.iov_base = message;
+    iov.iov_len = 12 + size;
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    if (numFds > 0)
+    {
+        struct cmsghdr *cmsg;
+        memset(&control, 0, sizeof(control));
+        msg.msg_control = control.buffer;
+        msg.msg_controllen = CMSG_SPACE(sizeof(int) * numFds);
+        cmsg = CMSG_FIRSTHDR(&msg);
+        cmsg->cmsg_level = SOL_SOCKET;
+        cmsg->cmsg_type = SCM_RIGHTS;
+        cmsg->cmsg_len = CMSG_LEN(sizeof(int) * numFds);
+        memcpy(CMSG_DATA(cmsg), fds, sizeof(int) * numFds);
+    }
+    return sendmsg(vmmSocket, &msg, MSG_NOSIGNAL) == (ssize_t)(12 + size);
+}
+
+// Receive a reply to a request (returns the payload size, or -1)
+static long ReceiveReply(unsigned long request, unsigned char *payload, unsigned long capacity)
+{
+    unsigned char header[12];
+    unsigned long size;
+    if (recv(vmmSocket, header, 12, MSG_WAITALL) != 12) { return -1; }
+    size = (unsigned long)GetLe(header + 8, 4);
+    if (GetLe(header, 4) != request || GetLe(header + 4, 4) != (FLAG_VERSION | FLAG_REPLY) || size > capacity) { return -1; }
+    if (size > 0 && recv(vmmSocket, payload, size, MSG_WAITALL) != (ssize_t)size) { return -1; }
+    return (long)size;
+}
+
+// Request a 64-bit value
+static unsigned long long GetValue(unsigned long request)
+{
+    unsigned char payload[8];
+    if (!SendMessage(request, 0, NULL, 0, NULL, 0) || ReceiveReply(request, payload, 8) != 8) { return ~0ull; }
+    return GetLe(payload, 8);
+}
+
+// Send a message asking for an acknowledgement (returns the back-end's result, zero for success, or -1)
+static long SendAcked(unsigned long request, const unsigned char *payload, unsigned long size, const int *fds, int numFds)
+{
+    unsigned char ack[8];
+    if (!SendMessage(request, FLAG_NEED_REPLY, payload, size, fds, numFds) || ReceiveReply(request, ack, 8) != 8) { return -1; }
+    return (long)GetLe(ack, 8);
+}
+
+// Send a vring state message (index and number)
+static long SendState(unsigned long request, unsigned long index, unsigned long num)
+{
+    unsigned char payload[8];
+    SetLe(payload + 0, index, 4);
+    SetLe(payload + 4, num, 4);
+    return SendAcked(request, payload, 8, NULL, 0);
+}
+
+// Send a vring file descriptor message
+static long SendVringFd(unsigned long request, unsigned long index, int fd)
+{
+    unsigned char payload[8];
+    SetLe(payload, index, 8);
+    return SendAcked(request, payload, 8, &fd, 1);
+}
+
+// Start queue 0 from the specified ring position
+static int StartQueue(unsigned short base)
+{
+    unsigned char payload[40];
+    int problems = 0;
+
+    problems += SendState(SET_VRING_NUM, 0, QUEUE_SIZE) != 0;
+    problems += SendState(SET_VRING_BASE, 0, base) != 0;
+    memset(payload, 0, sizeof(payload));
+    SetLe(payload + 8, (unsigned long long)(size_t)Guest(DESC_GPA), 8);
+    SetLe(payload + 16, (unsigned long long)(size_t)Guest(USED_GPA), 8);
+    SetLe(payload + 24, (unsigned long long)(size_t)Guest(AVAIL_GPA), 8);
+    problems += SendAcked(SET_VRING_ADDR, payload, 40, NULL, 0) != 0;
+    problems += SendVringFd(SET_VRING_KICK, 0, kickFd) != 0;
+    problems += SendVringFd(SET_VRING_CALL, 0, callFd) != 0;
+    problems += SendState(SET_VRING_ENABLE, 0, 1) != 0;
+    return problems;
+}
+
+
+// Make a request available, its chain in a slot's descriptors (or an indirect table), and kick the back-end
+static void Submit(int slot, const segment_t *segments, int count, int indirect)
+{
+    unsigned short head = (unsigned short)(slot * DESCS_PER_SLOT), base = indirect ? 0 : head;
+    desc_t *table = indirect ? (desc_t *)Guest(INDIRECT_GPA + (unsigned long long)slot * 4096) : descs;
+    int i;
+
+    for (i = 0; i < count; i++)
+    {
+        table[base + i].addr = segments[i].addr;
+        table[base + i].len = (unsigned int)segments[i].len;
+        table[base + i].flags = (unsigned short)(segments[i].flags | ((i < count - 1) ? DESC_NEXT : 0));
+        table[base + i].next = (unsigned short)(base + i + 1);
+    }
+    if (indirect)
+    {
+        descs[head].addr = INDIRECT_GPA + (unsigned long long)slot * 4096;
+        descs[head].len = (unsigned int)(count * sizeof(desc_t));
+        descs[head].flags = DESC_INDIRECT;
+        descs[head].next = 0;
+    }
+    avail->ring[availIdx % QUEUE_SIZE] = head;
+    availIdx++;
+    __atomic_store_n(&avail->idx, availIdx, __ATOMIC_RELEASE);
+    eventfd_write(kickFd, 1);
+}
+
+// Wait for a used request (returns its slot, or -1 after a timeout)
+static int Complete(unsigned long *length)
+{
+    int slot;
+    while (usedIdx == __atomic_load_n(&used->idx, __ATOMIC_ACQUIRE))
+    {
+        struct pollfd pfd;
+        eventfd_t value;
+        pfd.fd = callFd;
+        pfd.events = POLLIN;
+        if (poll(&pfd, 1, 5000) <= 0) { return -1; }
+        eventfd_read(callFd, &value);
+    }
+    slot = (int)(used->ring[usedIdx % QUEUE_SIZE].id / DESCS_PER_SLOT);
+    *length = used->ring[usedIdx % QUEUE_SIZE].len;
+    usedIdx++;
+    return slot;
+}
+
+// A single request with one data buffer (returns the status, or -1 if not used as expected)
+static int Request(unsigned long type, unsigned long long sector, unsigned long long dataAddress, unsigned long dataLength, unsigned short dataFlags, unsigned long *length)
+{
+    segment_t segments[3];
+    int count = 0;
+
+    SetLe(Guest(HEADER_GPA), type, 4);
+    SetLe(Guest(HEADER_GPA) + 4, 0, 4);
+    SetLe(Guest(HEADER_GPA) + 8, sector, 8);
+    *Guest(STATUS_GPA) = 0xee;
+    segments[count].addr = HEADER_GPA; segments[count].len = 16; segments[count++].flags = 0;
+    if (dataLength > 0) { segments[count].addr = dataAddress; segments[count].len = dataLength; segments[count++].flags = dataFlags; }
+    segments[count].addr = STATUS_GPA; segments[count].len = 1; segments[count++].flags = DESC_WRITE;
+    Submit(0, segments, count, 0);
+    if (Complete(length) != 0) { return -1; }
+    return *Guest(STATUS_GPA);
+}
+
+// Read a range split across a number of buffers (alternately in each region, at arbitrary alignment), checking the data read
+static int CheckRead(unsigned long long sector, unsigned long length, int pieces, int indirect, int combineStatus)
+{
+    static unsigned char expected[4096 * 64];
+    segment_t segments[256];
+    unsigned long cuts[256], used, done;
+    unsigned long long position[2] = { CHECK_GPA, REGION1_GPA };
+    int count = 0, i, j, problems = 0;
+
+    // Cut points (distinct, sorted)
+    cuts[0] = 0;
+    for (i = 1; i < pieces; i++)
+    {
+        cuts[i] = 1 + (unsigned long)rand() % (length - 1);
+        for (j = 1; j < i; j++) { if (cuts[j] == cuts[i]) { i--; break; } }
+    }
+    cuts[pieces] = length;
+    for (i = 1; i < pieces; i++) { for (j = i + 1; j < pieces; j++) { if (cuts[j] < cuts[i]) { unsigned long t = cuts[i]; cuts[i] = cuts[j]; cuts[j] = t; } } }
+
+    SetLe(Guest(HEADER_GPA), T_IN, 4);
+    SetLe(Guest(HEADER_GPA) + 4, 0, 4);
+    SetLe(Guest(HEADER_GPA) + 8, sector, 8);
+    segments[count].addr = HEADER_GPA; segments[count].len = 16; segments[count++].flags = 0;
+    for (i = 0; i < pieces; i++)
+    {
+        segments[count].addr = position[i & 1] + (unsigned long)rand() % 64;
+        segments[count].len = cuts[i + 1] - cuts[i];
+        segments[count].flags = DESC_WRITE;
+        memset(Guest(segments[count].addr), 0xcc, segments[count].len + 1);
+        position[i & 1] = segments[count].addr + segments[count].len + 1;
+        count++;
+    }
+    if (combineStatus) { segments[count - 1].len++; } else { segments[count].addr = STATUS_GPA; segments[count].len = 1; segments[count++].flags = DESC_WRITE; }
+    *Guest(segments[count - 1].addr + segments[count - 1].len - 1) = 0xee;
+
+    Submit(0, segments, count, indirect);
+    if (Complete(&used) != 0 || used != length + 1 || *Guest(segments[count - 1].addr + segments[count - 1].len - 1) != 0) { return 1; }
+    ReadReference(sector * 512, length, expected);
+    for (i = 1, done = 0; i <= pieces; i++)
+    {
+        if (memcmp(Guest(segments[i].addr), expected + done, cuts[i] - cuts[i - 1]) != 0) { problems++; }
+        done += cuts[i] - cuts[i - 1];
+    }
+    return problems;
+}
+
+
+// Send the guest memory table: two regions of the one file (listed in either order, so the back-end maps them at other addresses)
+static long SendMemTable(int memFd, int reversed)
+{
+    unsigned char table[8 + 2 * 32], *region0 = table + 8 + (reversed ? 32 : 0), *region1 = table + 8 + (reversed ? 0 : 32);
+    int fds[2];
+
+    fds[0] = memFd; fds[1] = memFd;
+    memset(table, 0, sizeof(table));
+    SetLe(table, 2, 4);
+    SetLe(region0, REGION0_GPA, 8); SetLe(region0 + 8, REGION0_SIZE, 8); SetLe(region0 + 16, (unsigned long long)(size_t)Guest(REGION0_GPA), 8); SetLe(region0 + 24, 0, 8);
+    SetLe(region1, REGION1_GPA, 8); SetLe(region1 + 8, region1Size, 8); SetLe(region1 + 16, (unsigned long long)(size_t)Guest(REGION1_GPA), 8); SetLe(region1 + 24, REGION1_OFFSET, 8);
+    return SendAcked(SET_MEM_TABLE, table, sizeof(table), fds, 2);
+}
+
+
+// Protocol checks (returns the number of problems found)
+static int CheckProtocol(virtualdisk_vhost_t *vhost, int memFd)
+{
+    unsigned long long capacity = (unsigned long long)VirtualDiskSectorCount(&virtualdisk) * sectorSize / 512;
+    static unsigned char expected[4096 * 4];
+    unsigned long long features, bounced;
+    unsigned char payload[12 + 64];
+    unsigned long length;
+    int problems = 0, i, status;
+
+    // Negotiation (as QEMU does)
+    features = GetValue(GET_FEATURES);
+    if ((features & (F_PROTOCOL_FEATURES | F_VERSION_1 | F_RO | F_INDIRECT_DESC)) != (F_PROTOCOL_FEATURES | F_VERSION_1 | F_RO | F_INDIRECT_DESC)) { printf("Features: 0x%llx\n", features); problems++; }
+    if ((GetValue(GET_PROTOCOL_FEATURES) & (PROTOCOL_F_REPLY_ACK | PROTOCOL_F_CONFIG)) != (PROTOCOL_F_REPLY_ACK | PROTOCOL_F_CONFIG)) { printf("Protocol features\n"); problems++; }
+    SetLe(payload, PROTOCOL_F_REPLY_ACK | PROTOCOL_F_CONFIG, 8);
+    problems += !SendMessage(SET_PROTOCOL_FEATURES, 0, payload, 8, NULL, 0);
+    if (GetValue(GET_QUEUE_NUM) != VIRTUALDISKVHOST_MAX_QUEUES) { printf("Queue count\n"); problems++; }
+    problems += SendAcked(SET_OWNER, NULL, 0, NULL, 0) != 0;
+    SetLe(payload, features & (F_PROTOCOL_FEATURES | F_VERSION_1 | F_RO | F_INDIRECT_DESC | (1ull << 2) | (1ull << 6) | (1ull << 9)), 8);
+    problems += SendAcked(SET_FEATURES, payload, 8, NULL, 0) != 0;
+
+    // Configuration space
+    memset(payload, 0, sizeof(payload));
+    SetLe(payload + 4, 64, 4);
+    if (!SendMessage(GET_CONFIG, 0, payload, 12 + 64, NULL, 0) || ReceiveReply(GET_CONFIG, payload, sizeof(payload)) != 12 + 64) { printf("Config\n"); problems++; }
+    else if (GetLe(payload + 12, 8) != capacity || GetLe(payload + 12 + 20, 4) != sectorSize || GetLe(payload + 12 + 34, 2) != VIRTUALDISKVHOST_MAX_QUEUES) { printf("Config: capacity %llu, block size %llu\n", GetLe(payload + 12, 8), GetLe(payload + 12 + 20, 4)); problems++; }
+    if (SendAcked(SET_CONFIG, payload, 12 + 4, NULL, 0) == 0) { printf("Config written\n"); problems++; }
+
+    // Guest memory (two regions of the one file) and the queue
+    problems += SendMemTable(memFd, 0) != 0;
+    {
+        unsigned char addr[40];
+        memset(addr, 0, sizeof(addr));
+        SetLe(addr + 8, 0xdead0000ull, 8);
+        problems += SendState(SET_VRING_NUM, 0, QUEUE_SIZE) != 0;
+        if (SendAcked(SET_VRING_ADDR, addr, 40, NULL, 0) == 0) { printf("Bad ring address accepted\n"); problems++; }
+    }
+    problems += StartQueue(0);
+    if (problems > 0) { printf("Negotiation: %d problems\n", problems); return problems; }
+
+    // Reads of arbitrary ranges and splits, direct and indirect
+    for (i = 0; i < 400; i++)
+    {
+        unsigned long length = 512 * (1 + (unsigned long)rand() % 128);
+        unsigned long long sector = (unsigned long long)rand() * rand() % (capacity - length / 512 + 1);
+        int indirect = (i & 1), pieces = 1 + rand() % (indirect ? 200 : 6);
+        if (i < 8) { sector = (i < 4) ? 0 : capacity - length / 512; }
+        if (CheckRead(sector, length, pieces, indirect, (i & 2) != 0)) { printf("Read at sector %llu, %lu bytes in %d pieces, %s: mismatch\n", sector, length, pieces, indirect ? "indirect" : "direct"); problems++; }
+    }
+
+    // Device ID, flush, write, unknown, out of range
+    memset(Guest(CHECK_GPA), 0xcc, 20);
+    status = Request(T_GET_ID, 0, CHECK_GPA, 20, DESC_WRITE, &length);
+    if (status != 0 || length != 21 || memcmp(Guest(CHECK_GPA), "VHOSTBENCH\0\0\0\0\0\0\0\0\0\0", 20) != 0) { printf("Get ID: status %d, length %lu\n", status, length); problems++; }
+    if ((status = Request(T_FLUSH, 0, 0, 0, 0, &length)) != 0 || length != 1) { printf("Flush: status %d\n", status); problems++; }
+    if ((status = Request(T_OUT, 0, CHECK_GPA, 512, 0, &length)) != 1 || length != 1) { printf("Write: status %d\n", status); problems++; }
+    if ((status = Request(99, 0, CHECK_GPA, 512, DESC_WRITE, &length)) != 2) { printf("Unknown request: status %d\n", status); problems++; }
+    if ((status = Request(T_IN, capacity, CHECK_GPA, 512, DESC_WRITE, &length)) != 1) { printf("Read past end: status %d\n", status); problems++; }
+    if ((status = Request(T_IN, capacity - 1, CHECK_GPA, 1024, DESC_WRITE, &length)) != 1) { printf("Read over end: status %d\n", status); problems++; }
+    if ((status = Request(T_IN, capacity - 1, CHECK_GPA, 512, DESC_WRITE, &length)) != 0 || length != 513) { printf("Read of last sector: status %d\n", status); problems++; }
+    if ((status = Request(T_IN, 0, CHECK_GPA, 100, DESC_WRITE, &length)) != 1) { printf("Read of part of a sector: status %d\n", status); problems++; }
+    if ((status = Request(T_IN, 0, 0xdead00000000ull, 512, DESC_WRITE, &length)) != 0xee || length != 0) { printf("Buffer outside guest memory: status %d, length %lu\n", status, length); problems++; }
+
+    // A sector that cannot be generated is an I/O error, read whole or through the bounce sector
+    {
+        unsigned long failed, sectorCount = VirtualDiskSectorCount(&reference);
+        failFirstSector = 1;
+        for (failed = 0; failed < sectorCount && VirtualDiskReadSectors(&reference, failed, 1, expected) == 1; failed++) { ; }
+        if (failed >= sectorCount || (status = Request(T_IN, (unsigned long long)failed * sectorSize / 512, CHECK_GPA, sectorSize, DESC_WRITE, &length)) != 1) { printf("Read of a failing sector: status %d\n", status); problems++; }
+        if ((status = Request(T_IN, ((unsigned long long)failed + 1) * sectorSize / 512 - 1, CHECK_GPA, 512, DESC_WRITE, &length)) != 1) { printf("Read of part of a failing sector: status %d\n", status); problems++; }
+        failFirstSector = 0;
+    }
+
+    // Stopping the queue returns where it stopped; restarting it from there carries on
+    {
+        unsigned char state[8];
+        SetLe(state, 0, 4);
+        SetLe(state + 4, 0, 4);
+        if (!SendMessage(GET_VRING_BASE, 0, state, 8, NULL, 0) || ReceiveReply(GET_VRING_BASE, state, 8) != 8 || GetLe(state + 4, 4) != availIdx) { printf("Queue stop\n"); problems++; }
+        bounced = vhost->bytesBounced;
+        problems += StartQueue(availIdx);
+        status = Request(T_IN, 8, CHECK_GPA, 4096 * 4, DESC_WRITE, &length);
+        ReadReference(8 * 512, 4096 * 4, expected);
+        if (status != 0 || memcmp(Guest(CHECK_GPA), expected, 4096 * 4) != 0 || vhost->bytesBounced != bounced) { printf("Read after restart\n"); problems++; }
+    }
+
+    // A new memory table (mapped afresh by the back-end) while the queue runs: its rings are found again in the new mappings
+    problems += SendMemTable(memFd, 1) != 0;
+    status = Request(T_IN, 16, CHECK_GPA, 4096, DESC_WRITE, &length);
+    ReadReference(16 * 512, 4096, expected);
+    if (status != 0 || memcmp(Guest(CHECK_GPA), expected, 4096) != 0) { printf("Read after a new memory table\n"); problems++; }
+
+    // An available index more than a ring ahead is refused, serving nothing
+    {
+        unsigned long errorsBefore = vhost->errors;
+        unsigned short usedBefore = __atomic_load_n(&used->idx, __ATOMIC_ACQUIRE);
+        struct timespec start;
+
+        __atomic_store_n(&avail->idx, (unsigned short)(availIdx + QUEUE_SIZE + 1), __ATOMIC_RELEASE);
+        eventfd_write(kickFd, 1);
+        clock_gettime(CLOCK_MONOTONIC, &start);
+        while (__atomic_load_n(&vhost->errors, __ATOMIC_ACQUIRE) == errorsBefore && Elapsed(&start) < 5) { sched_yield(); }
+        if (vhost->errors != errorsBefore + 1 || __atomic_load_n(&used->idx, __ATOMIC_ACQUIRE) != usedBefore) { printf("Corrupt available index served\n"); problems++; }
+        __atomic_store_n(&avail->idx, availIdx, __ATOMIC_RELEASE);
+    }
+    status = Request(T_IN, 24, CHECK_GPA, 4096, DESC_WRITE, &length);
+    ReadReference(24 * 512, 4096, expected);
+    if (status != 0 || memcmp(Guest(CHECK_GPA), expected, 4096) != 0) { printf("Read after a corrupt available index\n"); problems++; }
+    return problems;
+}
+
+
+static int CompareDouble(const void *a, const void *b) { double x = *(const double *)a, y = *(const double *)b; return (x > y) - (x < y); }
+
+static void *ServeThread(void *reference)
+{
+    VirtualDiskVhostServeSocket((virtualdisk_vhost_t *)reference, backEndSocket);
+    return NULL;
+}
+
+
+int main(int argc, char *argv[])
+{
+    static const int depths[] = { 1, 2, 4, 8, 16, 32, 64 };
+    unsigned long requestSize = ((argc > 3) ? strtoul(argv[3], NULL, 0) : 128) * 1024;
+    virtualdisk_index_t fileIndex;
+    virtualdisk_index_entry_t entries[MAX_FILES + 1];
+    unsigned long long fileClusters, size, bounced;
+    virtualdisk_vhost_t vhost;
+    pthread_t serveThread;
+    int sockets[2], memFd, errors, d, i;
+
+    numFiles = (argc > 1) ? atoi(argv[1]) : 0;
+    fileMiB = (argc > 2) ? strtoul(argv[2], NULL, 0) : 0;
+    sectorSize = (unsigned short)((argc > 4) ? atoi(argv[4]) : 512);
+    if (numFiles < 1 || numFiles > MAX_FILES || fileMiB < 1 || fileMiB > 4095 || requestSize == 0 || requestSize > (1ul << 20) || requestSize % 4096 != 0 || (sectorSize != 512 && sectorSize != 1024 && sectorSize != 2048 && sectorSize != 4096)) { fprintf(stderr, "Usage: vhostbench <files> <MiB-per-file> [request-KiB] [sector-size]\n"); return 1; }
+
+    // Each file's contents differ (by seed); a quarter of the volume is left unused
+    for (i = 0; i < numFiles; i++)
+    {
+        VirtualDiskSynthInit(&synth[i], VIRTUALDISKSYNTH_RANDOM, sectorSize, 0x5eed0000ull + i, NULL, 0);
+        sprintf(filenames[i], "SYNTH%03d.BIN", i + 1);
+    }
+    fileClusters = ((unsigned long long)fileMiB << 20) / ((unsigned long)sectorSize * SECTORS_PER_CLUSTER) * numFiles;
+    VirtualDiskInit(&virtualdisk, sectorSize);
+    if (!VirtualDiskAddExFatPartition(&virtualdisk, &partition, SynthFileInfo, SECTORS_PER_CLUSTER, (unsigned long)(fileClusters + fileClusters / 3 + 1024), 512)) { fprintf(stderr, "Problem adding partition\n"); return 1; }
+    fileIndex.entries = entries;
+    fileIndex.capacity = MAX_FILES + 1;
+    fileIndex.count = 0;
+    fileIndex.complete = 0;
+    if (!VirtualDiskPartitionBuildIndex(&partition, &fileIndex)) { fprintf(stderr, "Index incomplete\n"); return 1; }
+    VirtualDiskPartitionSetIndex(&partition, &fileIndex);
+    VirtualDiskCopy(&reference, referencePartitions, &virtualdisk);
+    size = (unsigned long long)VirtualDiskSectorCount(&virtualdisk) * sectorSize;
+    printf("%d files of %lu MiB, disk is %llu bytes of %u-byte sectors\n", numFiles, fileMiB, size, sectorSize);
+
+    // Guest memory, rings, and eventfds
+    region1Size = (REGION0_SIZE > (unsigned long long)MAX_DEPTH * requestSize) ? REGION0_SIZE : (unsigned long long)MAX_DEPTH * requestSize;
+    memFd = memfd_create("vhostbench", MFD_CLOEXEC);
+    if (memFd < 0 || ftruncate(memFd, (off_t)(REGION1_OFFSET + region1Size)) != 0) { fprintf(stderr, "Cannot create guest memory\n"); return 1; }
+    memory = (unsigned char *)mmap(NULL, (size_t)(REGION1_OFFSET + region1Size), PROT_READ | PROT_WRITE, MAP_SHARED, memFd, 0);
+    if (memory == MAP_FAILED) { fprintf(stderr, "Cannot map guest memory\n"); return 1; }
+    descs = (desc_t *)Guest(DESC_GPA);
+    avail = (avail_t *)Guest(AVAIL_GPA);
+    used = (used_t *)Guest(USED_GPA);
+    kickFd = eventfd(0, EFD_CLOEXEC);
+    callFd = eventfd(0, EFD_CLOEXEC);
+
+    // Back-end on a thread, over a socket pair
+    if (socketpair(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0, sockets) != 0) { fprintf(stderr, "Cannot create socket pair\n"); return 1; }
+    vmmSocket = sockets[0];
+    backEndSocket = sockets[1];
+    if (!VirtualDiskVhostInit(&vhost, &virtualdisk, "VHOSTBENCH")) { fprintf(stderr, "Cannot set up back-end\n"); return 1; }
+    pthread_create(&serveThread, NULL, ServeThread, &vhost);
+
+    errors = CheckProtocol(&vhost, memFd);
+    printf("Protocol checks: %d problems\n", errors);
+
+    // Sequential reads at each queue depth (requests of whole sectors: all generated in place)
+    bounced = vhost.bytesBounced;
+    for (d = 0; d < (int)(sizeof(depths) / sizeof(depths[0])) && errors == 0; d++)
+    {
+        unsigned long total = (unsigned long)((size + requestSize - 1) / requestSize), count = 0, length;
+        unsigned long long next = 0;
+        struct timespec sent[MAX_DEPTH], start;
+        double *latencies = (double *)malloc(sizeof(double) * total), seconds;
+        int inFlight = 0, slot;
+
+        clock_gettime(CLOCK_MONOTONIC, &start);
+        for (slot = 0; slot < depths[d] && next < size; slot++, inFlight++)
+        {
+            segment_t segments[3];
+            unsigned long part = (size - next < requestSize) ? (unsigned long)(size - next) : requestSize;
+            SetLe(Guest(HEADER_GPA + slot * 16), T_IN, 4);
+            SetLe(Guest(HEADER_GPA + slot * 16) + 8, next / 512, 8);
+            segments[0].addr = HEADER_GPA + slot * 16; segments[0].len = 16; segments[0].flags = 0;
+            segments[1].addr = REGION1_GPA + (unsigned long long)slot * requestSize; segments[1].len = part; segments[1].flags = DESC_WRITE;
+            segments[2].addr = STATUS_GPA + slot; segments[2].len = 1; segments[2].flags = DESC_WRITE;
+            clock_gettime(CLOCK_MONOTONIC, &sent[slot]);
+            Submit(slot, segments, 3, 0);
+            next += part;
+        }
+        while (inFlight > 0)
+        {
+            if ((slot = Complete(&length)) < 0 || *Guest(STATUS_GPA + slot) != 0) { errors++; break; }
+            latencies[count++] = Elapsed(&sent[slot]);
+            inFlight--;
+            if (next < size)
+            {
+                segment_t segments[3];
+                unsigned long part = (size - next < requestSize) ? (unsigned long)(size - next) : requestSize;
+                SetLe(Guest(HEADER_GPA + slot * 16) + 8, next / 512, 8);
+                segments[0].addr = HEADER_GPA + slot * 16; segments[0].len = 16; segments[0].flags = 0;
+                segments[1].addr = REGION1_GPA + (unsigned long long)slot * requestSize; segments[1].len = part; segments[1].flags = DESC_WRITE;
+                segments[2].addr = STATUS_GPA + slot; segments[2].len = 1; segments[2].flags = DESC_WRITE;
+                clock_gettime(CLOCK_MONOTONIC, &sent[slot]);
+                Submit(slot, segments, 3, 0);
+                next += part;
+                inFlight++;
+            }
+        }
+        seconds = Elapsed(&start);
+        if (errors == 0)
+        {
+            qsort(latencies, count, sizeof(double), CompareDouble);
+            printf("Depth %2d: %8.1f MB/s, %7.0f requests/s, latency p50 %7.1f us, p99 %7.1f us, max %7.1f us\n", depths[d], size / 1e6 / seconds, count / seconds, latencies[count / 2] * 1e6, latencies[count * 99 / 100] * 1e6, latencies[count - 1] * 1e6);
+        }
+        free(latencies);
+    }
+
+    // Disconnecting ends the back-end's session
+    close(vmmSocket);
+    pthread_join(serveThread, NULL);
+    printf("Back-end: %lu requests (%lu failed), %llu bytes read, %llu bounced (%llu in the benchmark), %lu notifications\n", vhost.requests, vhost.errors, vhost.bytesRead, vhost.bytesBounced, vhost.bytesBounced - bounced, vhost.notifications);
+    if (vhost.bytesBounced != bounced) { errors++; }
+    VirtualDiskVhostClose(&vhost);
+    close(sockets[1]);
+    VirtualDiskPartitionSetIndex(&partition, NULL);
+    munmap(memory, (size_t)(REGION1_OFFSET + region1Size));
+    close(memFd);
+    return (errors != 0);
+}
@@ -12,6 +12,16 @@
 
 #include "../virtualdisk/virtualdisk.h"
 #include "../virtualdisk/virtualdiskio.h"
+#include "../virtualdisk/virtualdiskindex.h"
+#include "../virtualdisk/virtualdiskdelta.h"
+#include "../virtualdisk/virtualdisksplit.h"
+#include "../virtualdisk/virtualdiskstore.h"
+#include "../virtualdisk/virtualdisksynth.h"
+#include "../virtualdisk/virtualdisksum.h"
+#include "../virtualdisk/virtualdiskstats.h"
+#include "../virtualdisk/virtualdiskuring.h"
+#include "../virtualdisk/virtualdiskmap.h"
+#include "../virtualdisk/virtualdisktransform.h"
 #include "../fatfs/ff.h"
 
 // File-system state
@@ -19,6 +29,19 @@ static FATFS fs;
 static virtualdisk_partition_t partition;
 virtualdisk_t virtualdisk;
 
+// File index state
+static virtualdisk_index_entry_t indexEntries[64];
+static virtualdisk_index_t fileIndex = { indexEntries, sizeof(indexEntries) / sizeof(indexEntries[0]), 0, 0 };
+static virtualdisk_index_file_t indexFile;
+
+// Check disks (separate from the demo disk)
+#define CHECK_SECTOR_SIZE 512
+#define CHECK_MAX_SECTORS 256
+static int checkVersion = 0;            // Version of the check file set
+static unsigned char checkImage[2][CHECK_MAX_SECTORS * CHECK_SECTOR_SIZE];
+#define CHECK_GET_WORD(_p) ( (unsigned short)*((_p)+0) | ((unsigned short)*((_p)+1) << 8) )
+#define CHECK_GET_DWORD(_p) ( (unsigned long)*((_p)+0) | ((unsigned long)*((_p)+1) << 8) | ((unsigned long)*((_p)+2) << 16) | ((unsigned long)*((_p)+3) << 24) )
+
 // For testing non-standard sectors
 #if VIRTUALDISK_DEFAULT_SECTOR_SIZE > _MAX_SS
     #error "_MAX_SS must be at least VIRTUALDISK_DEFAULT_SECTOR_SIZE"
@@ -31,7 +54,7 @@ unsigned short VirtualDiskFileContents(void *reference, unsigned long sector, un
     unsigned short sectorSize = VirtualDiskSectorSize(&virtualdisk);
 
     // Generate a sector with the current sector number written in it
-    sprintf((char *)buffer, "[#%d=%s:%08ld]", fileInfo->id, fileInfo->filename, sector);
+    sprintf((char *)buffer, "[#%d/%d=%s:%08ld]", fileInfo->parent, fileInfo->id, fileInfo->filename, sector);
     memset(buffer + strlen((char *)buffer), '.', sectorSize - strlen((char *)buffer));
 	buffer[sectorSize - 2] = '\r';
 	buffer[sectorSize - 1] = '\n';
@@ -39,10 +62,10 @@ unsigned short VirtualDiskFileContents(void *reference, unsigned long sector, un
     return 1;   // Generated one sector
 }
 
-// Call to retrieve information about the specified file entry
+// Call to retrieve information about the specified file entry (thread-safe, so the index can be built in parallel)
 char VirtualDiskFileInfo(virtualdisk_fileinfo_t *fileInfo)
 {
-    static char filename[13] = {0};
+    static char filenames[5][13] = {{0}};
 
     // Default return values
     fileInfo->filename = NULL;
@@ -54,6 +77,18 @@ char VirtualDiskFileInfo(virtualdisk_fileinfo_t *fileInfo)
     fileInfo->accessed = VIRTUALDISK_DATETIME_MIN;
     fileInfo->reference = NULL;
 
+    // Sub-directory contents
+    if (fileInfo->parent == 1)
+    {
+        if (fileInfo->id == 0) { fileInfo->filename = "LOG.CSV"; }
+        else if (fileInfo->id == 1) { fileInfo->filename = "Log file 2013-06.csv"; }     // Long filename
+        else { return 0; }
+        fileInfo->attributes = VIRTUALDISK_ATTRIB_ARCHIVE;
+        fileInfo->size = 2 * 512;
+        fileInfo->contents = VirtualDiskFileContents;
+        return 1;
+    }
+
     // Volume label
 #if 0
     if (fileInfo->id == 0)
@@ -66,8 +101,9 @@ char VirtualDiskFileInfo(virtualdisk_fileinfo_t *fileInfo)
     else
 #endif
 
-    if (fileInfo->id <= 4)
+    if (fileInfo->id >= 0 && fileInfo->id <= 4)
     {
+        char *filename = filenames[fileInfo->id];
         sprintf(filename, "TEST%04X.TXT", fileInfo->id);
         fileInfo->filename = filename;
         fileInfo->attributes = VIRTUALDISK_ATTRIB_ARCHIVE;
@@ -76,10 +112,33 @@ char VirtualDiskFileInfo(virtualdisk_fileinfo_t *fileInfo)
         return 1;
     }
 
+    // Sub-directory (its contents are listed with 'parent' set to its 'directory' value)
+    if (fileInfo->id == 5)
+    {
+        fileInfo->filename = "LOGS";
+        fileInfo->attributes = VIRTUALDISK_ATTRIB_DIRECTORY;
+        fileInfo->directory = 1;
+        return 1;
+    }
+
     return 0;       // No more files
 }
 
 
+// FatFs long filename support: code page 1252 (Latin-1) to Unicode conversion (as the virtual disk takes filename characters as Latin-1)
+WCHAR ff_convert(WCHAR chr, UINT dir)
+{
+    return (chr < 0x100) ? chr : 0;
+}
+
+// FatFs long filename support: Unicode upper-case conversion (Latin-1 only)
+WCHAR ff_wtoupper(WCHAR chr)
+{
+    if ((chr >= 'a' && chr <= 'z') || (chr >= 0xe0 && chr <= 0xfe && chr != 0xf7)) { return chr - 0x20; }
+    return chr;
+}
+
+
 void WriteLocalFileFromFile(const char *destFilename, const char *sourceFilename)
 {
     FIL sfp;
@@ -141,10 +200,1416 @@ buffer[72] = '>'; buffer[73] = '>'; buffer[74] = '>'; buffer[75] = '\0';
 }
 
 
+// Check file contents: the file's id, size and modified time, and the sector number (so a changed file has different contents)
+static unsigned short CheckFileContents(void *reference, unsigned long sector, unsigned short count, unsigned char *buffer)
+{
+    const virtualdisk_fileinfo_t *fileInfo = (const virtualdisk_fileinfo_t *)reference;
+    memset(buffer, 0, CHECK_SECTOR_SIZE);
+    sprintf((char *)buffer, "[%d:%lu:%lu:%lu]", fileInfo->id, fileInfo->size, fileInfo->modified, sector);
+    return 1;
+}
+
+// Check file set: the second version resizes one file (moving the files after it), touches another, and adds one
+static char CheckFileInfo(virtualdisk_fileinfo_t *fileInfo)
+{
+    static char filenames[9][13];
+    int numFiles = checkVersion ? 9 : 8;
+
+    if (fileInfo->parent != VIRTUALDISK_ROOT_DIRECTORY || fileInfo->id < 0 || fileInfo->id >= numFiles) { return 0; }
+    sprintf(filenames[fileInfo->id], "CHECK%03d.DAT", fileInfo->id);
+    fileInfo->filename = filenames[fileInfo->id];
+    fileInfo->attributes = VIRTUALDISK_ATTRIB_ARCHIVE;
+    fileInfo->size = 700ul * (fileInfo->id + 1) + ((checkVersion && fileInfo->id == 3) ? 2000 : 0);
+    fileInfo->created = VIRTUALDISK_DATETIME_MIN;
+    fileInfo->modified = (checkVersion && fileInfo->id == 5) ? VIRTUALDISK_DATETIME(2013, 7, 1, 12, 0, 0) : VIRTUALDISK_DATETIME(2013, 6, 1, 12, 0, 0);
+    fileInfo->accessed = VIRTUALDISK_DATETIME_MIN;
+    fileInfo->contents = CheckFileContents;
+    fileInfo->reference = NULL;
+    return 1;
+}
+
+// Read every sector of a check disk into a check image
+static void CheckReadImage(virtualdisk_t *disk, unsigned char *image)
+{
+    VirtualDiskReadSectors(disk, 0, (unsigned short)VirtualDiskSectorCount(disk), image);
+}
+
+// Delta export: write each exported block into the image it patches
+static char CheckPatchImage(void *reference, unsigned long sector, unsigned short count, const unsigned char *buffer)
+{
+    if (sector + count > CHECK_MAX_SECTORS) { return 0; }
+    memcpy((unsigned char *)reference + sector * CHECK_SECTOR_SIZE, buffer, (size_t)count * CHECK_SECTOR_SIZE);
+    return 1;
+}
+
+// Delta: count the changed sectors
+static char CheckCountRange(void *reference, unsigned long firstSector, unsigned long count)
+{
+    *(unsigned long *)reference += count;
+    return 1;
+}
+
+// Check the sector delta between two known versions of a file set: none between identical indexes, and patching the old image with the exported sectors gives the new image (without exporting the unchanged files before the resized one)
+static int CheckDelta(void)
+{
+    static virtualdisk_index_entry_t entries[2][16];
+    virtualdisk_index_t oldIndex = { entries[0], 16, 0, 0 }, newIndex = { entries[1], 16, 0, 0 };
+    virtualdisk_t disk;
+    virtualdisk_partition_t partition;
+    unsigned char buffer[8 * CHECK_SECTOR_SIZE];
+    unsigned long unchanged = 0, changed = 0, sectorCount;
+    int problems = 0;
+
+    VirtualDiskInit(&disk, CHECK_SECTOR_SIZE);
+    VirtualDiskAddPartition(&disk, &partition, CheckFileInfo, 1, 100, 16);
+    sectorCount = VirtualDiskSectorCount(&disk);
+    if (sectorCount > CHECK_MAX_SECTORS) { printf("[Check: delta, disk too large]\n"); return 1; }
+
+    checkVersion = 0;
+    VirtualDiskPartitionBuildIndex(&partition, &oldIndex);
+    VirtualDiskPartitionSetIndex(&partition, &oldIndex);
+    CheckReadImage(&disk, checkImage[0]);
+    if (!VirtualDiskPartitionDelta(&partition, &oldIndex, &oldIndex, CheckCountRange, &unchanged) || unchanged != 0) { problems++; }
+
+    checkVersion = 1;
+    VirtualDiskPartitionBuildIndex(&partition, &newIndex);
+    VirtualDiskPartitionSetIndex(&partition, &newIndex);
+    CheckReadImage(&disk, checkImage[1]);
+    if (!VirtualDiskPartitionDelta(&partition, &oldIndex, &newIndex, CheckCountRange, &changed) || changed == 0 || changed >= sectorCount) { problems++; }
+    if (!VirtualDiskPartitionExportDelta(&partition, &oldIndex, buffer, sizeof(buffer) / CHECK_SECTOR_SIZE, CheckPatchImage, checkImage[0])) { problems++; }
+    if (memcmp(checkImage[0], checkImage[1], sectorCount * CHECK_SECTOR_SIZE) != 0) { problems++; }
+    checkVersion = 0;
+
+    printf("[Check: delta, %lu of %lu sectors changed%s]\n", changed, sectorCount, problems ? ", FAILED" : "");
+    return problems;
+}
+
+
+// Delta path check file contents: the file's name and the sector number (so files of the same size and time differ by name)
+static unsigned short CheckPathContents(void *reference, unsigned long sector, unsigned short count, unsigned char *buffer)
+{
+    const virtualdisk_fileinfo_t *fileInfo = (const virtualdisk_fileinfo_t *)reference;
+    memset(buffer, 0, CHECK_SECTOR_SIZE);
+    sprintf((char *)buffer, "[%s:%lu]", fileInfo->filename, sector);
+    return 1;
+}
+
+// Delta path check file set: a sub-directory of files of the same size and time, then a root file -- the second version swaps the names of the sub-directory's first two files
+static char CheckPathFileInfo(virtualdisk_fileinfo_t *fileInfo)
+{
+    static const char *childFilenames[2][3] = { { "A.DAT", "B.DAT", "C.DAT" }, { "B.DAT", "A.DAT", "C.DAT" } };
+
+    if (fileInfo->parent == 1)
+    {
+        if (fileInfo->id < 0 || fileInfo->id >= 3) { return 0; }
+        fileInfo->filename = childFilenames[checkVersion][fileInfo->id];
+    }
+    else
+    {
+        if (fileInfo->parent != VIRTUALDISK_ROOT_DIRECTORY || fileInfo->id < 0 || fileInfo->id >= 2) { return 0; }
+        fileInfo->filename = (fileInfo->id == 0) ? "DATA" : "ROOT.DAT";
+    }
+    fileInfo->attributes = VIRTUALDISK_ATTRIB_ARCHIVE;
+    fileInfo->size = 1400;
+    fileInfo->created = fileInfo->modified = fileInfo->accessed = VIRTUALDISK_DATETIME(2013, 6, 1, 12, 0, 0);
+    fileInfo->contents = CheckPathContents;
+    fileInfo->reference = NULL;
+    if (fileInfo->parent == VIRTUALDISK_ROOT_DIRECTORY && fileInfo->id == 0)
+    {
+        fileInfo->attributes = VIRTUALDISK_ATTRIB_DIRECTORY;
+        fileInfo->size = 0;
+        fileInfo->directory = 1;
+        fileInfo->contents = NULL;
+    }
+    return 1;
+}
+
+// Check the sector delta compares each file with the file at the same path: swapping the names of two sub-directory files of the same size and time (so the entries at each position have the same runs) exports both files' data, so patching the old image gives the new image
+static int CheckDeltaPaths(void)
+{
+    static virtualdisk_index_entry_t entries[2][16];
+    virtualdisk_index_t oldIndex = { entries[0], 16, 0, 0 }, newIndex = { entries[1], 16, 0, 0 };
+    virtualdisk_t disk;
+    virtualdisk_partition_t partition;
+    unsigned char buffer[8 * CHECK_SECTOR_SIZE];
+    unsigned long changed = 0, sectorCount;
+    int problems = 0;
+
+    VirtualDiskInit(&disk, CHECK_SECTOR_SIZE);
+    VirtualDiskAddPartition(&disk, &partition, CheckPathFileInfo, 1, 100, 16);
+    sectorCount = VirtualDiskSectorCount(&disk);
+    if (sectorCount > CHECK_MAX_SECTORS) { printf("[Check: delta paths, disk too large]\n"); return 1; }
+
+    checkVersion = 0;
+    if (!VirtualDiskPartitionBuildIndex(&partition, &oldIndex)) { problems++; }
+    VirtualDiskPartitionSetIndex(&partition, &oldIndex);
+    CheckReadImage(&disk, checkImage[0]);
+
+    checkVersion = 1;
+    if (!VirtualDiskPartitionBuildIndex(&partition, &newIndex)) { problems++; }
+    VirtualDiskPartitionSetIndex(&partition, &newIndex);
+    CheckReadImage(&disk, checkImage[1]);
+    if (!VirtualDiskPartitionDelta(&partition, &oldIndex, &newIndex, CheckCountRange, &changed) || changed == 0 || changed >= sectorCount) { problems++; }
+    if (!VirtualDiskPartitionExportDelta(&partition, &oldIndex, buffer, sizeof(buffer) / CHECK_SECTOR_SIZE, CheckPatchImage, checkImage[0])) { problems++; }
+    if (memcmp(checkImage[0], checkImage[1], sectorCount * CHECK_SECTOR_SIZE) != 0) { problems++; }
+    VirtualDiskPartitionSetIndex(&partition, NULL);
+    checkVersion = 0;
+
+    printf("[Check: delta paths, %lu of %lu sectors changed%s]\n", changed, sectorCount, problems ? ", FAILED" : "");
+    return problems;
+}
+
+
+// Stale index check file set: a sub-directory (whose contents are indexed after the root files), then root files -- more of either can be appended
+static int checkStaleRootFiles = 2, checkStaleChildFiles = 3;
+static char CheckStaleFileInfo(virtualdisk_fileinfo_t *fileInfo)
+{
+    static char filenames[2][8][13];
+    int parent = (fileInfo->parent == 1) ? 1 : 0;
+
+    if ((fileInfo->parent != VIRTUALDISK_ROOT_DIRECTORY && fileInfo->parent != 1) || fileInfo->id < 0 || fileInfo->id >= (parent ? checkStaleChildFiles : checkStaleRootFiles) || fileInfo->id >= 8) { return 0; }
+    sprintf(filenames[parent][fileInfo->id], parent ? "CHILD%03d.DAT" : "ROOT%03d.DAT", fileInfo->id);
+    fileInfo->filename = filenames[parent][fileInfo->id];
+    fileInfo->attributes = VIRTUALDISK_ATTRIB_ARCHIVE;
+    fileInfo->size = 700;
+    fileInfo->created = fileInfo->modified = fileInfo->accessed = VIRTUALDISK_DATETIME(2013, 6, 1, 12, 0, 0);
+    fileInfo->contents = CheckFileContents;
+    fileInfo->reference = NULL;
+    if (!parent && fileInfo->id == 0)
+    {
+        fileInfo->filename = "SUBDIR";
+        fileInfo->attributes = VIRTUALDISK_ATTRIB_DIRECTORY;
+        fileInfo->size = 0;
+        fileInfo->directory = 1;
+        fileInfo->contents = NULL;
+    }
+    return 1;
+}
+
+// Check a saved index with sub-directories is mapped while the file set is unchanged, but not once a file is appended to the root directory, or to the sub-directory (so it is rebuilt, and the rebuilt index is mapped)
+static int CheckStaleIndex(void)
+{
+    static virtualdisk_index_entry_t entries[16];
+    virtualdisk_index_t index = { entries, 16, 0, 0 };
+    virtualdisk_index_file_t mapped;
+    virtualdisk_t disk;
+    virtualdisk_partition_t partition;
+    const char *filename = "check-index.bin";
+    int problems = 0, step;
+
+    VirtualDiskInit(&disk, CHECK_SECTOR_SIZE);
+    VirtualDiskAddPartition(&disk, &partition, CheckStaleFileInfo, 1, 100, 16);
+    for (step = 0; step < 3; step++)
+    {
+        if (!VirtualDiskPartitionBuildIndex(&partition, &index) || !VirtualDiskIndexSave(filename, &partition, &index, 1)) { problems++; break; }
+        if (!VirtualDiskIndexMap(&mapped, filename, &partition, 1, 0) || mapped.index.count != index.count) { problems++; }
+        VirtualDiskIndexUnmap(&mapped);
+
+        // Append a file (to the root directory, then the sub-directory): the saved index is stale
+        if (step == 0) { checkStaleRootFiles++; }
+        else if (step == 1) { checkStaleChildFiles++; }
+        else { break; }
+        if (VirtualDiskIndexMap(&mapped, filename, &partition, 1, 0)) { problems++; VirtualDiskIndexUnmap(&mapped); }
+    }
+    checkStaleRootFiles = 2;
+    checkStaleChildFiles = 3;
+    remove(filename);
+
+    printf("[Check: stale index, %lu entries%s]\n", index.count, problems ? ", FAILED" : "");
+    return problems;
+}
+
+
+// Parallel index check file set: enough root files for several chunks of a parallel build, some with long names, a sub-directory first, and on exFAT a last file of 1 TiB (which cannot be represented, so ends the directory)
+#define CHECK_PARALLEL_FILES 9000
+static char checkParallelExFat = 0;
+static char CheckParallelFileInfo(virtualdisk_fileinfo_t *fileInfo)
+{
+    static char filenames[CHECK_PARALLEL_FILES][40];
+    static char childFilenames[2][40];
+    char *filename;
+
+    if (fileInfo->parent == 1)
+    {
+        if (fileInfo->id < 0 || fileInfo->id >= 2) { return 0; }
+        filename = childFilenames[fileInfo->id];
+        sprintf(filename, "Parallel check child %d.dat", fileInfo->id);
+    }
+    else
+    {
+        if (fileInfo->parent != VIRTUALDISK_ROOT_DIRECTORY || fileInfo->id < 0 || fileInfo->id >= CHECK_PARALLEL_FILES) { return 0; }
+        filename = filenames[fileInfo->id];
+        if (fileInfo->id % 3 == 0) { sprintf(filename, "Parallel index check file %d.dat", fileInfo->id); }
+        else { sprintf(filename, "P%05d.DAT", fileInfo->id); }
+    }
+    fileInfo->filename = filename;
+    fileInfo->attributes = VIRTUALDISK_ATTRIB_ARCHIVE;
+    fileInfo->size = 300ul * (fileInfo->id % 7);
+    fileInfo->sizeHigh = (checkParallelExFat && fileInfo->parent == VIRTUALDISK_ROOT_DIRECTORY && fileInfo->id == CHECK_PARALLEL_FILES - 1) ? 0x100 : 0;
+    fileInfo->created = fileInfo->modified = fileInfo->accessed = VIRTUALDISK_DATETIME(2013, 6, 1, 12, 0, 0);
+    fileInfo->contents = CheckFileContents;
+    fileInfo->reference = NULL;
+    if (fileInfo->parent == VIRTUALDISK_ROOT_DIRECTORY && fileInfo->id == 0)
+    {
+        fileInfo->attributes = VIRTUALDISK_ATTRIB_DIRECTORY;
+        fileInfo->size = 0;
+        fileInfo->directory = 1;
+        fileInfo->contents = NULL;
+    }
+    return 1;
+}
+
+// Check an index built in parallel is the index built with one thread (and serially), for FAT and exFAT: the same entries, and the same disk contents read through each
+static int CheckParallelIndex(void)
+{
+    static virtualdisk_index_entry_t entries[3][CHECK_PARALLEL_FILES + 8];
+    virtualdisk_index_t indexes[3];
+    virtualdisk_t disks[3];
+    virtualdisk_partition_t partitions[3];
+    unsigned char sector[2][CHECK_SECTOR_SIZE];
+    unsigned long s, sectorCount = 0;
+    int problems = 0, i;
+
+    for (checkParallelExFat = 0; checkParallelExFat <= 1; checkParallelExFat++)
+    {
+        for (i = 0; i < 3; i++)
+        {
+            indexes[i].entries = entries[i];
+            indexes[i].capacity = CHECK_PARALLEL_FILES + 8;
+            indexes[i].count = 0;
+            indexes[i].complete = 0;
+            VirtualDiskInit(&disks[i], CHECK_SECTOR_SIZE);
+            if (checkParallelExFat) { VirtualDiskAddExFatPartition(&disks[i], &partitions[i], CheckParallelFileInfo, 1, 60000, 16); }
+            else { VirtualDiskAddPartition(&disks[i], &partitions[i], CheckParallelFileInfo, 1, 60000, 16); }
+        }
+        if (!VirtualDiskPartitionBuildIndex(&partitions[0], &indexes[0])) { problems++; }
+        if (!VirtualDiskIndexBuildParallel(&partitions[1], &indexes[1], 1)) { problems++; }
+        if (!VirtualDiskIndexBuildParallel(&partitions[2], &indexes[2], 4)) { problems++; }
+        if (indexes[0].count != CHECK_PARALLEL_FILES + 2 - checkParallelExFat) { problems++; }
+        for (i = 1; i < 3; i++)
+        {
+            if (indexes[i].count != indexes[0].count || memcmp(entries[i], entries[0], indexes[0].count * sizeof(virtualdisk_index_entry_t)) != 0) { problems++; }
+        }
+
+        // Every sector of the disk using the one-thread index matches the disk using the parallel index
+        for (i = 0; i < 3; i++) { VirtualDiskPartitionSetIndex(&partitions[i], &indexes[i]); }
+        sectorCount = VirtualDiskSectorCount(&disks[1]);
+        if (VirtualDiskSectorCount(&disks[2]) != sectorCount) { problems++; }
+        for (s = 0; s < sectorCount; s++)
+        {
+            if (VirtualDiskReadSectors(&disks[1], s, 1, sector[0]) != 1 || VirtualDiskReadSectors(&disks[2], s, 1, sector[1]) != 1 || memcmp(sector[0], sector[1], CHECK_SECTOR_SIZE) != 0) { problems++; break; }
+        }
+        for (i = 0; i < 3; i++) { VirtualDiskPartitionSetIndex(&partitions[i], NULL); }
+    }
+    checkParallelExFat = 0;
+
+    printf("[Check: parallel index, %d files%s]\n", CHECK_PARALLEL_FILES, problems ? ", FAILED" : "");
+    return problems;
+}
+
+
+// Lazy index check file set: root files (a lazily filled index covers only the root directory), all long names with the same base name (so the short names' tails from their ids are the lowest free tails a built index gives)
+#define CHECK_LAZY_FILES 600
+static char CheckLazyFileInfo(virtualdisk_fileinfo_t *fileInfo)
+{
+    static char filenames[CHECK_LAZY_FILES][40];
+
+    if (fileInfo->parent != VIRTUALDISK_ROOT_DIRECTORY || fileInfo->id < 0 || fileInfo->id >= CHECK_LAZY_FILES) { return 0; }
+    sprintf(filenames[fileInfo->id], "Lazy index check file %d.dat", fileInfo->id);
+    fileInfo->filename = filenames[fileInfo->id];
+    fileInfo->attributes = VIRTUALDISK_ATTRIB_ARCHIVE;
+    fileInfo->size = 300ul * (fileInfo->id % 7);
+    fileInfo->created = fileInfo->modified = fileInfo->accessed = VIRTUALDISK_DATETIME(2013, 6, 1, 12, 0, 0);
+    fileInfo->contents = CheckFileContents;
+    fileInfo->reference = NULL;
+    return 1;
+}
+
+// Check a lazily filled index: the root directory and FAT regions read while the index is empty (backwards, so the first read is past every file) match a disk with an index built up front, the filled index is complete and the same as the built one, and then every sector still matches
+static int CheckLazyIndex(void)
+{
+    static virtualdisk_index_entry_t entries[2][CHECK_LAZY_FILES + 8];
+    virtualdisk_index_t eagerIndex = { entries[0], CHECK_LAZY_FILES + 8, 0, 0 }, lazyIndex = { entries[1], CHECK_LAZY_FILES + 8, 0, 0 };
+    virtualdisk_t eager, lazy;
+    virtualdisk_partition_t eagerPartition, lazyPartition;
+    unsigned char sector[2][CHECK_SECTOR_SIZE];
+    unsigned long s, first, sectorCount;
+    int problems = 0;
+
+    VirtualDiskInit(&eager, CHECK_SECTOR_SIZE);
+    VirtualDiskInit(&lazy, CHECK_SECTOR_SIZE);
+    if (!VirtualDiskAddPartition(&eager, &eagerPartition, CheckLazyFileInfo, 1, 2000, 4096) || !VirtualDiskAddPartition(&lazy, &lazyPartition, CheckLazyFileInfo, 1, 2000, 4096)) { printf("[Check: lazy index, problem adding partition]\n"); return 1; }
+    if (!VirtualDiskPartitionBuildIndex(&eagerPartition, &eagerIndex)) { problems++; }
+    VirtualDiskPartitionSetIndex(&eagerPartition, &eagerIndex);
+    VirtualDiskPartitionSetIndex(&lazyPartition, &lazyIndex);
+
+    // Before filling: the root directory, then the FAT, each from its last sector
+    first = lazyPartition.partitionStartSector + lazyPartition.sectorsReserved;
+    for (s = lazyPartition.partitionStartSector + lazyPartition.regionData; s-- > first; )
+    {
+        if (VirtualDiskReadSectors(&lazy, s, 1, sector[0]) != 1 || VirtualDiskReadSectors(&eager, s, 1, sector[1]) != 1 || memcmp(sector[0], sector[1], CHECK_SECTOR_SIZE) != 0) { problems++; break; }
+    }
+
+    // Filled: the same as the index built up front
+    if (!lazyIndex.complete || lazyIndex.count != eagerIndex.count || lazyIndex.count != CHECK_LAZY_FILES || memcmp(entries[1], entries[0], eagerIndex.count * sizeof(virtualdisk_index_entry_t)) != 0) { problems++; }
+
+    // After filling: every sector
+    sectorCount = VirtualDiskSectorCount(&lazy);
+    for (s = 0; s < sectorCount; s++)
+    {
+        if (VirtualDiskReadSectors(&lazy, s, 1, sector[0]) != 1 || VirtualDiskReadSectors(&eager, s, 1, sector[1]) != 1 || memcmp(sector[0], sector[1], CHECK_SECTOR_SIZE) != 0) { problems++; break; }
+    }
+    VirtualDiskPartitionSetIndex(&eagerPartition, NULL);
+    VirtualDiskPartitionSetIndex(&lazyPartition, NULL);
+
+    printf("[Check: lazy index, %lu files%s]\n", lazyIndex.count, problems ? ", FAILED" : "");
+    return problems;
+}
+
+
+// Short name check file set: an existing 8.3 name of the generated form, then long names that all have the same base name (so their tails collide, past ~9)
+#define CHECK_SHORT_FILES 13
+static char CheckShortFileInfo(virtualdisk_fileinfo_t *fileInfo)
+{
+    static char filenames[CHECK_SHORT_FILES][32];
+
+    if (fileInfo->parent != VIRTUALDISK_ROOT_DIRECTORY || fileInfo->id < 0 || fileInfo->id >= CHECK_SHORT_FILES) { return 0; }
+    if (fileInfo->id == 0) { strcpy(filenames[0], "LONGNA~3.TXT"); }
+    else { sprintf(filenames[fileInfo->id], "Long name %d.txt", fileInfo->id); }
+    fileInfo->filename = filenames[fileInfo->id];
+    fileInfo->attributes = VIRTUALDISK_ATTRIB_ARCHIVE;
+    fileInfo->size = 100ul * (fileInfo->id + 1);
+    fileInfo->created = fileInfo->modified = fileInfo->accessed = VIRTUALDISK_DATETIME(2013, 6, 1, 12, 0, 0);
+    fileInfo->contents = CheckFileContents;
+    fileInfo->reference = NULL;
+    return 1;
+}
+
+// Check a built index gives colliding long names distinct short names: the root directory's short entries are the existing name, then the lowest free tails in order (skipping the existing ~3, and shortening the base name from ~10), and FatFs finds each file by its long name
+static int CheckShortNames(void)
+{
+    static virtualdisk_index_entry_t entries[CHECK_SHORT_FILES + 8];
+    virtualdisk_index_t index = { entries, CHECK_SHORT_FILES + 8, 0, 0 };
+    virtualdisk_t disk;
+    virtualdisk_partition_t partition;
+    FATFS shortFs;
+    FILINFO fno = {0};
+    unsigned char sector[CHECK_SECTOR_SIZE], names[CHECK_SHORT_FILES][11];
+    char expected[32], filename[32];
+    unsigned long s, tail;
+    int problems = 0, count = 0, i, j;
+
+    VirtualDiskInit(&disk, CHECK_SECTOR_SIZE);
+    if (!VirtualDiskAddPartition(&disk, &partition, CheckShortFileInfo, 1, 100, 64)) { printf("[Check: short names, problem adding partition]\n"); return 1; }
+    if (!VirtualDiskPartitionBuildIndex(&partition, &index)) { problems++; }
+    VirtualDiskPartitionSetIndex(&partition, &index);
+
+    // The short entries of the root directory (skipping long filename entries)
+    for (s = partition.sectorsReserved + partition.numFat * partition.sectorsFat0; s < partition.regionData; s++)
+    {
+        if (VirtualDiskReadSectors(&disk, partition.partitionStartSector + s, 1, sector) != 1) { problems++; break; }
+        for (i = 0; i < CHECK_SECTOR_SIZE; i += 32)
+        {
+            if (sector[i] == 0x00 || sector[i + 11] == 0x0f) { continue; }
+            if (count < CHECK_SHORT_FILES) { memcpy(names[count], sector + i, 11); }
+            count++;
+        }
+    }
+    if (count != CHECK_SHORT_FILES) { problems++; }
+
+    // The existing name, then ~1, ~2, ~4, ... ~13
+    for (i = 0, tail = 0; i < CHECK_SHORT_FILES && i < count; i++)
+    {
+        if (i == 0) { strcpy(expected, "LONGNA~3TXT"); }
+        else
+        {
+            if (++tail == 3) { tail++; }
+            if (tail < 10) { sprintf(expected, "LONGNA~%luTXT", tail); }
+            else { sprintf(expected, "LONGN~%luTXT", tail); }
+        }
+        if (memcmp(names[i], expected, 11) != 0) { problems++; }
+        for (j = 0; j < i; j++) { if (memcmp(names[i], names[j], 11) == 0) { problems++; } }
+    }
+
+    // Every file by its long name
+    VirtualDiskIOSet(0, &disk);
+    if (f_mount(0, &shortFs) != FR_OK) { problems++; }
+    else
+    {
+        for (i = 1; i < CHECK_SHORT_FILES; i++)
+        {
+            sprintf(filename, "Long name %d.txt", i);
+            if (f_stat(filename, &fno) != FR_OK || fno.fsize != 100ul * (i + 1)) { problems++; }
+        }
+        f_mount(0, NULL);
+    }
+    VirtualDiskPartitionSetIndex(&partition, NULL);
+
+    printf("[Check: short names, %d files%s]\n", count, problems ? ", FAILED" : "");
+    return problems;
+}
+
+
+// FAT32 root chain check file set: a volume label, then files with long names (each taking long filename entries as well as its short entry)
+#define CHECK_ROOT_FILES 5
+static char CheckRootFileInfo(virtualdisk_fileinfo_t *fileInfo)
+{
+    static char filenames[CHECK_ROOT_FILES + 1][32];
+
+    if (fileInfo->parent != VIRTUALDISK_ROOT_DIRECTORY || fileInfo->id < 0 || fileInfo->id > CHECK_ROOT_FILES) { return 0; }
+    if (fileInfo->id == 0) { strcpy(filenames[0], "ROOTCHAIN"); }
+    else { sprintf(filenames[fileInfo->id], "Root chain check file %d.dat", fileInfo->id); }
+    fileInfo->filename = filenames[fileInfo->id];
+    fileInfo->attributes = (fileInfo->id == 0) ? VIRTUALDISK_ATTRIB_VOLUME : VIRTUALDISK_ATTRIB_ARCHIVE;
+    fileInfo->size = (fileInfo->id == 0) ? 0 : 700ul * fileInfo->id;
+    fileInfo->created = fileInfo->modified = fileInfo->accessed = VIRTUALDISK_DATETIME(2013, 6, 1, 12, 0, 0);
+    fileInfo->contents = CheckFileContents;
+    fileInfo->reference = NULL;
+    return 1;
+}
+
+// Check the FAT32 root directory's cluster chain is sized to its entries (the volume label, and each file's long filename and short entries), up to the maximum number of root entries, and every file is found through it
+static int CheckRootChain(void)
+{
+    virtualdisk_t disk;
+    virtualdisk_partition_t partition;
+    FATFS rootFs;
+    FILINFO fno = {0};
+    char filename[32];
+    unsigned long entries = 1 + CHECK_ROOT_FILES * (1 + 3), perCluster = CHECK_SECTOR_SIZE / 32;     // (names of 27 characters need 3 long filename entries of 13)
+    int problems = 0, i;
+
+    VirtualDiskInit(&disk, CHECK_SECTOR_SIZE);
+    if (!VirtualDiskAddPartition(&disk, &partition, CheckRootFileInfo, 1, 66000, perCluster)) { printf("[Check: root chain, problem adding partition]\n"); return 1; }
+    if (partition.fatType != VIRTUALDISK_FAT32 || partition.rootDirClusters != 1) { problems++; }      // Capped at the maximum number of root entries
+
+    VirtualDiskInit(&disk, CHECK_SECTOR_SIZE);
+    if (!VirtualDiskAddPartition(&disk, &partition, CheckRootFileInfo, 1, 66000, 4096)) { printf("[Check: root chain, problem adding partition]\n"); return 1; }
+    if (partition.rootDirClusters != (entries + perCluster - 1) / perCluster) { problems++; }
+    VirtualDiskIOSet(0, &disk);
+    if (f_mount(0, &rootFs) != FR_OK) { problems++; }
+    else
+    {
+        for (i = 1; i <= CHECK_ROOT_FILES; i++)
+        {
+            sprintf(filename, "Root chain check file %d.dat", i);
+            if (f_stat(filename, &fno) != FR_OK || fno.fsize != 700ul * i) { problems++; }
+        }
+        f_mount(0, NULL);
+    }
+
+    printf("[Check: root chain, %lu entries in %lu clusters%s]\n", entries, partition.rootDirClusters, problems ? ", FAILED" : "");
+    return problems;
+}
+
+
+// Live file check file set: two files with reserved capacity (whose sizes, and so contents, can change) between fixed-size files
+static unsigned long checkLiveSizes[4];
+static char CheckLiveFileInfo(virtualdisk_fileinfo_t *fileInfo)
+{
+    static char filenames[4][13];
+
+    if (fileInfo->parent != VIRTUALDISK_ROOT_DIRECTORY || fileInfo->id < 0 || fileInfo->id >= 4) { return 0; }
+    sprintf(filenames[fileInfo->id], "LIVE%d.DAT", fileInfo->id);
+    fileInfo->filename = filenames[fileInfo->id];
+    fileInfo->attributes = VIRTUALDISK_ATTRIB_ARCHIVE;
+    fileInfo->size = checkLiveSizes[fileInfo->id];
+    fileInfo->maxSize = (fileInfo->id == 1 || fileInfo->id == 2) ? 8ul * CHECK_SECTOR_SIZE : 0;
+    fileInfo->created = fileInfo->modified = fileInfo->accessed = VIRTUALDISK_DATETIME(2013, 6, 1, 12, 0, 0);
+    fileInfo->contents = CheckFileContents;
+    fileInfo->reference = NULL;
+    return 1;
+}
+
+// Check a live file update (without and with an index): after a file's size and contents change, the disk is the same as one built with the new file (directory entry, FAT chain and data), FatFs reads the new file back, only the reported ranges change outside the file's data, and a cached generator for another file is not left referring to the moved file enumerator
+static int CheckLiveUpdate(void)
+{
+    static virtualdisk_index_entry_t entries[16];
+    virtualdisk_index_t index = { entries, 16, 0, 0 };
+    virtualdisk_t disk, reference;
+    virtualdisk_partition_t partition, referencePartition;
+    virtualdisk_sector_range_t ranges[4];
+    virtualdisk_fileinfo_t fileInfo;
+    unsigned char sector[CHECK_SECTOR_SIZE], expected[CHECK_SECTOR_SIZE];
+    FATFS liveFs;
+    FIL fp;
+    FILINFO fno = {0};
+    UINT length;
+    unsigned long sectorCount, fileSector, s, i;
+    int problems = 0, indexed, numRanges, r;
+
+    for (indexed = 0; indexed < 2; indexed++)
+    {
+        checkLiveSizes[0] = 700; checkLiveSizes[1] = 1000; checkLiveSizes[2] = 1000; checkLiveSizes[3] = 700;
+        VirtualDiskInit(&disk, CHECK_SECTOR_SIZE);
+        if (!VirtualDiskAddPartition(&disk, &partition, CheckLiveFileInfo, 1, 100, 16)) { printf("[Check: live update, problem adding partition]\n"); return 1; }
+        if (indexed) { VirtualDiskPartitionBuildIndex(&partition, &index); VirtualDiskPartitionSetIndex(&partition, &index); }
+        sectorCount = VirtualDiskSectorCount(&disk);
+        if (sectorCount > CHECK_MAX_SECTORS) { printf("[Check: live update, disk too large]\n"); return 1; }
+        CheckReadImage(&disk, checkImage[0]);
+        for (fileSector = 0; fileSector < sectorCount && memcmp(checkImage[0] + fileSector * CHECK_SECTOR_SIZE, "[1:", 3) != 0; fileSector++) { }
+
+        // Read the other live file's data (caching its generator), then grow the file after it
+        if (VirtualDiskReadSectors(&disk, fileSector, 1, sector) != 1) { problems++; }
+        checkLiveSizes[2] = 3000;
+        numRanges = VirtualDiskPartitionUpdateFile(&partition, VIRTUALDISK_ROOT_DIRECTORY, 2, ranges, 4);
+        if (numRanges != 1 + partition.numFat) { problems++; }
+        if (VirtualDiskReadSectors(&disk, fileSector, 1, sector) != 1 || memcmp(sector, checkImage[0] + fileSector * CHECK_SECTOR_SIZE, CHECK_SECTOR_SIZE) != 0) { problems++; }
+
+        // The same as a disk built with the new file, and the only changes outside the file's data are in the reported ranges
+        CheckReadImage(&disk, checkImage[1]);
+        VirtualDiskInit(&reference, CHECK_SECTOR_SIZE);
+        VirtualDiskAddPartition(&reference, &referencePartition, CheckLiveFileInfo, 1, 100, 16);
+        for (s = 0; s < sectorCount; s++)
+        {
+            if (VirtualDiskReadSectors(&reference, s, 1, sector) != 1 || memcmp(sector, checkImage[1] + s * CHECK_SECTOR_SIZE, CHECK_SECTOR_SIZE) != 0) { problems++; break; }
+            if (memcmp(checkImage[0] + s * CHECK_SECTOR_SIZE, checkImage[1] + s * CHECK_SECTOR_SIZE, CHECK_SECTOR_SIZE) == 0 || memcmp(checkImage[1] + s * CHECK_SECTOR_SIZE, "[2:", 3) == 0) { continue; }
+            for (r = 0; r < numRanges && (s < ranges[r].firstSector || s >= ranges[r].firstSector + ranges[r].count); r++) { }
+            if (r >= numRanges) { problems++; break; }
+        }
+
+        // Read back through FatFs
+        VirtualDiskIOSet(0, &disk);
+        memset(&fileInfo, 0, sizeof(fileInfo));
+        fileInfo.parent = VIRTUALDISK_ROOT_DIRECTORY;
+        fileInfo.id = 2;
+        CheckLiveFileInfo(&fileInfo);
+        if (f_mount(0, &liveFs) != FR_OK || f_stat("LIVE2.DAT", &fno) != FR_OK || fno.fsize != 3000 || f_open(&fp, "LIVE2.DAT", FA_READ) != FR_OK) { problems++; }
+        else
+        {
+            for (i = 0; i * CHECK_SECTOR_SIZE < 3000; i++)
+            {
+                memset(sector, 0, sizeof(sector));
+                CheckFileContents(&fileInfo, i, 1, expected);
+                if (f_read(&fp, sector, CHECK_SECTOR_SIZE, &length) != FR_OK || memcmp(sector, expected, length) != 0 || length != ((3000 - i * CHECK_SECTOR_SIZE < CHECK_SECTOR_SIZE) ? 3000 - i * CHECK_SECTOR_SIZE : CHECK_SECTOR_SIZE)) { problems++; break; }
+            }
+            f_close(&fp);
+        }
+        f_mount(0, NULL);
+        VirtualDiskPartitionSetIndex(&partition, NULL);
+    }
+
+    printf("[Check: live update%s]\n", problems ? ", FAILED" : "");
+    return problems;
+}
+
+
+// exFAT check file set: long names (several file name entries each), then a file of 1 TiB, which cannot be represented so must end the directory
+#define CHECK_EXFAT_FILES 4
+static char CheckExFatFileInfo(virtualdisk_fileinfo_t *fileInfo)
+{
+    static char filenames[CHECK_EXFAT_FILES + 1][64];
+
+    if (fileInfo->parent != VIRTUALDISK_ROOT_DIRECTORY || fileInfo->id < 0 || fileInfo->id > CHECK_EXFAT_FILES) { return 0; }
+    sprintf(filenames[fileInfo->id], "exFAT check file number %d, with a long name.dat", fileInfo->id);
+    fileInfo->filename = filenames[fileInfo->id];
+    fileInfo->attributes = VIRTUALDISK_ATTRIB_ARCHIVE;
+    fileInfo->size = 700ul * (fileInfo->id + 1);
+    fileInfo->sizeHigh = (fileInfo->id == CHECK_EXFAT_FILES) ? 0x100 : 0;
+    fileInfo->created = fileInfo->modified = fileInfo->accessed = VIRTUALDISK_DATETIME(2013, 6, 1, 12, 0, 0);
+    fileInfo->contents = CheckFileContents;
+    fileInfo->reference = NULL;
+    return 1;
+}
+
+// exFAT checksum step (16- or 32-bit rotate right and add, as used for the boot region, up-case table, entry sets and name hashes)
+static unsigned long CheckExFatSum(unsigned long sum, unsigned char value, int bits)
+{
+    unsigned long top = (bits == 16) ? 0xfffful : 0xfffffffful;
+    return (((sum & 1) ? ((top >> 1) + 1) : 0) + (sum >> 1) + value) & top;
+}
+
+// Check an exFAT volume independently of the generator (FatFs R0.09b cannot mount exFAT): the boot region checksum, the up-case table checksum, and each file's entry set checksum, name hash, name and first sector of contents
+static int CheckExFat(void)
+{
+    static unsigned char root[4 * CHECK_SECTOR_SIZE];
+    static unsigned short upcase[256];
+    virtualdisk_t disk;
+    virtualdisk_partition_t partition;
+    unsigned char sector[CHECK_SECTOR_SIZE];
+    unsigned long start, fatOffset, heapOffset, rootCluster, cluster, sum, i, j;
+    unsigned int spc, rootLength = 0;
+    int problems = 0, files = 0;
+
+    VirtualDiskInit(&disk, CHECK_SECTOR_SIZE);
+    if (!VirtualDiskAddExFatPartition(&disk, &partition, CheckExFatFileInfo, 1, 3000, 16)) { printf("[Check: exFAT, problem adding partition]\n"); return 1; }
+    VirtualDiskReadSectors(&disk, 0, 1, sector);
+    start = CHECK_GET_DWORD(sector + 0x1be + 8);
+
+    // Boot region checksum (sectors 0-10, except the volume flags and percent in use), repeated through sector 11
+    for (sum = 0, i = 0; i < 11; i++)
+    {
+        VirtualDiskReadSectors(&disk, start + i, 1, sector);
+        if (i == 0)
+        {
+            if (memcmp(sector + 3, "EXFAT   ", 8) != 0) { problems++; }
+            fatOffset = CHECK_GET_DWORD(sector + 80);
+            heapOffset = CHECK_GET_DWORD(sector + 88);
+            rootCluster = CHECK_GET_DWORD(sector + 96);
+            spc = 1u << sector[109];
+        }
+        for (j = 0; j < CHECK_SECTOR_SIZE; j++)
+        {
+            if (i == 0 && (j == 106 || j == 107 || j == 112)) { continue; }
+            sum = CheckExFatSum(sum, sector[j], 32);
+        }
+    }
+    VirtualDiskReadSectors(&disk, start + 11, 1, sector);
+    for (j = 0; j < CHECK_SECTOR_SIZE; j += 4) { if (CHECK_GET_DWORD(sector + j) != sum) { problems++; break; } }
+
+    // Root directory, following its FAT chain
+    for (cluster = rootCluster; cluster >= 2 && cluster < 0xfffffff7ul && rootLength < sizeof(root); cluster = CHECK_GET_DWORD(sector + (cluster * 4) % CHECK_SECTOR_SIZE))
+    {
+        for (i = 0; i < spc && rootLength < sizeof(root); i++, rootLength += CHECK_SECTOR_SIZE) { VirtualDiskReadSectors(&disk, start + heapOffset + (cluster - 2) * spc + i, 1, root + rootLength); }
+        VirtualDiskReadSectors(&disk, start + fatOffset + cluster * 4 / CHECK_SECTOR_SIZE, 1, sector);
+    }
+
+    // Up-case table: checksum of the whole table, and its mapping of the first 256 characters (for the name hashes)
+    for (i = 0; i < 256; i++) { upcase[i] = (unsigned short)i; }
+    for (i = 0; i < rootLength && root[i] != 0x00; i += 32)
+    {
+        if (root[i] == 0x82)
+        {
+            unsigned long first = CHECK_GET_DWORD(root + i + 20), length = CHECK_GET_DWORD(root + i + 24), c = 0, skip = 0;
+            unsigned short previous = 0;
+            for (sum = 0, j = 0; j < length; j++)
+            {
+                if (j % CHECK_SECTOR_SIZE == 0) { VirtualDiskReadSectors(&disk, start + heapOffset + (first - 2) * spc + j / CHECK_SECTOR_SIZE, 1, sector); }
+                sum = CheckExFatSum(sum, sector[j % CHECK_SECTOR_SIZE], 32);
+                if (j & 1)
+                {
+                    unsigned short value = (unsigned short)(previous | (sector[j % CHECK_SECTOR_SIZE] << 8));
+                    if (skip) { c += value; skip = 0; }
+                    else if (value == 0xffff) { skip = 1; }
+                    else { if (c < 256) { upcase[c] = value; } c++; }
+                }
+                else { previous = sector[j % CHECK_SECTOR_SIZE]; }
+            }
+            if (sum != CHECK_GET_DWORD(root + i + 4)) { problems++; }
+        }
+    }
+
+    // File entry sets
+    for (i = 0; i < rootLength && root[i] != 0x00; i += 32)
+    {
+        virtualdisk_fileinfo_t fileInfo;
+        char expected[CHECK_SECTOR_SIZE];
+        unsigned char *stream = root + i + 32;
+        unsigned long count = root[i + 1], nameLength, hash, first;
+        char name[256];
+
+        if (root[i] != 0x85) { continue; }
+        if (i + (count + 1) * 32 > rootLength || stream[0] != 0xc0) { problems++; break; }
+        for (sum = 0, j = 0; j < (count + 1) * 32; j++) { if (j != 2 && j != 3) { sum = CheckExFatSum(sum, root[i + j], 16); } }
+        if (sum != CHECK_GET_WORD(root + i + 2)) { problems++; }
+
+        // Name (Latin-1, so each character is its code unit's low byte) and its hash of the up-cased code units
+        nameLength = stream[3];
+        for (hash = 0, j = 0; j < nameLength; j++)
+        {
+            unsigned short c = CHECK_GET_WORD(root + i + 64 + (j / 15) * 32 + 2 + (j % 15) * 2);
+            unsigned short u = (c < 256) ? upcase[c] : c;
+            name[j] = (char)c;
+            hash = CheckExFatSum(CheckExFatSum(hash, (unsigned char)u, 16), (unsigned char)(u >> 8), 16);
+        }
+        name[j] = '\0';
+        if (hash != CHECK_GET_WORD(stream + 4)) { problems++; }
+
+        // The file information and contents it should have
+        fileInfo.id = files++;
+        fileInfo.parent = VIRTUALDISK_ROOT_DIRECTORY;
+        fileInfo.sizeHigh = 0;
+        if (!CheckExFatFileInfo(&fileInfo) || fileInfo.sizeHigh != 0 || strcmp(name, fileInfo.filename) != 0 || CHECK_GET_DWORD(stream + 24) != fileInfo.size) { problems++; }
+        else
+        {
+            first = CHECK_GET_DWORD(stream + 20);
+            VirtualDiskReadSectors(&disk, start + heapOffset + (first - 2) * spc, 1, sector);
+            CheckFileContents(&fileInfo, 0, 1, (unsigned char *)expected);
+            if (memcmp(sector, expected, CHECK_SECTOR_SIZE) != 0) { problems++; }
+        }
+        i += count * 32;
+    }
+    if (files != CHECK_EXFAT_FILES) { problems++; }
+
+    printf("[Check: exFAT, %d files%s]\n", files, problems ? ", FAILED" : "");
+    return problems;
+}
+
+
+// Split check source: each sector holds its sector number
+static unsigned short CheckSplitSource(void *reference, unsigned long sector, unsigned short count, unsigned char *buffer)
+{
+    unsigned short i;
+    for (i = 0; i < count; i++)
+    {
+        memset(buffer + (size_t)i * CHECK_SECTOR_SIZE, 0, CHECK_SECTOR_SIZE);
+        sprintf((char *)buffer + (size_t)i * CHECK_SECTOR_SIZE, "[%lu]", sector + i);
+    }
+    return count;
+}
+
+// Split check source, part of a sector
+static unsigned short CheckSplitSourcePartial(void *reference, unsigned long sector, unsigned short offset, unsigned short length, unsigned char *buffer)
+{
+    unsigned char whole[CHECK_SECTOR_SIZE];
+    CheckSplitSource(reference, sector, 1, whole);
+    memcpy(buffer, whole + offset, length);
+    return length;
+}
+
+// Split check file set: the parts of the split source
+static virtualdisk_split_t checkSplit;
+static char CheckSplitFileInfo(virtualdisk_fileinfo_t *fileInfo)
+{
+    if (fileInfo->parent != VIRTUALDISK_ROOT_DIRECTORY || fileInfo->id < 0) { return 0; }
+    if (!VirtualDiskSplitFileInfo(&checkSplit, (unsigned long)fileInfo->id, fileInfo)) { return 0; }
+    fileInfo->created = fileInfo->modified = fileInfo->accessed = VIRTUALDISK_DATETIME(2013, 6, 1, 12, 0, 0);
+    return 1;
+}
+
+// Read a sector of a file through FatFs, and compare it with the split source's sector
+static int CheckSplitRead(const char *filename, unsigned long offset, unsigned long sourceSector)
+{
+    FIL fp;
+    UINT length = 0;
+    unsigned char buffer[CHECK_SECTOR_SIZE], expected[CHECK_SECTOR_SIZE];
+    int problems = 0;
+
+    if (f_open(&fp, filename, FA_READ) != FR_OK) { return 1; }
+    CheckSplitSource(NULL, sourceSector, 1, expected);
+    if (f_lseek(&fp, offset) != FR_OK || f_read(&fp, buffer, sizeof(buffer), &length) != FR_OK) { problems++; }
+    else if (length == 0 || memcmp(buffer, expected, length) != 0) { problems++; }
+    f_close(&fp);
+    return problems;
+}
+
+// Check a source of just over 4 GiB split into two parts, read back through FatFs: the parts' names and sizes add up to the source, and the sectors either side of the join and at the very end are the source's
+static int CheckSplit(void)
+{
+    static virtualdisk_split_part_t parts[4];
+    virtualdisk_t disk;
+    virtualdisk_partition_t partition;
+    FATFS splitFs;
+    FILINFO fno = {0};
+    virtualdisk_fileinfo_t fileInfo;
+    unsigned char piece[20], expected[CHECK_SECTOR_SIZE];
+    unsigned long sourceSize = 1000, lastSectors;
+    int problems = 0;
+
+    if (!VirtualDiskSplitInit(&checkSplit, parts, 4, "SPLIT", sourceSize, 1, CHECK_SECTOR_SIZE, 64, CheckSplitSource, NULL) || checkSplit.numParts != 2) { printf("[Check: split, problem dividing the source]\n"); return 1; }
+    if (strcmp(parts[0].filename, "SPLIT.001") != 0 || strcmp(parts[1].filename, "SPLIT.002") != 0) { problems++; }
+    if (((parts[0].size + parts[1].size) & 0xfffffffful) != sourceSize || parts[0].size < parts[1].size) { problems++; }      // (adds up to 4 GiB + 1000 bytes, so the low 32 bits are 1000)
+    if (parts[1].firstSector != parts[0].numSectors || parts[0].size % (64ul * CHECK_SECTOR_SIZE) != 0) { problems++; }
+    lastSectors = parts[1].numSectors;
+
+    // Part of a sector of a part, through the source's partial generator, and blank beyond the part
+    checkSplit.partial = CheckSplitSourcePartial;
+    memset(&fileInfo, 0, sizeof(fileInfo));
+    fileInfo.id = 1;
+    CheckSplitFileInfo(&fileInfo);
+    CheckSplitSource(NULL, parts[1].firstSector + lastSectors - 1, 1, expected);
+    if (fileInfo.partial == NULL || fileInfo.partial(&fileInfo, lastSectors - 1, 1, sizeof(piece), piece) != sizeof(piece) || memcmp(piece, expected + 1, sizeof(piece)) != 0) { problems++; }
+    memset(expected, 0, sizeof(piece));
+    if (fileInfo.partial == NULL || fileInfo.partial(&fileInfo, lastSectors, 0, sizeof(piece), piece) != sizeof(piece) || memcmp(piece, expected, sizeof(piece)) != 0) { problems++; }
+
+    VirtualDiskInit(&disk, CHECK_SECTOR_SIZE);
+    if (!VirtualDiskAddPartition(&disk, &partition, CheckSplitFileInfo, 64, (0xfffffffful / (64ul * CHECK_SECTOR_SIZE)) + 8, 16)) { printf("[Check: split, problem adding partition]\n"); return 1; }
+    VirtualDiskIOSet(0, &disk);
+    if (f_mount(0, &splitFs) != FR_OK) { problems++; }
+    else
+    {
+        if (f_stat("SPLIT.001", &fno) != FR_OK || fno.fsize != parts[0].size) { problems++; }
+        if (f_stat("SPLIT.002", &fno) != FR_OK || fno.fsize != parts[1].size) { problems++; }
+        if (f_stat("SPLIT.003", &fno) == FR_OK) { problems++; }
+        problems += CheckSplitRead("SPLIT.001", 0, 0);
+        problems += CheckSplitRead("SPLIT.001", parts[0].size - CHECK_SECTOR_SIZE, parts[0].numSectors - 1);
+        problems += CheckSplitRead("SPLIT.002", 0, parts[1].firstSector);
+        problems += CheckSplitRead("SPLIT.002", (lastSectors - 1) * CHECK_SECTOR_SIZE, parts[1].firstSector + lastSectors - 1);
+        f_mount(0, NULL);
+    }
+
+    printf("[Check: split, %lu parts%s]\n", checkSplit.numParts, problems ? ", FAILED" : "");
+    return problems;
+}
+
+
+// Source file check: write a host file of pseudo-random bytes (returns zero if it cannot be written)
+static char CheckSourceWrite(const char *filename, unsigned long size)
+{
+    unsigned long i, x = 12345;
+    FILE *fp;
+    char ok = 1;
+
+    if ((fp = fopen(filename, "wb")) == NULL) { return 0; }
+    for (i = 0; i < size && ok; i++)
+    {
+        x = (x * 1103515245ul + 12345ul) & 0xfffffffful;
+        ok = (fputc((int)(x >> 16) & 0xff, fp) != EOF);
+    }
+    if (fclose(fp) != 0) { ok = 0; }
+    return ok;
+}
+
+// Source file check: the expected sectors of a host file, read with plain file reads (beyond the end of the file, sectors are blank)
+static void CheckSourceExpected(FILE *fp, unsigned long sector, unsigned short count, unsigned char *buffer)
+{
+    size_t n = 0;
+
+    memset(buffer, 0, (size_t)count * CHECK_SECTOR_SIZE);
+    if (fseek(fp, (long)(sector * CHECK_SECTOR_SIZE), SEEK_SET) == 0) { n = fread(buffer, 1, (size_t)count * CHECK_SECTOR_SIZE, fp); }
+    (void)n;
+}
+
+// Source file check reads, as (sector, count): a sequential run (crossing blocks, so read ahead), reads going backwards, within the last page and block, of the last sector (part-filled), and beyond the end
+#define CHECK_SOURCE_SIZE (3ul * 1024 * 1024 + 123)
+#define CHECK_SOURCE_SECTORS ((CHECK_SOURCE_SIZE + CHECK_SECTOR_SIZE - 1) / CHECK_SECTOR_SIZE)
+static const unsigned long checkSourceReads[][2] = {
+    { 2000, 200 }, { 1000, 7 }, { 999, 1 }, { 0, 1 }, { 7, 300 },
+    { CHECK_SOURCE_SECTORS - 9, 8 }, { CHECK_SOURCE_SECTORS - 3, 3 }, { CHECK_SOURCE_SECTORS - 1, 1 }, { CHECK_SOURCE_SECTORS - 2, 4 }, { CHECK_SOURCE_SECTORS + 5, 2 },
+};
+
+// Check reads of a file through an io_uring (with the page cache, and direct where supported) are the file's bytes as read with plain reads: a sequential pass over the whole file, in reads of an odd number of sectors, then reads out of order, at the end of the file and beyond it
+static int CheckUring(void)
+{
+#ifdef __linux__
+    static unsigned char expected[300 * CHECK_SECTOR_SIZE], actual[300 * CHECK_SECTOR_SIZE];
+    const char *filename = "check-source.bin";
+    virtualdisk_uring_t ring;
+    virtualdisk_uring_file_t file;
+    FILE *fp;
+    unsigned long sector, r;
+    int problems = 0, direct, available = 0;
+
+    if (!CheckSourceWrite(filename, CHECK_SOURCE_SIZE) || (fp = fopen(filename, "rb")) == NULL) { printf("[Check: io_uring, problem writing source file]\n"); return 1; }
+    for (direct = 0; direct <= 1; direct++)
+    {
+        if (!VirtualDiskUringInit(&ring, (char)direct)) { problems++; break; }
+        if (ring.fd >= 0) { available = 1; }
+        if (!VirtualDiskUringFileOpen(&file, &ring, filename, CHECK_SECTOR_SIZE)) { problems++; VirtualDiskUringClose(&ring); break; }
+        for (sector = 0; sector < CHECK_SOURCE_SECTORS; sector += 37)
+        {
+            CheckSourceExpected(fp, sector, 37, expected);
+            if (VirtualDiskUringRead(&file, sector, 37, actual) != 37 || memcmp(expected, actual, 37 * CHECK_SECTOR_SIZE) != 0) { problems++; break; }
+        }
+        for (r = 0; r < sizeof(checkSourceReads) / sizeof(checkSourceReads[0]); r++)
+        {
+            unsigned short count = (unsigned short)checkSourceReads[r][1];
+            CheckSourceExpected(fp, checkSourceReads[r][0], count, expected);
+            if (VirtualDiskUringRead(&file, checkSourceReads[r][0], count, actual) != count || memcmp(expected, actual, (size_t)count * CHECK_SECTOR_SIZE) != 0) { problems++; }
+        }
+        VirtualDiskUringFileClose(&file);
+        VirtualDiskUringClose(&ring);
+    }
+    fclose(fp);
+    remove(filename);
+
+    printf("[Check: io_uring, %s%s]\n", available ? "asynchronous reads" : "synchronous reads (io_uring not available)", problems ? ", FAILED" : "");
+    return problems;
+#else
+    return 0;
+#endif
+}
+
+
+// Check a memory-mapped file's sectors are the file's bytes as read with plain reads, for files of no, less than a page, a whole number of pages, and a part-filled last page of bytes: a sequential pass, then reads out of order, of the last sector, across the end of the file and beyond it, and the last sector streamed in pieces
+static int CheckMap(void)
+{
+    static unsigned char expected[300 * CHECK_SECTOR_SIZE], actual[300 * CHECK_SECTOR_SIZE];
+    static const unsigned long sizes[] = { CHECK_SOURCE_SIZE, 1000, 8192, 3 * 4096 + 1, 0 };
+    const char *filename = "check-source.bin";
+    virtualdisk_map_t map;
+    FILE *fp;
+    unsigned long sector, r, reads[4][2];
+    int problems = 0, i;
+    unsigned short offset;
+
+    for (i = 0; i < (int)(sizeof(sizes) / sizeof(sizes[0])); i++)
+    {
+        unsigned long sectors = (sizes[i] + CHECK_SECTOR_SIZE - 1) / CHECK_SECTOR_SIZE, last = (sectors > 0) ? sectors - 1 : 0;
+        if (!CheckSourceWrite(filename, sizes[i]) || (fp = fopen(filename, "rb")) == NULL) { printf("[Check: mapped files, problem writing source file]\n"); return 1; }
+        if (!VirtualDiskMapOpen(&map, filename, CHECK_SECTOR_SIZE)) { problems++; fclose(fp); continue; }
+
+        for (sector = 0; sector < sectors; sector += 37)
+        {
+            CheckSourceExpected(fp, sector, 37, expected);
+            if (VirtualDiskMapRead(&map, sector, 37, actual) != 37 || memcmp(expected, actual, 37 * CHECK_SECTOR_SIZE) != 0) { problems++; break; }
+        }
+        reads[0][0] = last; reads[0][1] = 1;
+        reads[1][0] = (last > 0) ? last - 1 : 0; reads[1][1] = 4;
+        reads[2][0] = sectors + 5; reads[2][1] = 2;
+        reads[3][0] = 0; reads[3][1] = 1;
+        for (r = 0; r < 4 + ((i == 0) ? sizeof(checkSourceReads) / sizeof(checkSourceReads[0]) : 0); r++)
+        {
+            unsigned long start = (r < 4) ? reads[r][0] : checkSourceReads[r - 4][0];
+            unsigned short count = (unsigned short)((r < 4) ? reads[r][1] : checkSourceReads[r - 4][1]);
+            CheckSourceExpected(fp, start, count, expected);
+            if (VirtualDiskMapRead(&map, start, count, actual) != count || memcmp(expected, actual, (size_t)count * CHECK_SECTOR_SIZE) != 0) { problems++; }
+        }
+
+        // The last sector in 20-byte pieces (the end of the file falls within one of them, unless it ends on a sector boundary)
+        CheckSourceExpected(fp, last, 1, expected);
+        for (offset = 0; offset < CHECK_SECTOR_SIZE; offset += 20)
+        {
+            unsigned short length = (CHECK_SECTOR_SIZE - offset < 20) ? (unsigned short)(CHECK_SECTOR_SIZE - offset) : 20;
+            if (VirtualDiskMapReadPartial(&map, last, offset, length, actual) != length || memcmp(expected + offset, actual, length) != 0) { problems++; break; }
+        }
+
+        VirtualDiskMapClose(&map);
+        fclose(fp);
+    }
+    remove(filename);
+
+    printf("[Check: mapped files, %d sizes%s]\n", (int)(sizeof(sizes) / sizeof(sizes[0])), problems ? ", FAILED" : "");
+    return problems;
+}
+
+
+// Transform check: format a record as a CSV line (of varying length), or (for the largest number of records) claim the longest text without writing it, so that setting up fails quickly once the text reaches 4 GiB
+#define CHECK_TRANSFORM_HEADER "record,square\r\n"
+static unsigned short CheckTransformFormat(void *reference, unsigned long record, char *text, unsigned short maxLength)
+{
+    if (reference != NULL) { return maxLength; }
+    return (unsigned short)sprintf(text, "%lu,%lu\r\n", record, (record * record) % 100000ul);
+}
+
+// Transform check: the expected text of a number of records (padded to a fixed width, if any), returns its length
+static unsigned long CheckTransformExpected(char *text, unsigned long numRecords, unsigned short fixedWidth)
+{
+    unsigned long length = (unsigned long)strlen(CHECK_TRANSFORM_HEADER), record;
+
+    memcpy(text, CHECK_TRANSFORM_HEADER, length);
+    for (record = 0; record < numRecords; record++)
+    {
+        unsigned short n = CheckTransformFormat(NULL, record, text + length, VIRTUALDISKTRANSFORM_MAX_RECORD);
+        if (fixedWidth > 0) { memset(text + length + n, ' ', fixedWidth - n); n = fixedWidth; }
+        length += n;
+    }
+    return length;
+}
+
+// Check text transformed from records is the records' text, read sequentially, backwards and in multi-sector reads, with the number of records variable-width or fixed-width, a multiple of the index capacity or not, and the index interval rounded up without overflowing for the largest number of records (so the caller's index is not overrun)
+static int CheckTransform(void)
+{
+    static char text[5000 * 24 + CHECK_SECTOR_SIZE * 4];
+    static const unsigned long numRecords[] = { 5000, 4096, 5000, 0 };
+    static const unsigned short fixedWidths[] = { 0, 0, 20, 0 };
+    unsigned long checkpoints[64 + 1];
+    unsigned char sector[4 * CHECK_SECTOR_SIZE];
+    virtualdisk_transform_t transform;
+    unsigned long length, sectors, s, i;
+    int problems = 0;
+
+    for (i = 0; i < sizeof(numRecords) / sizeof(numRecords[0]); i++)
+    {
+        if (!VirtualDiskTransformInit(&transform, CheckTransformFormat, NULL, numRecords[i], CHECK_SECTOR_SIZE, CHECK_TRANSFORM_HEADER, fixedWidths[i], checkpoints, 64)) { problems++; continue; }
+        if (fixedWidths[i] == 0 && (transform.interval != ((numRecords[i] + 63) / 64 ? (numRecords[i] + 63) / 64 : 1) || transform.numCheckpoints > 64)) { problems++; }
+        memset(text, 0, sizeof(text));
+        length = CheckTransformExpected(text, numRecords[i], fixedWidths[i]);
+        sectors = (length + CHECK_SECTOR_SIZE - 1) / CHECK_SECTOR_SIZE;
+        if (transform.size != length) { problems++; continue; }
+        for (s = 0; s < sectors + 1; s++)
+        {
+            if (VirtualDiskTransformRead(&transform, s, 1, sector) != 1 || memcmp(sector, text + s * CHECK_SECTOR_SIZE, CHECK_SECTOR_SIZE) != 0) { problems++; break; }
+        }
+        for (s = sectors; s-- > 0; )
+        {
+            if (VirtualDiskTransformRead(&transform, s, 1, sector) != 1 || memcmp(sector, text + s * CHECK_SECTOR_SIZE, CHECK_SECTOR_SIZE) != 0) { problems++; break; }
+        }
+        for (s = 0; s < sectors; s += 3)
+        {
+            if (VirtualDiskTransformRead(&transform, s, 4, sector) != 4 || memcmp(sector, text + s * CHECK_SECTOR_SIZE, 4 * CHECK_SECTOR_SIZE) != 0) { problems++; break; }
+        }
+    }
+
+    // The largest number of records: the interval is rounded up (not wrapped around to one), so the index is not overrun before the text is found to be too long
+    checkpoints[64] = 0x12345678ul;
+    if (VirtualDiskTransformInit(&transform, CheckTransformFormat, &transform, (unsigned long)-1, CHECK_SECTOR_SIZE, NULL, 0, checkpoints, 64)) { problems++; }
+    if (transform.interval != (unsigned long)-1 / 64 + 1 || transform.numCheckpoints > 64 || checkpoints[64] != 0x12345678ul) { problems++; }
+
+    printf("[Check: transform%s]\n", problems ? ", FAILED" : "");
+    return problems;
+}
+
+
+// Store check: source data (a compressible half of repeated text, then an incompressible half of pseudo-random bytes, ending part-way through a sector), and the store built from it
+#define CHECK_STORE_SIZE 20123
+#define CHECK_STORE_BLOCK_SIZE 2048
+static unsigned char checkStoreData[CHECK_STORE_SIZE];
+static unsigned char checkStore[CHECK_STORE_SIZE + CHECK_STORE_SIZE / 8 + 256];
+static unsigned long checkStoreLength;
+static virtualdisk_store_t checkStoreReader;
+
+// Store check: read bytes of the store from memory
+static char CheckStoreRead(void *reference, unsigned long offset, unsigned long length, unsigned char *buffer)
+{
+    if (offset > checkStoreLength || length > checkStoreLength - offset) { return 0; }
+    memcpy(buffer, checkStore + offset, length);
+    return 1;
+}
+
+// Store check file set: one file served from the store
+static char CheckStoreFileInfo(virtualdisk_fileinfo_t *fileInfo)
+{
+    if (fileInfo->parent != VIRTUALDISK_ROOT_DIRECTORY || fileInfo->id != 0) { return 0; }
+    fileInfo->filename = "STORE.DAT";
+    fileInfo->attributes = VIRTUALDISK_ATTRIB_ARCHIVE;
+    fileInfo->size = checkStoreReader.size;
+    fileInfo->created = fileInfo->modified = fileInfo->accessed = VIRTUALDISK_DATETIME(2013, 6, 1, 12, 0, 0);
+    fileInfo->contents = VirtualDiskStoreContents;
+    fileInfo->partial = VirtualDiskStorePartial;
+    fileInfo->reference = &checkStoreReader;
+    return 1;
+}
+
+// Check a compressed block store round trip: the compressible blocks are smaller and the incompressible ones stored as-is, and the file read back through FatFs, or streamed in pieces, is the source
+static int CheckStore(void)
+{
+    static unsigned char block[CHECK_STORE_BLOCK_SIZE], compressed[CHECK_STORE_BLOCK_SIZE], readBack[CHECK_STORE_SIZE + 1];
+    virtualdisk_t disk;
+    virtualdisk_partition_t partition;
+    FATFS storeFs;
+    FIL fp;
+    UINT length = 0;
+    virtualdisk_fileinfo_t fileInfo;
+    unsigned char piece[100];
+    unsigned long i, seed = 1, last;
+    int problems = 0;
+
+    for (i = 0; i < CHECK_STORE_SIZE / 2; i++) { checkStoreData[i] = (unsigned char)"Sensor reading 0042, status OK\r\n"[i % 32]; }
+    for (; i < CHECK_STORE_SIZE; i++) { seed = (seed * 1103515245ul + 12345ul) & 0xfffffffful; checkStoreData[i] = (unsigned char)(seed >> 16); }
+    checkStoreLength = VirtualDiskStoreBuild(checkStoreData, CHECK_STORE_SIZE, CHECK_STORE_BLOCK_SIZE, checkStore, sizeof(checkStore));
+    if (checkStoreLength == 0 || !VirtualDiskStoreOpen(&checkStoreReader, CheckStoreRead, NULL, CHECK_SECTOR_SIZE, block, compressed, sizeof(block))) { printf("[Check: store, problem building the store]\n"); return 1; }
+
+    // Block sizes: the first block (text) compressed, the last whole block (random) stored as-is
+    last = CHECK_STORE_SIZE / CHECK_STORE_BLOCK_SIZE - 1;
+    if (CHECK_GET_DWORD(checkStore + VIRTUALDISKSTORE_HEADER_SIZE + 4) - CHECK_GET_DWORD(checkStore + VIRTUALDISKSTORE_HEADER_SIZE) >= CHECK_STORE_BLOCK_SIZE / 4) { problems++; }
+    if (CHECK_GET_DWORD(checkStore + VIRTUALDISKSTORE_HEADER_SIZE + 4 * (last + 1)) - CHECK_GET_DWORD(checkStore + VIRTUALDISKSTORE_HEADER_SIZE + 4 * last) != CHECK_STORE_BLOCK_SIZE) { problems++; }
+
+    VirtualDiskInit(&disk, CHECK_SECTOR_SIZE);
+    if (!VirtualDiskAddPartition(&disk, &partition, CheckStoreFileInfo, 1, 100, 16)) { printf("[Check: store, problem adding partition]\n"); return 1; }
+    VirtualDiskIOSet(0, &disk);
+    if (f_mount(0, &storeFs) != FR_OK || f_open(&fp, "STORE.DAT", FA_READ) != FR_OK) { problems++; }
+    else
+    {
+        if (f_read(&fp, readBack, sizeof(readBack), &length) != FR_OK || length != CHECK_STORE_SIZE || memcmp(readBack, checkStoreData, CHECK_STORE_SIZE) != 0) { problems++; }
+        f_close(&fp);
+        f_mount(0, NULL);
+    }
+
+    // Each sector in pieces through the partial generator (the last blank past the end)
+    memset(&fileInfo, 0, sizeof(fileInfo));
+    CheckStoreFileInfo(&fileInfo);
+    for (i = 0; i < (CHECK_STORE_SIZE + CHECK_SECTOR_SIZE - 1) / CHECK_SECTOR_SIZE * CHECK_SECTOR_SIZE; i += length)
+    {
+        unsigned short offset = (unsigned short)(i % CHECK_SECTOR_SIZE);
+        unsigned long j;
+        length = (CHECK_SECTOR_SIZE - offset < sizeof(piece)) ? CHECK_SECTOR_SIZE - offset : sizeof(piece);
+        if (fileInfo.partial(&fileInfo, i / CHECK_SECTOR_SIZE, offset, (unsigned short)length, piece) != length) { problems++; break; }
+        for (j = 0; j < length; j++) { if (piece[j] != ((i + j < CHECK_STORE_SIZE) ? checkStoreData[i + j] : 0)) { break; } }
+        if (j < length) { problems++; break; }
+    }
+
+    printf("[Check: store, %lu bytes stored as %lu%s]\n", (unsigned long)CHECK_STORE_SIZE, checkStoreLength, problems ? ", FAILED" : "");
+    return problems;
+}
+
+
+// Session check: a stream per file that only knows its own position, so generates the wrong sectors unless every read it is not told to seek for does continue from the last
+typedef struct
+{
+    int id;                                 // File
+    unsigned long next;                     // Sector the stream is at
+} check_stream_t;
+static check_stream_t checkStreams[2];
+static int checkOpens, checkCloses, checkSeeks;
+
+// Session check: open a file's stream
+static void *CheckSessionOpen(const virtualdisk_fileinfo_t *fileInfo)
+{
+    check_stream_t *stream = &checkStreams[fileInfo->id];
+    stream->id = fileInfo->id;
+    stream->next = 0;
+    checkOpens++;
+    return stream;
+}
+
+// Session check: close a file's stream
+static void CheckSessionClose(void *session)
+{
+    ((check_stream_t *)session)->next = 0xfffffffful;
+    checkCloses++;
+}
+
+// Session check: generate the stream's next sectors, seeking only if the read does not continue the stream
+static unsigned short CheckSessionContents(void *reference, unsigned long sector, unsigned short count, unsigned char *buffer)
+{
+    const virtualdisk_fileinfo_t *fileInfo = (const virtualdisk_fileinfo_t *)reference;
+    check_stream_t *stream = (check_stream_t *)fileInfo->session;
+    unsigned short i;
+
+    if (stream == NULL) { return 0; }
+    if (!fileInfo->continuation) { stream->next = sector; checkSeeks++; }
+    for (i = 0; i < count; i++, stream->next++)
+    {
+        memset(buffer + (size_t)i * CHECK_SECTOR_SIZE, 0, CHECK_SECTOR_SIZE);
+        sprintf((char *)buffer + (size_t)i * CHECK_SECTOR_SIZE, "[%d:%lu]", stream->id, stream->next);
+    }
+    return count;
+}
+
+// Session check file set: two streamed files
+static char CheckSessionFileInfo(virtualdisk_fileinfo_t *fileInfo)
+{
+    static const char *filenames[] = { "STREAM0.DAT", "STREAM1.DAT" };
+
+    if (fileInfo->parent != VIRTUALDISK_ROOT_DIRECTORY || fileInfo->id < 0 || fileInfo->id > 1) { return 0; }
+    fileInfo->filename = filenames[fileInfo->id];
+    fileInfo->attributes = VIRTUALDISK_ATTRIB_ARCHIVE;
+    fileInfo->size = 32ul * CHECK_SECTOR_SIZE;
+    fileInfo->created = fileInfo->modified = fileInfo->accessed = VIRTUALDISK_DATETIME(2013, 6, 1, 12, 0, 0);
+    fileInfo->contents = CheckSessionContents;
+    fileInfo->reference = NULL;
+    fileInfo->open = CheckSessionOpen;
+    fileInfo->close = CheckSessionClose;
+    return 1;
+}
+
+// Session check: read sectors of an open file through FatFs, and compare them with the file's expected sectors
+static int CheckSessionRead(FIL *fp, int id, unsigned long sector, unsigned short count)
+{
+    static unsigned char buffer[8 * CHECK_SECTOR_SIZE];
+    unsigned char expected[CHECK_SECTOR_SIZE];
+    UINT length = 0;
+    unsigned short i;
+
+    if (f_lseek(fp, sector * CHECK_SECTOR_SIZE) != FR_OK || f_read(fp, buffer, (UINT)count * CHECK_SECTOR_SIZE, &length) != FR_OK || length != (UINT)count * CHECK_SECTOR_SIZE) { return 1; }
+    for (i = 0; i < count; i++)
+    {
+        memset(expected, 0, sizeof(expected));
+        sprintf((char *)expected, "[%d:%lu]", id, sector + i);
+        if (memcmp(buffer + (size_t)i * CHECK_SECTOR_SIZE, expected, CHECK_SECTOR_SIZE) != 0) { return 1; }
+    }
+    return 0;
+}
+
+// Check generator sessions: a file's session stays open across reads of other areas, continues without seeking when reads follow on, seeks when they do not, and is closed when another file is read and at the end
+static int CheckSession(void)
+{
+    virtualdisk_t disk;
+    virtualdisk_partition_t partition;
+    FATFS sessionFs;
+    FIL fp[2];
+    int problems = 0;
+
+    checkOpens = checkCloses = checkSeeks = 0;
+    VirtualDiskInit(&disk, CHECK_SECTOR_SIZE);
+    if (!VirtualDiskAddPartition(&disk, &partition, CheckSessionFileInfo, 8, 100, 16)) { printf("[Check: sessions, problem adding partition]\n"); return 1; }
+    VirtualDiskIOSet(0, &disk);
+    if (f_mount(0, &sessionFs) != FR_OK || f_open(&fp[0], "STREAM0.DAT", FA_READ) != FR_OK || f_open(&fp[1], "STREAM1.DAT", FA_READ) != FR_OK) { printf("[Check: sessions, problem opening files]\n"); return 1; }
+
+    problems += CheckSessionRead(&fp[0], 0, 0, 4);      // New session (continues from the start)
+    problems += CheckSessionRead(&fp[0], 0, 4, 8);      // Continues, across a cluster boundary
+    problems += CheckSessionRead(&fp[0], 0, 20, 2);     // Seeks
+    problems += CheckSessionRead(&fp[0], 0, 22, 2);     // Continues
+    if (checkOpens != 1 || checkCloses != 0 || checkSeeks != 1) { problems++; }
+    problems += CheckSessionRead(&fp[1], 1, 8, 4);      // Another file: closes the first, and its new session seeks
+    if (checkOpens != 2 || checkCloses != 1 || checkSeeks != 2) { problems++; }
+    problems += CheckSessionRead(&fp[0], 0, 24, 2);     // The first file again: a new session, so seeks
+    VirtualDiskEndSession(&disk);
+    if (checkOpens != 3 || checkCloses != 3 || checkSeeks != 3) { problems++; }
+    f_close(&fp[0]);
+    f_close(&fp[1]);
+    f_mount(0, NULL);
+
+    printf("[Check: sessions, %d opened, %d seeks%s]\n", checkOpens, checkSeeks, problems ? ", FAILED" : "");
+    return problems;
+}
+
+
+// Check synthetic contents against known values: the random stream's first words with a seed of zero are the reference SplitMix64 outputs, a stamp is its offset, and reads and verification agree at any position
+static int CheckSynth(void)
+{
+    static const unsigned char splitMix64[24] =
+    {
+        0xaf, 0xcd, 0x1d, 0x7b, 0x39, 0xa8, 0x20, 0xe2,     // 0xe220a8397b1dcdaf
+        0xf4, 0x65, 0xb9, 0xa1, 0x6a, 0x9e, 0x78, 0x6e,     // 0x6e789e6aa1b965f4
+        0x4f, 0x45, 0x09, 0x80, 0x18, 0x5d, 0xc4, 0x06,     // 0x06c45d188009454f
+    };
+    static const unsigned char stamp[8] = { 0x08, 0x06, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00 };     // Offset 0x208 (sector 1, word 1) exclusive-or 0x0400
+    virtualdisk_synth_t synth;
+    unsigned char buffer[4 * CHECK_SECTOR_SIZE], piece[100];
+    int problems = 0;
+
+    VirtualDiskSynthInit(&synth, VIRTUALDISKSYNTH_RANDOM, CHECK_SECTOR_SIZE, 0, NULL, 0);
+    VirtualDiskSynthRead(&synth, 0, 4, buffer);
+    if (memcmp(buffer, splitMix64, sizeof(splitMix64)) != 0) { problems++; }
+    if (VirtualDiskSynthVerify(&synth, 0, 4, buffer) != 4) { problems++; }
+    buffer[3 * CHECK_SECTOR_SIZE + 17] ^= 1;
+    if (VirtualDiskSynthVerify(&synth, 0, 4, buffer) != 3) { problems++; }
+
+    // A later sector directly, and part of one (at an offset that is not a whole word)
+    VirtualDiskSynthRead(&synth, 1000, 1, buffer);
+    {
+        virtualdisk_fileinfo_t fileInfo;
+        memset(&fileInfo, 0, sizeof(fileInfo));
+        fileInfo.reference = &synth;
+        if (VirtualDiskSynthPartial(&fileInfo, 1000, 203, sizeof(piece), piece) != sizeof(piece) || memcmp(piece, buffer + 203, sizeof(piece)) != 0) { problems++; }
+    }
+
+    VirtualDiskSynthInit(&synth, VIRTUALDISKSYNTH_STAMP, CHECK_SECTOR_SIZE, 0x0400, NULL, 0);
+    VirtualDiskSynthRead(&synth, 1, 1, buffer);
+    if (memcmp(buffer + 8, stamp, sizeof(stamp)) != 0) { problems++; }
+
+    printf("[Check: synthetic contents%s]\n", problems ? ", FAILED" : "");
+    return problems;
+}
+
+
+// Checksum check data file: "abc", or (longer files) a byte pattern
+static unsigned short CheckSumData(void *reference, unsigned long sector, unsigned short count, unsigned char *buffer)
+{
+    const virtualdisk_fileinfo_t *fileInfo = (const virtualdisk_fileinfo_t *)reference;
+    unsigned long i;
+
+    memset(buffer, 0, (size_t)count * CHECK_SECTOR_SIZE);
+    if (fileInfo->size == 3) { memcpy(buffer, "abc", 3); return count; }
+    for (i = 0; i < (unsigned long)count * CHECK_SECTOR_SIZE; i++) { buffer[i] = (unsigned char)((sector * CHECK_SECTOR_SIZE + i) * 7 + 1); }
+    return count;
+}
+
+// Checksum check: read a sidecar (as its file information sets it up), returns the number of reads that failed before it was ready
+static unsigned long CheckSumRead(virtualdisk_sum_t *sum, char *text)
+{
+    virtualdisk_fileinfo_t fileInfo;
+    unsigned char buffer[CHECK_SECTOR_SIZE];
+    unsigned long failed = 0;
+
+    memset(&fileInfo, 0, sizeof(fileInfo));
+    VirtualDiskSumFileInfo(sum, &fileInfo);
+    while (fileInfo.contents(&fileInfo, 0, 1, buffer) == 0 && failed < 100) { failed++; }
+    memcpy(text, buffer, fileInfo.size);
+    text[fileInfo.size] = '\0';
+    return failed;
+}
+
+// Checksum check file set: a data file and its sidecar
+static virtualdisk_sum_t checkSum;
+static char CheckSumFileInfo(virtualdisk_fileinfo_t *fileInfo)
+{
+    if (fileInfo->parent != VIRTUALDISK_ROOT_DIRECTORY || fileInfo->id < 0 || fileInfo->id > 1) { return 0; }
+    if (fileInfo->id == 0) { VirtualDiskSumDataFileInfo(&checkSum, fileInfo); }
+    else { VirtualDiskSumFileInfo(&checkSum, fileInfo); }
+    fileInfo->created = fileInfo->modified = fileInfo->accessed = VIRTUALDISK_DATETIME(2013, 6, 1, 12, 0, 0);
+    return 1;
+}
+
+// Check checksum sidecars: the CRC-32 and SHA-256 of "abc" are the known values, a sidecar read before the data file hashes a bounded number of sectors per read (failing until complete, which a read of the disk reports), and long names are capped alike in the sidecar's size and contents
+static int CheckSum(void)
+{
+    static char longName[300];
+    virtualdisk_sum_t sum, inOrder;
+    virtualdisk_fileinfo_t fileInfo;
+    virtualdisk_t disk;
+    virtualdisk_partition_t partition;
+    FATFS sumFs;
+    FIL fp;
+    UINT length;
+    unsigned char hashBuffer[4 * CHECK_SECTOR_SIZE], buffer[CHECK_SECTOR_SIZE];
+    char text[CHECK_SECTOR_SIZE + 1], expected[CHECK_SECTOR_SIZE + 1];
+    unsigned long sector, failed, diskFailed = 0;
+    int problems = 0;
+
+    VirtualDiskSumInit(&sum, VIRTUALDISKSUM_CRC32, "ABC.TXT", 3, 0, CHECK_SECTOR_SIZE, CheckSumData, NULL, hashBuffer, sizeof(hashBuffer));
+    if (CheckSumRead(&sum, text) != 0 || strcmp(text, "352441c2  ABC.TXT\n") != 0) { problems++; }
+    VirtualDiskSumInit(&sum, VIRTUALDISKSUM_SHA256, "ABC.TXT", 3, 0, CHECK_SECTOR_SIZE, CheckSumData, NULL, hashBuffer, sizeof(hashBuffer));
+    if (CheckSumRead(&sum, text) != 0 || strcmp(text, "ba7816bf8f01cfea414140de5dae2223b00361a396177a9cb410ff61f20015ad  ABC.TXT\n") != 0) { problems++; }
+
+    // A larger file: the sidecar first (in bounded steps), and reading the data file in order, agree
+    VirtualDiskSumInit(&sum, VIRTUALDISKSUM_SHA256, "DATA.BIN", (2 * VIRTUALDISKSUM_STEP_SECTORS + 10) * CHECK_SECTOR_SIZE - 100, 0, CHECK_SECTOR_SIZE, CheckSumData, NULL, hashBuffer, sizeof(hashBuffer));
+    failed = CheckSumRead(&sum, text);
+    if (failed != 2 || !VirtualDiskSumReady(&sum)) { problems++; }
+    VirtualDiskSumInit(&inOrder, VIRTUALDISKSUM_SHA256, "DATA.BIN", (2 * VIRTUALDISKSUM_STEP_SECTORS + 10) * CHECK_SECTOR_SIZE - 100, 0, CHECK_SECTOR_SIZE, CheckSumData, NULL, hashBuffer, sizeof(hashBuffer));
+    memset(&fileInfo, 0, sizeof(fileInfo));
+    VirtualDiskSumDataFileInfo(&inOrder, &fileInfo);
+    for (sector = 0; sector < inOrder.numSectors; sector++) { fileInfo.contents(&fileInfo, sector, 1, buffer); }
+    if (!VirtualDiskSumReady(&inOrder) || CheckSumRead(&inOrder, expected) != 0 || strcmp(text, expected) != 0) { problems++; }
+
+    // The sidecar read through the disk (FatFs): each disk read fails until the checksum is complete, rather than giving 0xff as its contents
+    VirtualDiskSumInit(&checkSum, VIRTUALDISKSUM_SHA256, "DATA.BIN", (2 * VIRTUALDISKSUM_STEP_SECTORS + 10) * CHECK_SECTOR_SIZE - 100, 0, CHECK_SECTOR_SIZE, CheckSumData, NULL, hashBuffer, sizeof(hashBuffer));
+    VirtualDiskInit(&disk, CHECK_SECTOR_SIZE);
+    if (!VirtualDiskAddPartition(&disk, &partition, CheckSumFileInfo, 1, 600, 16)) { printf("[Check: checksums, problem adding partition]\n"); return 1; }
+    VirtualDiskIOSet(0, &disk);
+    if (f_mount(0, &sumFs) != FR_OK) { problems++; }
+    for (;;)
+    {
+        FRESULT res;
+        memset(expected, 0, sizeof(expected));
+        if (f_open(&fp, "DATA.BIN.SHA256", FA_READ) != FR_OK) { problems++; break; }
+        res = f_read(&fp, expected, sizeof(expected) - 1, &length);
+        f_close(&fp);
+        if (res == FR_OK) { break; }
+        if (res != FR_DISK_ERR || ++diskFailed > 10) { problems++; break; }
+    }
+    if (diskFailed != failed || disk.stats.sectors[VIRTUALDISK_REGION_ERROR] != failed || strcmp(text, expected) != 0) { problems++; }
+    if (VirtualDiskReadSectors(&disk, VirtualDiskSectorCount(&disk), 1, buffer) != 0) { problems++; }      // (beyond the end of the disk)
+    f_mount(0, NULL);
+
+    // A name longer than the limit
+    memset(longName, 'N', sizeof(longName) - 1);
+    VirtualDiskSumInit(&sum, VIRTUALDISKSUM_CRC32, longName, 3, 0, CHECK_SECTOR_SIZE, CheckSumData, NULL, hashBuffer, sizeof(hashBuffer));
+    memset(&fileInfo, 0, sizeof(fileInfo));
+    VirtualDiskSumFileInfo(&sum, &fileInfo);
+    CheckSumRead(&sum, text);
+    if (fileInfo.size != 8 + 2 + VIRTUALDISK_MAX_FILENAME + 1 || strlen(text) != fileInfo.size || text[fileInfo.size - 1] != '\n') { problems++; }
+
+    printf("[Check: checksums, %lu reads before ready%s]\n", failed, problems ? ", FAILED" : "");
+    return problems;
+}
+
+
+// Check the statistics file layout: the formatted text at its start, value column and line endings, padded with spaces to its fixed size and ending with a new line, alike when read a sector at a time or whole
+static int CheckStats(void)
+{
+    static const char start[] = "Virtual disk statistics\r\n\r\nReads                   12345\r\nSectors                 7\r\n  MBR                   2\r\n";
+    static const char end[] = "File info callbacks     0\r\nRead latency            (no clock set)\r\n";
+    static unsigned char whole[VIRTUALDISKSTATS_SIZE + CHECK_SECTOR_SIZE], sector[CHECK_SECTOR_SIZE];
+    char text[VIRTUALDISKSTATS_SIZE];
+    virtualdisk_t disk;
+    virtualdisk_fileinfo_t fileInfo;
+    unsigned long length, i;
+    int problems = 0;
+
+    VirtualDiskInit(&disk, CHECK_SECTOR_SIZE);
+    disk.stats.reads = 12345;
+    disk.stats.sectors[0] = 2;
+    disk.stats.sectors[VIRTUALDISK_REGION_COUNT - 1] = 5;
+    memset(&fileInfo, 0, sizeof(fileInfo));
+    VirtualDiskStatsFileInfo(&disk, &fileInfo);
+    if (fileInfo.size != VIRTUALDISKSTATS_SIZE) { problems++; }
+
+    // The whole file (and a sector beyond it)
+    length = VirtualDiskStatsFormat(&disk, text, sizeof(text));
+    if (fileInfo.contents(&fileInfo, 0, sizeof(whole) / CHECK_SECTOR_SIZE, whole) != sizeof(whole) / CHECK_SECTOR_SIZE) { problems++; }
+    if (memcmp(whole, start, strlen(start)) != 0 || length < strlen(end) || memcmp(text + length - strlen(end), end, strlen(end)) != 0 || memcmp(whole, text, length) != 0) { problems++; }
+    for (i = length; i < VIRTUALDISKSTATS_SIZE - 1; i++) { if (whole[i] != ' ') { problems++; break; } }
+    if (whole[VIRTUALDISKSTATS_SIZE - 1] != '\n') { problems++; }
+    for (i = VIRTUALDISKSTATS_SIZE; i < sizeof(whole); i++) { if (whole[i] != 0) { problems++; break; } }
+
+    // A sector at a time
+    for (i = 0; i < sizeof(whole) / CHECK_SECTOR_SIZE; i++)
+    {
+        if (fileInfo.contents(&fileInfo, i, 1, sector) != 1 || memcmp(sector, whole + i * CHECK_SECTOR_SIZE, CHECK_SECTOR_SIZE) != 0) { problems++; }
+    }
+
+    printf("[Check: statistics file, %lu characters of text%s]\n", length, problems ? ", FAILED" : "");
+    return problems;
+}
+
 
 int main(void)
 {
     FRESULT res;
+    int problems = 0;
 
     // Create virtual disk
     VirtualDiskInit(&virtualdisk, VIRTUALDISK_DEFAULT_SECTOR_SIZE);
@@ -154,6 +1619,21 @@ int main(void)
 //    VirtualDiskAddPartition(&virtualdisk, &partition, VirtualDiskFileInfo, VIRTUALDISK_DEFAULT_SECTORS_PER_CLUSTER, VIRTUALDISK_DEFAULT_COUNT_DATA_CLUSTERS, 16);
 VirtualDiskAddPartition(&virtualdisk, &partition, VirtualDiskFileInfo, 1, 30, 16);
 //VirtualDiskAddPartition(&virtualdisk, &partition, VirtualDiskFileInfo, 0x40, 65500, 63 * 1024);
+//VirtualDiskAddExFatPartition(&virtualdisk, &partition, VirtualDiskFileInfo, 1, 3000, 16);     // exFAT (FatFs R0.09b cannot read it: see CheckExFat())
+
+    // Use the saved file index if it is still valid, otherwise build (and save) a new one
+    if (VirtualDiskIndexMap(&indexFile, "index.bin", &partition, 1, 1))
+    {
+        printf("[Index: mapped %lu entries]\n", indexFile.index.count);
+        VirtualDiskPartitionSetIndex(&partition, &indexFile.index);
+    }
+    else
+    {
+        VirtualDiskIndexBuildParallel(&partition, &fileIndex, 4);
+        if (!VirtualDiskIndexSave("index.bin", &partition, &fileIndex, 1)) { printf("[Problem saving index]\n"); }
+        printf("[Index: built %lu entries]\n", fileIndex.count);
+        VirtualDiskPartitionSetIndex(&partition, &fileIndex);
+    }
 
 	// Map FatFs drive 0 to our virtual disk
 	VirtualDiskIOSet(0, &virtualdisk);
@@ -203,11 +1683,14 @@ VirtualDiskAddPartition(&virtualdisk, &partition, VirtualDiskFileInfo, 1, 30, 16
         else
         {
             FILINFO fno;
+            static char lfname[_MAX_LFN + 1];
+            fno.lfname = lfname;
+            fno.lfsize = sizeof(lfname);
             for (;;)
             {
                 if ((res = f_readdir(&dj, &fno)) != FR_OK) { printf("[Problem reading directory]\n"); break; }
                 if (fno.fname[0] == '\0') { break; }
-                printf("[File: '%s', %lu bytes, Date: %x, Time: %x, Attrib: %x]\n", fno.fname, fno.fsize, fno.fdate, fno.ftime, fno.fattrib);
+                printf("[File: '%s', %lu bytes, Date: %x, Time: %x, Attrib: %x]\n", (lfname[0] != '\0') ? lfname : fno.fname, fno.fsize, fno.fdate, fno.ftime, fno.fattrib);
             }
         }
     }
@@ -229,6 +1712,8 @@ VirtualDiskAddPartition(&virtualdisk, &partition, VirtualDiskFileInfo, 1, 30, 16
 
 //    WriteLocalFileFromFile("test.txt", "test.txt");
     PrintFile("test0001.txt");
+    PrintFile("logs/log.csv");
+    PrintFile("logs/Log file 2013-06.csv");
 //    PrintFile("test000f.txt");
 
 #if 1
@@ -246,9 +1731,33 @@ VirtualDiskAddPartition(&virtualdisk, &partition, VirtualDiskFileInfo, 1, 30, 16
     }
 #endif
 
+    VirtualDiskPartitionSetIndex(&partition, NULL);
+    VirtualDiskIndexUnmap(&indexFile);
+
+    // Checks
+    problems += CheckDelta();
+    problems += CheckDeltaPaths();
+    problems += CheckStaleIndex();
+    problems += CheckParallelIndex();
+    problems += CheckLazyIndex();
+    problems += CheckShortNames();
+    problems += CheckRootChain();
+    problems += CheckLiveUpdate();
+    problems += CheckExFat();
+    problems += CheckSplit();
+    problems += CheckTransform();
+    problems += CheckMap();
+    problems += CheckUring();
+    problems += CheckStore();
+    problems += CheckSession();
+    problems += CheckSynth();
+    problems += CheckSum();
+    problems += CheckStats();
+    if (problems) { printf("[Checks: %d problems]\n", problems); }
+
 #if defined(_WIN32) && defined(_DEBUG)
     getchar();
 #endif
 
-    return 0;
+    return problems ? 1 : 0;
 }
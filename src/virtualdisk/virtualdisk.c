@@ -11,39 +11,372 @@
 // Debug trace
 //#define VIRTUALDISK_DEBUG
 
-// Enable FAT32 (but in a hacky way) - hopefully can be done more nicely once subdirectories are supported
-#define VIRTUALDISK_HACK_FAT32
+// Index entry parent value for files in the root directory
+#define VIRTUALDISK_INDEX_NO_PARENT 0xfffffffful
 
 
 // Little-endian word writing macros
 #define SET_DWORD(_p, _ov) { unsigned long _v = (_ov); *((_p)+0) = (unsigned char)((_v)); *((_p)+1) = (unsigned char)((_v) >> 8); *((_p)+2) = (unsigned char)((_v) >> 16); *((_p)+3) = (unsigned char)((_v) >> 24); }
 #define SET_WORD(_p, _ov)  { unsigned short _v = (_ov); *((_p)+0) = (unsigned char)((_v)); *((_p)+1) = (unsigned char)((_v) >> 8); }
-#define SET_CHS(_p, _c, _h, _s) { *((_p)+0) = (unsigned char)(_h); *((_p)+1) = (unsigned char)(((_c) >> 8) | (_s)); *((_p)+2) = (unsigned char)(_c);  } // Cylinder-head-sector: hhhhhhhh ccssssss cccccccc, CHS=(1023,254,63)
+#define GET_DWORD(_p) ( (unsigned long)*((_p)+0) | ((unsigned long)*((_p)+1) << 8) | ((unsigned long)*((_p)+2) << 16) | ((unsigned long)*((_p)+3) << 24) )
 #define SET_DATETIME_FAT_DATE(_p, _od) { unsigned long _d = (_od); *((_p)+0) = (unsigned char)((_d) >> 17); *((_p)+1) = (unsigned char)((_d) >> 25) + 40; }    // Write [YYYYYYMM MMDDDDDh hhhhmmmm mmssssss] as FAT Date [15-9=Y, 8-5=M1, 4-0=D1]
 #define SET_DATETIME_FAT_TIME(_p, _od) { unsigned long _d = (_od); *((_p)+0) = (unsigned char)((_d) >>  1); *((_p)+1) = (unsigned char)((_d) >>  9); }         // Write [YYYYYYMM MMDDDDDh hhhhmmmm mmssssss] as FAT Time [15-11=H, 10-5=M, 4-0=S/2]
 
+// Windowed writing macros, for generating part of a structured sector (bytes outside the window are skipped)
+#define WINDOW_BYTE(_w, _pos, _ov)  { unsigned long _wp = (unsigned long)(_pos) - (_w)->offset; if (_wp < (_w)->length) { (_w)->buffer[_wp] = (unsigned char)(_ov); } }
+#define WINDOW_WORD(_w, _pos, _ov)  { unsigned short _v = (_ov); WINDOW_BYTE(_w, (_pos) + 0, _v); WINDOW_BYTE(_w, (_pos) + 1, _v >> 8); }
+#define WINDOW_DWORD(_w, _pos, _ov) { unsigned long _v = (_ov); WINDOW_BYTE(_w, (_pos) + 0, _v); WINDOW_BYTE(_w, (_pos) + 1, _v >> 8); WINDOW_BYTE(_w, (_pos) + 2, _v >> 16); WINDOW_BYTE(_w, (_pos) + 3, _v >> 24); }
+#define WINDOW_CHS(_w, _pos, _c, _h, _s) { WINDOW_BYTE(_w, (_pos) + 0, (_h)); WINDOW_BYTE(_w, (_pos) + 1, ((_c) >> 8) | (_s)); WINDOW_BYTE(_w, (_pos) + 2, (_c)); }
 
-// (Private) Seek a file enumerator to the specified id
+// Size of the pieces a structured sector is generated in when it is only needed to calculate a checksum (bytes, a divisor of the sector size)
+#define VIRTUALDISK_WINDOW_PIECE 32
+
+// exFAT up-case table (compressed: 0xffff then a count of characters that map to themselves), for Latin-1 filename characters -- 'a'-'z' and 0xe0-0xfe (except 0xf7) are upper-cased
+static const unsigned short virtualDiskExFatUpcase[] =
+{
+    0xffff, 0x0061,
+    'A', 'B', 'C', 'D', 'E', 'F', 'G', 'H', 'I', 'J', 'K', 'L', 'M', 'N', 'O', 'P', 'Q', 'R', 'S', 'T', 'U', 'V', 'W', 'X', 'Y', 'Z',
+    0xffff, 0x0065,
+    0x00c0, 0x00c1, 0x00c2, 0x00c3, 0x00c4, 0x00c5, 0x00c6, 0x00c7, 0x00c8, 0x00c9, 0x00ca, 0x00cb, 0x00cc, 0x00cd, 0x00ce, 0x00cf,
+    0x00d0, 0x00d1, 0x00d2, 0x00d3, 0x00d4, 0x00d5, 0x00d6, 0x00f7, 0x00d8, 0x00d9, 0x00da, 0x00db, 0x00dc, 0x00dd, 0x00de,
+};
+#define VIRTUALDISK_EXFAT_UPCASE_BYTES (2 * (sizeof(virtualDiskExFatUpcase) / sizeof(virtualDiskExFatUpcase[0])))
+
+
+// (Private) The part of a sector being generated: 'length' bytes from byte 'offset' of the sector, in 'buffer'
+typedef struct
+{
+    unsigned char *buffer;
+    unsigned short offset;
+    unsigned short length;
+} virtualdisk_window_t;
+
+
+// (Private) Copy bytes to a position in a sector, skipping those outside the window
+static void VirtualDiskWindowCopy(const virtualdisk_window_t *window, unsigned long position, const void *data, unsigned long length)
+{
+    unsigned long i;
+    for (i = 0; i < length; i++) { WINDOW_BYTE(window, position + i, ((const unsigned char *)data)[i]); }
+}
+
+
+// (Private) Fill bytes at a position in a sector, skipping those outside the window
+static void VirtualDiskWindowFill(const virtualdisk_window_t *window, unsigned long position, unsigned char value, unsigned long length)
+{
+    unsigned long i;
+    for (i = 0; i < length; i++) { WINDOW_BYTE(window, position + i, value); }
+}
+
+
+// (Private) Calculate the number of clusters occupied by a file of the specified size
+static unsigned long VirtualDiskPartitionFileClusters(virtualdisk_partition_t *partition, unsigned long size)
+{
+    return (size + (partition->sectorsPerCluster * partition->disk->sectorSize - 1)) / partition->sectorsPerCluster / partition->disk->sectorSize;
+}
+
+
+// (Private) Get the upper 32 bits of a file's size (only on exFAT, up to 1 TiB)
+static unsigned long VirtualDiskPartitionFileSizeHigh(virtualdisk_partition_t *partition, const virtualdisk_fileinfo_t *fileInfo)
+{
+    if (partition->fatType != VIRTUALDISK_EXFAT) { return 0; }
+    return fileInfo->sizeHigh;
+}
+
+
+// (Private) Calculate the number of clusters in a file's run (its size, or its reserved capacity if larger) -- a sub-directory's run is one cluster unless its contents are indexed
+static unsigned long VirtualDiskPartitionFileRunClusters(virtualdisk_partition_t *partition, const virtualdisk_fileinfo_t *fileInfo)
+{
+    unsigned long sizeHigh = VirtualDiskPartitionFileSizeHigh(partition, fileInfo);
+
+    if (fileInfo->attributes & VIRTUALDISK_ATTRIB_DIRECTORY) { return 1; }
+    if (sizeHigh > 0)
+    {
+        // Each 4 GiB is a whole number of clusters (as the cluster size is a power of two)
+        return sizeHigh * (0xfffffffful / ((unsigned long)partition->sectorsPerCluster * partition->disk->sectorSize) + 1) + VirtualDiskPartitionFileClusters(partition, fileInfo->size);
+    }
+    return VirtualDiskPartitionFileClusters(partition, (fileInfo->maxSize > fileInfo->size) ? fileInfo->maxSize : fileInfo->size);
+}
+
+
+// (Public) Calculate the first cluster available to files
+unsigned long VirtualDiskPartitionFirstFileCluster(virtualdisk_partition_t *partition)
+{
+    return 2 + partition->rootDirClusters + partition->bitmapClusters + partition->upcaseClusters;      // First FAT cluster is 2, after which is the FAT32/exFAT root directory cluster chain (if any), then the exFAT allocation bitmap and up-case table
+}
+
+
+// (Public) Get the number of entries at the start of the root directory (if non-zero) or a sub-directory before its files
+unsigned long VirtualDiskPartitionDirectoryStart(virtualdisk_partition_t *partition, char root)
+{
+    if (partition->fatType == VIRTUALDISK_EXFAT) { return root ? 2 : 0; }      // exFAT root directory: allocation bitmap and up-case table entries (sub-directories have no '.' and '..' entries)
+    return root ? 0 : 2;                                                        // FAT sub-directory: '.' and '..' entries
+}
+
+
+// (Public) Fetch information for the file with the current id in the specified parent directory (optional fields are cleared first, so callbacks need not set them) -- an exFAT file of 1 TiB or more cannot be represented, so ends its directory
+char VirtualDiskFileInfoGet(virtualdisk_partition_t *partition, int parent, virtualdisk_fileinfo_t *fileInfo)
+{
+    fileInfo->parent = parent;
+    fileInfo->maxSize = 0;
+    fileInfo->sizeHigh = 0;
+    fileInfo->directory = 0;
+    fileInfo->partial = NULL;
+    fileInfo->open = NULL;
+    fileInfo->close = NULL;
+    fileInfo->session = NULL;
+    fileInfo->continuation = 0;
+    if (!partition->fileInfoCallback(fileInfo)) { return 0; }
+    return (partition->fatType != VIRTUALDISK_EXFAT || fileInfo->sizeHigh <= 0xff);
+}
+
+
+// (Private) Fetch file information for the disk itself (counted in its statistics)
+static char VirtualDiskFileInfoCall(virtualdisk_partition_t *partition, int parent, virtualdisk_fileinfo_t *fileInfo)
+{
+    partition->disk->stats.fileInfoCalls++;
+    return VirtualDiskFileInfoGet(partition, parent, fileInfo);
+}
+
+// (Private) Check whether a character is valid in a short (8.3) name (lower-case letters are stored in upper-case; bytes 0x80 and above depend on the reader's OEM code page, so are not used)
+static char VirtualDiskShortNameChar(char c)
+{
+    if ((c >= 'A' && c <= 'Z') || (c >= 'a' && c <= 'z') || (c >= '0' && c <= '9')) { return 1; }
+    return (c != '\0' && strchr("$%'-_@~`!(){}^#&", c) != NULL);
+}
+
+
+// (Private) Calculate the number of VFAT long filename entries for a file (zero if its name is a valid 8.3 name, or it is a volume label)
+static unsigned long VirtualDiskLongNameEntries(const virtualdisk_fileinfo_t *fileInfo)
+{
+    const char *s = fileInfo->filename;
+    size_t length, dot, i;
+
+    if (s == NULL || (fileInfo->attributes & VIRTUALDISK_ATTRIB_VOLUME)) { return 0; }
+    length = strlen(s);
+    if (length > VIRTUALDISK_MAX_FILENAME) { length = VIRTUALDISK_MAX_FILENAME; }
+
+    // A 1-8 character name, optionally followed by a dot and 1-3 character extension
+    for (dot = 0; dot < length && s[dot] != '.'; dot++) { ; }
+    if (dot >= 1 && dot <= 8 && (dot == length || (length - dot >= 2 && length - dot <= 4)))
+    {
+        for (i = 0; i < length && (i == dot || VirtualDiskShortNameChar(s[i])); i++) { ; }
+        if (i >= length) { return 0; }
+    }
+
+    return (length + 12) / 13;      // 13 characters per entry
+}
+
+
+// (Private) Get the length of a file's name (up to the maximum)
+static unsigned long VirtualDiskFileNameLength(const virtualdisk_fileinfo_t *fileInfo)
+{
+    unsigned long length;
+
+    if (fileInfo->filename == NULL) { return 0; }
+    for (length = 0; length < VIRTUALDISK_MAX_FILENAME && fileInfo->filename[length] != '\0'; length++) { ; }
+    return length;
+}
+
+
+// (Private) Calculate the number of directory entries for a file (its long filename entries, then its short entry; on exFAT, its file entry, stream extension entry and file name entries, or a volume label entry)
+static unsigned long VirtualDiskFileDirEntries(virtualdisk_partition_t *partition, const virtualdisk_fileinfo_t *fileInfo)
+{
+    if (partition->fatType == VIRTUALDISK_EXFAT)
+    {
+        unsigned long length = VirtualDiskFileNameLength(fileInfo);
+        if (fileInfo->attributes & VIRTUALDISK_ATTRIB_VOLUME) { return 1; }
+        return 2 + ((length > 0) ? (length + 14) / 15 : 1);        // 15 characters per file name entry (at least one)
+    }
+    return 1 + VirtualDiskLongNameEntries(fileInfo);
+}
+
+
+// (Private) Hash of a file's long filename (on exFAT, any filename), so that an index can detect a changed long filename (zero if the file has none)
+static unsigned long VirtualDiskLongNameHash(virtualdisk_partition_t *partition, const virtualdisk_fileinfo_t *fileInfo)
+{
+    unsigned long hash = 2166136261ul;
+    size_t i;
+
+    if (partition->fatType == VIRTUALDISK_EXFAT ? (fileInfo->filename == NULL) : (VirtualDiskLongNameEntries(fileInfo) == 0)) { return 0; }
+    for (i = 0; i < VIRTUALDISK_MAX_FILENAME && fileInfo->filename[i] != '\0'; i++)
+    {
+        hash = ((hash ^ (unsigned char)fileInfo->filename[i]) * 16777619ul) & 0xfffffffful;
+    }
+    return hash | 1;
+}
+
+
+// (Private) Count the directory entries of the files in the root directory (including long filename entries and any volume label), up to the specified maximum
+static unsigned long VirtualDiskPartitionCountRootEntries(virtualdisk_partition_t *partition, unsigned long maximum)
+{
+    virtualdisk_fileinfo_t fileInfo;
+    unsigned long count = 0;
+
+    memset(&fileInfo, 0, sizeof(fileInfo));
+    for (fileInfo.id = 0; count < maximum; fileInfo.id++)
+    {
+        if (!VirtualDiskFileInfoCall(partition, VIRTUALDISK_ROOT_DIRECTORY, &fileInfo)) { break; }
+        count += VirtualDiskFileDirEntries(partition, &fileInfo);
+    }
+    return (count < maximum) ? count : maximum;
+}
+
+
+// (Public) Get the number of index entries in the root directory (entries for the contents of sub-directories follow them)
+unsigned long VirtualDiskIndexRootCount(const virtualdisk_index_t *index)
+{
+    unsigned long lo = 0, hi = index->count;
+
+    // Usually no sub-directory contents are indexed
+    if (hi == 0 || GET_DWORD(index->entries[hi - 1].parent) == VIRTUALDISK_INDEX_NO_PARENT) { return hi; }
+
+    // Find the first entry with a parent directory
+    while (lo < hi)
+    {
+        unsigned long mid = lo + ((hi - lo) >> 1);
+        if (GET_DWORD(index->entries[mid].parent) == VIRTUALDISK_INDEX_NO_PARENT) { lo = mid + 1; }
+        else { hi = mid; }
+    }
+    return lo;
+}
+
+
+// (Public) Fetch the file information for an index entry (with the id and parent it has within its directory)
+char VirtualDiskIndexFileInfo(virtualdisk_partition_t *partition, const virtualdisk_index_t *index, unsigned long entry, virtualdisk_fileinfo_t *fileInfo)
+{
+    unsigned long parent;
+
+    if (entry >= index->count) { return 0; }
+    parent = GET_DWORD(index->entries[entry].parent);
+    if (parent == VIRTUALDISK_INDEX_NO_PARENT)
+    {
+        fileInfo->id = (int)entry;
+        return VirtualDiskFileInfoCall(partition, VIRTUALDISK_ROOT_DIRECTORY, fileInfo);
+    }
+    fileInfo->id = (int)(entry - GET_DWORD(index->entries[parent].firstChild));
+    return VirtualDiskFileInfoCall(partition, (int)GET_DWORD(index->entries[parent].directory), fileInfo);
+}
+
+
+// (Private) Binary search the index for the entry whose cluster run covers the specified cluster (returns -1 if not found)
+static long VirtualDiskIndexFindCluster(const virtualdisk_index_t *index, unsigned long cluster)
+{
+    unsigned long lo = 0, hi = index->count;
+
+    // Find the last entry starting at or before the cluster
+    while (lo < hi)
+    {
+        unsigned long mid = lo + ((hi - lo) >> 1);
+        if (GET_DWORD(index->entries[mid].firstCluster) <= cluster) { lo = mid + 1; }
+        else { hi = mid; }
+    }
+    if (lo == 0) { return -1; }
+    lo--;
+
+    // Check the run covers the cluster (empty files cover nothing)
+    if (cluster >= GET_DWORD(index->entries[lo].firstCluster) + GET_DWORD(index->entries[lo].numClusters)) { return -1; }
+    return (long)lo;
+}
+
+
+// (Private) Binary search a directory's index entries (first to first + count - 1) for the last one whose directory entries start at or before the specified position (returns 'first' if none)
+static unsigned long VirtualDiskIndexFindSlot(const virtualdisk_index_t *index, unsigned long first, unsigned long count, unsigned long slot)
+{
+    unsigned long lo = first, hi = first + count;
+
+    while (lo < hi)
+    {
+        unsigned long mid = lo + ((hi - lo) >> 1);
+        if (GET_DWORD(index->entries[mid].dirOffset) <= slot) { lo = mid + 1; }
+        else { hi = mid; }
+    }
+    return (lo > first) ? lo - 1 : first;
+}
+
+
+// (Private) Check whether the index covers the specified cluster (a partial index only covers clusters before its last known file)
+static char VirtualDiskIndexCoversCluster(const virtualdisk_index_t *index, unsigned long cluster)
+{
+    if (index == NULL || index->count <= 0) { return 0; }
+    return index->complete || cluster < GET_DWORD(index->entries[index->count - 1].firstCluster);
+}
+
+
+// (Private) Record the enumerator's current file in an incomplete index, if it is the next unknown file (the index grows as files are enumerated)
+static void VirtualDiskFileEnumeratorRecord(virtualdisk_file_enumerator_t *fileEnumerator)
+{
+    virtualdisk_index_t *index = fileEnumerator->partition->index;
+
+    if (index == NULL || index->complete || (unsigned long)fileEnumerator->fileInfo.id != index->count) { return; }
+
+    if (!fileEnumerator->hasFile)
+    {
+        index->complete = 1;        // No more files: every root file is now known (sub-directories are not added: they stay empty, as they were served while the index filled in -- adding their contents would move clusters the host has already read)
+    }
+    else if (index->count < index->capacity)
+    {
+        VirtualDiskIndexSetEntry(fileEnumerator->partition, &index->entries[index->count], &fileEnumerator->fileInfo, fileEnumerator->firstCluster, fileEnumerator->dirOffset);
+        index->count++;
+    }
+}
+
+
+// (Private) Seek a file enumerator to the specified id (in the root directory)
 static char VirtualDiskFileEnumeratorSeekId(virtualdisk_file_enumerator_t *fileEnumerator, int id)
 {
+    virtualdisk_index_t *index = fileEnumerator->partition->index;
+    char inSubdirectory = (fileEnumerator->fileInfo.parent != VIRTUALDISK_ROOT_DIRECTORY);     // Current file is not in the root directory
+
+    // If there is an index, jump directly to the required file (or the nearest known one before it)
+    if (index != NULL && id >= 0 && (id != fileEnumerator->fileInfo.id || inSubdirectory))
+    {
+        unsigned long rootCount = VirtualDiskIndexRootCount(index);
+        if (index->complete && (unsigned long)id >= rootCount)
+        {
+            // No file beyond the end of a complete index
+            fileEnumerator->fileInfo.id = id;
+            fileEnumerator->fileInfo.parent = VIRTUALDISK_ROOT_DIRECTORY;
+            fileEnumerator->entry = (unsigned long)id;
+            fileEnumerator->firstCluster = VirtualDiskPartitionFirstFileCluster(fileEnumerator->partition);
+            if (index->count > 0) { fileEnumerator->firstCluster = GET_DWORD(index->entries[index->count - 1].firstCluster) + GET_DWORD(index->entries[index->count - 1].numClusters); }
+            fileEnumerator->numClusters = 0;
+            fileEnumerator->dirOffset = 0;
+            if (rootCount > 0) { fileEnumerator->dirOffset = GET_DWORD(index->entries[rootCount - 1].dirOffset) + GET_DWORD(index->entries[rootCount - 1].dirEntries); }
+            fileEnumerator->dirEntries = 0;
+            fileEnumerator->hasFile = 0;
+            return 0;
+        }
+        else if (rootCount > 0)
+        {
+            int known = ((unsigned long)id < rootCount) ? id : (int)(rootCount - 1);
+            if (id < fileEnumerator->fileInfo.id || known > fileEnumerator->fileInfo.id || inSubdirectory)
+            {
+                fileEnumerator->fileInfo.id = known;
+                fileEnumerator->firstCluster = GET_DWORD(index->entries[known].firstCluster);
+                fileEnumerator->hasFile = VirtualDiskFileInfoCall(fileEnumerator->partition, VIRTUALDISK_ROOT_DIRECTORY, &fileEnumerator->fileInfo);
+                fileEnumerator->numClusters = GET_DWORD(index->entries[known].numClusters);
+                fileEnumerator->dirOffset = GET_DWORD(index->entries[known].dirOffset);
+                fileEnumerator->dirEntries = GET_DWORD(index->entries[known].dirEntries);
+                inSubdirectory = 0;
+            }
+        }
+    }
+
     // If need to reset...
-    if (id < 0 || id < fileEnumerator->fileInfo.id)
+    if (id < 0 || id < fileEnumerator->fileInfo.id || inSubdirectory)
     {
 #ifdef VIRTUALDISK_DEBUG
         printf("!!! ENUMERATOR-RESET\n");
 #endif
+        fileEnumerator->partition->disk->stats.enumeratorResets++;
         // Get first file information
         fileEnumerator->fileInfo.id = 0;
-        fileEnumerator->firstCluster = 2;       // First FAT cluster is 2
-#ifdef VIRTUALDISK_HACK_FAT32
-        if (fileEnumerator->partition->fatType == VIRTUALDISK_FAT32)
-        {
-            // HACK: Adjust to point to cluster after FAT32 root directory cluster chain
-            fileEnumerator->firstCluster += (fileEnumerator->partition->sectorsRootDir / fileEnumerator->partition->sectorsPerCluster);
-        }
-#endif
-        fileEnumerator->hasFile = fileEnumerator->fileInfoCallback(&fileEnumerator->fileInfo);
-        fileEnumerator->numClusters = (fileEnumerator->fileInfo.size + (fileEnumerator->partition->sectorsPerCluster * fileEnumerator->partition->disk->sectorSize - 1)) / fileEnumerator->partition->sectorsPerCluster / fileEnumerator->partition->disk->sectorSize;
+        fileEnumerator->firstCluster = VirtualDiskPartitionFirstFileCluster(fileEnumerator->partition);
+        fileEnumerator->hasFile = VirtualDiskFileInfoCall(fileEnumerator->partition, VIRTUALDISK_ROOT_DIRECTORY, &fileEnumerator->fileInfo);
+        fileEnumerator->numClusters = VirtualDiskPartitionFileRunClusters(fileEnumerator->partition, &fileEnumerator->fileInfo);
+        fileEnumerator->dirOffset = 0;
+        fileEnumerator->dirEntries = fileEnumerator->hasFile ? VirtualDiskFileDirEntries(fileEnumerator->partition, &fileEnumerator->fileInfo) : 0;
+        VirtualDiskFileEnumeratorRecord(fileEnumerator);
     }
 
     // Advance to required index
@@ -55,10 +388,34 @@ static char VirtualDiskFileEnumeratorSeekId(virtualdisk_file_enumerator_t *fileE
         // Get next information
         fileEnumerator->fileInfo.id++;
         fileEnumerator->firstCluster += fileEnumerator->numClusters;
-        fileEnumerator->hasFile = fileEnumerator->fileInfoCallback(&fileEnumerator->fileInfo);
-        fileEnumerator->numClusters = (fileEnumerator->fileInfo.size + (fileEnumerator->partition->sectorsPerCluster * fileEnumerator->partition->disk->sectorSize - 1)) / fileEnumerator->partition->sectorsPerCluster / fileEnumerator->partition->disk->sectorSize;
+        fileEnumerator->dirOffset += fileEnumerator->dirEntries;
+        fileEnumerator->hasFile = VirtualDiskFileInfoCall(fileEnumerator->partition, VIRTUALDISK_ROOT_DIRECTORY, &fileEnumerator->fileInfo);
+        fileEnumerator->numClusters = VirtualDiskPartitionFileRunClusters(fileEnumerator->partition, &fileEnumerator->fileInfo);
+        fileEnumerator->dirEntries = fileEnumerator->hasFile ? VirtualDiskFileDirEntries(fileEnumerator->partition, &fileEnumerator->fileInfo) : 0;
+        VirtualDiskFileEnumeratorRecord(fileEnumerator);
     }
 
+    fileEnumerator->entry = (unsigned long)fileEnumerator->fileInfo.id;
+    return fileEnumerator->hasFile;
+}
+
+
+// (Private) Seek a file enumerator to the specified index entry (which may be in a sub-directory)
+static char VirtualDiskFileEnumeratorSeekEntry(virtualdisk_file_enumerator_t *fileEnumerator, unsigned long entry)
+{
+    virtualdisk_index_t *index = fileEnumerator->partition->index;
+
+    if (entry < VirtualDiskIndexRootCount(index)) { return VirtualDiskFileEnumeratorSeekId(fileEnumerator, (int)entry); }
+
+    // Already there
+    if (fileEnumerator->fileInfo.parent != VIRTUALDISK_ROOT_DIRECTORY && fileEnumerator->entry == entry) { return fileEnumerator->hasFile; }
+
+    fileEnumerator->entry = entry;
+    fileEnumerator->firstCluster = GET_DWORD(index->entries[entry].firstCluster);
+    fileEnumerator->numClusters = GET_DWORD(index->entries[entry].numClusters);
+    fileEnumerator->dirOffset = GET_DWORD(index->entries[entry].dirOffset);
+    fileEnumerator->dirEntries = GET_DWORD(index->entries[entry].dirEntries);
+    fileEnumerator->hasFile = VirtualDiskIndexFileInfo(fileEnumerator->partition, index, entry, &fileEnumerator->fileInfo);
     return fileEnumerator->hasFile;
 }
 
@@ -70,9 +427,57 @@ static char VirtualDiskFileEnumeratorNext(virtualdisk_file_enumerator_t *fileEnu
 }
 
 
+// (Private) Seek a file enumerator to the file whose directory entries cover the specified position in the root directory (returns zero if none)
+static char VirtualDiskFileEnumeratorSeekSlot(virtualdisk_file_enumerator_t *fileEnumerator, unsigned long slot)
+{
+    virtualdisk_index_t *index = fileEnumerator->partition->index;
+    unsigned long rootCount = (index != NULL) ? VirtualDiskIndexRootCount(index) : 0;
+    char restart = (fileEnumerator->fileInfo.parent != VIRTUALDISK_ROOT_DIRECTORY || slot < fileEnumerator->dirOffset);
+
+    // Start from the nearest indexed file at or before the position (if that is further on), otherwise from the first file if need to go back
+    if (rootCount > 0)
+    {
+        unsigned long known = VirtualDiskIndexFindSlot(index, 0, rootCount, slot);
+        if (restart || known > (unsigned long)fileEnumerator->fileInfo.id) { VirtualDiskFileEnumeratorSeekId(fileEnumerator, (int)known); }
+    }
+    else if (restart)
+    {
+        VirtualDiskFileEnumeratorSeekId(fileEnumerator, 0);
+    }
+
+    // Advance to the file covering the position
+    while (fileEnumerator->hasFile && slot >= fileEnumerator->dirOffset + fileEnumerator->dirEntries)
+    {
+        VirtualDiskFileEnumeratorNext(fileEnumerator);
+    }
+
+    return fileEnumerator->hasFile;
+}
+
+
 // (Private) Seek a file enumerator to the one covering the specified cluster
 static char VirtualDiskFileEnumeratorSeekCluster(virtualdisk_file_enumerator_t *fileEnumerator, unsigned long cluster)
 {
+    virtualdisk_index_t *index = fileEnumerator->partition->index;
+
+    // If the index covers the cluster, seek directly to the file
+    if (VirtualDiskIndexCoversCluster(index, cluster))
+    {
+        long found = VirtualDiskIndexFindCluster(index, cluster);
+        if (found < 0) { return 0; }    // Cluster not in any file's run
+        return VirtualDiskFileEnumeratorSeekEntry(fileEnumerator, (unsigned long)found);
+    }
+
+    // Otherwise, walk on from the last known file in a partial index (unless already beyond it)
+    if (index != NULL && index->count > 0)
+    {
+        unsigned long lastKnownCluster = GET_DWORD(index->entries[index->count - 1].firstCluster);
+        if (cluster < fileEnumerator->firstCluster || fileEnumerator->firstCluster < lastKnownCluster)
+        {
+            VirtualDiskFileEnumeratorSeekId(fileEnumerator, (int)(index->count - 1));
+        }
+    }
+
     // If we're looking for a cluster before the current one, reset
     if (cluster < fileEnumerator->firstCluster)
     {
@@ -101,14 +506,7 @@ static char VirtualDiskFileEnumeratorSeekCluster(virtualdisk_file_enumerator_t *
 static char VirtualDiskFileEnumeratorInit(virtualdisk_file_enumerator_t *fileEnumerator, virtualdisk_partition_t *partition, VirtualDiskFileInfoCallback fileInfoCallback)
 {
     fileEnumerator->partition = partition;
-    fileEnumerator->firstCluster = 2;       // First FAT cluster is 2
-#ifdef VIRTUALDISK_HACK_FAT32
-    if (fileEnumerator->partition->fatType == VIRTUALDISK_FAT32)
-    {
-        // HACK: Adjust to point to cluster after FAT32 root directory cluster chain
-        fileEnumerator->firstCluster += (fileEnumerator->partition->sectorsRootDir / fileEnumerator->partition->sectorsPerCluster);
-    }
-#endif
+    fileEnumerator->firstCluster = VirtualDiskPartitionFirstFileCluster(partition);
 
     fileEnumerator->fileInfoCallback = fileInfoCallback;
 
@@ -118,6 +516,29 @@ static char VirtualDiskFileEnumeratorInit(virtualdisk_file_enumerator_t *fileEnu
 }
 
 
+// (Private) Find the cluster run covering the specified cluster, and how many of its clusters are in use (using the index where possible, which avoids calling back for file information)
+static char VirtualDiskPartitionFindRun(virtualdisk_partition_t *partition, unsigned long cluster, unsigned long *firstCluster, unsigned long *numClusters, unsigned long *usedClusters)
+{
+    if (VirtualDiskIndexCoversCluster(partition->index, cluster))
+    {
+        long found = VirtualDiskIndexFindCluster(partition->index, cluster);
+        if (found < 0) { return 0; }
+        *firstCluster = GET_DWORD(partition->index->entries[found].firstCluster);
+        *numClusters = GET_DWORD(partition->index->entries[found].numClusters);
+        *usedClusters = VirtualDiskPartitionFileClusters(partition, GET_DWORD(partition->index->entries[found].dirEntry + 28));
+        if (partition->index->entries[found].dirEntry[11] & VIRTUALDISK_ATTRIB_DIRECTORY) { *usedClusters = *numClusters; }     // Sub-directories use their whole run
+        return 1;
+    }
+
+    if (!VirtualDiskFileEnumeratorSeekCluster(&partition->fileEnumerator, cluster)) { return 0; }
+    *firstCluster = partition->fileEnumerator.firstCluster;
+    *numClusters = partition->fileEnumerator.numClusters;
+    *usedClusters = VirtualDiskPartitionFileClusters(partition, partition->fileEnumerator.fileInfo.size);
+    if (partition->fileEnumerator.fileInfo.attributes & VIRTUALDISK_ATTRIB_DIRECTORY) { *usedClusters = *numClusters; }
+    return 1;
+}
+
+
 // (Public) Initialize a disk structure with the specified sector size (e.g. 512 bytes)
 char VirtualDiskInit(virtualdisk_t *disk, unsigned short sectorSize)
 {
@@ -134,14 +555,27 @@ char VirtualDiskInit(virtualdisk_t *disk, unsigned short sectorSize)
     // Number of sectors on the virtual drive -- just the MBR to begin with
     disk->sectorCount = 1;
 
+    // No cached generator
+    disk->generatorInfo.generator = NULL;
+    disk->generatorInfo.partial = NULL;
+    disk->generatorInfo.fileInfo = NULL;
+
+    // No file contents generator session
+    disk->session.partition = NULL;
+    disk->session.session = NULL;
+    disk->session.close = NULL;
+
+    // No statistics yet
+    memset(&disk->stats, 0, sizeof(disk->stats));
+
     // Set as initialized
     disk->initialized = 1;
 
     return 1;
 }
 
-// (Public) Initialize a partition structure and add it to the specified disk, with the specified callback for file information , sectors-per-cluster, number of data clusters, and maximum root directory entries.
-char VirtualDiskAddPartition(virtualdisk_t *disk, virtualdisk_partition_t *partition, VirtualDiskFileInfoCallback fileInfoCallback, unsigned char sectorsPerCluster, unsigned long countDataClusters, unsigned short rootDirEntries)
+// (Private) Initialize a partition structure (FAT12/FAT16/FAT32 by the number of clusters, or exFAT) and add it to the specified disk
+static char VirtualDiskPartitionAdd(virtualdisk_t *disk, virtualdisk_partition_t *partition, VirtualDiskFileInfoCallback fileInfoCallback, char exFat, unsigned char sectorsPerCluster, unsigned long countDataClusters, unsigned short rootDirEntries)
 {
     // Check we have space to add the partition
     if (disk->numPartitions >= VIRTUALDISK_MAX_PARTITIONS) { return 0; }    // Too many partitions
@@ -162,38 +596,51 @@ char VirtualDiskAddPartition(virtualdisk_t *disk, virtualdisk_partition_t *parti
         partition->sectorsPerCluster = sectorsPerCluster;   // e.g. 0x40 -- 64 * sector_size = 32Kb clusters
         partition->countDataClusters = countDataClusters;   // e.g. 64768.  Count of the number of data clusters (max cluster entries will be count+2).  FAT16 drive if this is between 4085 and 65524, FAT12 below, and FAT32 above.
         partition->numFat = VIRTUALDISK_DEFAULT_NUM_FAT;    // Number of FAT tables (usually 2, 1 is also supported).
-        partition->rootDirEntries = rootDirEntries;         // Number of root directory entries (ignored on FAT32)
+        partition->rootDirEntries = rootDirEntries;         // Maximum number of root directory entries (FAT32/exFAT: the most the root directory's cluster chain is sized for)
 
         // Calculate FAT type
-        if (partition->countDataClusters < 4085) { partition->fatType = VIRTUALDISK_FAT12; }
+        if (exFat) { partition->fatType = VIRTUALDISK_EXFAT; }
+        else if (partition->countDataClusters < 4085) { partition->fatType = VIRTUALDISK_FAT12; }
         else if(partition->countDataClusters < 65525) { partition->fatType = VIRTUALDISK_FAT16; }
         else { partition->fatType = VIRTUALDISK_FAT32; }
 
         // Calculate region lengths
         partition->sectorsReserved = (partition->fatType == VIRTUALDISK_FAT32) ? 32 : 1;        // Number of reserved sectors on the partition before the FAT, including the boot sector (FAT12/FAT16 at least 1, FAT32 commonly 32)
+        if (partition->fatType == VIRTUALDISK_EXFAT) { partition->sectorsReserved = 24; }       // exFAT: main and backup boot regions (12 sectors each)
         partition->sectorsData = partition->countDataClusters * partition->sectorsPerCluster;   // Number of sectors in the data region
 
         // FAT0 region length (depends on cluster entry size)
         partition->sectorsFat0 = (partition->countDataClusters + 2);
         if (partition->fatType == VIRTUALDISK_FAT12) { partition->sectorsFat0 += (partition->sectorsFat0 >> 1); }
         else if (partition->fatType == VIRTUALDISK_FAT16) { partition->sectorsFat0 <<= 1; }
-        else if (partition->fatType == VIRTUALDISK_FAT32) { partition->sectorsFat0 <<= 2; }
+        else { partition->sectorsFat0 <<= 2; }      // FAT32/exFAT
         partition->sectorsFat0 = (partition->sectorsFat0 + (partition->disk->sectorSize - 1)) / partition->disk->sectorSize;
 
         // Number of sectors for root directory
-        if (partition->fatType == VIRTUALDISK_FAT32)
+        partition->bitmapClusters = 0;
+        partition->upcaseClusters = 0;
+        if (partition->fatType == VIRTUALDISK_FAT32 || partition->fatType == VIRTUALDISK_EXFAT)
         {
-            // None really on FAT32 (root directory stored in the data area with a cluster chain)
+            // None on FAT32/exFAT: the root directory is a cluster chain from cluster 2, only as long as its entries need (at least one cluster) -- the root files' entries are counted, including long filename entries and any volume label, but no more than the maximum number of root entries (so the count is bounded)
+            unsigned long clusterSize = (unsigned long)partition->disk->sectorSize * partition->sectorsPerCluster;
+            unsigned long maximum = (partition->rootDirEntries < VIRTUALDISK_MAX_DIRECTORY_ENTRIES) ? partition->rootDirEntries : VIRTUALDISK_MAX_DIRECTORY_ENTRIES;
             partition->sectorsRootDir = 0;
-#ifdef VIRTUALDISK_HACK_FAT32
-            // HACK: Until subdirectories are supported, use the root directory code from FAT12/16 for FAT32 - round up to to a whole cluster cluster.
-            partition->sectorsRootDir = (((unsigned long)(partition->rootDirEntries * 32) + (partition->disk->sectorSize * partition->sectorsPerCluster - 1)) / partition->disk->sectorSize / partition->sectorsPerCluster) * partition->sectorsPerCluster;
-#endif
+            partition->rootDirClusters = ((VirtualDiskPartitionDirectoryStart(partition, 1) + VirtualDiskPartitionCountRootEntries(partition, maximum)) * 32 + clusterSize - 1) / clusterSize;
+            if (partition->rootDirClusters < 1) { partition->rootDirClusters = 1; }
+
+            // exFAT: followed by the allocation bitmap (one bit per cluster) and up-case table
+            if (partition->fatType == VIRTUALDISK_EXFAT)
+            {
+                partition->bitmapClusters = ((partition->countDataClusters + 7) / 8 + clusterSize - 1) / clusterSize;
+                partition->upcaseClusters = (VIRTUALDISK_EXFAT_UPCASE_BYTES + clusterSize - 1) / clusterSize;
+            }
+            if (partition->rootDirClusters + partition->bitmapClusters + partition->upcaseClusters > partition->countDataClusters) { return 0; }   // ERROR: Root directory does not fit the data clusters
         }
         else
         {
             // Calculate number of sectors of root directory
             partition->sectorsRootDir = ((partition->rootDirEntries * 32) + (partition->disk->sectorSize - 1)) / partition->disk->sectorSize;
+            partition->rootDirClusters = 0;
         }
 
         // Calculate region addresses
@@ -202,8 +649,13 @@ char VirtualDiskAddPartition(virtualdisk_t *disk, virtualdisk_partition_t *parti
         // The virtual partition start and length
         partition->partitionStartSector = 0;        // The number of padding sectors to add before this partition starts
         partition->partitionSizeSectors = partition->regionData + partition->sectorsData;
+        if (partition->fatType == VIRTUALDISK_EXFAT && partition->partitionSizeSectors < (1ul << 20) / partition->disk->sectorSize)
+        {
+            partition->partitionSizeSectors = (1ul << 20) / partition->disk->sectorSize;      // An exFAT volume is at least 1 MB (any sectors after the data region are blank)
+        }
 
-        // Create a file enumerator
+        // Create a file enumerator (no index until one is set)
+        partition->index = NULL;
         VirtualDiskFileEnumeratorInit(&partition->fileEnumerator, partition, partition->fileInfoCallback);
     }
 
@@ -219,123 +671,217 @@ char VirtualDiskAddPartition(virtualdisk_t *disk, virtualdisk_partition_t *parti
 }
 
 
-// (Private) Generate a MBR for a disk
-static unsigned short VirtualDiskGenerateMBR(void *reference, unsigned long sector, unsigned short count, unsigned char *buffer)
+// (Public) Initialize a partition structure and add it to the specified disk, with the specified callback for file information , sectors-per-cluster, number of data clusters, and maximum root directory entries.
+char VirtualDiskAddPartition(virtualdisk_t *disk, virtualdisk_partition_t *partition, VirtualDiskFileInfoCallback fileInfoCallback, unsigned char sectorsPerCluster, unsigned long countDataClusters, unsigned short rootDirEntries)
+{
+    return VirtualDiskPartitionAdd(disk, partition, fileInfoCallback, 0, sectorsPerCluster, countDataClusters, rootDirEntries);
+}
+
+
+// (Public) Initialize an exFAT partition structure and add it to the specified disk, with the specified callback for file information, sectors-per-cluster, number of data clusters, and maximum root directory entries (the root directory is a cluster chain only as large as its entries need, up to this).
+char VirtualDiskAddExFatPartition(virtualdisk_t *disk, virtualdisk_partition_t *partition, VirtualDiskFileInfoCallback fileInfoCallback, unsigned char sectorsPerCluster, unsigned long countDataClusters, unsigned short rootDirEntries)
+{
+    return VirtualDiskPartitionAdd(disk, partition, fileInfoCallback, 1, sectorsPerCluster, countDataClusters, rootDirEntries);
+}
+
+
+// (Private) Generate (part of) a MBR for a disk
+static unsigned short VirtualDiskGenerateMBR(void *reference, unsigned long sector, unsigned short offset, unsigned short length, unsigned char *buffer)
 {
     virtualdisk_t *disk = (virtualdisk_t *)reference;
+    virtualdisk_window_t window;
     int i;
-    if (count <= 0) { return 0; }
+
+    window.buffer = buffer;
+    window.offset = offset;
+    window.length = length;
 
     // Start with a blank
-    memset(buffer, 0, disk->sectorSize);
+    memset(buffer, 0, length);
 
     // Only the first sector on a disk is the MBR (other blank ones could exist before the first partition)
     if (sector == 0)
     {
-        SET_DWORD(buffer + 0x01B8, 0xF58B16F5ul);                               // @0x01B8 Disk signature
+        WINDOW_DWORD(&window, 0x01B8, 0xF58B16F5ul);                            // @0x01B8 Disk signature
     
         // @0x01BE Table of primary partitions (16 bytes/entry x 4 entries)
         for (i = 0; i < 4; i++)
         {
-            unsigned char *p = buffer + 0x01BE + (i * 16);
+            unsigned long p = 0x01BE + (i * 16);
 
             if (i < disk->numPartitions)
             {
-                p[0] = 0x80;                                                    // Status - 0x80 (bootable), 0x00 (not bootable), other (error)
-                SET_CHS(p + 1, 0, 1, 1);                                        // Cylinder-head-sector address of last sector in partition,  hhhhhhhh ccssssss cccccccc CHS=(0,1,1)
+                unsigned char type;
+                WINDOW_BYTE(&window, p + 0, 0x80);                              // Status - 0x80 (bootable), 0x00 (not bootable), other (error)
+                WINDOW_CHS(&window, p + 1, 0, 1, 1);                            // Cylinder-head-sector address of last sector in partition,  hhhhhhhh ccssssss cccccccc CHS=(0,1,1)
                 // Partition type: 0x01 = FAT12; 0x04 = FAT16 <32MB; 0x06 = FAT16 32MB+; 0x0C = FAT32 (FAT32X LBA-access); (0x07 = exFAT)
-                if (disk->partitions[i]->fatType == VIRTUALDISK_FAT32) { p[4] = 0x0c; }
-                else if (disk->partitions[i]->fatType == VIRTUALDISK_FAT12) { p[4] = 0x01; }
-                else if (disk->partitions[i]->partitionSizeSectors <= 0xffff) { p[4] = 0x04; }
-                else { p[4] = 0x06; }
-                SET_CHS(p + 5, 0, 1, 1);  //SET_CHS(p + 5, 1023, 254, 63)       // Cylinder-head-sector address of last sector in partition,  hhhhhhhh ccssssss cccccccc CHS=(1023,254,63)
-                SET_DWORD(p + 8, disk->partitions[i]->partitionStartSector);    // Logical block address of first sector in partition
-                SET_DWORD(p + 12, disk->partitions[i]->partitionSizeSectors);   // Length of partition in sectors (512MB 0x100000 sectors)
+                if (disk->partitions[i]->fatType == VIRTUALDISK_EXFAT) { type = 0x07; }
+                else if (disk->partitions[i]->fatType == VIRTUALDISK_FAT32) { type = 0x0c; }
+                else if (disk->partitions[i]->fatType == VIRTUALDISK_FAT12) { type = 0x01; }
+                else if (disk->partitions[i]->partitionSizeSectors <= 0xffff) { type = 0x04; }
+                else { type = 0x06; }
+                WINDOW_BYTE(&window, p + 4, type);
+                WINDOW_CHS(&window, p + 5, 0, 1, 1);  //WINDOW_CHS(&window, p + 5, 1023, 254, 63)   // Cylinder-head-sector address of last sector in partition,  hhhhhhhh ccssssss cccccccc CHS=(1023,254,63)
+                WINDOW_DWORD(&window, p + 8, disk->partitions[i]->partitionStartSector);    // Logical block address of first sector in partition
+                WINDOW_DWORD(&window, p + 12, disk->partitions[i]->partitionSizeSectors);   // Length of partition in sectors (512MB 0x100000 sectors)
             }
         }
-        SET_WORD(buffer + 0x1fe, 0xaa55);                                       // @0x01FE MBR signature
+        WINDOW_WORD(&window, 0x1fe, 0xaa55);                                    // @0x01FE MBR signature
     }
 
-    return 1;
+    return length;
+}
+
+
+// (Private) Generate (part of) a sector of an exFAT boot region (0 = boot sector, 1-8 = extended boot sectors, 9 = OEM parameters, 10 = reserved, 11 = checksum of the others)
+static void VirtualDiskPartitionExFatBootRegion(virtualdisk_partition_t *partition, unsigned long sector, const virtualdisk_window_t *window)
+{
+    unsigned short sectorSize = partition->disk->sectorSize;
+    unsigned char shift;
+
+    memset(window->buffer, 0, window->length);
+    if (sector == 0)
+    {
+        WINDOW_BYTE(window, 0, 0xeb); WINDOW_BYTE(window, 1, 0x76); WINDOW_BYTE(window, 2, 0x90);  // @0 Jump instruction
+        VirtualDiskWindowCopy(window, 3, "EXFAT   ", 8);                // @3 File system name (then 53 bytes that must be zero)
+        WINDOW_DWORD(window, 64, partition->partitionStartSector);      // @64 Partition offset (8 bytes)
+        WINDOW_DWORD(window, 72, partition->partitionSizeSectors);      // @72 Volume length (8 bytes)
+        WINDOW_DWORD(window, 80, partition->sectorsReserved);           // @80 FAT offset
+        WINDOW_DWORD(window, 84, partition->sectorsFat0);               // @84 FAT length
+        WINDOW_DWORD(window, 88, partition->regionData);                // @88 Cluster heap offset
+        WINDOW_DWORD(window, 92, partition->countDataClusters);         // @92 Cluster count
+        WINDOW_DWORD(window, 96, 2);                                    // @96 First cluster of root directory
+        WINDOW_DWORD(window, 100, partition->binaryId);                 // @100 Volume serial number
+        WINDOW_WORD(window, 104, 0x0100);                               // @104 File system revision (1.00)
+        WINDOW_WORD(window, 106, 0x0000);                               // @106 Volume flags (active FAT 0, clean)
+        for (shift = 0; (1ul << shift) < sectorSize; shift++) { ; }
+        WINDOW_BYTE(window, 108, shift);                                // @108 Bytes per sector (shift)
+        for (shift = 0; (1ul << shift) < partition->sectorsPerCluster; shift++) { ; }
+        WINDOW_BYTE(window, 109, shift);                                // @109 Sectors per cluster (shift)
+        WINDOW_BYTE(window, 110, partition->numFat);                    // @110 Number of FATs (1)
+        WINDOW_BYTE(window, 111, 0x80);                                 // @111 Drive select
+        WINDOW_BYTE(window, 112, 100);                                  // @112 Percent in use (every cluster is marked in use)
+        WINDOW_WORD(window, 0x1fe, 0xaa55);                             // @0x01FE Signature
+    }
+    else if (sector <= 8)
+    {
+        WINDOW_DWORD(window, sectorSize - 4, 0xaa550000ul);             // Extended boot signature (at the end of the sector)
+    }
+    else if (sector == 11)
+    {
+        // Checksum of the other sectors of the boot region (except the volume flags and percent in use), generated a piece at a time, then repeated
+        unsigned char piece[VIRTUALDISK_WINDOW_PIECE];
+        virtualdisk_window_t part;
+        unsigned long checksum = 0, i;
+
+        part.buffer = piece;
+        part.length = sizeof(piece);
+        for (sector = 0; sector < 11; sector++)
+        {
+            for (part.offset = 0; part.offset < sectorSize; part.offset += sizeof(piece))
+            {
+                VirtualDiskPartitionExFatBootRegion(partition, sector, &part);
+                for (i = 0; i < sizeof(piece); i++)
+                {
+                    unsigned long position = part.offset + i;
+                    if (sector == 0 && (position == 106 || position == 107 || position == 112)) { continue; }
+                    checksum = (((checksum & 1) ? 0x80000000ul : 0) + (checksum >> 1) + piece[i]) & 0xfffffffful;
+                }
+            }
+        }
+        for (i = 0; i < window->length; i++) { window->buffer[i] = (unsigned char)(checksum >> (8 * ((window->offset + i) & 3))); }
+    }
 }
 
 
-// (Private) Generate a sector in the reserved area (the first of which will be a boot sector)
-static unsigned short VirtualDiskPartitionGenerateReserved(void *reference, unsigned long sector, unsigned short count, unsigned char *buffer)
+// (Private) Generate (part of) a sector in the reserved area (the first of which will be a boot sector)
+static unsigned short VirtualDiskPartitionGenerateReserved(void *reference, unsigned long sector, unsigned short offset, unsigned short length, unsigned char *buffer)
 {
     virtualdisk_partition_t *partition = (virtualdisk_partition_t *)reference;
+    virtualdisk_window_t window;
+
+    window.buffer = buffer;
+    window.offset = offset;
+    window.length = length;
+
+    // exFAT: the main boot region, then its backup
+    if (partition->fatType == VIRTUALDISK_EXFAT)
+    {
+        VirtualDiskPartitionExFatBootRegion(partition, sector % 12, &window);
+        return length;
+    }
 
     // Reserved sectors are mostly blank
-    memset(buffer, 0, partition->disk->sectorSize);
+    memset(buffer, 0, length);
 
     // First sector in the reserved (first) area of a volume is a boot sector (also 6th sector of FAT32 is the backup boot sector)
     if (sector == 0 || (partition->fatType == VIRTUALDISK_FAT32 && sector == 6))
     {
-        buffer[0] = 0xeb; buffer[1] = 0x3c; buffer[2] = 0x90;           // @0x0000 Jump instruction
-        memcpy(buffer + 3, "MSDOS5.0", 8);                              // @0x0003 OEM Name "MSDOS5.0"
-        SET_WORD(buffer + 11, partition->disk->sectorSize);             // @0x000b Bytes per sector
-        buffer[13] = partition->sectorsPerCluster;                      // @0x000d Sectors per cluster
-        SET_WORD(buffer + 14, partition->sectorsReserved);              // @0x000e Reserved sector count (FAT12/FAT16 at least 1, FAT32 commonly 32)
-        buffer[16] = partition->numFat;                                 // @0x0010 Number of FATs (1)
-        SET_WORD(buffer + 17, (partition->fatType == VIRTUALDISK_FAT32) ? 0x0000 : ((unsigned short)partition->sectorsRootDir * (partition->disk->sectorSize / 32)));  // @0x0011 (FAT12/FAT16) Max number of root directory entries - 32-bytes each entry, 16 files allowed per sector
-        SET_WORD(buffer + 19, (partition->partitionSizeSectors <= 0xffff && partition->fatType != VIRTUALDISK_FAT32) ? (unsigned short)partition->partitionSizeSectors : 0x0000);  // @0x0013 Total sectors (0 = use 4-byte number later)
-        buffer[21] = 0xF8;                                              // @0x0015 Media Descriptor (0xF8-fixed, 0xF0-removable)
-        SET_WORD(buffer + 22, (partition->fatType != VIRTUALDISK_FAT32) ? (unsigned short)partition->sectorsFat0 : 0x0000);    // @0x0016 Sectors per FAT (FAT12/FAT16)
-        SET_WORD(buffer + 24, 0x3f);                                    // @0x0018 Sectors per track
-        SET_WORD(buffer + 26, 0xff);                                    // @0x001a Number of heads
-        SET_DWORD(buffer + 28, partition->partitionStartSector);        // @0x001c Hidden sectors (on disk before boot sector) // HACK: BPB_HiddSec may need to know about *all* other sectors on the drive before this partition (but think it may be largely unused)
-        SET_DWORD(buffer + 32, (partition->partitionSizeSectors > 0xffff || partition->fatType == VIRTUALDISK_FAT32) ? partition->partitionSizeSectors : 0); // @0x0020 Total sectors
+        WINDOW_BYTE(&window, 0, 0xeb); WINDOW_BYTE(&window, 1, 0x3c); WINDOW_BYTE(&window, 2, 0x90);  // @0x0000 Jump instruction
+        VirtualDiskWindowCopy(&window, 3, "MSDOS5.0", 8);              // @0x0003 OEM Name "MSDOS5.0"
+        WINDOW_WORD(&window, 11, partition->disk->sectorSize);          // @0x000b Bytes per sector
+        WINDOW_BYTE(&window, 13, partition->sectorsPerCluster);         // @0x000d Sectors per cluster
+        WINDOW_WORD(&window, 14, partition->sectorsReserved);           // @0x000e Reserved sector count (FAT12/FAT16 at least 1, FAT32 commonly 32)
+        WINDOW_BYTE(&window, 16, partition->numFat);                    // @0x0010 Number of FATs (1)
+        WINDOW_WORD(&window, 17, (partition->fatType == VIRTUALDISK_FAT32) ? 0x0000 : ((unsigned short)partition->sectorsRootDir * (partition->disk->sectorSize / 32)));  // @0x0011 (FAT12/FAT16) Max number of root directory entries - 32-bytes each entry, 16 files allowed per sector
+        WINDOW_WORD(&window, 19, (partition->partitionSizeSectors <= 0xffff && partition->fatType != VIRTUALDISK_FAT32) ? (unsigned short)partition->partitionSizeSectors : 0x0000);  // @0x0013 Total sectors (0 = use 4-byte number later)
+        WINDOW_BYTE(&window, 21, 0xF8);                                 // @0x0015 Media Descriptor (0xF8-fixed, 0xF0-removable)
+        WINDOW_WORD(&window, 22, (partition->fatType != VIRTUALDISK_FAT32) ? (unsigned short)partition->sectorsFat0 : 0x0000);    // @0x0016 Sectors per FAT (FAT12/FAT16)
+        WINDOW_WORD(&window, 24, 0x3f);                                 // @0x0018 Sectors per track
+        WINDOW_WORD(&window, 26, 0xff);                                 // @0x001a Number of heads
+        WINDOW_DWORD(&window, 28, partition->partitionStartSector);     // @0x001c Hidden sectors (on disk before boot sector) // HACK: BPB_HiddSec may need to know about *all* other sectors on the drive before this partition (but think it may be largely unused)
+        WINDOW_DWORD(&window, 32, (partition->partitionSizeSectors > 0xffff || partition->fatType == VIRTUALDISK_FAT32) ? partition->partitionSizeSectors : 0); // @0x0020 Total sectors
         if (partition->fatType == VIRTUALDISK_FAT32)
         {
-            SET_DWORD(buffer + 36, partition->sectorsFat0);             // @36 Sectors in FAT0 (FAT32)
-            SET_WORD(buffer + 40, 0x0000);                              // @40 ExtFlags (b0-3 = active FAT, b7 = only use active FAT, otherwise mirroring to all FATs enabled)
-            SET_WORD(buffer + 42, 0x0000);                              // @42 File-system version (0.0)
-            SET_DWORD(buffer + 44, 2);                                  // @44 Root directory cluster
-            SET_WORD(buffer + 48, 1);                                   // @48 FSINFO sector number within reserved area (usually 1)
-            SET_WORD(buffer + 50, 0);                                   // @50 Non-zero indicates backup boot record sector number within reserved area (usually 6, 0 = none)
-            memset(buffer + 52, 0, 12);                                 // @52 Reserved (12 bytes)
-            buffer[64] = 0x00;                                          // @64 Physical drive number (0x80 = fixed disk, 0x00 = removable)
-            buffer[65] = 0x00;                                          // @65 Reserved (Current Head), bit-0 = dirty, bit-1 = surface scan
-            buffer[66] = 0x29;                                          // @66 Signature (=0x29)
-            SET_DWORD(buffer + 67, partition->binaryId);                // @67 Binary ID (4 bytes) @0x27 @39 {0x01, 0x00, 0x00, 0x00}
-            memcpy(buffer + 71, "NO NAME    ", 11);                     // @71 FAT volume label (11 bytes) @0x2B @43 {'N','O',' ','N','A','M','E',' ',' ',' ',' ',}
-            memcpy(buffer + 82, "FAT32   ", 8);                         // @82 FAT system (8 bytes)
+            WINDOW_DWORD(&window, 36, partition->sectorsFat0);          // @36 Sectors in FAT0 (FAT32)
+            WINDOW_WORD(&window, 40, 0x0000);                           // @40 ExtFlags (b0-3 = active FAT, b7 = only use active FAT, otherwise mirroring to all FATs enabled)
+            WINDOW_WORD(&window, 42, 0x0000);                           // @42 File-system version (0.0)
+            WINDOW_DWORD(&window, 44, 2);                               // @44 Root directory cluster
+            WINDOW_WORD(&window, 48, 1);                                // @48 FSINFO sector number within reserved area (usually 1)
+            WINDOW_WORD(&window, 50, 0);                                // @50 Non-zero indicates backup boot record sector number within reserved area (usually 6, 0 = none)
+            VirtualDiskWindowFill(&window, 52, 0, 12);                  // @52 Reserved (12 bytes)
+            WINDOW_BYTE(&window, 64, 0x00);                             // @64 Physical drive number (0x80 = fixed disk, 0x00 = removable)
+            WINDOW_BYTE(&window, 65, 0x00);                             // @65 Reserved (Current Head), bit-0 = dirty, bit-1 = surface scan
+            WINDOW_BYTE(&window, 66, 0x29);                             // @66 Signature (=0x29)
+            WINDOW_DWORD(&window, 67, partition->binaryId);             // @67 Binary ID (4 bytes) @0x27 @39 {0x01, 0x00, 0x00, 0x00}
+            VirtualDiskWindowCopy(&window, 71, "NO NAME    ", 11);     // @71 FAT volume label (11 bytes) @0x2B @43 {'N','O',' ','N','A','M','E',' ',' ',' ',' ',}
+            VirtualDiskWindowCopy(&window, 82, "FAT32   ", 8);         // @82 FAT system (8 bytes)
         }
         else
         {
-            buffer[36] = 0x00;                                          // @0x0024 Physical drive number (0x80 = fixed disk, 0x00 = removable)
-            buffer[37] = 0x00;                                          // @0x0025 Reserved (Current Head), bit-0 = dirty, bit-1 = surface scan
-            buffer[38] = 0x29;                                          // @0x0026 Signature (=0x29)
-            SET_DWORD(buffer + 39, partition->binaryId);                // @0x0027 Binary ID (4 bytes) @0x27 @39 {0x01, 0x00, 0x00, 0x00}
-            memcpy(buffer + 43, "NO NAME    ", 11);                     // @0x002b FAT volume label (11 bytes) @0x2B @43 {'N','O',' ','N','A','M','E',' ',' ',' ',' ',}
-            memcpy(buffer + 54, (partition->fatType == VIRTUALDISK_FAT12) ? "FAT12   " : "FAT16   ", 8);     // @0x0036 FAT system (8 bytes)
+            WINDOW_BYTE(&window, 36, 0x00);                             // @0x0024 Physical drive number (0x80 = fixed disk, 0x00 = removable)
+            WINDOW_BYTE(&window, 37, 0x00);                             // @0x0025 Reserved (Current Head), bit-0 = dirty, bit-1 = surface scan
+            WINDOW_BYTE(&window, 38, 0x29);                             // @0x0026 Signature (=0x29)
+            WINDOW_DWORD(&window, 39, partition->binaryId);             // @0x0027 Binary ID (4 bytes) @0x27 @39 {0x01, 0x00, 0x00, 0x00}
+            VirtualDiskWindowCopy(&window, 43, "NO NAME    ", 11);     // @0x002b FAT volume label (11 bytes) @0x2B @43 {'N','O',' ','N','A','M','E',' ',' ',' ',' ',}
+            VirtualDiskWindowCopy(&window, 54, (partition->fatType == VIRTUALDISK_FAT12) ? "FAT12   " : "FAT16   ", 8);     // @0x0036 FAT system (8 bytes)
         }
-        SET_WORD(buffer + 0x1fe, 0xaa55);                               // @0x01FE Signature
+        WINDOW_WORD(&window, 0x1fe, 0xaa55);                            // @0x01FE Signature
     }
     else if (partition->fatType == VIRTUALDISK_FAT32 && (sector == 1 || sector == 7))
     {
         // FAT32 FSInfo sector at sector 1 (or 7 for backup)
-        SET_DWORD(buffer + 0, 0x41615252ul);                            // @0 Lead signature for FSInfo sector
-        memset(buffer + 4, 0, 480);                                     // @4 480 reserved zero bytes
-        SET_DWORD(buffer + 484, 0x61417272ul);                          // @484 Signature for FSInfo sector
-        SET_DWORD(buffer + 488, 0xfffffffful);                          // @488 Last known free cluster count (0xffffffff is unknown, could set to 0 on full disk?)
-        SET_DWORD(buffer + 492, 0xfffffffful);                          // @492 Hint for cluster to start looking for free clusters (0xffffffff is no hint, first is 2)
-        memset(buffer + 496, 0, 12);                                    // @496 12 reserved zero bytes
-        SET_DWORD(buffer + 508, 0xaa550000ul);                          // @508 4-byte signature (ends 0x55,0xaa as all others)
+        WINDOW_DWORD(&window, 0, 0x41615252ul);                         // @0 Lead signature for FSInfo sector
+        VirtualDiskWindowFill(&window, 4, 0, 480);                      // @4 480 reserved zero bytes
+        WINDOW_DWORD(&window, 484, 0x61417272ul);                       // @484 Signature for FSInfo sector
+        WINDOW_DWORD(&window, 488, 0xfffffffful);                       // @488 Last known free cluster count (0xffffffff is unknown, could set to 0 on full disk?)
+        WINDOW_DWORD(&window, 492, 0xfffffffful);                       // @492 Hint for cluster to start looking for free clusters (0xffffffff is no hint, first is 2)
+        VirtualDiskWindowFill(&window, 496, 0, 12);                     // @496 12 reserved zero bytes
+        WINDOW_DWORD(&window, 508, 0xaa550000ul);                       // @508 4-byte signature (ends 0x55,0xaa as all others)
     }
     else if (partition->fatType == VIRTUALDISK_FAT32 && (sector == 2 || sector == 8))
     {
         // "Third boot sector" common on FAT32
-        memset(buffer, 0, 510);                                         // Zero bytes
-        SET_WORD(buffer + 0x1fe, 0xaa55);                               // @0x01FE Signature
+        VirtualDiskWindowFill(&window, 0, 0, 510);                      // Zero bytes
+        WINDOW_WORD(&window, 0x1fe, 0xaa55);                            // @0x01FE Signature
     }
 
-    return 1;
+    return length;
 }
 
 
-// (Private) Generate a sector from the FAT
-static unsigned short VirtualDiskPartitionGenerateFAT(void *reference, unsigned long sector, unsigned short count, unsigned char *buffer)
+// (Private) Generate (part of) a sector from the FAT
+static unsigned short VirtualDiskPartitionGenerateFAT(void *reference, unsigned long sector, unsigned short offset, unsigned short length, unsigned char *buffer)
 {
     virtualdisk_partition_t *partition = (virtualdisk_partition_t *)reference;
     // Small FAT12 example:
@@ -352,76 +898,70 @@ static unsigned short VirtualDiskPartitionGenerateFAT(void *reference, unsigned
 	unsigned long entry = 0;
 	unsigned long fatOffset;
 	unsigned long value;
+    unsigned long firstFileCluster = VirtualDiskPartitionFirstFileCluster(partition);
 	unsigned char *p = (unsigned char *)buffer;
 	unsigned int i;
     unsigned char part = 0;     // For FAT12 fragments
-
-    virtualdisk_file_enumerator_t *fileEnumerator = &partition->fileEnumerator;
+    unsigned long runFirst = 0, runClusters = 0, runUsed = 0;   // Cluster run of the most recently found file
 
 	// byte offset within FAT table
 	fatOffset = sector;
-    if (partition->numFat > 1 && fatOffset > partition->sectorsFat0) { fatOffset %= partition->sectorsFat0; }   // Mirror
-    fatOffset *= partition->disk->sectorSize;
+    if (partition->numFat > 1 && fatOffset >= partition->sectorsFat0) { fatOffset %= partition->sectorsFat0; }  // Mirror
+    fatOffset = fatOffset * partition->disk->sectorSize + offset;
 
     if (partition->fatType == VIRTUALDISK_FAT12)
     {
 		// Each entry is 12 bits, write a 3 bytes (2 entries = 24-bits) each iteration
 		// Example if first file is 3kB with 512-byte clusters, FAT12: ff8 fff 003 004 005 006 007 fff
-        part = (fatOffset * 2) % 3; // which byte of the two-entry triplets: aa ba bb ?
-        entry = (fatOffset << 1) + (fatOffset >> 1);    // FAT12
+        part = (unsigned char)(fatOffset % 3);                           // which byte of the two-entry triplets: aa ba bb ?
+        entry = ((fatOffset / 3) << 1) + ((part == 2) ? 1 : 0);         // FAT12: the entry that byte starts in (the second entry of a triplet only starts in its last byte)
     }
     else if (partition->fatType == VIRTUALDISK_FAT16)
     {
 	    // Using FAT16, each entry is 16 bits
 		entry = (fatOffset >> 1);
     }
-    else if (partition->fatType == VIRTUALDISK_FAT32)
+    else
     {
-	    // Using FAT32, each entry is 32 bits
+	    // Using FAT32 (or exFAT), each entry is 32 bits
 		entry = (fatOffset >> 2);
     }
 
-	for (i = 0; i < partition->disk->sectorSize; )
+	for (i = 0; i < length; )
 	{
         if      (entry == 0)           { value = 0x0ffffff8; }  	// Entry 0: Copy of the media descriptor (0xf8), remaining 8-bits set (0xff)
 		else if (entry == 1)           { value = 0x0fffffff; }  	// Entry 1: End of cluster chain marker (bit 15 = last shutdown was clean, bit 14 = no disk I/O errors were detected)
-#ifdef VIRTUALDISK_HACK_FAT32
-        else if (fileEnumerator->partition->fatType == VIRTUALDISK_FAT32 && entry < 2 + (fileEnumerator->partition->sectorsRootDir / fileEnumerator->partition->sectorsPerCluster))
+        else if (entry < firstFileCluster)
         {
-            // HACK: FAT32 root directory cluster chain
-            unsigned long end = 2 + (fileEnumerator->partition->sectorsRootDir / fileEnumerator->partition->sectorsPerCluster);
-            if (entry < end - 1) { value = (entry + 1); }               // Entry 2...(end-1): Next cluster of file
-            else { value = 0x0fffffff; }                            // Entry (end): End of chain (0xffff)
+            // FAT32 root directory cluster chain (exFAT: then the allocation bitmap and up-case table chains)
+            if (entry + 1 == 2 + partition->rootDirClusters || entry + 1 == 2 + partition->rootDirClusters + partition->bitmapClusters || entry + 1 == firstFileCluster)
+            {
+                value = 0x0fffffff;                                 // Entry (end): End of chain
+            }
+            else { value = (entry + 1); }                           // Entry 2...(end-1): Next cluster of root directory
         }
-#endif
-        else if (VirtualDiskFileEnumeratorSeekCluster(fileEnumerator, entry))
+        else if (partition->fatType == VIRTUALDISK_EXFAT) { value = 0; }   // exFAT files are contiguous (marked as having no FAT chain), so have no FAT entries (no need to look up the file)
+        else if ((entry >= runFirst && entry < runFirst + runClusters) || VirtualDiskPartitionFindRun(partition, entry, &runFirst, &runClusters, &runUsed))
         {
-            if (entry < fileEnumerator->firstCluster + fileEnumerator->numClusters - 1)
+            if (entry < runFirst + runUsed - 1)
 		    { 
                 value = (entry + 1);                                // Entry 2...(end-1): Next cluster of file
             }
-            else
+            else if (entry < runFirst + runUsed)
             {
                 value = 0x0fffffff;                                 // Entry (end): End of chain (0xffff)
             }
+            else { value = 0x0ffffff7; }                            // Entry reserved for the file to grow into: Bad sector (0xfff7)
         }
         else { value = 0x0ffffff7; }                                // Entry > (end-1): Bad sector (0xfff7)
 
-        if (partition->fatType == VIRTUALDISK_FAT16)
-        {
-			// Write 16-bit entry
-			p[0] = (unsigned char)value; p[1] = (unsigned char)(value >> 8);
-            p += 2;
-			entry++;
-            i += 2;
-        }
-        else if (partition->fatType == VIRTUALDISK_FAT32)
+        if (partition->fatType == VIRTUALDISK_FAT16 || partition->fatType == VIRTUALDISK_FAT32 || partition->fatType == VIRTUALDISK_EXFAT)
         {
-			// Write 32-bit entry
-			p[0] = (unsigned char)value; p[1] = (unsigned char)(value >> 8); p[2] = (unsigned char)(value >> 16); p[3] = (unsigned char)(value >> 24);
-            p += 4;
+            unsigned int size = (partition->fatType == VIRTUALDISK_FAT16) ? 2 : 4, b;
+            if (partition->fatType == VIRTUALDISK_EXFAT && value >= 0x0ffffff7) { value |= 0xf0000000ul; }   // exFAT uses all 32 bits for the media descriptor and markers
+			// Write 16-bit or 32-bit entry (a partial sector can start or end part way through one)
+            for (b = (unsigned int)((fatOffset + i) % size); b < size && i < length; b++, i++) { *p++ = (unsigned char)(value >> (8 * b)); }
 			entry++;
-            i += 4;
         }
         else if (partition->fatType == VIRTUALDISK_FAT12)
         {
@@ -441,91 +981,905 @@ static unsigned short VirtualDiskPartitionGenerateFAT(void *reference, unsigned
 
 	}
 
-    return 1;
+    return length;
 }
 
 
-// (Private) Generate a sector of directory entries
-static unsigned short VirtualDiskPartitionGenerateDirectory(void *reference, unsigned long sector, unsigned short count, unsigned char *buffer)
+// (Private) Generate (part of) a sector of the exFAT allocation bitmap -- every cluster is marked in use (as the FAT12/FAT16/FAT32 FAT marks clusters not in a file as bad), so it is generated without looking up any files
+static unsigned short VirtualDiskPartitionGenerateBitmap(void *reference, unsigned long sector, unsigned short offset, unsigned short length, unsigned char *buffer)
 {
     virtualdisk_partition_t *partition = (virtualdisk_partition_t *)reference;
-    int entriesPerSector = (partition->disk->sectorSize / 32);
-    int i;
-    virtualdisk_file_enumerator_t *fileEnumerator = &partition->fileEnumerator;
-
-    // Update file enumerator to the current offset
-    VirtualDiskFileEnumeratorSeekId(fileEnumerator, sector * entriesPerSector);   // Calculate first file index for this sector
+    unsigned long firstCluster = (sector * partition->disk->sectorSize + offset) * 8;   // Bit 0 is cluster 2
+    unsigned long i;
 
-    // Start with an empty sector
-    memset(buffer, 0, partition->disk->sectorSize);
-
-    // For each of the file indices in this sector...
-    for (i = 0; i < entriesPerSector; i++)
+    memset(buffer, 0, length);
+    for (i = 0; i < length && firstCluster + (i * 8) < partition->countDataClusters; i++)
     {
-        if (fileEnumerator->hasFile)
-        {
-            const char *s;
-            unsigned char *p;
-            unsigned long cluster;
-            int j;
+        unsigned long remaining = partition->countDataClusters - (firstCluster + (i * 8));
+        buffer[i] = (remaining >= 8) ? 0xff : (unsigned char)((1 << remaining) - 1);
+    }
+    return length;
+}
 
-            p = buffer + (i * 32);
 
-            // Copy filename as expected by FAT
-            memset(p, ' ', 11);
-            s = fileEnumerator->fileInfo.filename;
-            for (j = 0; j < 12; s++)
-            {
-                char c = *s;
-                if (c == '\0') { break; }
-                else if (c == '.') { j = 8; }
-                else
-                {
-                    if (c >= 'a' && c <= 'z') { c = c - 'a' + 'A'; }
+// (Private) Generate (part of) a sector of the exFAT up-case table
+static unsigned short VirtualDiskPartitionGenerateUpcase(void *reference, unsigned long sector, unsigned short offset, unsigned short length, unsigned char *buffer)
+{
+    virtualdisk_partition_t *partition = (virtualdisk_partition_t *)reference;
+    unsigned long i;
 
-                    // Additional checking...
-                    //if (c == 0xE5) { c = 0x05; }
-                    //else if ((c >= 'A' && c <= 'Z') || (c >= '0' && c <= '9') || c == '$' || c == '%' || c == '\'' || c == '-' || c == '_' || c == '@' || c == '~' || c == '`' || c == '!' || c == '(' || c == ')' || c == '{' || c =='}' || c == '^' || c == '#' || c == '&' || c >= 0x80) { ; }
-                    //else { c = '_'; }
+    memset(buffer, 0, length);
+    for (i = 0; i < length; i++)
+    {
+        unsigned long position = sector * partition->disk->sectorSize + offset + i;
+        if (position >= VIRTUALDISK_EXFAT_UPCASE_BYTES) { break; }
+        buffer[i] = (unsigned char)(virtualDiskExFatUpcase[position / 2] >> ((position & 1) ? 8 : 0));
+    }
+    return length;
+}
 
-                    p[j] = (unsigned char)c;
-                    j++;
-                }
-            }
 
-            p[11] = fileEnumerator->fileInfo.attributes;                        // Attributes (+A=0x20,+R=0x01,volume=0x08)
-            p[12] = 0x00;                                                       // Reserved (case information)
-            p[13] = (fileEnumerator->fileInfo.created & 1) ? 100 : 0;           // Create time fine resolution (10ms unit, 0-199)
-            SET_DATETIME_FAT_TIME(p + 14, fileEnumerator->fileInfo.created);    // Create time (00:00) [15-11=H, 10-5=M, 4-0=S/2]
-            SET_DATETIME_FAT_DATE(p + 16, fileEnumerator->fileInfo.created);    // Create date (01/01/10) [15-9=Y, 8-5=M1, 4-0=D1]
-            SET_DATETIME_FAT_DATE(p + 18, fileEnumerator->fileInfo.accessed);   // Last access date (01/01/10) [15-9=Y, 8-5=M1, 4-0=D1]
-            SET_WORD(p + 20, 0x0000);                                           // EA-index
-            SET_DATETIME_FAT_TIME(p + 22, fileEnumerator->fileInfo.modified);   // Last modified time (00:00) [15-11=H, 10-5=M, 4-0=S/2]
-            SET_DATETIME_FAT_DATE(p + 24, fileEnumerator->fileInfo.modified);   // Last modified date (01/01/10) [15-9=Y, 8-5=M1, 4-0=D1]
-            cluster = 0;                                                        // First FAT data cluster is at 2 (0 and 1 are reserved). Zero length files, such as volume labels, set to 0.
-            if (fileEnumerator->fileInfo.size > 0)  //  && !(fileEnumerator->fileInfo.attributes & VIRTUALDISK_ATTRIB_VOLUME))
+// (Private) Write the short name for a long filename: the first (up to six) valid characters before the last dot, a numeric tail (up to six digits), and the first three valid characters after it
+static void VirtualDiskShortName(unsigned char *p, const char *s, unsigned long tail)
+{
+    const char *ext = strrchr(s, '.');
+    unsigned long v;
+    int j, tailLength = 1;
+
+    for (v = tail; v > 0; v /= 10) { tailLength++; }
+    if (ext == s) { ext = NULL; }      // A leading dot does not start an extension
+    memset(p, ' ', 11);
+    for (j = 0; *s != '\0' && s != ext && j < 8 - tailLength && j < 6; s++)
+    {
+        char c = *s;
+        if (c == '.' || c == ' ') { continue; }
+        if (c >= 'a' && c <= 'z') { c = c - 'a' + 'A'; }
+        p[j++] = VirtualDiskShortNameChar(c) ? (unsigned char)c : '_';
+    }
+    if (j == 0) { p[j++] = '_'; }
+    p[j] = '~';
+    for (j += tailLength - 1, v = tail; v > 0; j--, v /= 10) { p[j] = (unsigned char)('0' + (v % 10)); }
+    for (j = 8, s = (ext != NULL) ? ext + 1 : ""; *s != '\0' && j < 11; s++)
+    {
+        char c = *s;
+        if (c == ' ') { continue; }
+        if (c >= 'a' && c <= 'z') { c = c - 'a' + 'A'; }
+        p[j++] = VirtualDiskShortNameChar(c) ? (unsigned char)c : '_';
+    }
+}
+
+
+// (Private) Write a 32-byte FAT directory entry for a file
+static void VirtualDiskPartitionDirectoryEntry(virtualdisk_partition_t *partition, unsigned char *p, const virtualdisk_fileinfo_t *fileInfo, unsigned long firstCluster)
+{
+    const char *s;
+    unsigned long cluster;
+    int j;
+
+    // Copy filename as expected by FAT
+    memset(p, ' ', 11);
+    s = fileInfo->filename;
+    if (VirtualDiskLongNameEntries(fileInfo) > 0)
+    {
+        // Not a valid 8.3 name (it has long filename entries): the tail is the file's id + 1, so generated names in a directory differ without an index (building a complete index then gives each the lowest free tail)
+        VirtualDiskShortName(p, s, (unsigned long)fileInfo->id % 999999 + 1);
+        s = "";
+    }
+    for (j = 0; j < 12; s++)
+    {
+        char c = *s;
+        if (c == '\0') { break; }
+        else if (c == '.') { j = 8; }
+        else
+        {
+            if (c >= 'a' && c <= 'z') { c = c - 'a' + 'A'; }
+
+            // Additional checking...
+            //if (c == 0xE5) { c = 0x05; }
+            //else if ((c >= 'A' && c <= 'Z') || (c >= '0' && c <= '9') || c == '$' || c == '%' || c == '\'' || c == '-' || c == '_' || c == '@' || c == '~' || c == '`' || c == '!' || c == '(' || c == ')' || c == '{' || c =='}' || c == '^' || c == '#' || c == '&' || c >= 0x80) { ; }
+            //else { c = '_'; }
+
+            p[j] = (unsigned char)c;
+            j++;
+        }
+    }
+
+    p[11] = fileInfo->attributes;                           // Attributes (+A=0x20,+R=0x01,volume=0x08)
+    p[12] = (unsigned char)VirtualDiskPartitionFileSizeHigh(partition, fileInfo);  // Reserved (case information) -- on exFAT, holds bits 32-39 of the size
+    p[13] = (fileInfo->created & 1) ? 100 : 0;              // Create time fine resolution (10ms unit, 0-199)
+    SET_DATETIME_FAT_TIME(p + 14, fileInfo->created);       // Create time (00:00) [15-11=H, 10-5=M, 4-0=S/2]
+    SET_DATETIME_FAT_DATE(p + 16, fileInfo->created);       // Create date (01/01/10) [15-9=Y, 8-5=M1, 4-0=D1]
+    SET_DATETIME_FAT_DATE(p + 18, fileInfo->accessed);      // Last access date (01/01/10) [15-9=Y, 8-5=M1, 4-0=D1]
+    SET_WORD(p + 20, 0x0000);                               // EA-index
+    SET_DATETIME_FAT_TIME(p + 22, fileInfo->modified);      // Last modified time (00:00) [15-11=H, 10-5=M, 4-0=S/2]
+    SET_DATETIME_FAT_DATE(p + 24, fileInfo->modified);      // Last modified date (01/01/10) [15-9=Y, 8-5=M1, 4-0=D1]
+    cluster = 0;                                            // First FAT data cluster is at 2 (0 and 1 are reserved). Zero length files, such as volume labels, set to 0.
+    if (fileInfo->size > 0 || p[12] != 0 || (fileInfo->attributes & VIRTUALDISK_ATTRIB_DIRECTORY))  //  && !(fileInfo->attributes & VIRTUALDISK_ATTRIB_VOLUME))
+    {
+        cluster = firstCluster;
+    }
+    SET_WORD(p + 26, (unsigned short)cluster);              // Lower 16-bits of cluster
+    SET_WORD(p + 20, (unsigned short)(cluster >> 16));      // Upper 16-bits of cluster
+    SET_DWORD(p + 28, fileInfo->size);
+}
+
+
+// (Private) Checksum of a short name, as stored in its long filename entries
+static unsigned char VirtualDiskShortNameChecksum(const unsigned char *p)
+{
+    unsigned char sum = 0;
+    int i;
+
+    for (i = 0; i < 11; i++)
+    {
+        sum = (unsigned char)(((sum & 1) << 7) + (sum >> 1) + p[i]);
+    }
+    return sum;
+}
+
+
+// (Private) Up-case a filename character (taken as Latin-1), as the exFAT up-case table does
+static unsigned short VirtualDiskExFatUpcaseChar(unsigned char c)
+{
+    if ((c >= 'a' && c <= 'z') || (c >= 0xe0 && c <= 0xfe && c != 0xf7)) { return (unsigned short)(c - 0x20); }
+    return c;
+}
+
+
+// (Private) Write those of a file's exFAT directory entries (at the specified position in its directory) that fall within the sector starting at 'firstSlot' -- the entry set (file, stream extension, then file name entries; or a volume label entry) is made from the file's FAT directory entry and name, as its checksum covers every entry
+static void VirtualDiskPartitionExFatEntries(virtualdisk_partition_t *partition, unsigned char *buffer, unsigned long firstSlot, unsigned long numSlots, unsigned long dirOffset, unsigned long dirEntries, const unsigned char *dirEntry, unsigned long numClusters, const char *filename)
+{
+    unsigned char set[(2 + (VIRTUALDISK_MAX_FILENAME + 14) / 15) * 32];
+    unsigned long length = 0, i;
+
+    if (filename != NULL) { length = (unsigned long)strlen(filename); }
+    if (length > VIRTUALDISK_MAX_FILENAME) { length = VIRTUALDISK_MAX_FILENAME; }
+    if (dirEntries > sizeof(set) / 32) { dirEntries = sizeof(set) / 32; }
+    memset(set, 0, dirEntries * 32);
+
+    if (dirEntry[11] & VIRTUALDISK_ATTRIB_VOLUME)
+    {
+        // Volume label entry (up to 11 characters)
+        if (length > 11) { length = 11; }
+        set[0] = 0x83;                                              // Entry type: volume label
+        set[1] = (unsigned char)length;                             // Character count
+        for (i = 0; i < length; i++) { SET_WORD(set + 2 + (i * 2), (unsigned char)filename[i]); }
+    }
+    else
+    {
+        unsigned char *stream = set + 32;
+        unsigned long cluster = (unsigned long)dirEntry[26] | ((unsigned long)dirEntry[27] << 8) | ((unsigned long)dirEntry[20] << 16) | ((unsigned long)dirEntry[21] << 24);
+        unsigned long size = GET_DWORD(dirEntry + 28), sizeHigh = dirEntry[12];
+        unsigned short hash = 0, checksum = 0;
+
+        // Sub-directories are the size of their run
+        if (dirEntry[11] & VIRTUALDISK_ATTRIB_DIRECTORY)
+        {
+            size = numClusters * partition->sectorsPerCluster * partition->disk->sectorSize;
+            sizeHigh = 0;
+        }
+
+        // File entry
+        set[0] = 0x85;                                              // Entry type: file
+        set[1] = (unsigned char)(dirEntries - 1);                   // Secondary count
+        SET_WORD(set + 4, dirEntry[11] & 0x37);                     // File attributes (read-only, hidden, system, directory, archive)
+        memcpy(set + 8, dirEntry + 14, 4);                          // Created timestamp (FAT time then date)
+        memcpy(set + 12, dirEntry + 22, 4);                         // Last modified timestamp (FAT time then date)
+        memcpy(set + 18, dirEntry + 18, 2);                         // Last accessed timestamp (date only)
+        set[20] = dirEntry[13];                                     // Created 10ms increment (UTC offsets are zero: local time)
+
+        // Stream extension entry
+        stream[0] = 0xc0;                                           // Entry type: stream extension
+        stream[1] = (cluster != 0) ? 0x03 : 0x01;                   // Flags: allocation possible, no FAT chain (if it has clusters)
+        stream[3] = (unsigned char)length;                          // Name length
+        SET_DWORD(stream + 8, size);                                // Valid data length (8 bytes)
+        SET_DWORD(stream + 12, sizeHigh);
+        SET_DWORD(stream + 20, cluster);                            // First cluster
+        SET_DWORD(stream + 24, size);                               // Data length (8 bytes)
+        SET_DWORD(stream + 28, sizeHigh);
+
+        // File name entries (15 characters each), and the hash of the up-cased name
+        for (i = 0; i < length; i++)
+        {
+            unsigned short c = VirtualDiskExFatUpcaseChar((unsigned char)filename[i]);
+            SET_WORD(set + 64 + (i / 15) * 32 + 2 + (i % 15) * 2, (unsigned char)filename[i]);
+            hash = (unsigned short)(((hash & 1) ? 0x8000 : 0) + (hash >> 1) + (c & 0xff));
+            hash = (unsigned short)(((hash & 1) ? 0x8000 : 0) + (hash >> 1) + (c >> 8));
+        }
+        for (i = 2; i < dirEntries; i++) { set[i * 32] = 0xc1; }       // Entry type: file name
+        SET_WORD(stream + 4, hash);
+
+        // Checksum of the entry set (except the checksum itself)
+        for (i = 0; i < dirEntries * 32; i++)
+        {
+            if (i == 2 || i == 3) { continue; }
+            checksum = (unsigned short)(((checksum & 1) ? 0x8000 : 0) + (checksum >> 1) + set[i]);
+        }
+        SET_WORD(set + 2, checksum);
+    }
+
+    // Copy the entries in the range
+    for (i = 0; i < dirEntries; i++)
+    {
+        unsigned long slot = dirOffset + i;
+        if (slot < firstSlot) { continue; }
+        if (slot >= firstSlot + numSlots) { break; }
+        memcpy(buffer + ((slot - firstSlot) * 32), set + (i * 32), 32);
+    }
+}
+
+
+// (Private) Write those of a file's directory entries (at the specified position in its directory) that fall within the 'numSlots' entries starting at 'firstSlot': the long filename entries, last part first, then the short entry (on exFAT, its entry set)
+static void VirtualDiskPartitionFileEntries(virtualdisk_partition_t *partition, unsigned char *buffer, unsigned long firstSlot, unsigned long numSlots, unsigned long dirOffset, unsigned long dirEntries, const unsigned char *dirEntry, unsigned long numClusters, const char *filename)
+{
+    static const unsigned char offsets[13] = { 1, 3, 5, 7, 9, 14, 16, 18, 20, 22, 24, 28, 30 };     // Positions of the 13 UCS-2 characters in a long filename entry
+    unsigned long length = 0, i;
+
+    if (partition->fatType == VIRTUALDISK_EXFAT)
+    {
+        VirtualDiskPartitionExFatEntries(partition, buffer, firstSlot, numSlots, dirOffset, dirEntries, dirEntry, numClusters, filename);
+        return;
+    }
+
+    if (filename != NULL) { length = (unsigned long)strlen(filename); }
+    if (length > VIRTUALDISK_MAX_FILENAME) { length = VIRTUALDISK_MAX_FILENAME; }
+
+    for (i = 0; i < dirEntries; i++)
+    {
+        unsigned long slot = dirOffset + i;
+        unsigned char *p = buffer + ((slot - firstSlot) * 32);
+
+        if (slot < firstSlot) { continue; }
+        if (slot >= firstSlot + numSlots) { break; }
+
+        if (i + 1 >= dirEntries)
+        {
+            memcpy(p, dirEntry, 32);
+        }
+        else
+        {
+            unsigned long ordinal = dirEntries - 1 - i;             // 1 for the entry with the start of the name
+            unsigned long start = (ordinal - 1) * 13;
+            int j;
+
+            p[0] = (unsigned char)ordinal | ((i == 0) ? 0x40 : 0);  // The first entry holds the last part of the name
+            p[11] = 0x0f;                                           // Attributes (read-only, hidden, system, volume)
+            p[12] = 0x00;                                           // Type
+            p[13] = VirtualDiskShortNameChecksum(dirEntry);         // Checksum of the short name
+            SET_WORD(p + 26, 0x0000);                               // Cluster (always zero)
+            for (j = 0; j < 13; j++)
             {
-                cluster = fileEnumerator->firstCluster;
+                unsigned short c = 0xffff;                                                  // Padding after the terminator
+                if (start + j < length) { c = (unsigned char)filename[start + j]; }         // Characters are taken as Latin-1
+                else if (start + j == length) { c = 0x0000; }                               // Terminator (if there is room)
+                SET_WORD(p + offsets[j], c);
             }
-            SET_WORD(p + 26, (unsigned short)cluster);                           // Lower 16-bits of cluster
-            SET_WORD(p + 20, (unsigned short)(cluster >> 16));                   // Upper 16-bits of cluster
-            SET_DWORD(p + 28, fileEnumerator->fileInfo.size);
         }
+    }
+}
+
+
+// (Private) Write those of an indexed file's directory entries that fall within the 'numSlots' entries starting at 'firstSlot' of its directory (whose contents start at 'baseSlot'), fetching the file information only for a long filename (or any exFAT filename)
+static void VirtualDiskPartitionIndexEntries(virtualdisk_partition_t *partition, unsigned char *buffer, unsigned long firstSlot, unsigned long numSlots, unsigned long baseSlot, const virtualdisk_index_t *index, unsigned long entry)
+{
+    const virtualdisk_index_entry_t *indexEntry = &index->entries[entry];
+    unsigned long dirEntries = GET_DWORD(indexEntry->dirEntries);
+    virtualdisk_fileinfo_t fileInfo;
+    const char *filename = NULL;
+
+    if (dirEntries > 1 || partition->fatType == VIRTUALDISK_EXFAT)
+    {
+        memset(&fileInfo, 0, sizeof(fileInfo));
+        if (VirtualDiskIndexFileInfo(partition, index, entry, &fileInfo)) { filename = fileInfo.filename; }
+    }
+    VirtualDiskPartitionFileEntries(partition, buffer, firstSlot, numSlots, baseSlot + GET_DWORD(indexEntry->dirOffset), dirEntries, indexEntry->dirEntry, GET_DWORD(indexEntry->numClusters), filename);
+}
+
+
+// (Private) Write one of the exFAT root directory's first two entries: the allocation bitmap (slot 0) or up-case table (slot 1) entry
+static void VirtualDiskPartitionExFatRootEntry(virtualdisk_partition_t *partition, unsigned long slot, unsigned char *p)
+{
+    unsigned long checksum = 0, i;
+
+    if (slot == 0)
+    {
+        // Allocation bitmap entry
+        p[0] = 0x81;                                                                    // Entry type: allocation bitmap
+        p[1] = 0x00;                                                                    // Flags (first bitmap)
+        SET_DWORD(p + 20, 2 + partition->rootDirClusters);                              // First cluster
+        SET_DWORD(p + 24, (partition->countDataClusters + 7) / 8);                      // Data length (8 bytes)
+    }
+    else
+    {
+        // Up-case table entry
+        for (i = 0; i < VIRTUALDISK_EXFAT_UPCASE_BYTES; i++)
+        {
+            unsigned char b = (unsigned char)(virtualDiskExFatUpcase[i / 2] >> ((i & 1) ? 8 : 0));
+            checksum = (((checksum & 1) ? 0x80000000ul : 0) + (checksum >> 1) + b) & 0xfffffffful;
+        }
+        p[0] = 0x82;                                                                    // Entry type: up-case table
+        SET_DWORD(p + 4, checksum);                                                     // Table checksum
+        SET_DWORD(p + 20, 2 + partition->rootDirClusters + partition->bitmapClusters);  // First cluster
+        SET_DWORD(p + 24, VIRTUALDISK_EXFAT_UPCASE_BYTES);                              // Data length (8 bytes)
+    }
+}
+
+
+// (Private) Directory entries generator function -- writes the 'numSlots' 32-byte entries of a directory starting at entry position 'firstSlot'
+typedef void (*virtualdisk_entries_generator_t)(void *reference, unsigned long firstSlot, unsigned long numSlots, unsigned char *buffer);
+
+
+// (Private) Generate part of a sector of 32-byte directory entries: whole entries directly into the buffer, and the part of an entry at either end through a single entry
+static unsigned short VirtualDiskGenerateEntries(virtualdisk_entries_generator_t entries, void *reference, unsigned short sectorSize, unsigned long sector, unsigned short offset, unsigned short length, unsigned char *buffer)
+{
+    unsigned long slot = sector * (sectorSize / 32) + offset / 32;
+    unsigned short done = 0;
+
+    while (done < length)
+    {
+        unsigned short within = (unsigned short)((offset + done) % 32);
+        unsigned short remaining = length - done;
+
+        if (within == 0 && remaining >= 32)
+        {
+            entries(reference, slot, remaining / 32, buffer + done);
+            slot += remaining / 32;
+            done += (remaining / 32) * 32;
+        }
+        else
+        {
+            unsigned char entry[32];
+            unsigned short part = 32 - within;
+            if (part > remaining) { part = remaining; }
+            entries(reference, slot, 1, entry);
+            memcpy(buffer + done, entry + within, part);
+            slot++;
+            done += part;
+        }
+    }
+    return length;
+}
+
+
+// (Private) Write a range of root directory entries
+static void VirtualDiskPartitionDirectoryEntries(void *reference, unsigned long firstSlot, unsigned long numSlots, unsigned char *buffer)
+{
+    virtualdisk_partition_t *partition = (virtualdisk_partition_t *)reference;
+    unsigned long base = VirtualDiskPartitionDirectoryStart(partition, 1);     // Position of the first file's entries
+    unsigned long firstFileSlot = (firstSlot > base) ? firstSlot - base : 0;   // First file directory entry position for this range
+    virtualdisk_index_t *index = partition->index;
+    unsigned long rootCount = (index != NULL) ? VirtualDiskIndexRootCount(index) : 0;
+    virtualdisk_file_enumerator_t *fileEnumerator = &partition->fileEnumerator;
+    unsigned long slot;
+
+    // Start with empty entries (exFAT: the allocation bitmap and up-case table entries come first)
+    memset(buffer, 0, numSlots * 32);
+    for (slot = firstSlot; slot < base && slot < firstSlot + numSlots; slot++) { VirtualDiskPartitionExFatRootEntry(partition, slot, buffer + ((slot - firstSlot) * 32)); }
+
+    // If the index covers the range, binary search for its first file, then copy the pre-generated entries
+    if (index != NULL && (index->complete || (rootCount > 0 && firstSlot + numSlots <= base + GET_DWORD(index->entries[rootCount - 1].dirOffset) + GET_DWORD(index->entries[rootCount - 1].dirEntries))))
+    {
+        unsigned long entry;
+        for (entry = VirtualDiskIndexFindSlot(index, 0, rootCount, firstFileSlot); entry < rootCount && base + GET_DWORD(index->entries[entry].dirOffset) < firstSlot + numSlots; entry++)
+        {
+            VirtualDiskPartitionIndexEntries(partition, buffer, firstSlot, numSlots, base, index, entry);
+        }
+        return;
+    }
+
+    // Update file enumerator to the file at the current offset
+    VirtualDiskFileEnumeratorSeekSlot(fileEnumerator, firstFileSlot);
+
+    // For each of the files with entries in this range...
+    while (fileEnumerator->hasFile && base + fileEnumerator->dirOffset < firstSlot + numSlots)
+    {
+        unsigned char dirEntry[32];
+        VirtualDiskPartitionDirectoryEntry(partition, dirEntry, &fileEnumerator->fileInfo, fileEnumerator->firstCluster);
+        VirtualDiskPartitionFileEntries(partition, buffer, firstSlot, numSlots, base + fileEnumerator->dirOffset, fileEnumerator->dirEntries, dirEntry, fileEnumerator->numClusters, fileEnumerator->fileInfo.filename);
 
         // Next file
         VirtualDiskFileEnumeratorNext(fileEnumerator);
-            
     }
+}
+
+
+// (Private) Generate (part of) a sector of directory entries
+static unsigned short VirtualDiskPartitionGenerateDirectory(void *reference, unsigned long sector, unsigned short offset, unsigned short length, unsigned char *buffer)
+{
+    virtualdisk_partition_t *partition = (virtualdisk_partition_t *)reference;
+    return VirtualDiskGenerateEntries(VirtualDiskPartitionDirectoryEntries, reference, partition->disk->sectorSize, sector, offset, length, buffer);
+}
+
+
+// (Private) Write a range of a sub-directory's entries ('.', '..' (FAT only), then its indexed contents)
+static void VirtualDiskPartitionSubdirectoryEntries(void *reference, unsigned long firstSlot, unsigned long numSlots, unsigned char *buffer)
+{
+    virtualdisk_file_enumerator_t *fileEnumerator = (virtualdisk_file_enumerator_t *)reference;
+    virtualdisk_partition_t *partition = fileEnumerator->partition;
+    virtualdisk_index_t *index = partition->index;
+    const virtualdisk_index_entry_t *directory = NULL;
+    unsigned long base = VirtualDiskPartitionDirectoryStart(partition, 0);     // Position of the first file's entries
+    unsigned long firstChild = 0, numChildren = 0, parent = VIRTUALDISK_INDEX_NO_PARENT;
+    unsigned long i;
+
+    // Start with empty entries
+    memset(buffer, 0, numSlots * 32);
+
+    // The directory's contents are only known if it is in the index
+    if (index != NULL && fileEnumerator->entry < index->count)
+    {
+        directory = &index->entries[fileEnumerator->entry];
+        firstChild = GET_DWORD(directory->firstChild);
+        numChildren = GET_DWORD(directory->numChildren);
+        parent = GET_DWORD(directory->parent);
+    }
+
+    for (i = 0; i < numSlots && firstSlot + i < base; i++)
+    {
+        unsigned long slot = firstSlot + i;
+        unsigned char *p = buffer + (i * 32);
+
+        // '.' (this directory) and '..' (the parent directory, cluster 0 for the root)
+        if (slot == 1 && parent != VIRTUALDISK_INDEX_NO_PARENT) { memcpy(p, index->entries[parent].dirEntry, 32); }
+        else if (directory != NULL) { memcpy(p, directory->dirEntry, 32); }
+        else { VirtualDiskPartitionDirectoryEntry(partition, p, &fileEnumerator->fileInfo, fileEnumerator->firstCluster); }
+        if (slot == 1 && parent == VIRTUALDISK_INDEX_NO_PARENT) { SET_WORD(p + 26, 0); SET_WORD(p + 20, 0); }
+        memset(p, ' ', 11);
+        p[0] = '.';
+        if (slot == 1) { p[1] = '.'; }
+    }
+
+    // The directory's contents follow (binary search for the first file with entries in this range)
+    if (numChildren > 0)
+    {
+        unsigned long entry = VirtualDiskIndexFindSlot(index, firstChild, numChildren, (firstSlot > base) ? firstSlot - base : 0);
+        for (; entry < firstChild + numChildren && base + GET_DWORD(index->entries[entry].dirOffset) < firstSlot + numSlots; entry++)
+        {
+            VirtualDiskPartitionIndexEntries(partition, buffer, firstSlot, numSlots, base, index, entry);
+        }
+    }
+}
+
+
+// (Private) Generate (part of) a sector of a sub-directory's entries
+static unsigned short VirtualDiskPartitionGenerateSubdirectory(void *reference, unsigned long sector, unsigned short offset, unsigned short length, unsigned char *buffer)
+{
+    virtualdisk_file_enumerator_t *fileEnumerator = (virtualdisk_file_enumerator_t *)reference;
+    return VirtualDiskGenerateEntries(VirtualDiskPartitionSubdirectoryEntries, reference, fileEnumerator->partition->disk->sectorSize, sector, offset, length, buffer);
+}
+
+
+// (Public) Fill in an index entry for a file with the specified first cluster and directory entry position (returns the number of clusters in the file's run)
+unsigned long VirtualDiskIndexSetEntry(virtualdisk_partition_t *partition, virtualdisk_index_entry_t *entry, const virtualdisk_fileinfo_t *fileInfo, unsigned long firstCluster, unsigned long dirOffset)
+{
+    unsigned long numClusters = VirtualDiskPartitionFileRunClusters(partition, fileInfo);
+    VirtualDiskPartitionDirectoryEntry(partition, entry->dirEntry, fileInfo, firstCluster);
+    SET_DWORD(entry->firstCluster, firstCluster);
+    SET_DWORD(entry->numClusters, numClusters);
+    SET_DWORD(entry->parent, VIRTUALDISK_INDEX_NO_PARENT);
+    SET_DWORD(entry->firstChild, 0);
+    SET_DWORD(entry->numChildren, 0);
+    SET_DWORD(entry->directory, (fileInfo->attributes & VIRTUALDISK_ATTRIB_DIRECTORY) ? (unsigned long)fileInfo->directory : 0);
+    SET_DWORD(entry->dirOffset, dirOffset);
+    SET_DWORD(entry->dirEntries, VirtualDiskFileDirEntries(partition, fileInfo));
+    SET_DWORD(entry->nameHash, VirtualDiskLongNameHash(partition, fileInfo));
+    return numClusters;
+}
+
+
+// (Public) Move an index entry's cluster run and directory entry position by the specified number of clusters and entries
+void VirtualDiskIndexRelocateEntry(virtualdisk_index_entry_t *entry, unsigned long clusterOffset, unsigned long dirOffset)
+{
+    unsigned long firstCluster = GET_DWORD(entry->firstCluster) + clusterOffset;
+    SET_DWORD(entry->firstCluster, firstCluster);
+    SET_DWORD(entry->dirOffset, GET_DWORD(entry->dirOffset) + dirOffset);
+    if (GET_DWORD(entry->dirEntry + 28) > 0 || entry->dirEntry[12] != 0 || (entry->dirEntry[11] & VIRTUALDISK_ATTRIB_DIRECTORY))   // Directory entries of empty files have no cluster
+    {
+        SET_WORD(entry->dirEntry + 26, (unsigned short)firstCluster);
+        SET_WORD(entry->dirEntry + 20, (unsigned short)(firstCluster >> 16));
+    }
+}
+
+
+// (Public) Build a file index for a partition by calling the file information callback for every file (returns non-zero if the index is complete)
+char VirtualDiskPartitionBuildIndex(virtualdisk_partition_t *partition, virtualdisk_index_t *index)
+{
+    virtualdisk_fileinfo_t fileInfo;
+    unsigned long cluster = VirtualDiskPartitionFirstFileCluster(partition);
+    unsigned long slot = 0;
+
+    index->count = 0;
+    index->complete = 0;
+    memset(&fileInfo, 0, sizeof(fileInfo));
+    for (fileInfo.id = 0; ; fileInfo.id++)
+    {
+        if (!VirtualDiskFileInfoCall(partition, VIRTUALDISK_ROOT_DIRECTORY, &fileInfo)) { index->complete = 1; break; }    // No more files
+        if (index->count >= index->capacity) { break; }                                                 // Index full (a partial index is still usable)
+        cluster += VirtualDiskIndexSetEntry(partition, &index->entries[index->count], &fileInfo, cluster, slot);
+        slot += GET_DWORD(index->entries[index->count].dirEntries);
+        index->count++;
+    }
+
+    // Add the contents of any sub-directories
+    if (index->complete) { VirtualDiskIndexBuildDirectories(partition, index); }
+
+    return index->complete;
+}
+
+
+// (Private) Hash of an 11-character short name (or basis name and extension), for the short name hash sets
+static unsigned long VirtualDiskShortNameHash(const unsigned char *name)
+{
+    unsigned long hash = 2166136261ul;
+    int i;
+
+    for (i = 0; i < 11; i++)
+    {
+        hash = ((hash ^ name[i]) * 16777619ul) & 0xfffffffful;
+    }
+    return hash;
+}
+
+
+// (Private) Find a short name in a hash set of index entries (open addressing, entry + 1 per slot, zero if empty), returns the slot holding the name or the empty slot for it
+static unsigned long VirtualDiskShortNameFind(const virtualdisk_index_t *index, const unsigned long *names, unsigned long mask, const unsigned char *name)
+{
+    unsigned long i = VirtualDiskShortNameHash(name) & mask;
+
+    while (names[i] != 0 && memcmp(index->entries[names[i] - 1].dirEntry, name, 11) != 0)
+    {
+        i = (i + 1) & mask;
+    }
+    return i;
+}
+
+
+// (Private) Short name basis (before the numeric tail) and extension, with the next numeric tail to try for it
+typedef struct
+{
+    unsigned char key[11];
+    unsigned long next;
+} virtualdisk_short_basis_t;
+
+
+// (Private) Give each file in a directory's index entries (first to first + count - 1) that has a long filename a unique short name, replacing its tail with the lowest free '~N' for its basis name -- a hash set of the directory's short names, and the next tail for each basis name, keep this linear in the number of files (returns zero if there is not enough memory, leaving the tails from the files' ids)
+static char VirtualDiskIndexUniqueShortNames(virtualdisk_partition_t *partition, virtualdisk_index_t *index, unsigned long first, unsigned long count)
+{
+    virtualdisk_fileinfo_t fileInfo;
+    unsigned long mask, entry;
+    unsigned long *names;
+    virtualdisk_short_basis_t *bases;
+
+    // Hash sets at most half full
+    for (mask = 15; mask < 2 * count; mask = (mask << 1) | 1) { ; }
+    names = (unsigned long *)calloc(mask + 1, sizeof(unsigned long));
+    bases = (virtualdisk_short_basis_t *)calloc(mask + 1, sizeof(virtualdisk_short_basis_t));
+    if (names == NULL || bases == NULL) { free(names); free(bases); return 0; }
+
+    // Names used as they are (valid 8.3 names and volume labels)
+    for (entry = first; entry < first + count; entry++)
+    {
+        if (GET_DWORD(index->entries[entry].dirEntries) <= 1)
+        {
+            unsigned long i = VirtualDiskShortNameFind(index, names, mask, index->entries[entry].dirEntry);
+            if (names[i] == 0) { names[i] = entry + 1; }
+        }
+    }
+
+    // Names with a numeric tail take the next free tail for their basis name
+    for (entry = first; entry < first + count; entry++)
+    {
+        unsigned char *p = index->entries[entry].dirEntry;
+        unsigned long i, n;
+        int basisLength, j;
+
+        if (GET_DWORD(index->entries[entry].dirEntries) <= 1) { continue; }
+
+        // The basis name is before the last '~' (the tail), then the extension -- the whole basis name, as a longer tail from the file's id shortens it
+        if (VirtualDiskIndexFileInfo(partition, index, entry, &fileInfo)) { VirtualDiskShortName(p, fileInfo.filename, 1); }
+        for (basisLength = 7; basisLength > 0 && p[basisLength] != '~'; basisLength--) { ; }
+        {
+            unsigned char key[11];
+            memset(key, ' ', 8);
+            memcpy(key, p, basisLength);
+            memcpy(key + 8, p + 8, 3);
+            for (i = VirtualDiskShortNameHash(key) & mask; bases[i].next != 0 && memcmp(bases[i].key, key, 11) != 0; i = (i + 1) & mask) { ; }
+            if (bases[i].next == 0) { memcpy(bases[i].key, key, 11); bases[i].next = 1; }
+        }
+
+        // Lowest free tail from the basis name's next
+        for (n = bases[i].next; n <= 999999; n++)
+        {
+            unsigned long v;
+            int tailLength = 1, length;
+            for (v = n; v > 0; v /= 10) { tailLength++; }
+            length = (basisLength < 8 - tailLength) ? basisLength : 8 - tailLength;
+            memset(p, ' ', 8);
+            memcpy(p, bases[i].key, length);
+            p[length] = '~';
+            for (j = length + tailLength - 1, v = n; j > length; j--, v /= 10) { p[j] = (unsigned char)('0' + (v % 10)); }
+            if (names[VirtualDiskShortNameFind(index, names, mask, p)] == 0) { break; }
+        }
+        bases[i].next = n + 1;
+        names[VirtualDiskShortNameFind(index, names, mask, p)] = entry + 1;
+    }
+
+    free(names);
+    free(bases);
     return 1;
 }
 
 
-// (Private) Generate a null data sector
-static unsigned short VirtualDiskGenerateNull(void *reference, unsigned long sector, unsigned short count, unsigned char *buffer)
+// (Public) Add the contents of each sub-directory to a complete index of the root directory, give files with long filenames unique short names, and lay out every cluster run (returns non-zero if the index is complete)
+char VirtualDiskIndexBuildDirectories(virtualdisk_partition_t *partition, virtualdisk_index_t *index)
 {
-    virtualdisk_t *disk = (virtualdisk_t *)reference;
-    memset(buffer, 0x00, count * disk->sectorSize);
-    return count;
+    unsigned long rootCount = index->count;
+    unsigned long clusterSize = (unsigned long)partition->sectorsPerCluster * partition->disk->sectorSize;
+    unsigned long entry, cluster;
+    char hasDirectories = 0;
+    unsigned long base = VirtualDiskPartitionDirectoryStart(partition, 0);      // Entries before a sub-directory's contents ('.' and '..' on FAT)
+    char shortNames = (partition->fatType != VIRTUALDISK_EXFAT);       // exFAT has no short names
+
+    if (!index->complete || VirtualDiskIndexRootCount(index) != rootCount) { return index->complete; }    // Root directory not complete, or sub-directories already added
+    if (shortNames) { VirtualDiskIndexUniqueShortNames(partition, index, 0, rootCount); }
+
+    // Breadth-first: each sub-directory's contents are appended to the index, so are themselves visited later in this loop
+    for (entry = 0; entry < index->count; entry++)
+    {
+        virtualdisk_fileinfo_t fileInfo;
+        unsigned long directory = GET_DWORD(index->entries[entry].directory);
+        unsigned long firstChild = index->count;
+        unsigned long slots = 0;
+        char full = 0;
+        int id;
+
+        if (!(index->entries[entry].dirEntry[11] & VIRTUALDISK_ATTRIB_DIRECTORY) || directory == VIRTUALDISK_ROOT_DIRECTORY) { continue; }
+        hasDirectories = 1;
+
+        memset(&fileInfo, 0, sizeof(fileInfo));
+        for (id = 0; ; id++)
+        {
+            fileInfo.id = id;
+            if (!VirtualDiskFileInfoCall(partition, (int)directory, &fileInfo)) { break; }
+            if (index->count >= index->capacity) { full = 1; break; }
+            VirtualDiskIndexSetEntry(partition, &index->entries[index->count], &fileInfo, 0, slots);
+            if (base + slots + GET_DWORD(index->entries[index->count].dirEntries) > VIRTUALDISK_MAX_DIRECTORY_ENTRIES) { break; }    // Directory full
+            slots += GET_DWORD(index->entries[index->count].dirEntries);
+            SET_DWORD(index->entries[index->count].parent, entry);
+            index->count++;
+        }
+
+        // Index full: leave just the root directory (sub-directories appear empty, as without an index)
+        if (full)
+        {
+            index->count = rootCount;
+            index->complete = 0;
+            for (entry = 0; entry < rootCount; entry++)
+            {
+                if (index->entries[entry].dirEntry[11] & VIRTUALDISK_ATTRIB_DIRECTORY)
+                {
+                    SET_DWORD(index->entries[entry].firstChild, 0);
+                    SET_DWORD(index->entries[entry].numChildren, 0);
+                    SET_DWORD(index->entries[entry].numClusters, 1);
+                }
+            }
+            return 0;
+        }
+
+        // The directory's run holds the '.' and '..' entries (FAT only), then its contents (at least one cluster)
+        SET_DWORD(index->entries[entry].firstChild, firstChild);
+        SET_DWORD(index->entries[entry].numChildren, index->count - firstChild);
+        if (shortNames) { VirtualDiskIndexUniqueShortNames(partition, index, firstChild, index->count - firstChild); }
+        SET_DWORD(index->entries[entry].numClusters, (base + slots > 0) ? ((base + slots) * 32 + clusterSize - 1) / clusterSize : 1);
+    }
+
+    // Lay out the cluster runs in index order (unchanged if there are no sub-directories)
+    if (hasDirectories)
+    {
+        cluster = VirtualDiskPartitionFirstFileCluster(partition);
+        for (entry = 0; entry < index->count; entry++)
+        {
+            VirtualDiskIndexRelocateEntry(&index->entries[entry], cluster - GET_DWORD(index->entries[entry].firstCluster), 0);
+            cluster += GET_DWORD(index->entries[entry].numClusters);
+        }
+    }
+
+    return index->complete;
+}
+
+
+// (Public) Use the specified file index for a partition (NULL to remove) -- an incomplete index (e.g. empty) is filled in as files are enumerated
+void VirtualDiskPartitionSetIndex(virtualdisk_partition_t *partition, virtualdisk_index_t *index)
+{
+    partition->index = index;
+
+    // Restart the file enumerator and discard any cached generator (it may refer to the enumerator)
+    VirtualDiskFileEnumeratorSeekId(&partition->fileEnumerator, -1);
+    partition->disk->generatorInfo.generator = NULL;
+    partition->disk->generatorInfo.partial = NULL;
+    partition->disk->generatorInfo.fileInfo = NULL;
+}
+
+
+// (Private) Get the partition sector holding the specified directory entry position in the directory of an index entry (or root directory id)
+static unsigned long VirtualDiskPartitionEntrySector(virtualdisk_partition_t *partition, unsigned long entry, unsigned long slot)
+{
+    virtualdisk_index_t *index = partition->index;
+    unsigned long entriesPerSector = (partition->disk->sectorSize / 32);
+
+    if (index != NULL && entry < index->count)
+    {
+        unsigned long parent = GET_DWORD(index->entries[entry].parent);
+        if (parent != VIRTUALDISK_INDEX_NO_PARENT)
+        {
+            // After the '.' and '..' entries (FAT) in the parent directory's cluster run
+            slot += VirtualDiskPartitionDirectoryStart(partition, 0);
+            return partition->regionData + (GET_DWORD(index->entries[parent].firstCluster) - 2) * partition->sectorsPerCluster + (slot / entriesPerSector);
+        }
+    }
+    slot += VirtualDiskPartitionDirectoryStart(partition, 1);     // After the allocation bitmap and up-case table entries (exFAT)
+    return partition->sectorsReserved + (partition->sectorsFat0 * partition->numFat) + (slot / entriesPerSector);
+}
+
+
+// (Public) Refresh a live file's information (by its directory and position within it, as given to the file information callback) after its size changed within its reserved capacity, outputting the changed disk sector ranges (returns the number of ranges, or zero if the file no longer fits its run or directory entries)
+int VirtualDiskPartitionUpdateFile(virtualdisk_partition_t *partition, int parent, int id, virtualdisk_sector_range_t *ranges, int maxRanges)
+{
+    virtualdisk_file_enumerator_t *fileEnumerator = &partition->fileEnumerator;
+    virtualdisk_index_t *index = partition->index;
+    virtualdisk_fileinfo_t fileInfo;
+    unsigned long entry = (unsigned long)id;        // The file's index entry (the same as its id in the root directory)
+    unsigned long firstCluster, numClusters, oldUsed, newUsed, dirOffset, dirEntries, firstSector, firstByte, lastByte;
+    char indexed;
+    int numRanges = 0, i;
+
+    // A file in a sub-directory is only on the disk through a complete index: find its entry from the directory's entry
+    if (id < 0) { return 0; }
+    if (parent != VIRTUALDISK_ROOT_DIRECTORY)
+    {
+        if (index == NULL || !index->complete) { return 0; }
+        for (entry = 0; entry < index->count; entry++)
+        {
+            if ((index->entries[entry].dirEntry[11] & VIRTUALDISK_ATTRIB_DIRECTORY) && GET_DWORD(index->entries[entry].directory) == (unsigned long)parent) { break; }
+        }
+        if (entry >= index->count || (unsigned long)id >= GET_DWORD(index->entries[entry].numChildren)) { return 0; }
+        entry = GET_DWORD(index->entries[entry].firstChild) + (unsigned long)id;
+    }
+    indexed = (index != NULL && entry < index->count);
+
+    // Current cluster run and size of the file
+    if (indexed)
+    {
+        if (index->entries[entry].dirEntry[11] & VIRTUALDISK_ATTRIB_DIRECTORY) { return 0; }      // A sub-directory's run depends on its contents
+        firstCluster = GET_DWORD(index->entries[entry].firstCluster);
+        numClusters = GET_DWORD(index->entries[entry].numClusters);
+        oldUsed = VirtualDiskPartitionFileClusters(partition, GET_DWORD(index->entries[entry].dirEntry + 28));
+        dirOffset = GET_DWORD(index->entries[entry].dirOffset);
+        dirEntries = GET_DWORD(index->entries[entry].dirEntries);
+    }
+    else if (fileEnumerator->entry == entry && fileEnumerator->hasFile)
+    {
+        firstCluster = fileEnumerator->firstCluster;
+        numClusters = fileEnumerator->numClusters;
+        oldUsed = VirtualDiskPartitionFileClusters(partition, fileEnumerator->fileInfo.size);
+        dirOffset = fileEnumerator->dirOffset;
+        dirEntries = fileEnumerator->dirEntries;
+    }
+    else
+    {
+        // Not cached, so the previous size is unknown (the whole run's chain may have changed)
+        if (!VirtualDiskFileEnumeratorSeekId(fileEnumerator, id)) { return 0; }
+        firstCluster = fileEnumerator->firstCluster;
+        numClusters = fileEnumerator->numClusters;
+        oldUsed = numClusters + 1;
+        dirOffset = fileEnumerator->dirOffset;
+        dirEntries = fileEnumerator->dirEntries;
+    }
+
+    // New file information must still have the same run and number of directory entries (otherwise later files would move)
+    memset(&fileInfo, 0, sizeof(fileInfo));
+    fileInfo.id = id;
+    if (indexed) { if (!VirtualDiskIndexFileInfo(partition, index, entry, &fileInfo)) { return 0; } }
+    else if (!VirtualDiskFileInfoCall(partition, VIRTUALDISK_ROOT_DIRECTORY, &fileInfo)) { return 0; }
+    if (fileInfo.maxSize > 0 && fileInfo.size > fileInfo.maxSize) { return 0; }
+    if ((fileInfo.attributes & VIRTUALDISK_ATTRIB_DIRECTORY) || VirtualDiskPartitionFileRunClusters(partition, &fileInfo) != numClusters) { return 0; }
+    if (VirtualDiskFileDirEntries(partition, &fileInfo) != dirEntries) { return 0; }
+    newUsed = VirtualDiskPartitionFileClusters(partition, fileInfo.size);
+
+    // Update the cached copies of the file information
+    if (indexed)
+    {
+        unsigned char name[11];
+        memcpy(name, index->entries[entry].dirEntry, 11);
+        VirtualDiskPartitionDirectoryEntry(partition, index->entries[entry].dirEntry, &fileInfo, firstCluster);
+        if (dirEntries > 1) { memcpy(index->entries[entry].dirEntry, name, 11); }      // Keep the unique short name
+        SET_DWORD(index->entries[entry].nameHash, VirtualDiskLongNameHash(partition, &fileInfo));
+    }
+    if (fileEnumerator->entry == entry)
+    {
+        fileEnumerator->fileInfo = fileInfo;
+        fileEnumerator->hasFile = 1;
+    }
+
+    // Any session for the file was opened with its previous information
+    if (partition->disk->session.partition == partition && partition->disk->session.parent == fileInfo.parent && partition->disk->session.id == fileInfo.id)
+    {
+        VirtualDiskEndSession(partition->disk);
+    }
+
+    // Discard any cached generator (it may refer to the file enumerator, which may have moved to this file, or to the file's previous information)
+    partition->disk->generatorInfo.generator = NULL;
+    partition->disk->generatorInfo.partial = NULL;
+    partition->disk->generatorInfo.fileInfo = NULL;
+
+    // The directory sectors holding the file's entries
+    if (numRanges < maxRanges)
+    {
+        firstSector = VirtualDiskPartitionEntrySector(partition, entry, dirOffset);
+        ranges[numRanges].firstSector = partition->partitionStartSector + firstSector;
+        ranges[numRanges].count = VirtualDiskPartitionEntrySector(partition, entry, dirOffset + dirEntries - 1) - firstSector + 1;
+        numRanges++;
+    }
+
+    // The FAT sectors (in each FAT) holding the entries between the old and new end of the file's chain (exFAT files have no chain)
+    if (oldUsed != newUsed && numClusters > 0 && partition->fatType != VIRTUALDISK_EXFAT)
+    {
+        unsigned long firstEntry = firstCluster + ((oldUsed < newUsed) ? oldUsed : newUsed);
+        unsigned long lastEntry = firstCluster + ((oldUsed > newUsed) ? oldUsed : newUsed) - 1;
+
+        if (lastEntry >= firstCluster + numClusters) { lastEntry = firstCluster + numClusters - 1; }
+        if (firstEntry > firstCluster) { firstEntry--; }        // The previous end of chain also changes
+        if (partition->fatType == VIRTUALDISK_FAT12) { firstByte = firstEntry + (firstEntry >> 1); lastByte = lastEntry + (lastEntry >> 1) + 1; }
+        else if (partition->fatType == VIRTUALDISK_FAT16) { firstByte = firstEntry << 1; lastByte = (lastEntry << 1) + 1; }
+        else { firstByte = firstEntry << 2; lastByte = (lastEntry << 2) + 3; }
+
+        for (i = 0; i < partition->numFat && numRanges < maxRanges; i++)
+        {
+            ranges[numRanges].firstSector = partition->partitionStartSector + partition->sectorsReserved + (i * partition->sectorsFat0) + (firstByte / partition->disk->sectorSize);
+            ranges[numRanges].count = (lastByte / partition->disk->sectorSize) - (firstByte / partition->disk->sectorSize) + 1;
+            numRanges++;
+        }
+    }
+
+    return numRanges;
+}
+
+
+// (Private) Generate (part of) a null data sector
+static unsigned short VirtualDiskGenerateNull(void *reference, unsigned long sector, unsigned short offset, unsigned short length, unsigned char *buffer)
+{
+    memset(buffer, 0x00, length);
+    return length;
+}
+
+
+// (Private) Close the session of the file whose contents were last generated (if any)
+static void VirtualDiskCloseSession(virtualdisk_t *disk)
+{
+    if (disk->session.partition != NULL && disk->session.close != NULL) { disk->session.close(disk->session.session); }
+    disk->session.partition = NULL;
+    disk->session.session = NULL;
+    disk->session.close = NULL;
+}
+
+
+// (Private) Make a file the one whose contents generator has the session, closing the previous file's session and opening one for the file if it is a different file
+static void VirtualDiskPartitionSelectSession(virtualdisk_partition_t *partition, virtualdisk_fileinfo_t *fileInfo)
+{
+    virtualdisk_session_info_t *session = &partition->disk->session;
+
+    if (session->partition != partition || session->parent != fileInfo->parent || session->id != fileInfo->id)
+    {
+        VirtualDiskCloseSession(partition->disk);
+        session->partition = partition;
+        session->parent = fileInfo->parent;
+        session->id = fileInfo->id;
+        session->session = (fileInfo->open != NULL) ? fileInfo->open(fileInfo) : NULL;
+        session->close = fileInfo->close;
+        session->nextSector = 0;        // A new session starts at the start of the file
+        session->nextOffset = 0;
+    }
+    fileInfo->session = session->session;
 }
 
 
@@ -540,39 +1894,65 @@ static char VirtualDiskPartitionGetGenerator(virtualdisk_partition_t *partition,
 
 	if (sector < addressFAT)                            // ---------- Boot sector ---------- 
 	{
-        generatorInfo->generator = VirtualDiskPartitionGenerateReserved;
+        generatorInfo->partial = VirtualDiskPartitionGenerateReserved;
         generatorInfo->firstSector = 0;
         generatorInfo->lastSector = addressFAT - 1;
         return 1;
     }
 	else if (sector < addressRootDir)                   // ---------- FAT0 contents ---------- 
 	{
-        generatorInfo->generator = VirtualDiskPartitionGenerateFAT;
+        generatorInfo->partial = VirtualDiskPartitionGenerateFAT;
         generatorInfo->firstSector = addressFAT;
         generatorInfo->lastSector = addressRootDir - 1;
         return 1;
 	}
     else if (sector < addressFileContents)              // ---------- Root directory ----------
 	{
-        generatorInfo->generator = VirtualDiskPartitionGenerateDirectory;
+        generatorInfo->partial = VirtualDiskPartitionGenerateDirectory;
         generatorInfo->firstSector = addressRootDir;
         generatorInfo->lastSector = addressFileContents - 1;
         return 1;
 	}
+    else if (sector < addressFileContents + partition->rootDirClusters * partition->sectorsPerCluster)    // ---------- Root directory cluster chain (FAT32) ----------
+    {
+        generatorInfo->partial = VirtualDiskPartitionGenerateDirectory;
+        generatorInfo->firstSector = addressFileContents;
+        generatorInfo->lastSector = addressFileContents + partition->rootDirClusters * partition->sectorsPerCluster - 1;
+        return 1;
+    }
+    else if (sector < addressFileContents + (partition->rootDirClusters + partition->bitmapClusters) * partition->sectorsPerCluster)    // ---------- Allocation bitmap (exFAT) ----------
+    {
+        generatorInfo->partial = VirtualDiskPartitionGenerateBitmap;
+        generatorInfo->firstSector = addressFileContents + partition->rootDirClusters * partition->sectorsPerCluster;
+        generatorInfo->lastSector = addressFileContents + (partition->rootDirClusters + partition->bitmapClusters) * partition->sectorsPerCluster - 1;
+        return 1;
+    }
+    else if (sector < addressFileContents + (partition->rootDirClusters + partition->bitmapClusters + partition->upcaseClusters) * partition->sectorsPerCluster)    // ---------- Up-case table (exFAT) ----------
+    {
+        generatorInfo->partial = VirtualDiskPartitionGenerateUpcase;
+        generatorInfo->firstSector = addressFileContents + (partition->rootDirClusters + partition->bitmapClusters) * partition->sectorsPerCluster;
+        generatorInfo->lastSector = addressFileContents + (partition->rootDirClusters + partition->bitmapClusters + partition->upcaseClusters) * partition->sectorsPerCluster - 1;
+        return 1;
+    }
     else //if (sector < partition->partitionSizeSectors)  // ---------- File contents ----------
 	{
         unsigned long dataCluster = (sector - addressFileContents) / partition->sectorsPerCluster;
-        unsigned short clusterOffset = 2;   // Cluster 'address' needs the two reserved clusters adding
-#ifdef VIRTUALDISK_HACK_FAT32
-        if (partition->fatType == VIRTUALDISK_FAT32)
-        {
-            clusterOffset += (unsigned short)(partition->sectorsRootDir / partition->sectorsPerCluster);
-        }
-#endif
+        const unsigned short clusterOffset = 2;     // Cluster 'address' needs the two reserved clusters adding
         if (VirtualDiskFileEnumeratorSeekCluster(&partition->fileEnumerator, dataCluster + clusterOffset))
         {
-            generatorInfo->reference = &partition->fileEnumerator.fileInfo;
-            generatorInfo->generator = partition->fileEnumerator.fileInfo.contents;
+            if (partition->fileEnumerator.fileInfo.attributes & VIRTUALDISK_ATTRIB_DIRECTORY)
+            {
+                generatorInfo->reference = &partition->fileEnumerator;
+                generatorInfo->partial = VirtualDiskPartitionGenerateSubdirectory;
+            }
+            else
+            {
+                generatorInfo->reference = &partition->fileEnumerator.fileInfo;
+                generatorInfo->generator = partition->fileEnumerator.fileInfo.contents;
+                generatorInfo->partial = partition->fileEnumerator.fileInfo.partial;
+                generatorInfo->fileInfo = &partition->fileEnumerator.fileInfo;
+                VirtualDiskPartitionSelectSession(partition, &partition->fileEnumerator.fileInfo);
+            }
             generatorInfo->firstSector = addressFileContents + ((partition->fileEnumerator.firstCluster - clusterOffset) * partition->sectorsPerCluster);
             generatorInfo->lastSector = addressFileContents + ((partition->fileEnumerator.firstCluster - clusterOffset + partition->fileEnumerator.numClusters) * partition->sectorsPerCluster - 1);
             return 1;
@@ -587,12 +1967,17 @@ static char VirtualDiskPartitionGetGenerator(virtualdisk_partition_t *partition,
 // (Private) Determine which generator function to call for a disk
 static char VirtualDiskGetGenerator(virtualdisk_t *disk, virtualdisk_generator_info_t *generatorInfo, unsigned long sector)
 {
+    unsigned long lastSector = disk->sectorCount - 1;
     int i;
 
+    generatorInfo->generator = NULL;        // Only a file's contents have a whole-sector generator (the other regions generate any part of a sector)
+    generatorInfo->partial = NULL;
+    generatorInfo->fileInfo = NULL;
+
     // Check if it's the MBR
     if (sector <= 0)                        // ---------- Master boot record ---------- 
 	{
-        generatorInfo->generator = VirtualDiskGenerateMBR;
+        generatorInfo->partial = VirtualDiskGenerateMBR;
         generatorInfo->reference = disk;
         generatorInfo->firstSector = sector;
         generatorInfo->lastSector = sector;
@@ -605,7 +1990,7 @@ static char VirtualDiskGetGenerator(virtualdisk_t *disk, virtualdisk_generator_i
         // Blank space before a partition
         if (sector < disk->partitions[i]->partitionStartSector)
         {
-            generatorInfo->generator = VirtualDiskGenerateNull;
+            generatorInfo->partial = VirtualDiskGenerateNull;
             generatorInfo->reference = disk;
             generatorInfo->firstSector = sector;        // Could be earlier
             generatorInfo->lastSector = disk->partitions[i]->partitionStartSector - 1;
@@ -621,15 +2006,16 @@ static char VirtualDiskGetGenerator(virtualdisk_t *disk, virtualdisk_generator_i
                 generatorInfo->lastSector += disk->partitions[i]->partitionStartSector;
                 return 1;
             }
+            lastSector = disk->partitions[i]->partitionStartSector + disk->partitions[i]->partitionSizeSectors - 1;    // Unused space at the end of the partition
             break;
         }
     }
 
-    // Blank space after partitions
-    generatorInfo->generator = (virtualdisk_generator_t)VirtualDiskGenerateNull;
+    // Blank space after partitions (or at the end of a partition)
+    generatorInfo->partial = VirtualDiskGenerateNull;
     generatorInfo->reference = disk;
     generatorInfo->firstSector = sector;                // Could be earlier
-    generatorInfo->lastSector = disk->sectorCount - 1;
+    generatorInfo->lastSector = lastSector;
 
     if (sector >= disk->sectorCount) { return 0; }      // Off the end of the disk
 
@@ -637,72 +2023,286 @@ static char VirtualDiskGetGenerator(virtualdisk_t *disk, virtualdisk_generator_i
 }
 
 
+// (Private) Determine the disk region of a generator (for statistics)
+static VIRTUALDISK_REGION VirtualDiskGeneratorRegion(const virtualdisk_generator_info_t *generatorInfo)
+{
+    if (generatorInfo->fileInfo != NULL) { return VIRTUALDISK_REGION_FILE; }
+    if (generatorInfo->partial == VirtualDiskGenerateMBR) { return VIRTUALDISK_REGION_MBR; }
+    if (generatorInfo->partial == VirtualDiskPartitionGenerateReserved) { return VIRTUALDISK_REGION_RESERVED; }
+    if (generatorInfo->partial == VirtualDiskPartitionGenerateFAT) { return VIRTUALDISK_REGION_FAT; }
+    if (generatorInfo->partial == VirtualDiskPartitionGenerateDirectory) { return VIRTUALDISK_REGION_DIRECTORY; }
+    if (generatorInfo->partial == VirtualDiskPartitionGenerateSubdirectory) { return VIRTUALDISK_REGION_SUBDIRECTORY; }
+    if (generatorInfo->partial == VirtualDiskPartitionGenerateBitmap) { return VIRTUALDISK_REGION_BITMAP; }
+    if (generatorInfo->partial == VirtualDiskPartitionGenerateUpcase) { return VIRTUALDISK_REGION_UPCASE; }
+    return VIRTUALDISK_REGION_BLANK;
+}
+
+
+// (Private) Make the disk's current generator the one for the specified sector (the current one if it covers the sector), returns zero if there is none
+static char VirtualDiskFindGenerator(virtualdisk_t *disk, unsigned long sector)
+{
+    // Check whether we can use the current generator
+    if ((disk->generatorInfo.generator == NULL && disk->generatorInfo.partial == NULL) || sector < disk->generatorInfo.firstSector || sector > disk->generatorInfo.lastSector)
+    {
+#ifdef VIRTUALDISK_DEBUG
+        printf("! GET-GENERATOR\n");
+#endif
+        // If not, find the required generator
+        disk->stats.generatorLookups++;
+        if (!VirtualDiskGetGenerator(disk, &disk->generatorInfo, sector))
+        {
+            // None found
+            disk->generatorInfo.generator = NULL;
+            disk->generatorInfo.partial = NULL;
+        }
+    }
+    else
+    {
+        disk->stats.generatorHits++;
+    }
+    return (disk->generatorInfo.generator != NULL || disk->generatorInfo.partial != NULL);
+}
+
+
+// (Private) Add a read's latency to the statistics histogram (bucket by the number of significant bits)
+static void VirtualDiskRecordLatency(virtualdisk_t *disk, unsigned long started)
+{
+    if (disk->stats.clock != NULL)
+    {
+        unsigned long elapsed = disk->stats.clock() - started;
+        int bucket = 0;
+        while (bucket < VIRTUALDISK_LATENCY_BUCKETS - 1 && (elapsed >> bucket) != 0) { bucket++; }
+        disk->stats.latency[bucket]++;
+        if (elapsed > disk->stats.maxLatency) { disk->stats.maxLatency = elapsed; }
+    }
+}
+
+
 // (Public) Read the specified number of (contiguous) sectors from the disk to the user-supplied buffer
 unsigned short VirtualDiskReadSectors(virtualdisk_t *disk, unsigned long sector, unsigned short count, void *buffer)
 {
-    unsigned short totalSectors = 0;
+    unsigned short totalSectors = 0;                // Sectors generated (not counting any read as errors)
+    unsigned long started;
 
     if (!disk->initialized) { return 0; }
+    disk->stats.reads++;
+    started = (disk->stats.clock != NULL) ? disk->stats.clock() : 0;
 
     // While we still have sectors to read
     while (count > 0)
     {
         unsigned short contiguous;
 
-        // Check whether we can use the current generator
-        if (disk->generatorInfo.generator == NULL || sector < disk->generatorInfo.firstSector || sector > disk->generatorInfo.lastSector)
-        {
-#ifdef VIRTUALDISK_DEBUG
-            printf("! GET-GENERATOR\n");
-#endif
-            // If not, find the required generator
-            if (!VirtualDiskGetGenerator(disk, &disk->generatorInfo, sector))
-            {
-                // None found
-                disk->generatorInfo.generator = NULL;
-            }
-        }
-
         // If a generator was found
-        if (disk->generatorInfo.generator != NULL)
+        if (VirtualDiskFindGenerator(disk, sector))
         {
 #ifdef VIRTUALDISK_DEBUG
             const char *label = "?";
-            if (disk->generatorInfo.generator == VirtualDiskGenerateMBR) { label = "MBR"; }
-            else if (disk->generatorInfo.generator == VirtualDiskPartitionGenerateReserved) { label = "Reserved"; }
-            else if (disk->generatorInfo.generator == VirtualDiskPartitionGenerateFAT) { label = "FAT"; }
-            else if (disk->generatorInfo.generator == VirtualDiskPartitionGenerateDirectory) { label = "Directory"; }
-            else if (disk->generatorInfo.generator == VirtualDiskGenerateNull) { label = "Null"; }
+            if (disk->generatorInfo.partial == VirtualDiskGenerateMBR) { label = "MBR"; }
+            else if (disk->generatorInfo.partial == VirtualDiskPartitionGenerateReserved) { label = "Reserved"; }
+            else if (disk->generatorInfo.partial == VirtualDiskPartitionGenerateFAT) { label = "FAT"; }
+            else if (disk->generatorInfo.partial == VirtualDiskPartitionGenerateDirectory) { label = "Directory"; }
+            else if (disk->generatorInfo.partial == VirtualDiskPartitionGenerateSubdirectory) { label = "Subdirectory"; }
+            else if (disk->generatorInfo.partial == VirtualDiskPartitionGenerateBitmap) { label = "Bitmap"; }
+            else if (disk->generatorInfo.partial == VirtualDiskPartitionGenerateUpcase) { label = "Upcase"; }
+            else if (disk->generatorInfo.partial == VirtualDiskGenerateNull) { label = "Null"; }
             else { label = "Data?"; }
             printf("GENERATE: #%ld - @%ld = %s(%ld/%ld)\n", sector, disk->generatorInfo.firstSector, label, sector - disk->generatorInfo.firstSector, disk->generatorInfo.lastSector - disk->generatorInfo.firstSector);
 #endif
-            // Generate sectors
-            contiguous = disk->generatorInfo.generator(disk->generatorInfo.reference, sector - disk->generatorInfo.firstSector, count, buffer);
+            // Tell a file's contents generator its session, and whether the read continues from the previous one
+            if (disk->generatorInfo.fileInfo != NULL)
+            {
+                disk->generatorInfo.fileInfo->session = disk->session.session;
+                disk->generatorInfo.fileInfo->continuation = (sector - disk->generatorInfo.firstSector == disk->session.nextSector && disk->session.nextOffset == 0);
+            }
+
+            // Generate sectors (a file's contents no further than its run, so they cannot run into the next file's)
+            contiguous = count;
+            if (disk->generatorInfo.fileInfo != NULL && sector + count - 1 > disk->generatorInfo.lastSector) { contiguous = (unsigned short)(disk->generatorInfo.lastSector - sector + 1); }
+            if (disk->generatorInfo.generator != NULL)
+            {
+                contiguous = disk->generatorInfo.generator(disk->generatorInfo.reference, sector - disk->generatorInfo.firstSector, contiguous, buffer);
+            }
+            else
+            {
+                // The other regions are generated a whole sector at a time, and one sector per call (except blank space)
+                unsigned short generated;
+                if (disk->generatorInfo.partial != VirtualDiskGenerateNull) { contiguous = 1; }
+                for (generated = 0; generated < contiguous; generated++)
+                {
+                    if (!disk->generatorInfo.partial(disk->generatorInfo.reference, sector - disk->generatorInfo.firstSector + generated, 0, disk->sectorSize, (unsigned char *)buffer + (generated * disk->sectorSize))) { break; }
+                }
+                contiguous = generated;
+            }
+            if (disk->generatorInfo.fileInfo != NULL && contiguous > 0) { disk->session.nextSector = sector - disk->generatorInfo.firstSector + contiguous; disk->session.nextOffset = 0; }
+            if (contiguous > 0) { disk->stats.sectors[VirtualDiskGeneratorRegion(&disk->generatorInfo)] += contiguous; }
         } 
         else 
         { 
             contiguous = 0; 
         }
 
-        // If no sectors could be generated, that's an error
+        // If no sectors could be generated, that's an error the caller is told of (by the count returned)
         if (contiguous <= 0)
         {
             // Skip this sector
             contiguous = 1;
             memset(buffer, 0xff, disk->sectorSize * contiguous);
+            disk->stats.sectors[VIRTUALDISK_REGION_ERROR]++;
+        }
+        else
+        {
+            totalSectors += contiguous;
         }
 
         // Adjust for next request, based on the sectors generated
-        totalSectors += contiguous;
         count -= contiguous;
         sector += contiguous;
         buffer = (unsigned char *)buffer + (contiguous * disk->sectorSize);
     }
 
+    VirtualDiskRecordLatency(disk, started);
     return totalSectors;
 }
 
 
+// (Public) Read part of a virtual sector into a memory buffer
+unsigned short VirtualDiskReadPartial(virtualdisk_t *disk, unsigned long sector, unsigned short offset, unsigned short length, void *buffer)
+{
+    char generated = 0;
+    char complete = (offset + length == disk->sectorSize);  // Whether the read completes the sector (counted in the statistics)
+    unsigned long started;
+
+    if (!disk->initialized || length == 0 || offset >= disk->sectorSize || length > disk->sectorSize - offset) { return 0; }
+    disk->stats.reads++;
+    started = (disk->stats.clock != NULL) ? disk->stats.clock() : 0;
+
+    if (VirtualDiskFindGenerator(disk, sector))
+    {
+        unsigned long fileSector = sector - disk->generatorInfo.firstSector;
+
+        // Tell a file's contents generator its session, and whether the read continues from the previous one
+        if (disk->generatorInfo.fileInfo != NULL)
+        {
+            disk->generatorInfo.fileInfo->session = disk->session.session;
+            disk->generatorInfo.fileInfo->continuation = (fileSector == disk->session.nextSector && offset == disk->session.nextOffset);
+        }
+
+        // Generate the part (a whole-sector generator can only be used for the whole sector)
+        if (disk->generatorInfo.partial != NULL)
+        {
+            generated = (disk->generatorInfo.partial(disk->generatorInfo.reference, fileSector, offset, length, (unsigned char *)buffer) > 0);
+        }
+        else if (offset == 0 && complete)
+        {
+            generated = (disk->generatorInfo.generator(disk->generatorInfo.reference, fileSector, 1, (unsigned char *)buffer) > 0);
+        }
+
+        if (disk->generatorInfo.fileInfo != NULL && generated)
+        {
+            disk->session.nextSector = complete ? fileSector + 1 : fileSector;
+            disk->session.nextOffset = complete ? 0 : offset + length;
+        }
+        if (generated && complete) { disk->stats.sectors[VirtualDiskGeneratorRegion(&disk->generatorInfo)]++; }
+    }
+
+    // If the part could not be generated (including a part of a file with no partial generator), that's an error the caller is told of
+    if (!generated)
+    {
+        memset(buffer, 0xff, length);
+        if (complete) { disk->stats.sectors[VIRTUALDISK_REGION_ERROR]++; }
+    }
+
+    VirtualDiskRecordLatency(disk, started);
+    return generated ? length : 0;
+}
+
+
+// (Public) Count the sectors from the specified sector that are generated alike (to the end of a file's run, a metadata region, or blank space), and whether they are blank (all zero) -- e.g. to answer a host's allocation queries without generating them; returns zero beyond the end of the disk
+unsigned long VirtualDiskSectorExtent(virtualdisk_t *disk, unsigned long sector, char *blank)
+{
+    unsigned long lastSector;
+
+    *blank = 0;
+    if (!disk->initialized || sector >= disk->sectorCount) { return 0; }
+    if (!VirtualDiskFindGenerator(disk, sector)) { return 1; }
+    *blank = (disk->generatorInfo.partial == VirtualDiskGenerateNull);
+    lastSector = disk->generatorInfo.lastSector;
+    if (lastSector >= disk->sectorCount) { lastSector = disk->sectorCount - 1; }
+    return lastSector - sector + 1;
+}
+
+
+// (Public) Make a separate read context for a disk (e.g. one per thread), with caller-supplied memory for copies of its partitions (VIRTUALDISK_MAX_PARTITIONS)
+char VirtualDiskCopy(virtualdisk_t *copy, virtualdisk_partition_t *partitions, const virtualdisk_t *disk)
+{
+    int i;
+
+    if (!disk->initialized) { return 0; }
+    *copy = *disk;
+
+    for (i = 0; i < disk->numPartitions; i++)
+    {
+        partitions[i] = *disk->partitions[i];
+        partitions[i].disk = copy;
+        if (partitions[i].index != NULL && !partitions[i].index->complete) { partitions[i].index = NULL; }     // Shared only once complete (reads would otherwise add to it)
+        VirtualDiskFileEnumeratorInit(&partitions[i].fileEnumerator, &partitions[i], partitions[i].fileInfoCallback);
+        copy->partitions[i] = &partitions[i];
+    }
+
+    // Nothing cached, no session and no statistics yet
+    copy->generatorInfo.generator = NULL;
+    copy->generatorInfo.partial = NULL;
+    copy->generatorInfo.fileInfo = NULL;
+    copy->session.partition = NULL;
+    copy->session.session = NULL;
+    copy->session.close = NULL;
+    VirtualDiskResetStats(copy);
+
+    return 1;
+}
+
+
+// (Public) Close any open file contents generator session (e.g. when the host releases the disk)
+void VirtualDiskEndSession(virtualdisk_t *disk)
+{
+    VirtualDiskCloseSession(disk);
+    if (disk->generatorInfo.fileInfo != NULL) { disk->generatorInfo.generator = NULL; disk->generatorInfo.partial = NULL; }     // A cached file contents generator would otherwise run without its session
+}
+
+
+// (Public) Set a clock function to measure read latencies for the statistics (NULL for none)
+void VirtualDiskSetClock(virtualdisk_t *disk, VirtualDiskClockCallback clock)
+{
+    disk->stats.clock = clock;
+}
+
+
+// (Public) Reset the statistics of a disk
+void VirtualDiskResetStats(virtualdisk_t *disk)
+{
+    VirtualDiskClockCallback clock = disk->stats.clock;
+    memset(&disk->stats, 0, sizeof(disk->stats));
+    disk->stats.clock = clock;
+}
+
+
+// (Public) Add the statistics of another context to a disk's (e.g. a copy's, when its thread finishes with it)
+void VirtualDiskAddStats(virtualdisk_t *disk, const virtualdisk_t *from)
+{
+    int i;
+
+    disk->stats.reads += from->stats.reads;
+    for (i = 0; i < VIRTUALDISK_REGION_COUNT; i++) { disk->stats.sectors[i] += from->stats.sectors[i]; }
+    disk->stats.generatorLookups += from->stats.generatorLookups;
+    disk->stats.generatorHits += from->stats.generatorHits;
+    disk->stats.enumeratorResets += from->stats.enumeratorResets;
+    disk->stats.fileInfoCalls += from->stats.fileInfoCalls;
+    for (i = 0; i < VIRTUALDISK_LATENCY_BUCKETS; i++) { disk->stats.latency[i] += from->stats.latency[i]; }
+    if (from->stats.maxLatency > disk->stats.maxLatency) { disk->stats.maxLatency = from->stats.maxLatency; }
+}
+
+
 // (Public) Query the size (bytes) of each sector of the disk
 unsigned short VirtualDiskSectorSize(virtualdisk_t *disk)
 {
@@ -13,6 +13,9 @@ extern "C" {
 // Fixed values
 #define VIRTUALDISK_MAX_PARTITIONS 4                    // Maximum number of primary partitions on the disk (must be 1-4)
 #define VIRTUALDISK_DEFAULT_NUM_FAT 1                   // Number of FAT tables (1 is acceptable on removable media, but traditionally 2)
+#define VIRTUALDISK_MAX_DIRECTORY_ENTRIES 65536         // Maximum number of entries in a sub-directory (FAT limit, including the '.' and '..' entries)
+#define VIRTUALDISK_ROOT_DIRECTORY 0                    // Parent identifier of files in the root directory
+#define VIRTUALDISK_MAX_FILENAME 255                    // Maximum length of a long filename (longer names are truncated)
 
 // Defaults for initialization
 #define VIRTUALDISK_DEFAULT_SECTORS_PER_CLUSTER 0x40    // 0x40 -- 64 * sector_size = 32Kb clusters
@@ -22,6 +25,7 @@ extern "C" {
 
 // Declaration
 struct virtualdisk_fileinfo_struct_t;
+struct virtualdisk_fileinfo_t_struct;
 struct virtualdisk_partition_struct_t;
 
 // Date/time type -- not exactly as FAT's, but shifted up by one to include exact seconds, and years are stored from 2000 rather than 1980.
@@ -40,27 +44,79 @@ struct virtualdisk_partition_struct_t;
 // (Public) sector generator function
 typedef unsigned short (*virtualdisk_generator_t)(void *reference, unsigned long sector, unsigned short count, unsigned char *buffer);
 
+// (Public) Partial sector generator function -- generates 'length' bytes from byte 'offset' of a sector (so a sector can be streamed in pieces smaller than a sector), returns the length generated (zero on failure)
+typedef unsigned short (*virtualdisk_partial_generator_t)(void *reference, unsigned long sector, unsigned short offset, unsigned short length, unsigned char *buffer);
+
+// (Public) Optional session hooks for a stateful file contents generator (e.g. a decompressor): open a session before a file's contents are generated (returning the session, or NULL), and close it once another file's contents are generated
+typedef void *(*virtualdisk_session_open_t)(const struct virtualdisk_fileinfo_t_struct *fileInfo);
+typedef void (*virtualdisk_session_close_t)(void *session);
+
 // (Public) File information structure
 typedef struct virtualdisk_fileinfo_t_struct
 {
     // Set by caller
-    int id;                                     // Unique numeric identifier
+    int id;                                     // Unique numeric identifier (position within the parent directory)
+    int parent;                                 // Identifier of the parent directory (VIRTUALDISK_ROOT_DIRECTORY, or a sub-directory's 'directory' value)
 
     // Set by callee
-    const char *filename;                       // Pointer to filename
+    const char *filename;                       // Pointer to filename (a name that is not a valid 8.3 name also gets VFAT long filename entries)
     unsigned long size;                         // File size (bytes)
+    unsigned long maxSize;                      // Reserved capacity (bytes) for a live file to grow into without moving later files (0 = none)
+    unsigned long sizeHigh;                     // (exFAT) Upper 32 bits of the file size, for files of 4 GiB or more (up to 0xff, just under 1 TiB: a larger value ends the directory listing); ignored on FAT12/FAT16/FAT32
     unsigned char attributes;                   // File attributes
+    int directory;                              // For a sub-directory (VIRTUALDISK_ATTRIB_DIRECTORY): non-zero identifier passed as 'parent' to list its contents
     unsigned long modified;                     // Modified date/time
     unsigned long created;                      // Created date/time
     unsigned long accessed;                     // Accessed date/time
     virtualdisk_generator_t contents;           // Function to generate file contents
     void *reference;                            // User-supplied reference for file generator
+    virtualdisk_partial_generator_t partial;    // Optional function to generate part of a sector of the file's contents, for VirtualDiskReadPartial() (NULL if none: the contents are then only read as whole sectors)
+    virtualdisk_session_open_t open;            // Optional function to open a session for the file's contents generator (NULL if none)
+    virtualdisk_session_close_t close;          // Optional function to close the session (NULL if none)
+
+    // Set by the disk while generating the file's contents
+    void *session;                              // Session opened for the file (NULL if none)
+    char continuation;                          // Non-zero if the read starts where the previous read of the file in this session ended (at the start of the file, for a new session), so a stream can continue without seeking
 } virtualdisk_fileinfo_t;
 
 // (Public) Type of the callback function to get file information
 typedef char (*VirtualDiskFileInfoCallback)(virtualdisk_fileinfo_t *);
 
 
+// (Public) File index entry -- fixed little-endian byte layout (no padding) so that an index can be persisted and memory-mapped directly
+typedef struct
+{
+    unsigned char dirEntry[32];                     // Pre-generated FAT directory entry (8.3 name, attributes, timestamps, first cluster, size -- on exFAT, the size's upper bits are in the reserved byte 12)
+    unsigned char firstCluster[4];                  // First cluster of the file's run (also set for empty files, for searching)
+    unsigned char numClusters[4];                   // Number of clusters in the file's run
+    unsigned char parent[4];                        // Entry of the parent directory (0xffffffff for the root directory)
+    unsigned char firstChild[4];                    // For a sub-directory: entry of its first child
+    unsigned char numChildren[4];                   // For a sub-directory: number of children (zero if its contents are not indexed)
+    unsigned char directory[4];                     // For a sub-directory: its identifier (from the file information)
+    unsigned char dirOffset[4];                     // Position of the file's first directory entry among its directory's contents (a prefix sum of the files' entry counts)
+    unsigned char dirEntries[4];                    // Number of directory entries for the file (its long filename entries, if any, then its short entry)
+    unsigned char nameHash[4];                      // Hash of the long filename (zero if none) -- the long filename entries are not stored
+} virtualdisk_index_entry_t;
+
+
+// (Public) File index -- optional per-partition table of file cluster runs and directory entries (avoids walking the file information callback)
+typedef struct
+{
+    virtualdisk_index_entry_t *entries;             // Index entries (caller-supplied memory, or memory-mapped)
+    unsigned long capacity;                         // Maximum number of entries
+    unsigned long count;                            // Number of valid entries
+    char complete;                                  // Non-zero if the index covers every file on the partition
+} virtualdisk_index_t;
+
+
+// (Public) A range of sectors on the disk
+typedef struct
+{
+    unsigned long firstSector;                      // First sector
+    unsigned long count;                            // Number of sectors
+} virtualdisk_sector_range_t;
+
+
 // (Private) File enumerator
 typedef struct
 {
@@ -70,6 +126,9 @@ typedef struct
     virtualdisk_fileinfo_t fileInfo;                // File information for the current file
     unsigned long firstCluster;                     // First cluster index
     unsigned long numClusters;                      // Number of clusters
+    unsigned long entry;                            // Index entry of the current file (for the root directory, the same as the id)
+    unsigned long dirOffset;                        // Position of the current file's first directory entry in its directory
+    unsigned long dirEntries;                       // Number of directory entries for the current file (zero if no file)
 } virtualdisk_file_enumerator_t;
 
 
@@ -83,16 +142,66 @@ typedef struct
     unsigned long firstSector;
     unsigned long lastSector;
 
-    // Generator function
+    // Generator function (NULL if the generator only has a partial sector function)
     virtualdisk_generator_t generator;
 
+    // Partial sector generator function (NULL if none)
+    virtualdisk_partial_generator_t partial;
+
+    // File information, if the generator is a file's contents (NULL otherwise)
+    virtualdisk_fileinfo_t *fileInfo;
+
 } virtualdisk_generator_info_t;
 
 
+// (Private) Session of the file whose contents were last generated
+typedef struct
+{
+    struct virtualdisk_partition_struct_t *partition;   // Partition of the file (NULL if there is no session)
+    int parent;                                     // Parent directory identifier of the file
+    int id;                                         // Identifier of the file
+    void *session;                                  // Session returned by the file's open function (NULL if none)
+    virtualdisk_session_close_t close;              // File's close function (NULL if none)
+    unsigned long nextSector;                       // File sector following the previous read of the file (or the sector it ended within)
+    unsigned short nextOffset;                      // Byte offset within that sector that the previous read ended at (non-zero only after a partial sector read)
+
+} virtualdisk_session_info_t;
+
+
+// Regions of the disk, for statistics
+typedef enum
+{
+    VIRTUALDISK_REGION_MBR, VIRTUALDISK_REGION_RESERVED, VIRTUALDISK_REGION_FAT, VIRTUALDISK_REGION_DIRECTORY, VIRTUALDISK_REGION_SUBDIRECTORY,
+    VIRTUALDISK_REGION_BITMAP, VIRTUALDISK_REGION_UPCASE, VIRTUALDISK_REGION_FILE, VIRTUALDISK_REGION_BLANK, VIRTUALDISK_REGION_ERROR,
+    VIRTUALDISK_REGION_COUNT
+} VIRTUALDISK_REGION;
+
+// Number of read latency histogram buckets (bucket n counts reads taking from 2^(n-1) to 2^n - 1 clock ticks, bucket 0 those taking none)
+#define VIRTUALDISK_LATENCY_BUCKETS 32
+
+// (Public) Type of the optional clock function for read latency statistics (any monotonic tick, e.g. microseconds)
+typedef unsigned long (*VirtualDiskClockCallback)(void);
+
+// (Private) Live statistics of a disk
+typedef struct
+{
+    unsigned long reads;                            // Number of calls to read sectors
+    unsigned long sectors[VIRTUALDISK_REGION_COUNT];    // Number of sectors generated in each region (errors: sectors that could not be generated)
+    unsigned long generatorLookups;                 // Number of times a generator was looked up
+    unsigned long generatorHits;                    // Number of times the cached generator was used
+    unsigned long enumeratorResets;                 // Number of times a file enumerator restarted from the first file
+    unsigned long fileInfoCalls;                    // Number of calls to a file information callback (from the disk, not a parallel index build)
+    VirtualDiskClockCallback clock;                 // Clock for read latencies (NULL if none)
+    unsigned long latency[VIRTUALDISK_LATENCY_BUCKETS]; // Histogram of read latencies (clock ticks)
+    unsigned long maxLatency;                       // Longest read latency (clock ticks)
+
+} virtualdisk_stats_t;
+
+
 // FAT type
 typedef enum
 {
-    VIRTUALDISK_FAT12, VIRTUALDISK_FAT16, VIRTUALDISK_FAT32
+    VIRTUALDISK_FAT12, VIRTUALDISK_FAT16, VIRTUALDISK_FAT32, VIRTUALDISK_EXFAT
 } VIRTUALDISK_FAT_TYPE;
 
 
@@ -110,20 +219,24 @@ typedef struct virtualdisk_partition_struct_t
     // User-supplied FAT-specific values
     unsigned char sectorsPerCluster;                // e.g. 0x40 (=64) -->  64 * sector_size = 32Kb clusters
     unsigned long countDataClusters;                // e.g. 64768.  Count of the number of data clusters (max cluster entries will be count+2) FAT16 between 4085 and 65524
-    unsigned short rootDirEntries;                  // Maximum number of root directory entries - should be a multiple of (sector_size/32=) 16
-    VirtualDiskFileInfoCallback fileInfoCallback;   // Function to return information about files in the root directory of the partition
+    unsigned short rootDirEntries;                  // Maximum number of root directory entries - should be a multiple of (sector_size/32=) 16 (FAT32/exFAT: the root directory's cluster chain is only as large as its entries need, up to this)
+    VirtualDiskFileInfoCallback fileInfoCallback;   // Function to return information about files in the root directory (and any sub-directories) of the partition
 
     // Calculated FAT-specific values
-    VIRTUALDISK_FAT_TYPE fatType;                   // FAT sub-type (FAT12, FAT16, FAT32) determined by the number of clusters
+    VIRTUALDISK_FAT_TYPE fatType;                   // FAT sub-type (FAT12, FAT16, FAT32) determined by the number of clusters, or exFAT
     unsigned char numFat;                           // Number of FAT tables (1 or 2)
-    unsigned short sectorsReserved;                 // Number of reserved sectors on the partition before the FAT, including the boot sector (at least 1)
-    unsigned long sectorsRootDir;                   // Number of sectors in the root directory region
+    unsigned short sectorsReserved;                 // Number of reserved sectors on the partition before the FAT, including the boot sector (at least 1; exFAT: the main and backup boot regions)
+    unsigned long sectorsRootDir;                   // Number of sectors in the root directory region (FAT12/FAT16)
+    unsigned long rootDirClusters;                  // Number of clusters in the root directory's cluster chain from cluster 2 (FAT32/exFAT), sized to the root files' entries (including long filename entries and any volume label), up to 'rootDirEntries'
+    unsigned long bitmapClusters;                   // (exFAT) Number of clusters in the allocation bitmap, after the root directory
+    unsigned long upcaseClusters;                   // (exFAT) Number of clusters in the up-case table, after the allocation bitmap
     unsigned long sectorsFat0;                      // Number of sectors in the FAT0 region
     unsigned long sectorsData;                      // Number of sectors in the data region
     unsigned long regionData;                       // Offset on the partition of the data region (also, the total number of sectors 'overhead' in the partition - those not in the data region)
 
     // Track file enumeration
     virtualdisk_file_enumerator_t fileEnumerator;   // File enumeration (mainly tracks cluster offset)
+    virtualdisk_index_t *index;                     // Optional file index (NULL if none)
 
 } virtualdisk_partition_t;
 
@@ -143,6 +256,12 @@ typedef struct virtualdisk_struct_t
     // Sector generator
     virtualdisk_generator_info_t generatorInfo;
 
+    // File contents generator session
+    virtualdisk_session_info_t session;
+
+    // Statistics
+    virtualdisk_stats_t stats;
+
 } virtualdisk_t;
 
 
@@ -155,15 +274,72 @@ char VirtualDiskInit(virtualdisk_t *disk, unsigned short sectorSize);
 // (Public) Add a FAT partition to a disk
 char VirtualDiskAddPartition(virtualdisk_t *disk, virtualdisk_partition_t *partition, VirtualDiskFileInfoCallback fileInfoCallback, unsigned char sectorsPerCluster, unsigned long countDataClusters, unsigned short rootDirEntries);
 
+// (Public) Add an exFAT partition to a disk (files are contiguous and marked as such, so hosts do not read the FAT for them)
+char VirtualDiskAddExFatPartition(virtualdisk_t *disk, virtualdisk_partition_t *partition, VirtualDiskFileInfoCallback fileInfoCallback, unsigned char sectorsPerCluster, unsigned long countDataClusters, unsigned short rootDirEntries);
+
+// (Public) Build a file index for a partition by calling the file information callback for every file (returns non-zero if the index is complete)
+char VirtualDiskPartitionBuildIndex(virtualdisk_partition_t *partition, virtualdisk_index_t *index);
+
+// (Public) Add the contents of each sub-directory to a complete index of the root directory, and lay out every cluster run (returns non-zero if the index is complete)
+char VirtualDiskIndexBuildDirectories(virtualdisk_partition_t *partition, virtualdisk_index_t *index);
+
+// (Public) Get the number of index entries in the root directory (entries for the contents of sub-directories follow them)
+unsigned long VirtualDiskIndexRootCount(const virtualdisk_index_t *index);
+
+// (Public) Fetch information for the file with the current 'id' in the specified parent directory through the partition's file information callback, as the disk does (optional fields are cleared first; an exFAT file of 1 TiB or more ends its directory) -- not counted in the disk statistics, so may be called from several threads if the callback is thread-safe
+char VirtualDiskFileInfoGet(virtualdisk_partition_t *partition, int parent, virtualdisk_fileinfo_t *fileInfo);
+
+// (Public) Fetch the file information for an index entry (with the id and parent it has within its directory)
+char VirtualDiskIndexFileInfo(virtualdisk_partition_t *partition, const virtualdisk_index_t *index, unsigned long entry, virtualdisk_fileinfo_t *fileInfo);
+
+// (Public) Use the specified file index for a partition (NULL to remove) -- an incomplete index (e.g. empty) is filled in as files are enumerated, but then only covers the root directory (its sub-directories appear empty)
+void VirtualDiskPartitionSetIndex(virtualdisk_partition_t *partition, virtualdisk_index_t *index);
+
+// (Public) Fill in an index entry for a file with the specified first cluster and directory entry position (returns the number of clusters in the file's run)
+unsigned long VirtualDiskIndexSetEntry(virtualdisk_partition_t *partition, virtualdisk_index_entry_t *entry, const virtualdisk_fileinfo_t *fileInfo, unsigned long firstCluster, unsigned long dirOffset);
+
+// (Public) Move an index entry's cluster run and directory entry position by the specified number of clusters and entries (e.g. when entries are built in independent chunks)
+void VirtualDiskIndexRelocateEntry(virtualdisk_index_entry_t *entry, unsigned long clusterOffset, unsigned long dirOffset);
+
+// (Public) Calculate the first cluster available to files on a partition
+unsigned long VirtualDiskPartitionFirstFileCluster(virtualdisk_partition_t *partition);
+
+// (Public) Get the number of entries at the start of the root directory (if non-zero) or a sub-directory before its files: '.' and '..' in a FAT sub-directory, the allocation bitmap and up-case table in the exFAT root directory
+unsigned long VirtualDiskPartitionDirectoryStart(virtualdisk_partition_t *partition, char root);
+
+// (Public) Refresh a live file's information (identified as to the file information callback: its 'parent' directory, VIRTUALDISK_ROOT_DIRECTORY for the root, and 'id' within it -- files in sub-directories need a complete index) after its size changed within its reserved capacity ('maxSize'), outputting the disk sector ranges that changed (its directory entries and FAT chain, so up to 1 + numFat ranges; exFAT files have no FAT chain, so just the one), returns the number of ranges, or zero if the file no longer fits its run or directory entries
+int VirtualDiskPartitionUpdateFile(virtualdisk_partition_t *partition, int parent, int id, virtualdisk_sector_range_t *ranges, int maxRanges);
+
 // (Public) Get the sector size of a disk (in bytes) - e.g. 512
 unsigned short VirtualDiskSectorSize(virtualdisk_t *disk);
 
 // (Public) Get the size of the disk (in sectors)
 unsigned long VirtualDiskSectorCount(virtualdisk_t *disk);
 
-// (Public) Read the specified virtual sectors into a memory buffer
+// (Public) Read the specified virtual sectors into a memory buffer; returns the number of sectors generated, so fewer than 'count' if any could not be (they read as 0xff, and the read should be reported as failed) or the disk is not initialized
 unsigned short VirtualDiskReadSectors(virtualdisk_t *disk, unsigned long sector, unsigned short count, void *buffer);
 
+// (Public) Read part of a virtual sector ('length' bytes from byte 'offset') into a memory buffer, so that a sector can be streamed through a buffer smaller than a sector; returns the length read (zero if the disk is not initialized, the part is not within a sector, or it could not be generated, when it reads as 0xff) -- a file's contents are only generated in parts if it has a 'partial' generator (otherwise only a whole sector of it can be read)
+unsigned short VirtualDiskReadPartial(virtualdisk_t *disk, unsigned long sector, unsigned short offset, unsigned short length, void *buffer);
+
+// (Public) Count the sectors from the specified sector that are generated alike (to the end of a file's run, a metadata region, or blank space), and whether they are blank (all zero) -- e.g. to answer a host's allocation queries without generating them; returns zero beyond the end of the disk
+unsigned long VirtualDiskSectorExtent(virtualdisk_t *disk, unsigned long sector, char *blank);
+
+// (Public) Make a separate read context for a disk (e.g. one per thread), with caller-supplied memory for copies of its partitions (VIRTUALDISK_MAX_PARTITIONS) -- a complete index is shared (an incomplete one is not used by the copy), and the file information callbacks and generators are then called from each context's thread, so must be thread-safe; a live file update (VirtualDiskPartitionUpdateFile) made through any context changes the shared index, so must not run while any context reads, and the other contexts keep the file's previous information until copied again; a copy starts with no statistics (see VirtualDiskAddStats)
+char VirtualDiskCopy(virtualdisk_t *copy, virtualdisk_partition_t *partitions, const virtualdisk_t *disk);
+
+// (Public) Close any open file contents generator session (e.g. when the host releases the disk)
+void VirtualDiskEndSession(virtualdisk_t *disk);
+
+// (Public) Set a clock function to measure read latencies for the statistics (NULL for none)
+void VirtualDiskSetClock(virtualdisk_t *disk, VirtualDiskClockCallback clock);
+
+// (Public) Reset the statistics of a disk
+void VirtualDiskResetStats(virtualdisk_t *disk);
+
+// (Public) Add the statistics of another context to a disk's (e.g. a copy's, when its thread finishes with it)
+void VirtualDiskAddStats(virtualdisk_t *disk, const virtualdisk_t *from);
+
 
 #ifdef __cplusplus
 }
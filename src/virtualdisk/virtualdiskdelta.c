@@ -0,0 +1,378 @@
+// Virtual Disk/File System - Delta Export Between File Sets
+// Dan Jackson, 2013
+
+// Two file indexes for the same partition geometry fully determine which sectors differ between their disk images:
+//   - a root directory sector differs if any of its files' entries differ (short entry, position, or long filename);
+//   - a FAT entry differs only within the runs of files whose run (position, length, or used clusters) differs;
+//   - a data cluster differs only within the runs of files that moved or changed (size or modified time), or of sub-directories whose entries changed.
+// A file is compared with the file at the same path in the other index (its parent directory's match, and the same name), not the entry at the same position, as added or removed files shift the positions of the entries after them.
+// The changed runs of each index are in ascending cluster order, so merging them gives ascending sector ranges without sorting.
+
+#include <stddef.h>
+#include <string.h>
+
+#include "virtualdiskdelta.h"
+
+// Little-endian word macros
+#define GET_DWORD(_p) ( (unsigned long)*((_p)+0) | ((unsigned long)*((_p)+1) << 8) | ((unsigned long)*((_p)+2) << 16) | ((unsigned long)*((_p)+3) << 24) )
+
+// Index entry parent value for files in the root directory
+#define VIRTUALDISK_INDEX_NO_PARENT 0xfffffffful
+
+// Index entry value for a file with no file at the same path in the other index
+#define VIRTUALDISK_DELTA_NO_MATCH 0xfffffffful
+
+
+// (Private) Delta state
+typedef struct virtualdisk_delta_struct_t
+{
+    virtualdisk_partition_t *partition;
+    const virtualdisk_index_t *index[2];                // Old and new index
+    unsigned long rootCount[2];                         // Number of each index's entries in the root directory
+
+    // Output range (pending until it can no longer be extended)
+    VirtualDiskSectorRangeCallback callback;
+    void *reference;
+    unsigned long firstSector;
+    unsigned long count;
+    char ok;
+
+    // Current FAT copy being output
+    int fat;
+} virtualdisk_delta_t;
+
+
+// (Private) Pass on the pending output range
+static void VirtualDiskDeltaFlush(virtualdisk_delta_t *delta)
+{
+    if (delta->ok && delta->count > 0)
+    {
+        delta->ok = delta->callback(delta->reference, delta->partition->partitionStartSector + delta->firstSector, delta->count);
+    }
+    delta->count = 0;
+}
+
+
+// (Private) Add a partition-relative range of changed sectors (in non-decreasing order of first sector), joining it to the pending range if they touch
+static void VirtualDiskDeltaAdd(virtualdisk_delta_t *delta, unsigned long firstSector, unsigned long count)
+{
+    if (count == 0) { return; }
+    if (delta->count > 0 && firstSector <= delta->firstSector + delta->count)
+    {
+        if (firstSector + count > delta->firstSector + delta->count) { delta->count = firstSector + count - delta->firstSector; }
+        return;
+    }
+    VirtualDiskDeltaFlush(delta);
+    delta->firstSector = firstSector;
+    delta->count = count;
+}
+
+
+// (Private) Get a file's run from an index (an empty run if the index has no such file)
+static const unsigned char *VirtualDiskDeltaRun(const virtualdisk_delta_t *delta, int side, unsigned long id, unsigned long *firstCluster, unsigned long *numClusters, unsigned long *usedClusters)
+{
+    const virtualdisk_index_t *index = delta->index[side];
+    unsigned long clusterSize = (unsigned long)delta->partition->sectorsPerCluster * delta->partition->disk->sectorSize;
+    if (id >= index->count)
+    {
+        *firstCluster = 0; *numClusters = 0; *usedClusters = 0;
+        return NULL;
+    }
+    *firstCluster = GET_DWORD(index->entries[id].firstCluster);
+    *numClusters = GET_DWORD(index->entries[id].numClusters);
+    *usedClusters = (GET_DWORD(index->entries[id].dirEntry + 28) + clusterSize - 1) / clusterSize;
+    if (index->entries[id].dirEntry[11] & VIRTUALDISK_ATTRIB_DIRECTORY) { *usedClusters = *numClusters; }
+    return index->entries[id].dirEntry;
+}
+
+
+// (Private) Check whether two index entries name the same file within their directories: the same long filename (by its hash) or, without one, the same 8.3 name, and both files or both sub-directories
+static char VirtualDiskDeltaSameName(const virtualdisk_index_entry_t *a, const virtualdisk_index_entry_t *b)
+{
+    if (memcmp(a->nameHash, b->nameHash, 4) != 0 || ((a->dirEntry[11] ^ b->dirEntry[11]) & VIRTUALDISK_ATTRIB_DIRECTORY)) { return 0; }
+    return GET_DWORD(a->nameHash) != 0 || memcmp(a->dirEntry, b->dirEntry, 11) == 0;
+}
+
+
+// (Private) Find the entry in the other index at the same path as an index entry: in its parent directory's match, the entry with the same name, searching outwards from the same position within the directory (the files are usually in the same order, perhaps shifted by added or removed files) -- returns VIRTUALDISK_DELTA_NO_MATCH if there is none
+static unsigned long VirtualDiskDeltaMatch(const virtualdisk_delta_t *delta, int side, unsigned long id)
+{
+    const virtualdisk_index_t *index = delta->index[side], *other = delta->index[1 - side];
+    const virtualdisk_index_entry_t *entry;
+    unsigned long parent, first, otherFirst, otherCount, i, d;
+
+    if (id >= index->count) { return VIRTUALDISK_DELTA_NO_MATCH; }
+    entry = &index->entries[id];
+    parent = GET_DWORD(entry->parent);
+    if (parent == VIRTUALDISK_INDEX_NO_PARENT)
+    {
+        first = 0;
+        otherFirst = 0;
+        otherCount = delta->rootCount[1 - side];
+    }
+    else
+    {
+        unsigned long otherParent = VirtualDiskDeltaMatch(delta, side, parent);
+        if (otherParent == VIRTUALDISK_DELTA_NO_MATCH) { return VIRTUALDISK_DELTA_NO_MATCH; }
+        first = GET_DWORD(index->entries[parent].firstChild);
+        otherFirst = GET_DWORD(other->entries[otherParent].firstChild);
+        otherCount = GET_DWORD(other->entries[otherParent].numChildren);
+        if (otherFirst > other->count || otherCount > other->count - otherFirst) { return VIRTUALDISK_DELTA_NO_MATCH; }
+    }
+    if (otherCount == 0) { return VIRTUALDISK_DELTA_NO_MATCH; }
+
+    i = id - first;
+    if (i >= otherCount) { i = otherCount - 1; }
+    for (d = 0; d <= i || i + d < otherCount; d++)
+    {
+        if (i + d < otherCount && VirtualDiskDeltaSameName(entry, &other->entries[otherFirst + i + d])) { return otherFirst + i + d; }
+        if (d > 0 && d <= i && VirtualDiskDeltaSameName(entry, &other->entries[otherFirst + i - d])) { return otherFirst + i - d; }
+    }
+    return VIRTUALDISK_DELTA_NO_MATCH;
+}
+
+
+// (Private) Check whether a file's directory entries differ between two index entries (its short entry, position, or long filename; on exFAT, also a sub-directory's size)
+static char VirtualDiskDeltaEntryChanged(const virtualdisk_delta_t *delta, const virtualdisk_index_entry_t *oldEntry, const virtualdisk_index_entry_t *newEntry)
+{
+    if (delta->partition->fatType == VIRTUALDISK_EXFAT && (newEntry->dirEntry[11] & VIRTUALDISK_ATTRIB_DIRECTORY) && memcmp(oldEntry->numClusters, newEntry->numClusters, 4) != 0) { return 1; }
+    return memcmp(oldEntry->dirEntry, newEntry->dirEntry, 32) != 0 || memcmp(oldEntry->dirOffset, newEntry->dirOffset, 4) != 0
+        || memcmp(oldEntry->dirEntries, newEntry->dirEntries, 4) != 0 || memcmp(oldEntry->nameHash, newEntry->nameHash, 4) != 0;
+}
+
+
+// (Private) Check whether a sub-directory's entries ('.', '..', and its contents) differ between its entries in the old and new indexes
+static char VirtualDiskDeltaDirectoryChanged(const virtualdisk_delta_t *delta, const unsigned long *ids)
+{
+    const virtualdisk_index_entry_t *entry[2];
+    unsigned long parent[2], firstChild[2], numChildren, i;
+    int side;
+
+    for (side = 0; side < 2; side++)
+    {
+        entry[side] = &delta->index[side]->entries[ids[side]];
+        parent[side] = GET_DWORD(entry[side]->parent);
+        firstChild[side] = GET_DWORD(entry[side]->firstChild);
+    }
+    numChildren = GET_DWORD(entry[0]->numChildren);
+
+    if (memcmp(entry[0]->dirEntry, entry[1]->dirEntry, 32) != 0 || numChildren != GET_DWORD(entry[1]->numChildren)) { return 1; }
+    if ((parent[0] == VIRTUALDISK_INDEX_NO_PARENT) != (parent[1] == VIRTUALDISK_INDEX_NO_PARENT)) { return 1; }
+    if (parent[0] != VIRTUALDISK_INDEX_NO_PARENT && memcmp(delta->index[0]->entries[parent[0]].dirEntry, delta->index[1]->entries[parent[1]].dirEntry, 32) != 0) { return 1; }
+    for (i = 0; i < numChildren; i++)
+    {
+        if (VirtualDiskDeltaEntryChanged(delta, &delta->index[0]->entries[firstChild[0] + i], &delta->index[1]->entries[firstChild[1] + i])) { return 1; }
+    }
+    return 0;
+}
+
+
+// (Private) Check whether a file's FAT chain (or, for data, also its contents) differs from the file at the same path in the other index (a file with no match has an empty run there)
+static char VirtualDiskDeltaFileChanged(const virtualdisk_delta_t *delta, int side, unsigned long id, char data)
+{
+    unsigned long ids[2], first[2], num[2], used[2];
+    const unsigned char *entry[2];
+    int i;
+
+    ids[side] = id;
+    ids[1 - side] = VirtualDiskDeltaMatch(delta, side, id);
+    for (i = 0; i < 2; i++)
+    {
+        entry[i] = VirtualDiskDeltaRun(delta, i, ids[i], &first[i], &num[i], &used[i]);
+    }
+
+    // Run changed
+    if (num[0] != num[1]) { return 1; }
+    if (num[0] == 0) { return 0; }      // Both empty
+    if (first[0] != first[1] || used[0] != used[1]) { return 1; }
+
+    // Contents changed (size, or modified time and date; or, for a sub-directory, its entries)
+    if (data && ((entry[0][11] | entry[1][11]) & VIRTUALDISK_ATTRIB_DIRECTORY)) { return VirtualDiskDeltaDirectoryChanged(delta, ids); }
+    if (data && (memcmp(entry[0] + 28, entry[1] + 28, 4) != 0 || entry[0][12] != entry[1][12] || memcmp(entry[0] + 22, entry[1] + 22, 4) != 0)) { return 1; }     // (exFAT size's upper bits in byte 12)
+
+    return 0;
+}
+
+
+// (Private) Output the FAT sectors for a run of cluster entries in the current FAT copy
+static void VirtualDiskDeltaFatClusters(virtualdisk_delta_t *delta, unsigned long firstCluster, unsigned long numClusters)
+{
+    virtualdisk_partition_t *partition = delta->partition;
+    unsigned long lastCluster = firstCluster + numClusters - 1;
+    unsigned long firstByte, lastByte;
+
+    if (partition->fatType == VIRTUALDISK_FAT12) { firstByte = firstCluster + (firstCluster >> 1); lastByte = lastCluster + (lastCluster >> 1) + 1; }
+    else if (partition->fatType == VIRTUALDISK_FAT16) { firstByte = firstCluster << 1; lastByte = (lastCluster << 1) + 1; }
+    else { firstByte = firstCluster << 2; lastByte = (lastCluster << 2) + 3; }
+
+    firstByte /= partition->disk->sectorSize;
+    lastByte /= partition->disk->sectorSize;
+    if (firstByte >= partition->sectorsFat0) { return; }
+    if (lastByte >= partition->sectorsFat0) { lastByte = partition->sectorsFat0 - 1; }
+    VirtualDiskDeltaAdd(delta, partition->sectorsReserved + (delta->fat * partition->sectorsFat0) + firstByte, lastByte - firstByte + 1);
+}
+
+
+// (Private) Output the data sectors for a run of clusters
+static void VirtualDiskDeltaDataClusters(virtualdisk_delta_t *delta, unsigned long firstCluster, unsigned long numClusters)
+{
+    virtualdisk_partition_t *partition = delta->partition;
+    unsigned long endCluster = 2 + partition->countDataClusters;     // Clusters beyond the data region are not on the disk
+
+    if (firstCluster < VirtualDiskPartitionFirstFileCluster(partition)) { return; }
+    if (firstCluster + numClusters > endCluster) { numClusters = (firstCluster < endCluster) ? endCluster - firstCluster : 0; }
+    VirtualDiskDeltaAdd(delta, partition->regionData + (firstCluster - 2) * partition->sectorsPerCluster, numClusters * partition->sectorsPerCluster);
+}
+
+
+// (Private) Find the next changed file, at or after the specified id, that has a non-empty run in the index on the specified side
+static unsigned long VirtualDiskDeltaNextChanged(const virtualdisk_delta_t *delta, int side, unsigned long id, char data)
+{
+    const virtualdisk_index_t *index = delta->index[side];
+    for (; id < index->count; id++)
+    {
+        if (GET_DWORD(index->entries[id].numClusters) > 0 && VirtualDiskDeltaFileChanged(delta, side, id, data)) { break; }
+    }
+    return id;
+}
+
+
+// (Private) Output the changed runs from both indexes, merged in ascending cluster order
+static void VirtualDiskDeltaChangedRuns(virtualdisk_delta_t *delta, char data, void (*output)(virtualdisk_delta_t *delta, unsigned long firstCluster, unsigned long numClusters))
+{
+    unsigned long id[2];
+    int side;
+
+    for (side = 0; side < 2; side++) { id[side] = VirtualDiskDeltaNextChanged(delta, side, 0, data); }
+
+    while (delta->ok && (id[0] < delta->index[0]->count || id[1] < delta->index[1]->count))
+    {
+        unsigned long first[2] = { 0, 0 }, num[2] = { 0, 0 }, used;
+        for (side = 0; side < 2; side++)
+        {
+            if (id[side] < delta->index[side]->count) { VirtualDiskDeltaRun(delta, side, id[side], &first[side], &num[side], &used); }
+        }
+
+        // Take the run that starts first
+        if (id[1] >= delta->index[1]->count || (id[0] < delta->index[0]->count && first[0] <= first[1])) { side = 0; }
+        else { side = 1; }
+        output(delta, first[side], num[side]);
+        id[side] = VirtualDiskDeltaNextChanged(delta, side, id[side] + 1, data);
+    }
+}
+
+
+// (Public) Find the disk sectors that differ between two complete file indexes for the partition (e.g. two versions of its file set): directory sectors, FAT entries, and clusters of files that are added, moved, or changed (size or modified time), in ascending, non-overlapping ranges
+char VirtualDiskPartitionDelta(virtualdisk_partition_t *partition, const virtualdisk_index_t *oldIndex, const virtualdisk_index_t *newIndex, VirtualDiskSectorRangeCallback callback, void *reference)
+{
+    virtualdisk_delta_t delta;
+    unsigned long entriesPerSector = partition->disk->sectorSize / 32;
+    unsigned long rootSectors = partition->sectorsRootDir + partition->rootDirClusters * partition->sectorsPerCluster;     // Root directory region (FAT12/FAT16) or cluster chain (FAT32/exFAT), which directly follow the FATs
+    unsigned long base = VirtualDiskPartitionDirectoryStart(partition, 1);    // Root directory entries before its files (exFAT)
+    unsigned long count[2], id[2], sector;
+    int side;
+
+    if (!oldIndex->complete || !newIndex->complete) { return 0; }       // Files beyond an incomplete index are unknown
+
+    memset(&delta, 0, sizeof(delta));
+    delta.partition = partition;
+    delta.index[0] = oldIndex;
+    delta.index[1] = newIndex;
+    delta.rootCount[0] = VirtualDiskIndexRootCount(oldIndex);
+    delta.rootCount[1] = VirtualDiskIndexRootCount(newIndex);
+    delta.callback = callback;
+    delta.reference = reference;
+    delta.ok = 1;
+
+    // FAT entries (in each copy of the FAT) -- exFAT files have no FAT chains
+    for (delta.fat = 0; delta.fat < partition->numFat && partition->fatType != VIRTUALDISK_EXFAT; delta.fat++)
+    {
+        VirtualDiskDeltaChangedRuns(&delta, 0, VirtualDiskDeltaFatClusters);
+    }
+
+    // Root directory sectors (sub-directories are in their clusters), walking both indexes' root files in directory entry order
+    for (side = 0; side < 2; side++)
+    {
+        count[side] = delta.rootCount[side];
+        id[side] = 0;
+    }
+    for (sector = 0; sector < rootSectors; sector++)
+    {
+        unsigned long firstSlot = (sector * entriesPerSector > base) ? sector * entriesPerSector - base : 0;     // Positions among the files' entries covered by this sector
+        unsigned long endSlot = (sector + 1) * entriesPerSector - base;
+        unsigned long i[2];
+        char inSector[2];
+
+        // Skip the files whose entries end before this sector
+        for (side = 0; side < 2; side++)
+        {
+            const virtualdisk_index_entry_t *entries = delta.index[side]->entries;
+            while (id[side] < count[side] && GET_DWORD(entries[id[side]].dirOffset) + GET_DWORD(entries[id[side]].dirEntries) <= firstSlot) { id[side]++; }
+        }
+        if (id[0] >= count[0] && id[1] >= count[1]) { break; }
+
+        // Compare the files with entries in this sector
+        for (i[0] = id[0], i[1] = id[1]; ; i[0]++, i[1]++)
+        {
+            for (side = 0; side < 2; side++)
+            {
+                inSector[side] = (i[side] < count[side] && GET_DWORD(delta.index[side]->entries[i[side]].dirOffset) < endSlot);
+            }
+            if (!inSector[0] && !inSector[1]) { break; }
+            if (inSector[0] != inSector[1] || VirtualDiskDeltaEntryChanged(&delta, &oldIndex->entries[i[0]], &newIndex->entries[i[1]]))
+            {
+                VirtualDiskDeltaAdd(&delta, partition->sectorsReserved + (partition->sectorsFat0 * partition->numFat) + sector, 1);
+                break;
+            }
+        }
+    }
+
+    // File contents
+    VirtualDiskDeltaChangedRuns(&delta, 1, VirtualDiskDeltaDataClusters);
+
+    VirtualDiskDeltaFlush(&delta);
+    return delta.ok;
+}
+
+
+// (Private) Export state
+typedef struct
+{
+    virtualdisk_t *disk;
+    unsigned char *buffer;
+    unsigned short bufferSectors;
+    VirtualDiskExportCallback callback;
+    void *reference;
+} virtualdisk_delta_export_t;
+
+
+// (Private) Read a changed range and pass it on in buffer-sized blocks
+static char VirtualDiskDeltaExportRange(void *reference, unsigned long firstSector, unsigned long count)
+{
+    virtualdisk_delta_export_t *exporter = (virtualdisk_delta_export_t *)reference;
+    while (count > 0)
+    {
+        unsigned short sectors = (count > exporter->bufferSectors) ? exporter->bufferSectors : (unsigned short)count;
+        if (VirtualDiskReadSectors(exporter->disk, firstSector, sectors, exporter->buffer) != sectors) { return 0; }
+        if (!exporter->callback(exporter->reference, firstSector, sectors, exporter->buffer)) { return 0; }
+        firstSector += sectors;
+        count -= sectors;
+    }
+    return 1;
+}
+
+
+// (Public) Read only the sectors that differ from an older file index of the partition (the partition must currently use the newer index), using the supplied buffer, and pass them to the callback
+char VirtualDiskPartitionExportDelta(virtualdisk_partition_t *partition, const virtualdisk_index_t *oldIndex, unsigned char *buffer, unsigned short bufferSectors, VirtualDiskExportCallback callback, void *reference)
+{
+    virtualdisk_delta_export_t exporter;
+
+    if (partition->index == NULL || bufferSectors == 0) { return 0; }
+
+    exporter.disk = partition->disk;
+    exporter.buffer = buffer;
+    exporter.bufferSectors = bufferSectors;
+    exporter.callback = callback;
+    exporter.reference = reference;
+    return VirtualDiskPartitionDelta(partition, oldIndex, partition->index, VirtualDiskDeltaExportRange, &exporter);
+}
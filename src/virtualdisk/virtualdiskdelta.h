@@ -0,0 +1,33 @@
+// Virtual Disk/File System - Delta Export Between File Sets
+// Dan Jackson, 2013
+
+#ifndef VIRTUALDISKDELTA_H
+#define VIRTUALDISKDELTA_H
+
+#include "virtualdisk.h"
+
+// Plain C linkage
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+
+// (Public) Callback for each range of changed sectors (return zero to stop)
+typedef char (*VirtualDiskSectorRangeCallback)(void *reference, unsigned long firstSector, unsigned long count);
+
+// (Public) Callback for each block of exported sector data (return zero to stop)
+typedef char (*VirtualDiskExportCallback)(void *reference, unsigned long sector, unsigned short count, const unsigned char *buffer);
+
+
+// (Public) Find the disk sectors that differ between two complete file indexes for the partition (e.g. two versions of its file set): directory sectors, FAT entries, and clusters of files that are added, moved, or changed (size or modified time), in ascending, non-overlapping ranges
+char VirtualDiskPartitionDelta(virtualdisk_partition_t *partition, const virtualdisk_index_t *oldIndex, const virtualdisk_index_t *newIndex, VirtualDiskSectorRangeCallback callback, void *reference);
+
+// (Public) Read only the sectors that differ from an older file index of the partition (the partition must currently use the newer index), using the supplied buffer, and pass them to the callback
+char VirtualDiskPartitionExportDelta(virtualdisk_partition_t *partition, const virtualdisk_index_t *oldIndex, unsigned char *buffer, unsigned short bufferSectors, VirtualDiskExportCallback callback, void *reference);
+
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,553 @@
+// Virtual Disk/File System - Host Directory Adapter
+// Dan Jackson, 2013
+
+// The host directory tree is scanned once into a compact table: one entry per file or directory (each directory's contents together,
+// sorted by name, breadth-first), and a pool of names. A file's information is then a table lookup by its parent and id, so no host
+// calls are made while the disk is enumerated or indexed. File contents are read from a small cache of open files: with pread(), or
+// copied from memory-mapped files (virtualdiskmap), or read asynchronously through an io_uring (virtualdiskuring). Except through a ring,
+// part of a sector can also be read on its own, for streaming sectors in pieces. The cache is locked, so the generators can be called
+// from several threads (e.g. the NBD server's connections): a slot counts the reads using it, so is not closed under them, and reads
+// with pread() are made outside the lock, but a mapping's access pattern and a ring are not thread-safe, so those reads hold the lock.
+
+#ifdef _WIN32
+#define _CRT_SECURE_NO_WARNINGS
+#else
+#define _POSIX_C_SOURCE 200809L
+#define _FILE_OFFSET_BITS 64
+#include <dirent.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#endif
+
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "virtualdiskhost.h"
+#include "virtualdiskmap.h"
+#include "virtualdiskuring.h"
+
+// Entry parent value for files in the top-level directory
+#define VIRTUALDISKHOST_NO_PARENT 0xfffffffful
+
+// Maximum length of a host path
+#define VIRTUALDISKHOST_MAX_PATH 4096
+
+#ifndef _WIN32
+
+// (Private) A directory's contents while it is being scanned
+typedef struct
+{
+    char *name;                                     // Host name
+    char *filename;                                 // Virtual disk filename (Latin-1, in the same allocation as the host name)
+    struct stat st;
+} virtualdisk_host_scan_t;
+
+
+// (Private) Upper-case a Latin-1 character
+static unsigned char VirtualDiskHostUpper(unsigned char c)
+{
+    if ((c >= 'a' && c <= 'z') || (c >= 0xe0 && c <= 0xfe && c != 0xf7)) { return (unsigned char)(c - 0x20); }
+    return c;
+}
+
+
+// (Private) Compare two Latin-1 filenames ignoring case (as a FAT host does)
+static int VirtualDiskHostCompareFilename(const char *a, const char *b)
+{
+    const unsigned char *p = (const unsigned char *)a, *q = (const unsigned char *)b;
+    while (*p != '\0' && VirtualDiskHostUpper(*p) == VirtualDiskHostUpper(*q)) { p++; q++; }
+    return (int)VirtualDiskHostUpper(*p) - (int)VirtualDiskHostUpper(*q);
+}
+
+
+// (Private) Order scanned directory contents by filename ignoring case (so that names a host would see as the same are together), then host name
+static int VirtualDiskHostCompare(const void *a, const void *b)
+{
+    const virtualdisk_host_scan_t *sa = (const virtualdisk_host_scan_t *)a, *sb = (const virtualdisk_host_scan_t *)b;
+    int result = VirtualDiskHostCompareFilename(sa->filename, sb->filename);
+    return (result != 0) ? result : strcmp(sa->name, sb->name);
+}
+
+
+// (Private) Check whether a filename is among a directory's sorted scanned contents (ignoring case)
+static char VirtualDiskHostScanContains(const virtualdisk_host_scan_t *scan, size_t numScan, const char *filename)
+{
+    size_t low = 0, high = numScan;
+
+    while (low < high)
+    {
+        size_t middle = low + (high - low) / 2;
+        int result = VirtualDiskHostCompareFilename(scan[middle].filename, filename);
+        if (result == 0) { return 1; }
+        if (result < 0) { low = middle + 1; } else { high = middle; }
+    }
+    return 0;
+}
+
+
+// (Private) Add a string to the name pool (returns its offset, or 0xffffffff if out of memory)
+static unsigned long VirtualDiskHostAddName(virtualdisk_host_t *host, size_t *capacity, const char *name, size_t length)
+{
+    unsigned long offset = (unsigned long)host->namesLength;
+
+    if (host->namesLength + length + 1 > *capacity)
+    {
+        size_t newCapacity = (*capacity > 0) ? *capacity * 2 : 4096;
+        char *names;
+        while (host->namesLength + length + 1 > newCapacity) { newCapacity *= 2; }
+        if ((names = (char *)realloc(host->names, newCapacity)) == NULL) { return 0xfffffffful; }
+        host->names = names;
+        *capacity = newCapacity;
+    }
+    memcpy(host->names + host->namesLength, name, length);
+    host->names[host->namesLength + length] = '\0';
+    host->namesLength += length + 1;
+    return offset;
+}
+
+
+// (Private) Convert a host (UTF-8) name to a virtual disk filename (Latin-1, characters outside it become '_'), returning its length
+static size_t VirtualDiskHostLatin1(char *filename, const char *name)
+{
+    const unsigned char *p = (const unsigned char *)name;
+    size_t length = 0;
+
+    while (*p != '\0' && length < VIRTUALDISK_MAX_FILENAME)
+    {
+        unsigned char c = *p++;
+        if (c >= 0x80)
+        {
+            if ((c == 0xc2 || c == 0xc3) && (*p & 0xc0) == 0x80) { c = (unsigned char)(((c & 0x03) << 6) | (*p++ & 0x3f)); }
+            else { while ((*p & 0xc0) == 0x80) { p++; } c = '_'; }     // Skip the rest of the sequence
+        }
+        if (c < 0x20) { c = '_'; }
+        filename[length++] = (char)c;
+    }
+    filename[length] = '\0';
+    return length;
+}
+
+
+// (Private) Convert a host time to a virtual disk date/time (2000-2063)
+static unsigned long VirtualDiskHostDateTime(time_t t)
+{
+    struct tm tm;
+
+    if (localtime_r(&t, &tm) == NULL || tm.tm_year < 100) { return VIRTUALDISK_DATETIME_MIN; }
+    if (tm.tm_year > 163) { return VIRTUALDISK_DATETIME(2063, 12, 31, 23, 59, 59); }
+    return VIRTUALDISK_DATETIME(tm.tm_year + 1900, tm.tm_mon + 1, tm.tm_mday, tm.tm_hour, tm.tm_min, tm.tm_sec > 59 ? 59 : tm.tm_sec);
+}
+
+
+// (Private) Write the filename for the specified occurrence of a name (hosts ignore case, so later occurrences are numbered before the extension: "index~2.html"), returning its length
+static size_t VirtualDiskHostNumberedName(char *filename, const char *name, unsigned long occurrence)
+{
+    char suffix[12];
+    size_t length = strlen(name), numDigits = 0, stem, extension;
+
+    if (occurrence <= 1) { memcpy(filename, name, length + 1); return length; }
+    do { suffix[sizeof(suffix) - 1 - numDigits++] = (char)('0' + occurrence % 10); occurrence /= 10; } while (occurrence > 0);
+    suffix[sizeof(suffix) - 1 - numDigits++] = '~';
+
+    // The suffix goes before the extension (if any), shortening the stem if required
+    for (stem = length; stem > 0 && name[stem] != '.'; stem--) { ; }
+    if (stem == 0) { stem = length; }
+    extension = length - stem;
+    if (stem + numDigits + extension > VIRTUALDISK_MAX_FILENAME) { stem = VIRTUALDISK_MAX_FILENAME - numDigits - extension; }
+    memcpy(filename, name, stem);
+    memcpy(filename + stem, suffix + sizeof(suffix) - numDigits, numDigits);
+    memcpy(filename + stem + numDigits, name + length - extension, extension + 1);
+    return stem + numDigits + extension;
+}
+
+
+// (Private) Write the host path of an entry (or the top-level directory) -- returns zero if too long
+static char VirtualDiskHostPath(const virtualdisk_host_t *host, unsigned long entry, char *path)
+{
+    size_t length;
+
+    if (entry == VIRTUALDISKHOST_NO_PARENT)
+    {
+        if (strlen(host->path) >= VIRTUALDISKHOST_MAX_PATH) { return 0; }
+        strcpy(path, host->path);
+        return 1;
+    }
+    if (!VirtualDiskHostPath(host, host->entries[entry].parent, path)) { return 0; }
+    length = strlen(path);
+    if (length + 1 + strlen(host->names + host->entries[entry].name) >= VIRTUALDISKHOST_MAX_PATH) { return 0; }
+    path[length] = '/';
+    strcpy(path + length + 1, host->names + host->entries[entry].name);
+    return 1;
+}
+
+
+// (Private) Read a host directory's regular files and sub-directories, sorted by name, and append them as the contents of the specified directory identifier
+static char VirtualDiskHostScanDirectory(virtualdisk_host_t *host, unsigned long entry, int directory, char largeFiles, unsigned long *entryCapacity, unsigned long *dirCapacity, size_t *namesCapacity)
+{
+    char path[VIRTUALDISKHOST_MAX_PATH], filename[VIRTUALDISK_MAX_FILENAME + 1];
+    virtualdisk_host_scan_t *scan = NULL;
+    size_t numScan = 0, scanCapacity = 0, pathLength, length, i;
+    unsigned long duplicate = 1;
+    struct dirent *de;
+    DIR *dir;
+    char ok = 1;
+
+    host->dirFirst[directory] = host->numEntries;
+    host->dirCount[directory] = 0;
+    if (!VirtualDiskHostPath(host, entry, path) || (dir = opendir(path)) == NULL) { return 1; }     // An unreadable directory is empty
+    pathLength = strlen(path);
+
+    // Read the directory's regular files and sub-directories (not following links to directories)
+    while (ok && (de = readdir(dir)) != NULL)
+    {
+        struct stat st;
+        if (strcmp(de->d_name, ".") == 0 || strcmp(de->d_name, "..") == 0) { continue; }
+        if (pathLength + 1 + strlen(de->d_name) >= VIRTUALDISKHOST_MAX_PATH) { continue; }
+        path[pathLength] = '/';
+        strcpy(path + pathLength + 1, de->d_name);
+        if (lstat(path, &st) != 0) { continue; }
+        if (S_ISLNK(st.st_mode) && (stat(path, &st) != 0 || !S_ISREG(st.st_mode))) { continue; }
+        if (!S_ISREG(st.st_mode) && !S_ISDIR(st.st_mode)) { continue; }
+        if (S_ISREG(st.st_mode) && ((unsigned long long)st.st_size >> 32) > (largeFiles ? 0xff : 0)) { continue; }
+        if (numScan >= scanCapacity)
+        {
+            virtualdisk_host_scan_t *newScan;
+            scanCapacity = (scanCapacity > 0) ? scanCapacity * 2 : 64;
+            if ((newScan = (virtualdisk_host_scan_t *)realloc(scan, scanCapacity * sizeof(virtualdisk_host_scan_t))) == NULL) { ok = 0; break; }
+            scan = newScan;
+        }
+        if ((scan[numScan].name = (char *)malloc(strlen(de->d_name) + 1 + VIRTUALDISK_MAX_FILENAME + 1)) == NULL) { ok = 0; break; }
+        strcpy(scan[numScan].name, de->d_name);
+        scan[numScan].filename = scan[numScan].name + strlen(de->d_name) + 1;
+        VirtualDiskHostLatin1(scan[numScan].filename, de->d_name);
+        scan[numScan].st = st;
+        numScan++;
+    }
+    closedir(dir);
+    if (numScan > 1) { qsort(scan, numScan, sizeof(virtualdisk_host_scan_t), VirtualDiskHostCompare); }
+
+    // Append the entries (up to the directory entry limit)
+    for (i = 0; ok && i < numScan && i < VIRTUALDISK_MAX_DIRECTORY_ENTRIES - 2; i++)
+    {
+        virtualdisk_host_entry_t *e;
+        if (host->numEntries >= *entryCapacity)
+        {
+            virtualdisk_host_entry_t *entries;
+            unsigned long newCapacity = (*entryCapacity > 0) ? *entryCapacity * 2 : 1024;
+            if ((entries = (virtualdisk_host_entry_t *)realloc(host->entries, newCapacity * sizeof(virtualdisk_host_entry_t))) == NULL) { ok = 0; break; }
+            host->entries = entries;
+            *entryCapacity = newCapacity;
+        }
+        e = &host->entries[host->numEntries];
+        e->name = VirtualDiskHostAddName(host, namesCapacity, scan[i].name, strlen(scan[i].name));
+        if (i > 0 && VirtualDiskHostCompareFilename(scan[i].filename, scan[i - 1].filename) == 0) { duplicate++; } else { duplicate = 1; }
+        length = VirtualDiskHostNumberedName(filename, scan[i].filename, duplicate);
+        while (duplicate > 1 && VirtualDiskHostScanContains(scan, numScan, filename)) { length = VirtualDiskHostNumberedName(filename, scan[i].filename, ++duplicate); }     // Numbered name taken by another file
+        e->filename = VirtualDiskHostAddName(host, namesCapacity, filename, length);
+        if (e->name == 0xfffffffful || e->filename == 0xfffffffful) { ok = 0; break; }
+        e->parent = entry;
+        e->modified = VirtualDiskHostDateTime(scan[i].st.st_mtime);
+        e->directory = 0;
+        e->size = 0;
+        e->sizeHigh = 0;
+        if (S_ISDIR(scan[i].st.st_mode))
+        {
+            // Sub-directories are numbered in the order they are found (their contents are scanned later, breadth-first)
+            if (host->numDirs >= *dirCapacity)
+            {
+                unsigned long newCapacity = *dirCapacity * 2, *dirFirst, *dirCount;
+                if ((dirFirst = (unsigned long *)realloc(host->dirFirst, newCapacity * sizeof(unsigned long))) == NULL) { ok = 0; break; }
+                host->dirFirst = dirFirst;
+                if ((dirCount = (unsigned long *)realloc(host->dirCount, newCapacity * sizeof(unsigned long))) == NULL) { ok = 0; break; }
+                host->dirCount = dirCount;
+                *dirCapacity = newCapacity;
+            }
+            host->dirFirst[host->numDirs] = 0;
+            host->dirCount[host->numDirs] = 0;
+            e->directory = (int)host->numDirs++;
+        }
+        else
+        {
+            e->size = (unsigned long)((unsigned long long)scan[i].st.st_size & 0xfffffffful);
+            e->sizeHigh = (unsigned long)((unsigned long long)scan[i].st.st_size >> 32);
+        }
+        host->numEntries++;
+        host->dirCount[directory]++;
+    }
+
+    for (i = 0; i < numScan; i++) { free(scan[i].name); }
+    free(scan);
+    return ok;
+}
+
+
+// (Private) Check if a file cache slot holds an open (or mapped) file
+static char VirtualDiskHostSlotUsed(const virtualdisk_host_fd_t *slot)
+{
+    return (slot->fd >= 0 || slot->map.open || slot->file.fd >= 0);
+}
+
+
+// (Private) Close a file cache slot
+static void VirtualDiskHostCloseSlot(virtualdisk_host_fd_t *slot)
+{
+    if (slot->fd >= 0) { close(slot->fd); }
+    if (slot->map.open) { VirtualDiskMapClose(&slot->map); }
+    if (slot->file.fd >= 0) { VirtualDiskUringFileClose(&slot->file); }
+    slot->fd = -1;
+}
+
+
+// (Private) Get the cache slot of an entry's open (or mapped) file, opening it in place of the least-recently used slot not being read if required (waiting if every slot is being read) -- call with the lock held, and release the slot after reading
+static virtualdisk_host_fd_t *VirtualDiskHostFile(virtualdisk_host_t *host, unsigned long entry)
+{
+    char path[VIRTUALDISKHOST_MAX_PATH];
+    virtualdisk_host_fd_t *slot;
+    int i;
+
+    host->useCounter++;
+    for (;;)
+    {
+        slot = NULL;
+        for (i = 0; i < VIRTUALDISKHOST_FD_CACHE; i++)
+        {
+            char used = VirtualDiskHostSlotUsed(&host->fds[i]);
+            if (used && host->fds[i].entry == entry)
+            {
+                host->fds[i].lastUse = host->useCounter;
+                host->fds[i].users++;
+                return &host->fds[i];
+            }
+            if (host->fds[i].users > 0) { continue; }
+            if (slot == NULL || !used || (VirtualDiskHostSlotUsed(slot) && host->fds[i].lastUse < slot->lastUse)) { slot = &host->fds[i]; }
+        }
+        if (slot != NULL) { break; }
+        pthread_cond_wait(&host->released, &host->lock);
+    }
+
+    VirtualDiskHostCloseSlot(slot);
+    if (!VirtualDiskHostPath(host, entry, path)) { return NULL; }
+    if (host->uring != NULL)
+    {
+        if (!VirtualDiskUringFileOpen(&slot->file, host->uring, path, host->sectorSize)) { return NULL; }
+    }
+    else if (host->mapFiles)
+    {
+        if (!VirtualDiskMapOpen(&slot->map, path, host->sectorSize)) { return NULL; }
+    }
+    else
+    {
+        if ((slot->fd = open(path, O_RDONLY)) < 0) { return NULL; }
+    }
+    slot->entry = entry;
+    slot->lastUse = host->useCounter;
+    slot->users = 1;
+    return slot;
+}
+
+
+// (Private) Stop using a cache slot -- call with the lock held
+static void VirtualDiskHostRelease(virtualdisk_host_t *host, virtualdisk_host_fd_t *slot)
+{
+    slot->users--;
+    pthread_cond_signal(&host->released);
+}
+
+
+// (Private) Read bytes of an open host file with pread() (beyond its end, bytes are blank), returns the number of bytes read or blanked (fewer than requested after a read error)
+static size_t VirtualDiskHostRead(int fd, off_t offset, size_t length, unsigned char *buffer)
+{
+    size_t done = 0;
+
+    while (done < length)
+    {
+        ssize_t n = pread(fd, buffer + done, length - done, offset + (off_t)done);
+        if (n < 0) { return done; }
+        if (n == 0) { memset(buffer + done, 0, length - done); return length; }
+        done += (size_t)n;
+    }
+    return done;
+}
+
+
+// (Private) Generate a file's sectors by reading the host file, or copying from its mapping (beyond its end, sectors are blank)
+static unsigned short VirtualDiskHostContents(void *reference, unsigned long sector, unsigned short count, unsigned char *buffer)
+{
+    const virtualdisk_fileinfo_t *fileInfo = (const virtualdisk_fileinfo_t *)reference;
+    virtualdisk_host_t *host = (virtualdisk_host_t *)fileInfo->reference;
+    virtualdisk_host_fd_t *slot;
+    unsigned short result;
+
+    pthread_mutex_lock(&host->lock);
+    slot = VirtualDiskHostFile(host, host->dirFirst[fileInfo->parent] + (unsigned long)fileInfo->id);
+    if (slot == NULL) { result = 0; }
+    else if (slot->file.fd >= 0) { result = VirtualDiskUringRead(&slot->file, sector, count, buffer); }
+    else if (slot->map.open) { result = VirtualDiskMapRead(&slot->map, sector, count, buffer); }
+    else
+    {
+        pthread_mutex_unlock(&host->lock);
+        result = (unsigned short)(VirtualDiskHostRead(slot->fd, (off_t)sector * host->sectorSize, (size_t)count * host->sectorSize, buffer) / host->sectorSize);
+        pthread_mutex_lock(&host->lock);
+    }
+    if (slot != NULL) { VirtualDiskHostRelease(host, slot); }
+    pthread_mutex_unlock(&host->lock);
+    return result;
+}
+
+
+// (Private) Generate part of a file's sector by reading just those bytes of the host file, or copying them from its mapping (not through a ring, which reads whole sectors)
+static unsigned short VirtualDiskHostPartial(void *reference, unsigned long sector, unsigned short offset, unsigned short length, unsigned char *buffer)
+{
+    const virtualdisk_fileinfo_t *fileInfo = (const virtualdisk_fileinfo_t *)reference;
+    virtualdisk_host_t *host = (virtualdisk_host_t *)fileInfo->reference;
+    virtualdisk_host_fd_t *slot;
+    unsigned short result;
+
+    pthread_mutex_lock(&host->lock);
+    slot = VirtualDiskHostFile(host, host->dirFirst[fileInfo->parent] + (unsigned long)fileInfo->id);
+    if (slot == NULL || slot->file.fd >= 0) { result = 0; }
+    else if (slot->map.open) { result = VirtualDiskMapReadPartial(&slot->map, sector, offset, length, buffer); }
+    else
+    {
+        pthread_mutex_unlock(&host->lock);
+        result = (VirtualDiskHostRead(slot->fd, (off_t)sector * host->sectorSize + offset, length, buffer) == length) ? length : 0;
+        pthread_mutex_lock(&host->lock);
+    }
+    if (slot != NULL) { VirtualDiskHostRelease(host, slot); }
+    pthread_mutex_unlock(&host->lock);
+    return result;
+}
+
+#endif
+
+
+// (Public) Scan a host directory tree (once) for use as a partition's files; files of 4 GiB or more are only included if 'largeFiles' is set (for exFAT)
+char VirtualDiskHostOpen(virtualdisk_host_t *host, const char *path, unsigned short sectorSize, char largeFiles)
+{
+    int i;
+
+    memset(host, 0, sizeof(virtualdisk_host_t));
+    for (i = 0; i < VIRTUALDISKHOST_FD_CACHE; i++) { host->fds[i].fd = -1; host->fds[i].file.fd = -1; }
+    host->sectorSize = sectorSize;
+
+#ifdef _WIN32
+    (void)path; (void)largeFiles;
+    return 0;       // Not supported
+#else
+    {
+        unsigned long entryCapacity = 0, dirCapacity = 16, entry;
+        size_t namesCapacity = 0;
+
+        if ((host->path = strdup(path)) == NULL) { return 0; }
+        pthread_mutex_init(&host->lock, NULL);          // (destroyed by VirtualDiskHostClose(), as the path is set)
+        pthread_cond_init(&host->released, NULL);
+        host->dirFirst = (unsigned long *)malloc(dirCapacity * sizeof(unsigned long));
+        host->dirCount = (unsigned long *)malloc(dirCapacity * sizeof(unsigned long));
+        if (host->dirFirst == NULL || host->dirCount == NULL) { VirtualDiskHostClose(host); return 0; }
+        host->numDirs = 1;
+
+        // Top-level directory, then each sub-directory in the order found (breadth-first)
+        if (!VirtualDiskHostScanDirectory(host, VIRTUALDISKHOST_NO_PARENT, 0, largeFiles, &entryCapacity, &dirCapacity, &namesCapacity)) { VirtualDiskHostClose(host); return 0; }
+        for (entry = 0; entry < host->numEntries; entry++)
+        {
+            if (host->entries[entry].directory == 0) { continue; }
+            if (!VirtualDiskHostScanDirectory(host, entry, host->entries[entry].directory, largeFiles, &entryCapacity, &dirCapacity, &namesCapacity)) { VirtualDiskHostClose(host); return 0; }
+        }
+    }
+    return 1;
+#endif
+}
+
+
+// (Public) Close any open host files and free the scanned tree (remove it from any partition first)
+void VirtualDiskHostClose(virtualdisk_host_t *host)
+{
+    int i;
+
+    for (i = 0; i < VIRTUALDISKHOST_FD_CACHE; i++)
+    {
+#ifndef _WIN32
+        VirtualDiskHostCloseSlot(&host->fds[i]);
+#endif
+        host->fds[i].fd = -1;
+        host->fds[i].file.fd = -1;
+    }
+#ifndef _WIN32
+    if (host->path != NULL)
+    {
+        pthread_cond_destroy(&host->released);
+        pthread_mutex_destroy(&host->lock);
+    }
+#endif
+    free(host->path);
+    free(host->entries);
+    free(host->dirFirst);
+    free(host->dirCount);
+    free(host->names);
+    host->path = NULL;
+    host->entries = NULL;
+    host->dirFirst = NULL;
+    host->dirCount = NULL;
+    host->names = NULL;
+    host->numEntries = 0;
+    host->numDirs = 0;
+}
+
+
+// (Public) Number of data clusters required for the scanned files and directories, with the specified cluster size (bytes)
+unsigned long VirtualDiskHostCountClusters(const virtualdisk_host_t *host, unsigned long clusterSize)
+{
+    unsigned long total = 0, entry, dir;
+
+    if (clusterSize == 0) { return 0; }
+
+    // Files (a whole number of clusters each)
+    for (entry = 0; entry < host->numEntries; entry++)
+    {
+        const virtualdisk_host_entry_t *e = &host->entries[entry];
+        total += e->sizeHigh * (0xfffffffful / clusterSize + 1) + (e->size + clusterSize - 1) / clusterSize;
+    }
+
+    // Directories (at least one cluster each, for the '.' and '..' entries then, at most, a short or file entry, a stream entry, and a name entry per 13 characters for each file)
+    for (dir = 0; dir < host->numDirs; dir++)
+    {
+        unsigned long slots = 2;
+        for (entry = host->dirFirst[dir]; entry < host->dirFirst[dir] + host->dirCount[dir]; entry++)
+        {
+            slots += 2 + ((unsigned long)strlen(host->names + host->entries[entry].filename) + 12) / 13;
+        }
+        total += (slots * 32 + clusterSize - 1) / clusterSize;
+    }
+    return total;
+}
+
+
+// (Public) Fill in the file information for a file of the scanned host tree, by its parent and id (returns zero if there is no such file) -- call from a file information callback (thread-safe), the contents' reference is the host tree
+char VirtualDiskHostFileInfo(virtualdisk_host_t *host, virtualdisk_fileinfo_t *fileInfo)
+{
+    const virtualdisk_host_entry_t *e;
+
+    if (fileInfo->parent < 0 || (unsigned long)fileInfo->parent >= host->numDirs) { return 0; }
+    if (fileInfo->id < 0 || (unsigned long)fileInfo->id >= host->dirCount[fileInfo->parent]) { return 0; }
+    e = &host->entries[host->dirFirst[fileInfo->parent] + (unsigned long)fileInfo->id];
+
+    fileInfo->filename = host->names + e->filename;
+    fileInfo->size = e->size;
+    fileInfo->sizeHigh = e->sizeHigh;
+    fileInfo->attributes = e->directory ? VIRTUALDISK_ATTRIB_DIRECTORY : VIRTUALDISK_ATTRIB_ARCHIVE;
+    fileInfo->directory = e->directory;
+    fileInfo->modified = e->modified;
+    fileInfo->created = e->modified;
+    fileInfo->accessed = e->modified;
+#ifdef _WIN32
+    fileInfo->contents = NULL;
+#else
+    fileInfo->contents = VirtualDiskHostContents;
+    fileInfo->partial = (host->uring == NULL) ? VirtualDiskHostPartial : NULL;
+#endif
+    fileInfo->reference = host;
+    return 1;
+}
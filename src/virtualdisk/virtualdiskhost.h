@@ -0,0 +1,90 @@
+// Virtual Disk/File System - Host Directory Adapter
+// Dan Jackson, 2013
+
+#ifndef VIRTUALDISKHOST_H
+#define VIRTUALDISKHOST_H
+
+#include <stddef.h>
+#ifndef _WIN32
+#include <pthread.h>
+#endif
+
+#include "virtualdisk.h"
+#include "virtualdiskmap.h"
+#include "virtualdiskuring.h"
+
+// Plain C linkage
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// Number of host files kept open for reading their contents (least-recently used are closed)
+#ifndef VIRTUALDISKHOST_FD_CACHE
+#define VIRTUALDISKHOST_FD_CACHE 32
+#endif
+
+
+// (Public) A scanned host file or directory
+typedef struct
+{
+    unsigned long name;                             // Offset of the host name in the name pool
+    unsigned long filename;                         // Offset of the virtual disk filename (Latin-1) in the name pool
+    unsigned long parent;                           // Entry of the parent directory (0xffffffff for the top-level directory)
+    unsigned long size;                             // File size (bytes)
+    unsigned long sizeHigh;                         // Upper 32 bits of the file size (only if large files are allowed)
+    unsigned long modified;                         // Modified date/time
+    int directory;                                  // For a sub-directory: its identifier (non-zero), as the 'parent' of its contents
+} virtualdisk_host_entry_t;
+
+// (Public) Host file descriptor cache slot
+typedef struct
+{
+    int fd;                                         // Open file (-1 if none)
+    virtualdisk_map_t map;                          // Mapped file (if mapping files)
+    virtualdisk_uring_file_t file;                  // File read through a ring (if reading through a ring)
+    unsigned long entry;                            // Entry of the open file
+    unsigned long lastUse;                          // Use counter value when last read
+    int users;                                      // Number of reads using the slot (it is not closed until they finish)
+} virtualdisk_host_fd_t;
+
+// (Public) A host directory tree scanned for use as a partition's files
+typedef struct
+{
+    char *path;                                     // Host directory
+    unsigned short sectorSize;                      // Sector size of the disk (bytes)
+    char mapFiles;                                  // Set (before any reads) to memory-map files, with prefetching for sequential reads, instead of reading them with pread()
+    virtualdisk_uring_t *uring;                     // Set (before any reads) to read files asynchronously through this ring instead
+    virtualdisk_host_entry_t *entries;              // Scanned entries, each directory's contents together (breadth-first)
+    unsigned long numEntries;                       // Number of entries
+    unsigned long *dirFirst;                        // For each directory identifier: its first entry
+    unsigned long *dirCount;                        // For each directory identifier: its number of entries
+    unsigned long numDirs;                          // Number of directory identifiers (including the top-level directory, 0)
+    char *names;                                    // Name pool
+    size_t namesLength;                             // Length of the name pool (bytes)
+    virtualdisk_host_fd_t fds[VIRTUALDISKHOST_FD_CACHE];    // Open file descriptor cache
+    unsigned long useCounter;                       // Incremented on each read
+#ifndef _WIN32
+    pthread_mutex_t lock;                           // Guards the file cache (and is held for reads from a mapping or through a ring, whose access state is shared)
+    pthread_cond_t released;                        // Signalled when a read stops using a slot (for a read waiting because every slot is in use)
+#endif
+} virtualdisk_host_t;
+
+
+// (Public) Scan a host directory tree (once) for use as a partition's files; files of 4 GiB or more are only included if 'largeFiles' is set (for exFAT)
+char VirtualDiskHostOpen(virtualdisk_host_t *host, const char *path, unsigned short sectorSize, char largeFiles);
+
+// (Public) Close any open host files and free the scanned tree (remove it from any partition first)
+void VirtualDiskHostClose(virtualdisk_host_t *host);
+
+// (Public) Number of data clusters required for the scanned files and directories, with the specified cluster size (bytes)
+unsigned long VirtualDiskHostCountClusters(const virtualdisk_host_t *host, unsigned long clusterSize);
+
+// (Public) Fill in the file information for a file of the scanned host tree, by its parent and id (returns zero if there is no such file) -- call from a file information callback (thread-safe), the contents' reference is the host tree (its generators are thread-safe: reads with pread() run in parallel, while reads from mappings or through a ring are taken one at a time)
+char VirtualDiskHostFileInfo(virtualdisk_host_t *host, virtualdisk_fileinfo_t *fileInfo);
+
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
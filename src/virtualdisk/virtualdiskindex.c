@@ -0,0 +1,465 @@
+// Virtual Disk/File System - Persisted File Index
+// Dan Jackson, 2013
+
+// Index file layout (all values little-endian):
+//   @0  Magic "VDINDEX\0"
+//   @8  Version (VIRTUALDISKINDEX_VERSION)
+//   @12 Header size (bytes)
+//   @16 Entry size (bytes)
+//   @20 Entry count
+//   @24 Geometry hash (partition parameters the index was built for)
+//   @28 Tag (caller-defined file-set hash/version)
+//   @32 Checksum of entries
+//   @36 Flags (bit 0 = complete, bit 1 = has sub-directories)
+//   @40 Checksum of header bytes 0-39
+//   @44 Reserved (zero) to VIRTUALDISKINDEX_HEADER_SIZE, then entries
+
+#ifdef _WIN32
+#define _CRT_SECURE_NO_WARNINGS
+#include <windows.h>
+#else
+#define _POSIX_C_SOURCE 200809L
+#include <fcntl.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "virtualdiskindex.h"
+
+// Little-endian word macros
+#define SET_DWORD(_p, _ov) { unsigned long _v = (_ov); *((_p)+0) = (unsigned char)((_v)); *((_p)+1) = (unsigned char)((_v) >> 8); *((_p)+2) = (unsigned char)((_v) >> 16); *((_p)+3) = (unsigned char)((_v) >> 24); }
+#define GET_DWORD(_p) ( (unsigned long)*((_p)+0) | ((unsigned long)*((_p)+1) << 8) | ((unsigned long)*((_p)+2) << 16) | ((unsigned long)*((_p)+3) << 24) )
+
+#define VIRTUALDISKINDEX_MAGIC "VDINDEX"
+
+// Number of file ids each thread takes at a time when building an index in parallel
+#ifndef VIRTUALDISKINDEX_PARALLEL_CHUNK
+#define VIRTUALDISKINDEX_PARALLEL_CHUNK 4096
+#endif
+
+// Number of entries, spread across the index, checked against the file information callback when mapping a saved index (unless verifying every entry)
+#ifndef VIRTUALDISKINDEX_PROBE_SAMPLES
+#define VIRTUALDISKINDEX_PROBE_SAMPLES 64
+#endif
+
+// Maximum number of threads for building an index in parallel
+#define VIRTUALDISKINDEX_MAX_THREADS 64
+
+
+// (Private) Shared state for building an index in parallel
+typedef struct
+{
+    virtualdisk_partition_t *partition;
+    virtualdisk_index_t *index;
+    unsigned long numChunks;                    // Number of chunks covering the index capacity
+    unsigned long *chunkClusters;               // Per-chunk total clusters (then, prefix sum of clusters before the chunk)
+    unsigned long *chunkEntries;                // Per-chunk total directory entries (then, prefix sum of directory entries before the chunk)
+    unsigned long nextChunk;                    // Next chunk to take (guarded by lock)
+    unsigned long endId;                        // Lowest id found to have no file (guarded by lock)
+    char pass;                                  // 0 = fetch file information, 1 = relocate entries
+#ifdef _WIN32
+    CRITICAL_SECTION lock;
+#else
+    pthread_mutex_t lock;
+#endif
+} virtualdisk_index_build_t;
+
+
+// (Private) FNV-1a hash over a buffer (continuing from the specified hash)
+static unsigned long VirtualDiskIndexHash(unsigned long hash, const void *buffer, size_t length)
+{
+    const unsigned char *p = (const unsigned char *)buffer;
+    while (length-- > 0)
+    {
+        hash = ((hash ^ *p++) * 16777619ul) & 0xfffffffful;
+    }
+    return hash;
+}
+
+
+// (Private) Hash of the partition parameters that determine the index contents
+static unsigned long VirtualDiskIndexGeometryHash(virtualdisk_partition_t *partition)
+{
+    unsigned char values[24];
+    SET_DWORD(values + 0, partition->disk->sectorSize);
+    SET_DWORD(values + 4, partition->sectorsPerCluster);
+    SET_DWORD(values + 8, partition->countDataClusters);
+    SET_DWORD(values + 12, partition->rootDirEntries);
+    SET_DWORD(values + 16, partition->fatType);
+    SET_DWORD(values + 20, partition->rootDirClusters);
+    return VirtualDiskIndexHash(2166136261ul, values, sizeof(values));
+}
+
+
+// (Private) Check an index entry against one freshly generated from the file information callback
+static char VirtualDiskIndexProbeEntry(virtualdisk_partition_t *partition, const virtualdisk_index_t *index, unsigned long i, virtualdisk_fileinfo_t *fileInfo)
+{
+    const virtualdisk_index_entry_t *entry = &index->entries[i];
+    virtualdisk_index_entry_t current;
+
+    memset(fileInfo, 0, sizeof(*fileInfo));
+    if (!VirtualDiskIndexFileInfo(partition, index, i, fileInfo)) { return 0; }
+    VirtualDiskIndexSetEntry(partition, &current, fileInfo, GET_DWORD(entry->firstCluster), GET_DWORD(entry->dirOffset));
+    memcpy(current.parent, entry->parent, sizeof(current.parent));
+    if (GET_DWORD(current.dirEntries) > 1) { memcpy(current.dirEntry, entry->dirEntry, 11); }     // A long filename's short name depends on the other names in its directory (the long filename is checked by its hash)
+    if (current.dirEntry[11] & VIRTUALDISK_ATTRIB_DIRECTORY)
+    {
+        // A sub-directory's run and children depend on its indexed contents
+        memcpy(current.numClusters, entry->numClusters, sizeof(current.numClusters));
+        memcpy(current.firstChild, entry->firstChild, sizeof(current.firstChild));
+        memcpy(current.numChildren, entry->numChildren, sizeof(current.numChildren));
+    }
+    return (memcmp(&current, entry, sizeof(current)) == 0);
+}
+
+
+// (Private) Check that there is no file after the indexed ones of a directory (its 'count' files, in the directory with the specified identifier)
+static char VirtualDiskIndexProbeEnd(virtualdisk_partition_t *partition, int parent, unsigned long count, virtualdisk_fileinfo_t *fileInfo)
+{
+    memset(fileInfo, 0, sizeof(*fileInfo));
+    fileInfo->id = (int)count;
+    return !VirtualDiskFileInfoGet(partition, parent, fileInfo);
+}
+
+
+// (Private) Check index entries against the file information callback ('all' entries, or a sample spread evenly across the index, including the last), and, for a complete index, that there is no file after the last one of the root directory, nor (if it has 'directories') of each sub-directory
+static char VirtualDiskIndexProbe(virtualdisk_partition_t *partition, const virtualdisk_index_t *index, char all, char directories)
+{
+    virtualdisk_fileinfo_t fileInfo;
+    unsigned long samples, n, i;
+
+    memset(&fileInfo, 0, sizeof(fileInfo));
+    samples = (all || index->count < VIRTUALDISKINDEX_PROBE_SAMPLES) ? index->count : VIRTUALDISKINDEX_PROBE_SAMPLES;
+    for (n = 1; n <= samples; n++)
+    {
+        i = (unsigned long)(((unsigned long long)index->count * n) / samples) - 1;       // (the last sample is the last entry)
+        if (!VirtualDiskIndexProbeEntry(partition, index, i, &fileInfo)) { return 0; }
+    }
+
+    if (!index->complete) { return 1; }
+    if (!VirtualDiskIndexProbeEnd(partition, VIRTUALDISK_ROOT_DIRECTORY, VirtualDiskIndexRootCount(index), &fileInfo)) { return 0; }
+    for (i = 0; directories && i < index->count; i++)
+    {
+        const virtualdisk_index_entry_t *entry = &index->entries[i];
+        if (!(entry->dirEntry[11] & VIRTUALDISK_ATTRIB_DIRECTORY)) { continue; }
+        if (!VirtualDiskIndexProbeEnd(partition, (int)GET_DWORD(entry->directory), GET_DWORD(entry->numChildren), &fileInfo)) { return 0; }
+    }
+    return 1;
+}
+
+
+// (Private) Take the next chunk for a parallel index build (returns zero if no chunks remain)
+static char VirtualDiskIndexBuildTakeChunk(virtualdisk_index_build_t *build, unsigned long *chunk)
+{
+    char taken;
+#ifdef _WIN32
+    EnterCriticalSection(&build->lock);
+#else
+    pthread_mutex_lock(&build->lock);
+#endif
+    *chunk = build->nextChunk;
+    taken = (*chunk < build->numChunks && *chunk * VIRTUALDISKINDEX_PARALLEL_CHUNK < build->endId);
+    if (taken) { build->nextChunk++; }
+#ifdef _WIN32
+    LeaveCriticalSection(&build->lock);
+#else
+    pthread_mutex_unlock(&build->lock);
+#endif
+    return taken;
+}
+
+
+// (Private) Record the end of the file set found during a parallel index build
+static void VirtualDiskIndexBuildSetEnd(virtualdisk_index_build_t *build, unsigned long id)
+{
+#ifdef _WIN32
+    EnterCriticalSection(&build->lock);
+#else
+    pthread_mutex_lock(&build->lock);
+#endif
+    if (id < build->endId) { build->endId = id; }
+#ifdef _WIN32
+    LeaveCriticalSection(&build->lock);
+#else
+    pthread_mutex_unlock(&build->lock);
+#endif
+}
+
+
+// (Private) Parallel index build worker: either fetch file information for chunks (with clusters and directory entries relative to the chunk), or relocate chunks by their prefix sums
+static void VirtualDiskIndexBuildWorker(virtualdisk_index_build_t *build)
+{
+    unsigned long chunk;
+
+    while (VirtualDiskIndexBuildTakeChunk(build, &chunk))
+    {
+        unsigned long first = chunk * VIRTUALDISKINDEX_PARALLEL_CHUNK;
+        unsigned long last = first + VIRTUALDISKINDEX_PARALLEL_CHUNK;
+        unsigned long id;
+        if (last > build->index->capacity) { last = build->index->capacity; }
+
+        if (build->pass == 0)
+        {
+            virtualdisk_fileinfo_t fileInfo;
+            unsigned long cluster = 0, slot = 0;
+            for (id = first; id < last; id++)
+            {
+                memset(&fileInfo, 0, sizeof(fileInfo));
+                fileInfo.id = (int)id;
+                if (!VirtualDiskFileInfoGet(build->partition, VIRTUALDISK_ROOT_DIRECTORY, &fileInfo))
+                {
+                    VirtualDiskIndexBuildSetEnd(build, id);
+                    break;
+                }
+                cluster += VirtualDiskIndexSetEntry(build->partition, &build->index->entries[id], &fileInfo, cluster, slot);
+                slot += GET_DWORD(build->index->entries[id].dirEntries);
+            }
+            build->chunkClusters[chunk] = cluster;
+            build->chunkEntries[chunk] = slot;
+        }
+        else
+        {
+            if (last > build->endId) { last = build->endId; }
+            for (id = first; id < last; id++)
+            {
+                VirtualDiskIndexRelocateEntry(&build->index->entries[id], build->chunkClusters[chunk], build->chunkEntries[chunk]);
+            }
+        }
+    }
+}
+
+
+#ifdef _WIN32
+static DWORD WINAPI VirtualDiskIndexBuildThread(LPVOID arg) { VirtualDiskIndexBuildWorker((virtualdisk_index_build_t *)arg); return 0; }
+#else
+static void *VirtualDiskIndexBuildThread(void *arg) { VirtualDiskIndexBuildWorker((virtualdisk_index_build_t *)arg); return NULL; }
+#endif
+
+
+// (Private) Run a pass of the parallel index build over the specified number of threads (the calling thread is one of them)
+static void VirtualDiskIndexBuildPass(virtualdisk_index_build_t *build, int numThreads, char pass)
+{
+#ifdef _WIN32
+    HANDLE threads[VIRTUALDISKINDEX_MAX_THREADS];
+#else
+    pthread_t threads[VIRTUALDISKINDEX_MAX_THREADS];
+#endif
+    int started = 0, i;
+
+    build->pass = pass;
+    build->nextChunk = 0;
+    for (i = 1; i < numThreads; i++)
+    {
+#ifdef _WIN32
+        if ((threads[started] = CreateThread(NULL, 0, VirtualDiskIndexBuildThread, build, 0, NULL)) == NULL) { break; }
+#else
+        if (pthread_create(&threads[started], NULL, VirtualDiskIndexBuildThread, build) != 0) { break; }
+#endif
+        started++;
+    }
+    VirtualDiskIndexBuildWorker(build);
+    for (i = 0; i < started; i++)
+    {
+#ifdef _WIN32
+        WaitForSingleObject(threads[i], INFINITE);
+        CloseHandle(threads[i]);
+#else
+        pthread_join(threads[i], NULL);
+#endif
+    }
+}
+
+
+// (Public) Build a file index using multiple threads -- only for partitions whose file information callback is thread-safe (returns non-zero if the index is complete)
+char VirtualDiskIndexBuildParallel(virtualdisk_partition_t *partition, virtualdisk_index_t *index, int numThreads)
+{
+    virtualdisk_index_build_t build;
+    unsigned long chunk, total, totalEntries;
+
+    if (numThreads < 1) { numThreads = 1; }
+    if (numThreads > VIRTUALDISKINDEX_MAX_THREADS) { numThreads = VIRTUALDISKINDEX_MAX_THREADS; }
+
+    memset(&build, 0, sizeof(build));
+    build.partition = partition;
+    build.index = index;
+    build.numChunks = (index->capacity + VIRTUALDISKINDEX_PARALLEL_CHUNK - 1) / VIRTUALDISKINDEX_PARALLEL_CHUNK;
+    build.endId = index->capacity;
+    if ((build.chunkClusters = (unsigned long *)calloc(2 * (build.numChunks + 1), sizeof(unsigned long))) == NULL) { return 0; }
+    build.chunkEntries = build.chunkClusters + build.numChunks + 1;
+#ifdef _WIN32
+    InitializeCriticalSection(&build.lock);
+#else
+    pthread_mutex_init(&build.lock, NULL);
+#endif
+
+    // Fetch file information for each chunk of ids, with cluster runs and directory entry positions relative to the chunk
+    VirtualDiskIndexBuildPass(&build, numThreads, 0);
+
+    // Exclusive prefix sums of the chunk cluster and directory entry totals (one value per chunk, so sequential is fine)
+    total = VirtualDiskPartitionFirstFileCluster(partition);
+    totalEntries = 0;
+    for (chunk = 0; chunk < build.numChunks && chunk * VIRTUALDISKINDEX_PARALLEL_CHUNK < build.endId; chunk++)
+    {
+        unsigned long clusters = build.chunkClusters[chunk];
+        unsigned long entries = build.chunkEntries[chunk];
+        build.chunkClusters[chunk] = total;
+        build.chunkEntries[chunk] = totalEntries;
+        total += clusters;
+        totalEntries += entries;
+    }
+
+    // Move each chunk's cluster runs and directory entries to their final position
+    VirtualDiskIndexBuildPass(&build, numThreads, 1);
+
+#ifdef _WIN32
+    DeleteCriticalSection(&build.lock);
+#else
+    pthread_mutex_destroy(&build.lock);
+#endif
+    free(build.chunkClusters);
+
+    // The index is complete if the end of the files was found within its capacity (otherwise, check if it is exactly full)
+    index->count = build.endId;
+    index->complete = (build.endId < index->capacity);
+    if (!index->complete)
+    {
+        virtualdisk_fileinfo_t fileInfo;
+        memset(&fileInfo, 0, sizeof(fileInfo));
+        fileInfo.id = (int)index->capacity;
+        index->complete = !VirtualDiskFileInfoGet(partition, VIRTUALDISK_ROOT_DIRECTORY, &fileInfo);
+    }
+
+    // Add the contents of any sub-directories (sequentially)
+    if (index->complete) { VirtualDiskIndexBuildDirectories(partition, index); }
+
+    return index->complete;
+}
+
+
+// (Public) Write a file index for the partition to a file, with a caller-defined tag (e.g. a hash or version of the file-set)
+char VirtualDiskIndexSave(const char *filename, virtualdisk_partition_t *partition, const virtualdisk_index_t *index, unsigned long tag)
+{
+    unsigned char header[VIRTUALDISKINDEX_HEADER_SIZE];
+    unsigned long flags = 0, i;
+    FILE *fp;
+    char ok;
+
+    memset(header, 0, sizeof(header));
+    memcpy(header + 0, VIRTUALDISKINDEX_MAGIC, 8);
+    SET_DWORD(header + 8, VIRTUALDISKINDEX_VERSION);
+    SET_DWORD(header + 12, VIRTUALDISKINDEX_HEADER_SIZE);
+    SET_DWORD(header + 16, sizeof(virtualdisk_index_entry_t));
+    SET_DWORD(header + 20, index->count);
+    SET_DWORD(header + 24, VirtualDiskIndexGeometryHash(partition));
+    SET_DWORD(header + 28, tag);
+    SET_DWORD(header + 32, VirtualDiskIndexHash(2166136261ul, index->entries, index->count * sizeof(virtualdisk_index_entry_t)));
+    if (index->complete) { flags |= 1; }
+    for (i = 0; i < index->count && !(flags & 2); i++) { if (index->entries[i].dirEntry[11] & VIRTUALDISK_ATTRIB_DIRECTORY) { flags |= 2; } }
+    SET_DWORD(header + 36, flags);
+    SET_DWORD(header + 40, VirtualDiskIndexHash(2166136261ul, header, 40));
+
+    if ((fp = fopen(filename, "wb")) == NULL) { return 0; }
+    ok = (fwrite(header, 1, sizeof(header), fp) == sizeof(header));
+    if (ok && index->count > 0) { ok = (fwrite(index->entries, sizeof(virtualdisk_index_entry_t), index->count, fp) == index->count); }
+    if (fclose(fp) != 0) { ok = 0; }
+    return ok;
+}
+
+
+// (Public) Memory-map a previously saved file index -- fails if missing, corrupt, or stale (different geometry, tag, or file-set); 'verify' also checks every entry against the checksum
+char VirtualDiskIndexMap(virtualdisk_index_file_t *indexFile, const char *filename, virtualdisk_partition_t *partition, unsigned long tag, char verify)
+{
+    const unsigned char *header;
+    unsigned long count;
+
+    memset(indexFile, 0, sizeof(*indexFile));
+
+    // Map the file (privately: any later in-place updates are not written back)
+#ifdef _WIN32
+    {
+        HANDLE hFile, hMapping;
+        LARGE_INTEGER size;
+        hFile = CreateFileA(filename, GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+        if (hFile == INVALID_HANDLE_VALUE) { return 0; }
+        if (!GetFileSizeEx(hFile, &size) || size.QuadPart < VIRTUALDISKINDEX_HEADER_SIZE) { CloseHandle(hFile); return 0; }
+        hMapping = CreateFileMappingA(hFile, NULL, PAGE_WRITECOPY, 0, 0, NULL);
+        CloseHandle(hFile);
+        if (hMapping == NULL) { return 0; }
+        indexFile->base = MapViewOfFile(hMapping, FILE_MAP_COPY, 0, 0, 0);
+        CloseHandle(hMapping);
+        if (indexFile->base == NULL) { return 0; }
+        indexFile->length = (size_t)size.QuadPart;
+    }
+#else
+    {
+        struct stat st;
+        void *base;
+        int fd = open(filename, O_RDONLY);
+        if (fd < 0) { return 0; }
+        if (fstat(fd, &st) != 0 || st.st_size < VIRTUALDISKINDEX_HEADER_SIZE) { close(fd); return 0; }
+        base = mmap(NULL, (size_t)st.st_size, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+        close(fd);
+        if (base == MAP_FAILED) { return 0; }
+        indexFile->base = base;
+        indexFile->length = (size_t)st.st_size;
+    }
+#endif
+
+    // Check the header describes this partition, tag, and file length
+    header = (const unsigned char *)indexFile->base;
+    count = GET_DWORD(header + 20);
+    if (memcmp(header, VIRTUALDISKINDEX_MAGIC, 8) != 0
+     || GET_DWORD(header + 8) != VIRTUALDISKINDEX_VERSION
+     || GET_DWORD(header + 12) != VIRTUALDISKINDEX_HEADER_SIZE
+     || GET_DWORD(header + 16) != sizeof(virtualdisk_index_entry_t)
+     || GET_DWORD(header + 24) != VirtualDiskIndexGeometryHash(partition)
+     || GET_DWORD(header + 28) != (tag & 0xfffffffful)
+     || GET_DWORD(header + 40) != VirtualDiskIndexHash(2166136261ul, header, 40)
+     || indexFile->length != VIRTUALDISKINDEX_HEADER_SIZE + (size_t)count * sizeof(virtualdisk_index_entry_t))
+    {
+        VirtualDiskIndexUnmap(indexFile);
+        return 0;
+    }
+
+    indexFile->index.entries = (virtualdisk_index_entry_t *)((unsigned char *)indexFile->base + VIRTUALDISKINDEX_HEADER_SIZE);
+    indexFile->index.capacity = count;
+    indexFile->index.count = count;
+    indexFile->index.complete = (GET_DWORD(header + 36) & 1) ? 1 : 0;
+
+    // Optionally check every entry (touches the whole mapping, but still makes no callbacks)
+    if (verify && GET_DWORD(header + 32) != VirtualDiskIndexHash(2166136261ul, indexFile->index.entries, count * sizeof(virtualdisk_index_entry_t)))
+    {
+        VirtualDiskIndexUnmap(indexFile);
+        return 0;
+    }
+
+    // Staleness probe: a sample of files spread across the index (or, if verifying, every file) must be unchanged, and a complete index must have no files after those of any of its directories (only an index with sub-directories is scanned to find them)
+    if (!VirtualDiskIndexProbe(partition, &indexFile->index, verify, (GET_DWORD(header + 36) & 2) ? 1 : 0))
+    {
+        VirtualDiskIndexUnmap(indexFile);
+        return 0;
+    }
+
+    return 1;
+}
+
+
+// (Public) Release a mapped file index (remove it from any partition first)
+void VirtualDiskIndexUnmap(virtualdisk_index_file_t *indexFile)
+{
+    if (indexFile->base != NULL)
+    {
+#ifdef _WIN32
+        UnmapViewOfFile(indexFile->base);
+#else
+        munmap(indexFile->base, indexFile->length);
+#endif
+    }
+    memset(indexFile, 0, sizeof(*indexFile));
+}
@@ -0,0 +1,47 @@
+// Virtual Disk/File System - Persisted File Index
+// Dan Jackson, 2013
+
+#ifndef VIRTUALDISKINDEX_H
+#define VIRTUALDISKINDEX_H
+
+#include <stddef.h>
+
+#include "virtualdisk.h"
+
+// Plain C linkage
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// Index file format
+#define VIRTUALDISKINDEX_VERSION        4       // Incremented whenever the entry or header layout changes
+#define VIRTUALDISKINDEX_HEADER_SIZE    64      // Header size (bytes), entries follow
+
+
+// (Public) A loaded index file -- the index is usable while the file is mapped
+typedef struct
+{
+    virtualdisk_index_t index;                  // Index (entries refer to the mapping)
+    void *base;                                 // Start of the mapping (NULL if not mapped)
+    size_t length;                              // Length of the mapping (bytes)
+} virtualdisk_index_file_t;
+
+
+// (Public) Build a file index using multiple threads -- only for partitions whose file information callback is thread-safe (returns non-zero if the index is complete)
+char VirtualDiskIndexBuildParallel(virtualdisk_partition_t *partition, virtualdisk_index_t *index, int numThreads);
+
+// (Public) Write a file index for the partition to a file, with a caller-defined tag (e.g. a hash or version of the file-set)
+char VirtualDiskIndexSave(const char *filename, virtualdisk_partition_t *partition, const virtualdisk_index_t *index, unsigned long tag);
+
+// (Public) Memory-map a previously saved file index -- fails if missing, corrupt, or stale (different geometry, tag, or file-set, probed at a sample of entries and after the last file of each directory); 'verify' also checks every entry against the checksum and the file information callback
+char VirtualDiskIndexMap(virtualdisk_index_file_t *indexFile, const char *filename, virtualdisk_partition_t *partition, unsigned long tag, char verify);
+
+// (Public) Release a mapped file index (remove it from any partition first)
+void VirtualDiskIndexUnmap(virtualdisk_index_file_t *indexFile);
+
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
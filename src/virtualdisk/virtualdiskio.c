@@ -38,7 +38,7 @@ DRESULT disk_read(BYTE drive, BYTE *buffer, DWORD sector, BYTE count)
 	if (drive != 0) { return RES_PARERR; }
     if (buffer == 0) { return RES_PARERR; }
     if (state == 0 || !state->initialized) { return RES_NOTRDY; }
-    if (!VirtualDiskReadSectors(state, sector, count, buffer))
+    if (VirtualDiskReadSectors(state, sector, count, buffer) != count)
     {
         return RES_ERROR;
     }
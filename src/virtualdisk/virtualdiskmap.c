@@ -0,0 +1,199 @@
+// Virtual Disk/File System - Memory-Mapped File Contents
+// Dan Jackson, 2013
+
+// A source file is mapped once, and its sectors are copied straight from the mapping. As a host copying a large file reads its
+// clusters in order, each read that continues from the previous one is a sequential run: the whole mapping is then advised as
+// sequential (so the system reads ahead and drops pages behind), and a window beyond the read, growing with the run, is advised as
+// needed -- so later reads find their pages already faulted in, rather than stalling on a major fault for each cluster. A read
+// elsewhere ends the run and returns the mapping to normal advice.
+
+#ifdef _WIN32
+#define _CRT_SECURE_NO_WARNINGS
+#include <windows.h>
+#else
+#define _DEFAULT_SOURCE
+#define _FILE_OFFSET_BITS 64
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#endif
+
+#include <string.h>
+
+#include "virtualdiskmap.h"
+
+
+// (Private) Advise the system of the expected use of a range of the mapping (page-aligned)
+static void VirtualDiskMapAdvise(virtualdisk_map_t *map, size_t start, size_t end, int advice)
+{
+#ifdef _WIN32
+    (void)map; (void)start; (void)end; (void)advice;
+#else
+    start -= start % map->pageSize;
+    if (end > map->length) { end = map->length; }
+    if (map->base == NULL || start >= end) { return; }
+    madvise((void *)(map->base + start), end - start, advice);
+#endif
+}
+
+
+// (Private) Note a read of the specified sectors, advising sequential access and prefetching ahead of a sequential run
+static void VirtualDiskMapAccess(virtualdisk_map_t *map, unsigned long sector, unsigned short count)
+{
+#ifndef _WIN32
+    size_t end = ((size_t)sector + count) * map->sectorSize;
+
+    if (sector == map->nextSector && map->runSectors > 0)
+    {
+        size_t window = (size_t)(map->runSectors + count) * map->sectorSize;
+        map->runSectors += count;
+        if (!map->sequential)
+        {
+            VirtualDiskMapAdvise(map, 0, map->length, MADV_SEQUENTIAL);
+            map->sequential = 1;
+        }
+
+        // Keep at least half of the window prefetched ahead of the read
+        if (window < VIRTUALDISKMAP_MIN_PREFETCH) { window = VIRTUALDISKMAP_MIN_PREFETCH; }
+        if (window > VIRTUALDISKMAP_MAX_PREFETCH) { window = VIRTUALDISKMAP_MAX_PREFETCH; }
+        if (map->prefetchEnd < end + window / 2 && map->prefetchEnd < map->length)
+        {
+            VirtualDiskMapAdvise(map, (map->prefetchEnd > end) ? map->prefetchEnd : end, end + window, MADV_WILLNEED);
+            map->prefetchEnd = end + window;
+        }
+    }
+    else
+    {
+        // Not a continuation: start a new run here
+        if (map->sequential)
+        {
+            VirtualDiskMapAdvise(map, 0, map->length, MADV_NORMAL);
+            map->sequential = 0;
+        }
+        map->runSectors = count;
+        map->prefetchEnd = end;
+    }
+    map->nextSector = sector + count;
+#else
+    (void)map; (void)sector; (void)count;
+#endif
+}
+
+
+// (Public) Memory-map a source file (read-only; the file must not be truncated while it is mapped)
+char VirtualDiskMapOpen(virtualdisk_map_t *map, const char *filename, unsigned short sectorSize)
+{
+    memset(map, 0, sizeof(virtualdisk_map_t));
+    map->sectorSize = sectorSize;
+    if (sectorSize == 0) { return 0; }
+
+#ifdef _WIN32
+    {
+        HANDLE hFile, hMapping;
+        LARGE_INTEGER size;
+        SYSTEM_INFO systemInfo;
+        GetSystemInfo(&systemInfo);
+        map->pageSize = systemInfo.dwPageSize;
+        hFile = CreateFileA(filename, GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, NULL);
+        if (hFile == INVALID_HANDLE_VALUE) { return 0; }
+        if (!GetFileSizeEx(hFile, &size) || (unsigned long long)size.QuadPart > (size_t)-1) { CloseHandle(hFile); return 0; }
+        map->length = (size_t)size.QuadPart;
+        if (map->length > 0)
+        {
+            hMapping = CreateFileMappingA(hFile, NULL, PAGE_READONLY, 0, 0, NULL);
+            CloseHandle(hFile);
+            if (hMapping == NULL) { return 0; }
+            map->base = (const unsigned char *)MapViewOfFile(hMapping, FILE_MAP_READ, 0, 0, 0);
+            CloseHandle(hMapping);
+            if (map->base == NULL) { return 0; }
+        }
+        else
+        {
+            CloseHandle(hFile);
+        }
+    }
+#else
+    {
+        struct stat st;
+        int fd = open(filename, O_RDONLY);
+        map->pageSize = (size_t)sysconf(_SC_PAGESIZE);
+        if (fd < 0) { return 0; }
+        if (fstat(fd, &st) != 0 || (unsigned long long)st.st_size > (size_t)-1) { close(fd); return 0; }
+        map->length = (size_t)st.st_size;
+        if (map->length > 0)
+        {
+            void *base = mmap(NULL, map->length, PROT_READ, MAP_SHARED, fd, 0);
+            if (base == MAP_FAILED) { close(fd); return 0; }
+            map->base = (const unsigned char *)base;
+        }
+        close(fd);
+    }
+#endif
+
+    map->open = 1;
+    return 1;
+}
+
+
+// (Public) Unmap a source file
+void VirtualDiskMapClose(virtualdisk_map_t *map)
+{
+    if (map->base != NULL)
+    {
+#ifdef _WIN32
+        UnmapViewOfFile((LPCVOID)map->base);
+#else
+        munmap((void *)map->base, map->length);
+#endif
+    }
+    map->base = NULL;
+    map->length = 0;
+    map->open = 0;
+}
+
+
+// (Public) Copy sectors of the source file to the buffer (beyond the end of the file, sectors are blank), advising the system of sequential access and prefetching ahead of it
+unsigned short VirtualDiskMapRead(virtualdisk_map_t *map, unsigned long sector, unsigned short count, unsigned char *buffer)
+{
+    size_t offset = (size_t)sector * map->sectorSize, length = (size_t)count * map->sectorSize, available;
+
+    if (!map->open) { return 0; }
+    VirtualDiskMapAccess(map, sector, count);
+    available = (offset < map->length) ? map->length - offset : 0;
+    if (available > length) { available = length; }
+    if (available > 0) { memcpy(buffer, map->base + offset, available); }
+    if (available < length) { memset(buffer + available, 0, length - available); }
+    return count;
+}
+
+
+// (Public) Copy part of a sector of the source file to the buffer ('length' bytes from byte 'offset'; blank beyond the end of the file), noting the access as the sector is started
+unsigned short VirtualDiskMapReadPartial(virtualdisk_map_t *map, unsigned long sector, unsigned short offset, unsigned short length, unsigned char *buffer)
+{
+    size_t start = (size_t)sector * map->sectorSize + offset, available;
+
+    if (!map->open || offset >= map->sectorSize || length > map->sectorSize - offset) { return 0; }
+    if (offset == 0) { VirtualDiskMapAccess(map, sector, 1); }      // (once per sector, so the parts of a sector continue a sequential run)
+    available = (start < map->length) ? map->length - start : 0;
+    if (available > length) { available = length; }
+    if (available > 0) { memcpy(buffer, map->base + start, available); }
+    if (available < length) { memset(buffer + available, 0, length - available); }
+    return length;
+}
+
+
+// (Public) File contents generator for a memory-mapped file (set the file information's 'reference' to the virtualdisk_map_t)
+unsigned short VirtualDiskMapContents(void *reference, unsigned long sector, unsigned short count, unsigned char *buffer)
+{
+    const virtualdisk_fileinfo_t *fileInfo = (const virtualdisk_fileinfo_t *)reference;
+    return VirtualDiskMapRead((virtualdisk_map_t *)fileInfo->reference, sector, count, buffer);
+}
+
+
+// (Public) Partial file contents generator for a memory-mapped file, for streaming a sector in pieces (set the file information's 'partial' to it, as well as its 'contents' to VirtualDiskMapContents)
+unsigned short VirtualDiskMapPartial(void *reference, unsigned long sector, unsigned short offset, unsigned short length, unsigned char *buffer)
+{
+    const virtualdisk_fileinfo_t *fileInfo = (const virtualdisk_fileinfo_t *)reference;
+    return VirtualDiskMapReadPartial((virtualdisk_map_t *)fileInfo->reference, sector, offset, length, buffer);
+}
@@ -0,0 +1,63 @@
+// Virtual Disk/File System - Memory-Mapped File Contents
+// Dan Jackson, 2013
+
+#ifndef VIRTUALDISKMAP_H
+#define VIRTUALDISKMAP_H
+
+#include <stddef.h>
+
+#include "virtualdisk.h"
+
+// Plain C linkage
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// Sequential reads advise the next part of the file as needed: the window grows with the run of sequential reads, up to this size (bytes)
+#ifndef VIRTUALDISKMAP_MAX_PREFETCH
+#define VIRTUALDISKMAP_MAX_PREFETCH (8ul * 1024 * 1024)
+#endif
+#define VIRTUALDISKMAP_MIN_PREFETCH (256ul * 1024)
+
+
+// (Public) A memory-mapped source file, with the access pattern seen so far
+typedef struct
+{
+    const unsigned char *base;                      // Start of the mapping (NULL if the file is empty)
+    size_t length;                                  // Length of the file (bytes)
+    size_t pageSize;                                // Size of a memory page (bytes)
+    unsigned short sectorSize;                      // Size of each sector (bytes)
+    char open;                                      // Non-zero if open
+
+    // Access pattern
+    unsigned long nextSector;                       // Sector following the previous read
+    unsigned long runSectors;                       // Number of sectors read sequentially (ending at the previous read)
+    size_t prefetchEnd;                             // End of the range already advised as needed (bytes)
+    char sequential;                                // Sequential access has been advised for the whole mapping
+} virtualdisk_map_t;
+
+
+// (Public) Memory-map a source file (read-only; the file must not be truncated while it is mapped)
+char VirtualDiskMapOpen(virtualdisk_map_t *map, const char *filename, unsigned short sectorSize);
+
+// (Public) Unmap a source file
+void VirtualDiskMapClose(virtualdisk_map_t *map);
+
+// (Public) Copy sectors of the source file to the buffer (beyond the end of the file, sectors are blank), advising the system of sequential access and prefetching ahead of it
+unsigned short VirtualDiskMapRead(virtualdisk_map_t *map, unsigned long sector, unsigned short count, unsigned char *buffer);
+
+// (Public) Copy part of a sector of the source file to the buffer ('length' bytes from byte 'offset'; blank beyond the end of the file), noting the access as the sector is started
+unsigned short VirtualDiskMapReadPartial(virtualdisk_map_t *map, unsigned long sector, unsigned short offset, unsigned short length, unsigned char *buffer);
+
+// (Public) File contents generator for a memory-mapped file (set the file information's 'reference' to the virtualdisk_map_t)
+unsigned short VirtualDiskMapContents(void *reference, unsigned long sector, unsigned short count, unsigned char *buffer);
+
+// (Public) Partial file contents generator for a memory-mapped file, for streaming a sector in pieces (set the file information's 'partial' to it, as well as its 'contents' to VirtualDiskMapContents)
+unsigned short VirtualDiskMapPartial(void *reference, unsigned long sector, unsigned short offset, unsigned short length, unsigned char *buffer);
+
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
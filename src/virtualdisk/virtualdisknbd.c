@@ -0,0 +1,980 @@
+// Virtual Disk/File System - Network Block Device Server
+// Dan Jackson, 2013
+
+// A read-only server for the NBD protocol (as nbd-server, qemu-nbd and the Linux nbd driver), so that a host can attach a virtual
+// disk over a Unix or TCP socket (e.g. 'nbd-client -unix /tmp/vd.sock /dev/nbd0', or 'qemu-img info nbd+unix:///?socket=/tmp/vd.sock').
+// Only fixed newstyle negotiation is offered. With structured replies, a read is answered as a run of chunks: blank extents of the
+// disk (VirtualDiskSectorExtent) as holes, so they are not sent, and data in pieces of the connection's buffer size; the
+// 'base:allocation' metadata context reports the same extents for block status queries. Each connection is served on its own thread,
+// with its own read context (a copy of the disk), or through the disk itself under a lock (for generators that are not thread-safe).
+// Reads hold a read-write lock: shared by the copies, exclusive on a shared disk. The application takes it exclusively to update files
+// live, after which each copy is made again before its next read. A copy's statistics are added to the disk's as its connection ends.
+
+#ifndef _WIN32
+#define _POSIX_C_SOURCE 200809L
+#include <errno.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <netdb.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#endif
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "virtualdisknbd.h"
+
+// Big-endian (network order) word macros
+#define SET_BE_WORD(_p, _v) { *((_p)+0) = (unsigned char)((_v) >> 8); *((_p)+1) = (unsigned char)(_v); }
+#define SET_BE_DWORD(_p, _ov) { unsigned long _v = (_ov); *((_p)+0) = (unsigned char)((_v) >> 24); *((_p)+1) = (unsigned char)((_v) >> 16); *((_p)+2) = (unsigned char)((_v) >> 8); *((_p)+3) = (unsigned char)(_v); }
+#define SET_BE_QWORD(_p, _ov) { unsigned long long _q = (_ov); SET_BE_DWORD((_p), (unsigned long)(_q >> 32)); SET_BE_DWORD((_p) + 4, (unsigned long)(_q & 0xfffffffful)); }
+#define GET_BE_WORD(_p) ( ((unsigned short)*((_p)+0) << 8) | (unsigned short)*((_p)+1) )
+#define GET_BE_DWORD(_p) ( ((unsigned long)*((_p)+0) << 24) | ((unsigned long)*((_p)+1) << 16) | ((unsigned long)*((_p)+2) << 8) | (unsigned long)*((_p)+3) )
+#define GET_BE_QWORD(_p) ( ((unsigned long long)GET_BE_DWORD(_p) << 32) | GET_BE_DWORD((_p) + 4) )
+
+// Protocol values
+#define NBD_MAGIC                   0x4e42444d41474943ull   // "NBDMAGIC"
+#define NBD_OPTION_MAGIC            0x49484156454f5054ull   // "IHAVEOPT"
+#define NBD_REPLY_MAGIC             0x0003e889045565a9ull
+#define NBD_REQUEST_MAGIC           0x25609513ul
+#define NBD_SIMPLE_REPLY_MAGIC      0x67446698ul
+#define NBD_STRUCTURED_REPLY_MAGIC  0x668e33eful
+
+#define NBD_FLAG_FIXED_NEWSTYLE     0x0001      // Handshake flags
+#define NBD_FLAG_NO_ZEROES          0x0002
+#define NBD_FLAG_HAS_FLAGS          0x0001      // Transmission flags
+#define NBD_FLAG_READ_ONLY          0x0002
+#define NBD_FLAG_SEND_FLUSH         0x0004
+#define NBD_FLAG_SEND_DF            0x0080
+#define NBD_FLAG_CAN_MULTI_CONN     0x0100
+
+#define NBD_OPT_EXPORT_NAME         1
+#define NBD_OPT_ABORT               2
+#define NBD_OPT_LIST                3
+#define NBD_OPT_INFO                6
+#define NBD_OPT_GO                  7
+#define NBD_OPT_STRUCTURED_REPLY    8
+#define NBD_OPT_LIST_META_CONTEXT   9
+#define NBD_OPT_SET_META_CONTEXT    10
+
+#define NBD_REP_ACK                 1
+#define NBD_REP_SERVER              2
+#define NBD_REP_INFO                3
+#define NBD_REP_META_CONTEXT        4
+#define NBD_REP_ERR_UNSUP           0x80000001ul
+#define NBD_REP_ERR_INVALID         0x80000003ul
+#define NBD_REP_ERR_UNKNOWN         0x80000006ul
+
+#define NBD_INFO_EXPORT             0
+#define NBD_INFO_NAME               1
+#define NBD_INFO_DESCRIPTION        2
+#define NBD_INFO_BLOCK_SIZE         3
+
+#define NBD_CMD_READ                0
+#define NBD_CMD_WRITE               1
+#define NBD_CMD_DISC                2
+#define NBD_CMD_FLUSH               3
+#define NBD_CMD_TRIM                4
+#define NBD_CMD_WRITE_ZEROES        6
+#define NBD_CMD_BLOCK_STATUS        7
+#define NBD_CMD_FLAG_DF             0x0004
+#define NBD_CMD_FLAG_REQ_ONE        0x0008
+
+#define NBD_REPLY_FLAG_DONE         0x0001
+#define NBD_REPLY_TYPE_NONE         0
+#define NBD_REPLY_TYPE_OFFSET_DATA  1
+#define NBD_REPLY_TYPE_OFFSET_HOLE  2
+#define NBD_REPLY_TYPE_BLOCK_STATUS 5
+#define NBD_REPLY_TYPE_ERROR        0x8001
+#define NBD_REPLY_TYPE_ERROR_OFFSET 0x8002
+
+#define NBD_STATE_HOLE              0x0001
+#define NBD_STATE_ZERO              0x0002
+
+#define NBD_EPERM                   1
+#define NBD_EIO                     5
+#define NBD_EINVAL                  22
+
+// Metadata context
+#define VIRTUALDISKNBD_ALLOCATION_CONTEXT "base:allocation"
+#define VIRTUALDISKNBD_ALLOCATION_ID 1
+
+// Maximum number of extents looked up for one block status reply (the reply may cover less than was asked)
+#define VIRTUALDISKNBD_MAX_LOOKUPS 4096
+
+
+#ifndef _WIN32
+
+// (Private) A connection accepted by the server
+typedef struct virtualdisk_nbd_connection_struct_t
+{
+    virtualdisk_nbd_t *server;
+    int socket;                                     // Connected socket (closed once the thread is joined)
+    pthread_t thread;
+    char finished;                                  // Set when the thread has finished (guarded by the lock)
+    struct virtualdisk_nbd_connection_struct_t *next;
+} virtualdisk_nbd_connection_t;
+
+// (Private) Server state
+typedef struct virtualdisk_nbd_state_struct_t
+{
+    pthread_mutex_t lock;                           // Guards the connections and statistics
+    pthread_rwlock_t readLock;                      // Held to read (shared by copies, exclusive for a shared disk), and exclusively by VirtualDiskNbdLock()
+    unsigned long updates;                          // Number of times VirtualDiskNbdLock() was released (guarded by the read lock)
+    virtualdisk_nbd_connection_t *connections;      // Connections not yet joined
+} virtualdisk_nbd_state_t;
+
+// (Private) A client being served
+typedef struct
+{
+    virtualdisk_nbd_t *server;
+    int socket;
+    virtualdisk_t *disk;                            // Read context: the server's disk (shared) or the copy
+    virtualdisk_t copy;
+    virtualdisk_partition_t partitions[VIRTUALDISK_MAX_PARTITIONS];
+    unsigned long updates;                          // The server's count of updates when the copy was made
+    unsigned short sectorSize;
+    unsigned long long size;                        // Size of the export (bytes)
+    unsigned char *buffer;                          // VIRTUALDISKNBD_BUFFER_SIZE bytes, for option data, sector data and extents
+    char noZeroes;                                  // Client agreed to omit the zero padding after NBD_OPT_EXPORT_NAME
+    char structured;                                // Structured replies negotiated
+    char allocation;                                // 'base:allocation' context selected
+    unsigned long requests;
+    unsigned long long bytesRead;
+} virtualdisk_nbd_client_t;
+
+
+// (Private) Send a whole buffer (more: further data follows immediately, so it can be coalesced)
+static char VirtualDiskNbdSend(int socket, const void *buffer, size_t length, char more)
+{
+    const unsigned char *p = (const unsigned char *)buffer;
+    int flags = 0;
+
+#ifdef MSG_NOSIGNAL
+    flags |= MSG_NOSIGNAL;
+#endif
+#ifdef MSG_MORE
+    if (more) { flags |= MSG_MORE; }
+#endif
+    while (length > 0)
+    {
+        ssize_t sent = send(socket, p, length, flags);
+        if (sent < 0 && errno == EINTR) { continue; }
+        if (sent <= 0) { return 0; }
+        p += sent;
+        length -= (size_t)sent;
+    }
+    return 1;
+}
+
+
+// (Private) Receive a whole buffer (returns zero on an error or end of stream)
+static char VirtualDiskNbdReceive(int socket, void *buffer, size_t length)
+{
+    unsigned char *p = (unsigned char *)buffer;
+
+    while (length > 0)
+    {
+        ssize_t received = recv(socket, p, length, 0);
+        if (received < 0 && errno == EINTR) { continue; }
+        if (received <= 0) { return 0; }
+        p += received;
+        length -= (size_t)received;
+    }
+    return 1;
+}
+
+
+// (Private) Receive and discard data (e.g. the payload of a refused write)
+static char VirtualDiskNbdDiscard(virtualdisk_nbd_client_t *client, unsigned long long length)
+{
+    while (length > 0)
+    {
+        size_t part = (length < VIRTUALDISKNBD_BUFFER_SIZE) ? (size_t)length : VIRTUALDISKNBD_BUFFER_SIZE;
+        if (!VirtualDiskNbdReceive(client->socket, client->buffer, part)) { return 0; }
+        length -= part;
+    }
+    return 1;
+}
+
+
+// (Private) Check an export name from the client (the default export, an empty name, is always accepted)
+static char VirtualDiskNbdExportMatches(virtualdisk_nbd_t *server, const unsigned char *name, unsigned long length)
+{
+    if (length == 0) { return 1; }
+    return (server->exportName != NULL && strlen(server->exportName) == length && memcmp(server->exportName, name, length) == 0);
+}
+
+
+// (Private) Send an option reply (with its data, if any)
+static char VirtualDiskNbdOptionReply(virtualdisk_nbd_client_t *client, unsigned long option, unsigned long type, const void *data, unsigned long length)
+{
+    unsigned char header[20];
+
+    SET_BE_QWORD(header + 0, NBD_REPLY_MAGIC);
+    SET_BE_DWORD(header + 8, option);
+    SET_BE_DWORD(header + 12, type);
+    SET_BE_DWORD(header + 16, length);
+    if (!VirtualDiskNbdSend(client->socket, header, sizeof(header), length > 0)) { return 0; }
+    return (length == 0 || VirtualDiskNbdSend(client->socket, data, length, 0));
+}
+
+
+// (Private) Send an NBD_REP_INFO reply of the specified information type with the specified data
+static char VirtualDiskNbdInfoReply(virtualdisk_nbd_client_t *client, unsigned long option, unsigned short info, const void *data, unsigned long length)
+{
+    unsigned char reply[4 + VIRTUALDISK_MAX_FILENAME + 1];
+
+    if (length > sizeof(reply) - 2) { length = sizeof(reply) - 2; }
+    SET_BE_WORD(reply, info);
+    memcpy(reply + 2, data, length);
+    return VirtualDiskNbdOptionReply(client, option, NBD_REP_INFO, reply, 2 + length);
+}
+
+
+// (Private) Transmission flags of the export (once options are negotiated)
+static unsigned short VirtualDiskNbdTransmissionFlags(virtualdisk_nbd_client_t *client)
+{
+    unsigned short flags = NBD_FLAG_HAS_FLAGS | NBD_FLAG_READ_ONLY | NBD_FLAG_SEND_FLUSH | NBD_FLAG_CAN_MULTI_CONN;
+    if (client->structured) { flags |= NBD_FLAG_SEND_DF; }
+    return flags;
+}
+
+
+// (Private) Handle NBD_OPT_INFO or NBD_OPT_GO (returns 2 to start transmission, 1 to continue negotiating, 0 on an error)
+static char VirtualDiskNbdOptionInfo(virtualdisk_nbd_client_t *client, unsigned long option, const unsigned char *data, unsigned long length)
+{
+    virtualdisk_nbd_t *server = client->server;
+    unsigned long nameLength, numRequests, i;
+    unsigned char reply[12];
+
+    // Export name, then a list of information requests
+    nameLength = (length >= 4) ? GET_BE_DWORD(data) : 0xfffffffful;
+    if (length < 6 || nameLength > length - 6) { return VirtualDiskNbdOptionReply(client, option, NBD_REP_ERR_INVALID, NULL, 0); }
+    numRequests = GET_BE_WORD(data + 4 + nameLength);
+    if (length != 6 + nameLength + 2 * numRequests) { return VirtualDiskNbdOptionReply(client, option, NBD_REP_ERR_INVALID, NULL, 0); }
+    if (!VirtualDiskNbdExportMatches(server, data + 4, nameLength)) { return VirtualDiskNbdOptionReply(client, option, NBD_REP_ERR_UNKNOWN, NULL, 0); }
+
+    // Requested information (other than the size and flags, which are always sent)
+    for (i = 0; i < numRequests; i++)
+    {
+        unsigned short info = GET_BE_WORD(data + 6 + nameLength + 2 * i);
+        if (info == NBD_INFO_NAME)
+        {
+            const char *name = (server->exportName != NULL) ? server->exportName : "";
+            if (!VirtualDiskNbdInfoReply(client, option, NBD_INFO_NAME, name, (unsigned long)strlen(name))) { return 0; }
+        }
+        else if (info == NBD_INFO_DESCRIPTION && server->description != NULL)
+        {
+            if (!VirtualDiskNbdInfoReply(client, option, NBD_INFO_DESCRIPTION, server->description, (unsigned long)strlen(server->description))) { return 0; }
+        }
+        else if (info == NBD_INFO_BLOCK_SIZE)
+        {
+            SET_BE_DWORD(reply + 0, 1);                         // Any alignment is accepted...
+            SET_BE_DWORD(reply + 4, client->sectorSize);        // ...but whole sectors are preferred
+            SET_BE_DWORD(reply + 8, VIRTUALDISKNBD_MAX_REQUEST);
+            if (!VirtualDiskNbdInfoReply(client, option, NBD_INFO_BLOCK_SIZE, reply, 12)) { return 0; }
+        }
+    }
+
+    SET_BE_QWORD(reply + 0, client->size);
+    SET_BE_WORD(reply + 8, VirtualDiskNbdTransmissionFlags(client));
+    if (!VirtualDiskNbdInfoReply(client, option, NBD_INFO_EXPORT, reply, 10)) { return 0; }
+    if (!VirtualDiskNbdOptionReply(client, option, NBD_REP_ACK, NULL, 0)) { return 0; }
+    return (option == NBD_OPT_GO) ? 2 : 1;
+}
+
+
+// (Private) Handle NBD_OPT_LIST_META_CONTEXT or NBD_OPT_SET_META_CONTEXT (only 'base:allocation' is offered)
+static char VirtualDiskNbdOptionMetaContext(virtualdisk_nbd_client_t *client, unsigned long option, const unsigned char *data, unsigned long length)
+{
+    static const char context[] = VIRTUALDISKNBD_ALLOCATION_CONTEXT;
+    unsigned char reply[4 + sizeof(context)];
+    unsigned long nameLength, numQueries, position, i;
+    char found = 0;
+
+    if (option == NBD_OPT_SET_META_CONTEXT && !client->structured) { return VirtualDiskNbdOptionReply(client, option, NBD_REP_ERR_INVALID, NULL, 0); }
+
+    // Export name, then the queries (each a length and string)
+    nameLength = (length >= 4) ? GET_BE_DWORD(data) : 0xfffffffful;
+    if (length < 8 || nameLength > length - 8) { return VirtualDiskNbdOptionReply(client, option, NBD_REP_ERR_INVALID, NULL, 0); }
+    numQueries = GET_BE_DWORD(data + 4 + nameLength);
+    position = 8 + nameLength;
+    for (i = 0; i < numQueries; i++)
+    {
+        unsigned long queryLength = (position + 4 <= length) ? GET_BE_DWORD(data + position) : 0xfffffffful;
+        if (queryLength > length - position - 4) { return VirtualDiskNbdOptionReply(client, option, NBD_REP_ERR_INVALID, NULL, 0); }
+        if ((queryLength == sizeof(context) - 1 && memcmp(data + position + 4, context, queryLength) == 0) || (option == NBD_OPT_LIST_META_CONTEXT && queryLength == 5 && memcmp(data + position + 4, "base:", 5) == 0)) { found = 1; }
+        position += 4 + queryLength;
+    }
+    if (position != length) { return VirtualDiskNbdOptionReply(client, option, NBD_REP_ERR_INVALID, NULL, 0); }
+    if (!VirtualDiskNbdExportMatches(client->server, data + 4, nameLength)) { return VirtualDiskNbdOptionReply(client, option, NBD_REP_ERR_UNKNOWN, NULL, 0); }
+
+    // Listing with no queries lists every context; setting replaces any earlier selection
+    if (option == NBD_OPT_LIST_META_CONTEXT && numQueries == 0) { found = 1; }
+    if (option == NBD_OPT_SET_META_CONTEXT) { client->allocation = found; }
+    if (found)
+    {
+        SET_BE_DWORD(reply, VIRTUALDISKNBD_ALLOCATION_ID);
+        memcpy(reply + 4, context, sizeof(context) - 1);
+        if (!VirtualDiskNbdOptionReply(client, option, NBD_REP_META_CONTEXT, reply, 4 + sizeof(context) - 1)) { return 0; }
+    }
+    return VirtualDiskNbdOptionReply(client, option, NBD_REP_ACK, NULL, 0);
+}
+
+
+// (Private) Handshake and option haggling (returns non-zero to start transmission)
+static char VirtualDiskNbdNegotiate(virtualdisk_nbd_client_t *client)
+{
+    virtualdisk_nbd_t *server = client->server;
+    unsigned char header[18];
+
+    // Fixed newstyle handshake
+    SET_BE_QWORD(header + 0, NBD_MAGIC);
+    SET_BE_QWORD(header + 8, NBD_OPTION_MAGIC);
+    SET_BE_WORD(header + 16, NBD_FLAG_FIXED_NEWSTYLE | NBD_FLAG_NO_ZEROES);
+    if (!VirtualDiskNbdSend(client->socket, header, 18, 0)) { return 0; }
+    if (!VirtualDiskNbdReceive(client->socket, header, 4)) { return 0; }
+    if ((GET_BE_DWORD(header) & ~(unsigned long)(NBD_FLAG_FIXED_NEWSTYLE | NBD_FLAG_NO_ZEROES)) != 0) { return 0; }     // Unknown client flags
+    client->noZeroes = (GET_BE_DWORD(header) & NBD_FLAG_NO_ZEROES) != 0;
+
+    // Options
+    while (!server->stopping)
+    {
+        unsigned long option, length;
+        unsigned char *data = client->buffer;
+        char result;
+
+        if (!VirtualDiskNbdReceive(client->socket, header, 16)) { return 0; }
+        if (GET_BE_QWORD(header) != NBD_OPTION_MAGIC) { return 0; }
+        option = GET_BE_DWORD(header + 8);
+        length = GET_BE_DWORD(header + 12);
+        if (length > VIRTUALDISKNBD_BUFFER_SIZE) { return 0; }
+        if (!VirtualDiskNbdReceive(client->socket, data, length)) { return 0; }
+
+        switch (option)
+        {
+            case NBD_OPT_EXPORT_NAME:
+            {
+                unsigned char reply[10 + 124];
+                if (!VirtualDiskNbdExportMatches(server, data, length)) { return 0; }      // No reply is possible: just disconnect
+                memset(reply, 0, sizeof(reply));
+                SET_BE_QWORD(reply + 0, client->size);
+                SET_BE_WORD(reply + 8, VirtualDiskNbdTransmissionFlags(client));
+                return VirtualDiskNbdSend(client->socket, reply, client->noZeroes ? 10 : sizeof(reply), 0);
+            }
+
+            case NBD_OPT_ABORT:
+                VirtualDiskNbdOptionReply(client, option, NBD_REP_ACK, NULL, 0);
+                return 0;
+
+            case NBD_OPT_LIST:
+            {
+                const char *name = (server->exportName != NULL) ? server->exportName : "";
+                unsigned long nameLength = (unsigned long)strlen(name), descriptionLength = (server->description != NULL) ? (unsigned long)strlen(server->description) : 0;
+                if (length != 0) { result = VirtualDiskNbdOptionReply(client, option, NBD_REP_ERR_INVALID, NULL, 0); break; }
+                if (4 + nameLength + descriptionLength > VIRTUALDISKNBD_BUFFER_SIZE) { descriptionLength = 0; }
+                SET_BE_DWORD(data, nameLength);
+                memcpy(data + 4, name, nameLength);
+                if (descriptionLength > 0) { memcpy(data + 4 + nameLength, server->description, descriptionLength); }
+                result = VirtualDiskNbdOptionReply(client, option, NBD_REP_SERVER, data, 4 + nameLength + descriptionLength) && VirtualDiskNbdOptionReply(client, option, NBD_REP_ACK, NULL, 0);
+                break;
+            }
+
+            case NBD_OPT_INFO:
+            case NBD_OPT_GO:
+                result = VirtualDiskNbdOptionInfo(client, option, data, length);
+                if (result == 2) { return 1; }
+                break;
+
+            case NBD_OPT_STRUCTURED_REPLY:
+                if (length != 0) { result = VirtualDiskNbdOptionReply(client, option, NBD_REP_ERR_INVALID, NULL, 0); break; }
+                client->structured = 1;
+                result = VirtualDiskNbdOptionReply(client, option, NBD_REP_ACK, NULL, 0);
+                break;
+
+            case NBD_OPT_LIST_META_CONTEXT:
+            case NBD_OPT_SET_META_CONTEXT:
+                result = VirtualDiskNbdOptionMetaContext(client, option, data, length);
+                break;
+
+            default:
+                result = VirtualDiskNbdOptionReply(client, option, NBD_REP_ERR_UNSUP, NULL, 0);
+                break;
+        }
+        if (!result) { return 0; }
+    }
+    return 0;
+}
+
+
+// (Private) Send a simple reply header
+static char VirtualDiskNbdSimpleReply(virtualdisk_nbd_client_t *client, const unsigned char *cookie, unsigned long error, char more)
+{
+    unsigned char reply[16];
+
+    SET_BE_DWORD(reply + 0, NBD_SIMPLE_REPLY_MAGIC);
+    SET_BE_DWORD(reply + 4, error);
+    memcpy(reply + 8, cookie, 8);
+    return VirtualDiskNbdSend(client->socket, reply, sizeof(reply), more);
+}
+
+
+// (Private) Send a structured reply chunk header, followed by the start of its payload (up to 14 bytes, the rest is sent separately)
+static char VirtualDiskNbdChunk(virtualdisk_nbd_client_t *client, const unsigned char *cookie, unsigned short flags, unsigned short type, unsigned long length, const unsigned char *payload, unsigned long payloadLength, char more)
+{
+    unsigned char reply[20 + 14];
+
+    SET_BE_DWORD(reply + 0, NBD_STRUCTURED_REPLY_MAGIC);
+    SET_BE_WORD(reply + 4, flags);
+    SET_BE_WORD(reply + 6, type);
+    memcpy(reply + 8, cookie, 8);
+    SET_BE_DWORD(reply + 16, length);
+    if (payloadLength > 0) { memcpy(reply + 20, payload, payloadLength); }
+    return VirtualDiskNbdSend(client->socket, reply, 20 + payloadLength, more);
+}
+
+
+// (Private) Reply to a request with an error
+static char VirtualDiskNbdError(virtualdisk_nbd_client_t *client, const unsigned char *cookie, unsigned long error)
+{
+    unsigned char payload[6];
+
+    if (!client->structured) { return VirtualDiskNbdSimpleReply(client, cookie, error, 0); }
+    SET_BE_DWORD(payload + 0, error);
+    SET_BE_WORD(payload + 4, 0);        // No message
+    return VirtualDiskNbdChunk(client, cookie, NBD_REPLY_FLAG_DONE, NBD_REPLY_TYPE_ERROR, sizeof(payload), payload, sizeof(payload), 0);
+}
+
+
+// (Private) Take the read lock for the client's read context (exclusive if the disk is shared), copying the disk again if files were updated since its copy
+static void VirtualDiskNbdReadLock(virtualdisk_nbd_client_t *client)
+{
+    virtualdisk_nbd_state_t *state = client->server->state;
+
+    if (client->server->shared) { pthread_rwlock_wrlock(&state->readLock); return; }
+    pthread_rwlock_rdlock(&state->readLock);
+    if (client->disk == &client->copy && client->updates != state->updates)
+    {
+        virtualdisk_stats_t stats = client->copy.stats;
+        VirtualDiskEndSession(&client->copy);
+        VirtualDiskCopy(&client->copy, client->partitions, client->server->disk);
+        client->copy.stats = stats;
+        client->updates = state->updates;
+    }
+}
+
+
+// (Private) Read sectors through the client's read context (returns zero if any could not be generated)
+static char VirtualDiskNbdReadSectors(virtualdisk_nbd_client_t *client, unsigned long sector, unsigned short count, unsigned char *buffer)
+{
+    unsigned short read;
+
+    VirtualDiskNbdReadLock(client);
+    read = VirtualDiskReadSectors(client->disk, sector, count, buffer);
+    pthread_rwlock_unlock(&client->server->state->readLock);
+    return (read == count);
+}
+
+
+// (Private) Find the extent of the disk at a byte offset: returns the offset where it ends, and whether it is blank
+static unsigned long long VirtualDiskNbdExtent(virtualdisk_nbd_client_t *client, unsigned long long offset, char *blank)
+{
+    unsigned long sector = (unsigned long)(offset / client->sectorSize), count;
+
+    VirtualDiskNbdReadLock(client);
+    count = VirtualDiskSectorExtent(client->disk, sector, blank);
+    pthread_rwlock_unlock(&client->server->state->readLock);
+    if (count == 0) { return client->size; }
+    return (unsigned long long)(sector + count) * client->sectorSize;
+}
+
+
+// (Private) Reply with the disk's data for a byte range, in pieces of the buffer size, each generated before the header that covers it is sent: a simple reply, or data chunks (one per piece if 'chunked', otherwise one for the range; the last ends the reply if 'done'); a piece that could not be generated is replied to with an I/O error (setting 'failed') unless its data was already announced, when the connection has to be ended (returns zero, as on a socket error)
+static char VirtualDiskNbdSendData(virtualdisk_nbd_client_t *client, const unsigned char *cookie, unsigned long long offset, unsigned long length, char chunked, char done, char *failed)
+{
+    const unsigned long maxSectors = VIRTUALDISKNBD_BUFFER_SIZE / client->sectorSize;
+    char announced = 0;                             // Whether a header covering the rest of the range has been sent
+
+    *failed = 0;
+    if (!client->structured && length == 0) { return VirtualDiskNbdSimpleReply(client, cookie, 0, 0); }
+    while (length > 0)
+    {
+        unsigned long sector = (unsigned long)(offset / client->sectorSize);
+        unsigned long skip = (unsigned long)(offset % client->sectorSize);
+        unsigned long count = (skip + length + client->sectorSize - 1) / client->sectorSize;
+        unsigned long part;
+
+        if (count > maxSectors) { count = maxSectors; }
+        if (count > 0xffff) { count = 0xffff; }
+        part = count * client->sectorSize - skip;
+        if (part > length) { part = length; }
+        if (!VirtualDiskNbdReadSectors(client, sector, (unsigned short)count, client->buffer))
+        {
+            unsigned char payload[14];
+
+            if (announced) { return 0; }
+            *failed = 1;
+            if (!client->structured) { return VirtualDiskNbdError(client, cookie, NBD_EIO); }
+            SET_BE_DWORD(payload + 0, NBD_EIO);
+            SET_BE_WORD(payload + 4, 0);    // No message
+            SET_BE_QWORD(payload + 6, offset);
+            return VirtualDiskNbdChunk(client, cookie, NBD_REPLY_FLAG_DONE, NBD_REPLY_TYPE_ERROR_OFFSET, sizeof(payload), payload, sizeof(payload), 0);
+        }
+        if (!client->structured && !announced)
+        {
+            if (!VirtualDiskNbdSimpleReply(client, cookie, 0, 1)) { return 0; }
+            announced = 1;
+        }
+        else if (client->structured && (chunked || !announced))
+        {
+            unsigned char payload[8];
+            unsigned long chunkLength = chunked ? part : length;
+
+            SET_BE_QWORD(payload, offset);
+            if (!VirtualDiskNbdChunk(client, cookie, (done && chunkLength == length) ? NBD_REPLY_FLAG_DONE : 0, NBD_REPLY_TYPE_OFFSET_DATA, 8 + chunkLength, payload, 8, 1)) { return 0; }
+            announced = !chunked;
+        }
+        if (!VirtualDiskNbdSend(client->socket, client->buffer + skip, part, part < length)) { return 0; }
+        client->bytesRead += part;
+        offset += part;
+        length -= part;
+    }
+    return 1;
+}
+
+
+// (Private) Reply to a read with structured reply chunks: holes for blank extents (unless the client asked for one chunk), data for the rest
+static char VirtualDiskNbdStructuredRead(virtualdisk_nbd_client_t *client, const unsigned char *cookie, unsigned short flags, unsigned long long offset, unsigned long length)
+{
+    const unsigned long long end = offset + length;
+    unsigned char payload[12];
+
+    if (length == 0) { return VirtualDiskNbdChunk(client, cookie, NBD_REPLY_FLAG_DONE, NBD_REPLY_TYPE_NONE, 0, NULL, 0, 0); }
+
+    while (offset < end)
+    {
+        unsigned long long chunkEnd = end;
+        char blank = 0;
+
+        // Extend the chunk over adjacent extents of the same kind
+        if (!(flags & NBD_CMD_FLAG_DF))
+        {
+            chunkEnd = VirtualDiskNbdExtent(client, offset, &blank);
+            while (chunkEnd < end)
+            {
+                char nextBlank;
+                unsigned long long nextEnd = VirtualDiskNbdExtent(client, chunkEnd, &nextBlank);
+                if (nextBlank != blank) { break; }
+                chunkEnd = nextEnd;
+            }
+            if (chunkEnd > end) { chunkEnd = end; }
+        }
+
+        SET_BE_QWORD(payload, offset);
+        if (blank)
+        {
+            SET_BE_DWORD(payload + 8, (unsigned long)(chunkEnd - offset));
+            if (!VirtualDiskNbdChunk(client, cookie, (chunkEnd == end) ? NBD_REPLY_FLAG_DONE : 0, NBD_REPLY_TYPE_OFFSET_HOLE, 12, payload, 12, chunkEnd < end)) { return 0; }
+        }
+        else
+        {
+            char failed;
+            if (!VirtualDiskNbdSendData(client, cookie, offset, (unsigned long)(chunkEnd - offset), !(flags & NBD_CMD_FLAG_DF), chunkEnd == end, &failed)) { return 0; }
+            if (failed) { return 1; }           // (the error ended the reply)
+        }
+        offset = chunkEnd;
+    }
+    return 1;
+}
+
+
+// (Private) Reply to a block status query for the 'base:allocation' context (blank extents are holes that read as zero)
+static char VirtualDiskNbdBlockStatus(virtualdisk_nbd_client_t *client, const unsigned char *cookie, unsigned short flags, unsigned long long offset, unsigned long length)
+{
+    const unsigned long long end = offset + length;
+    unsigned char *descriptors = client->buffer + 4;
+    unsigned long count = 0, lookups;
+    unsigned char context[4];
+
+    for (lookups = 0; offset < end && lookups < VIRTUALDISKNBD_MAX_LOOKUPS; lookups++)
+    {
+        char blank;
+        unsigned long long extentEnd = VirtualDiskNbdExtent(client, offset, &blank);
+        unsigned long state = blank ? (NBD_STATE_HOLE | NBD_STATE_ZERO) : 0;
+
+        if (extentEnd > end) { extentEnd = end; }
+        if (count > 0 && GET_BE_DWORD(descriptors + 8 * (count - 1) + 4) == state)
+        {
+            // Same state as the previous extent
+            SET_BE_DWORD(descriptors + 8 * (count - 1), GET_BE_DWORD(descriptors + 8 * (count - 1)) + (unsigned long)(extentEnd - offset));
+        }
+        else
+        {
+            if (count >= VIRTUALDISKNBD_MAX_EXTENTS || (count > 0 && (flags & NBD_CMD_FLAG_REQ_ONE))) { break; }
+            SET_BE_DWORD(descriptors + 8 * count, (unsigned long)(extentEnd - offset));
+            SET_BE_DWORD(descriptors + 8 * count + 4, state);
+            count++;
+        }
+        offset = extentEnd;
+    }
+
+    SET_BE_DWORD(context, VIRTUALDISKNBD_ALLOCATION_ID);
+    if (!VirtualDiskNbdChunk(client, cookie, NBD_REPLY_FLAG_DONE, NBD_REPLY_TYPE_BLOCK_STATUS, 4 + 8 * count, context, 4, 1)) { return 0; }
+    return VirtualDiskNbdSend(client->socket, descriptors, 8 * count, 0);
+}
+
+
+// (Private) Serve requests until the client disconnects (returns zero on a protocol or socket error)
+static char VirtualDiskNbdTransmission(virtualdisk_nbd_client_t *client)
+{
+    unsigned char request[28];
+
+    while (VirtualDiskNbdReceive(client->socket, request, sizeof(request)))
+    {
+        unsigned short flags = GET_BE_WORD(request + 4);
+        unsigned short type = GET_BE_WORD(request + 6);
+        const unsigned char *cookie = request + 8;
+        unsigned long long offset = GET_BE_QWORD(request + 16);
+        unsigned long length = GET_BE_DWORD(request + 24);
+        char inRange = (offset <= client->size && length <= client->size - offset);
+        char result, failed;
+
+        if (GET_BE_DWORD(request) != NBD_REQUEST_MAGIC) { return 0; }
+        client->requests++;
+
+        switch (type)
+        {
+            case NBD_CMD_READ:
+                if (!inRange || length > VIRTUALDISKNBD_MAX_REQUEST) { result = VirtualDiskNbdError(client, cookie, NBD_EINVAL); }
+                else if (client->structured) { result = VirtualDiskNbdStructuredRead(client, cookie, flags, offset, length); }
+                else { result = VirtualDiskNbdSendData(client, cookie, offset, length, 0, 1, &failed); }
+                break;
+
+            case NBD_CMD_WRITE:
+                if (length > VIRTUALDISKNBD_MAX_REQUEST || !VirtualDiskNbdDiscard(client, length)) { return 0; }
+                result = VirtualDiskNbdError(client, cookie, NBD_EPERM);
+                break;
+
+            case NBD_CMD_DISC:
+                return 1;
+
+            case NBD_CMD_FLUSH:
+                result = VirtualDiskNbdSimpleReply(client, cookie, 0, 0);   // Nothing is written
+                break;
+
+            case NBD_CMD_TRIM:
+            case NBD_CMD_WRITE_ZEROES:
+                result = VirtualDiskNbdError(client, cookie, NBD_EPERM);
+                break;
+
+            case NBD_CMD_BLOCK_STATUS:
+                if (!client->allocation || !inRange || length == 0) { result = VirtualDiskNbdError(client, cookie, NBD_EINVAL); }
+                else { result = VirtualDiskNbdBlockStatus(client, cookie, flags, offset, length); }
+                break;
+
+            default:
+                result = VirtualDiskNbdError(client, cookie, NBD_EINVAL);
+                break;
+        }
+        if (!result) { return 0; }
+        if (client->server->stopping) { return 1; }
+    }
+    return 0;
+}
+
+
+// (Private) Connection thread
+static void *VirtualDiskNbdConnectionThread(void *reference)
+{
+    virtualdisk_nbd_connection_t *connection = (virtualdisk_nbd_connection_t *)reference;
+
+    VirtualDiskNbdServeSocket(connection->server, connection->socket);
+    pthread_mutex_lock(&connection->server->state->lock);
+    connection->finished = 1;
+    pthread_mutex_unlock(&connection->server->state->lock);
+    return NULL;
+}
+
+
+// (Private) Join and free the connections whose threads have finished (or all of them)
+static void VirtualDiskNbdReap(virtualdisk_nbd_t *server, char all)
+{
+    for (;;)
+    {
+        virtualdisk_nbd_connection_t **link, *connection = NULL;
+
+        pthread_mutex_lock(&server->state->lock);
+        for (link = &server->state->connections; *link != NULL; link = &(*link)->next)
+        {
+            if (all || (*link)->finished)
+            {
+                connection = *link;
+                *link = connection->next;
+                break;
+            }
+        }
+        pthread_mutex_unlock(&server->state->lock);
+        if (connection == NULL) { break; }
+
+        pthread_join(connection->thread, NULL);
+        close(connection->socket);
+        free(connection);
+    }
+}
+
+#endif
+
+
+// (Public) Set up a server for a disk
+char VirtualDiskNbdInit(virtualdisk_nbd_t *server, virtualdisk_t *disk, const char *exportName, const char *description, char shared)
+{
+    memset(server, 0, sizeof(virtualdisk_nbd_t));
+    server->disk = disk;
+    server->exportName = exportName;
+    server->description = description;
+    server->shared = shared;
+    server->listenSocket = -1;
+#ifdef _WIN32
+    return 0;
+#else
+    server->state = (virtualdisk_nbd_state_t *)malloc(sizeof(virtualdisk_nbd_state_t));
+    if (server->state == NULL) { return 0; }
+    pthread_mutex_init(&server->state->lock, NULL);
+    pthread_rwlock_init(&server->state->readLock, NULL);
+    server->state->updates = 0;
+    server->state->connections = NULL;
+    return 1;
+#endif
+}
+
+
+// (Public) Listen on a TCP port
+char VirtualDiskNbdListenTcp(virtualdisk_nbd_t *server, const char *address, unsigned short port)
+{
+#ifdef _WIN32
+    return 0;
+#else
+    struct addrinfo hints, *addresses, *a;
+    char service[6];
+    int i, one = 1;
+
+    if (server->state == NULL || server->listenSocket >= 0) { return 0; }
+
+    // Port number as a string (without stdio)
+    for (i = 4; i >= 0; i--) { service[i] = (char)('0' + port % 10); port /= 10; }
+    service[5] = '\0';
+
+    memset(&hints, 0, sizeof(hints));
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_STREAM;
+    hints.ai_flags = AI_PASSIVE;
+    if (getaddrinfo(address, service, &hints, &addresses) != 0) { return 0; }
+    for (a = addresses; a != NULL; a = a->ai_next)
+    {
+        int s = socket(a->ai_family, a->ai_socktype, a->ai_protocol);
+        if (s < 0) { continue; }
+        setsockopt(s, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+        if (bind(s, a->ai_addr, a->ai_addrlen) == 0 && listen(s, SOMAXCONN) == 0) { server->listenSocket = s; break; }
+        close(s);
+    }
+    freeaddrinfo(addresses);
+    return (server->listenSocket >= 0);
+#endif
+}
+
+
+// (Public) Listen on a Unix socket
+char VirtualDiskNbdListenUnix(virtualdisk_nbd_t *server, const char *path)
+{
+#ifdef _WIN32
+    return 0;
+#else
+    struct sockaddr_un address;
+    int s;
+
+    if (server->state == NULL || server->listenSocket >= 0 || strlen(path) >= sizeof(address.sun_path) || strlen(path) >= sizeof(server->unixPath)) { return 0; }
+    memset(&address, 0, sizeof(address));
+    address.sun_family = AF_UNIX;
+    strcpy(address.sun_path, path);
+    s = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (s < 0) { return 0; }
+    unlink(path);
+    if (bind(s, (struct sockaddr *)&address, sizeof(address)) != 0 || listen(s, SOMAXCONN) != 0) { close(s); return 0; }
+    strcpy(server->unixPath, path);
+    server->listenSocket = s;
+    return 1;
+#endif
+}
+
+
+// (Public) Accept connections until stopped, serving each on a new thread
+char VirtualDiskNbdServe(virtualdisk_nbd_t *server)
+{
+#ifdef _WIN32
+    return 0;
+#else
+    if (server->state == NULL || server->listenSocket < 0) { return 0; }
+
+    while (!server->stopping)
+    {
+        virtualdisk_nbd_connection_t *connection;
+        int s = accept(server->listenSocket, NULL, NULL), one = 1;
+
+        if (s < 0)
+        {
+            if (server->stopping) { break; }
+            if (errno == EINTR || errno == ECONNABORTED) { continue; }
+            return 0;
+        }
+        setsockopt(s, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));     // (fails harmlessly on a Unix socket)
+
+        // Join any connections that have ended, then start a thread for this one
+        VirtualDiskNbdReap(server, 0);
+        connection = (virtualdisk_nbd_connection_t *)malloc(sizeof(virtualdisk_nbd_connection_t));
+        if (connection == NULL) { close(s); continue; }
+        connection->server = server;
+        connection->socket = s;
+        connection->finished = 0;
+        pthread_mutex_lock(&server->state->lock);
+        if (pthread_create(&connection->thread, NULL, VirtualDiskNbdConnectionThread, connection) != 0)
+        {
+            pthread_mutex_unlock(&server->state->lock);
+            close(s);
+            free(connection);
+            continue;
+        }
+        connection->next = server->state->connections;
+        server->state->connections = connection;
+        pthread_mutex_unlock(&server->state->lock);
+    }
+    return 1;
+#endif
+}
+
+
+// (Public) Serve a single connected socket on the calling thread
+char VirtualDiskNbdServeSocket(virtualdisk_nbd_t *server, int socket)
+{
+#ifdef _WIN32
+    return 0;
+#else
+    virtualdisk_nbd_client_t *client;
+    char result = 0;
+
+    if (server->state == NULL) { return 0; }
+    client = (virtualdisk_nbd_client_t *)malloc(sizeof(virtualdisk_nbd_client_t));
+    if (client == NULL) { return 0; }
+    memset(client, 0, sizeof(virtualdisk_nbd_client_t));
+    client->server = server;
+    client->socket = socket;
+    client->buffer = (unsigned char *)malloc(VIRTUALDISKNBD_BUFFER_SIZE);
+
+    // Read context for the connection
+    client->disk = server->disk;
+    if (!server->shared && client->buffer != NULL)
+    {
+        pthread_rwlock_rdlock(&server->state->readLock);    // (the disk is not updated while it is copied)
+        if (VirtualDiskCopy(&client->copy, client->partitions, server->disk)) { client->disk = &client->copy; }
+        client->updates = server->state->updates;
+        pthread_rwlock_unlock(&server->state->readLock);
+    }
+    client->sectorSize = VirtualDiskSectorSize(client->disk);
+    client->size = (unsigned long long)VirtualDiskSectorCount(client->disk) * client->sectorSize;
+
+    pthread_mutex_lock(&server->state->lock);
+    server->connections++;
+    server->activeConnections++;
+    pthread_mutex_unlock(&server->state->lock);
+
+    if (client->buffer != NULL && client->sectorSize > 0 && (server->shared || client->disk != server->disk))
+    {
+        result = VirtualDiskNbdNegotiate(client) && VirtualDiskNbdTransmission(client);
+    }
+
+    // End the copy's file contents generator session (a shared disk's session is left for the next read), and add its statistics to the disk's
+    if (client->disk == &client->copy)
+    {
+        VirtualDiskEndSession(&client->copy);
+        pthread_rwlock_wrlock(&server->state->readLock);
+        VirtualDiskAddStats(server->disk, &client->copy);
+        pthread_rwlock_unlock(&server->state->readLock);
+    }
+
+    pthread_mutex_lock(&server->state->lock);
+    server->activeConnections--;
+    server->requests += client->requests;
+    server->bytesRead += client->bytesRead;
+    pthread_mutex_unlock(&server->state->lock);
+
+    free(client->buffer);
+    free(client);
+    return result;
+#endif
+}
+
+
+// (Public) Lock out the connections' reads (e.g. to update files live with VirtualDiskPartitionUpdateFile())
+void VirtualDiskNbdLock(virtualdisk_nbd_t *server)
+{
+#ifndef _WIN32
+    if (server->state != NULL) { pthread_rwlock_wrlock(&server->state->readLock); }
+#endif
+}
+
+
+// (Public) Let the connections read again after VirtualDiskNbdLock() (each per-connection copy of the disk is made again before its next read)
+void VirtualDiskNbdUnlock(virtualdisk_nbd_t *server)
+{
+#ifndef _WIN32
+    if (server->state != NULL)
+    {
+        server->state->updates++;
+        pthread_rwlock_unlock(&server->state->readLock);
+    }
+#endif
+}
+
+
+// (Public) Stop serving
+void VirtualDiskNbdStop(virtualdisk_nbd_t *server)
+{
+    server->stopping = 1;
+#ifndef _WIN32
+    if (server->listenSocket >= 0) { shutdown(server->listenSocket, SHUT_RDWR); }      // Wakes the accepting thread
+#endif
+}
+
+
+// (Public) Close the server (once VirtualDiskNbdServe() has returned), disconnecting clients and waiting for their threads
+void VirtualDiskNbdClose(virtualdisk_nbd_t *server)
+{
+#ifndef _WIN32
+    virtualdisk_nbd_connection_t *connection;
+
+    VirtualDiskNbdStop(server);
+    if (server->state != NULL)
+    {
+        // Disconnect the clients (a thread blocked waiting for a request then ends)
+        pthread_mutex_lock(&server->state->lock);
+        for (connection = server->state->connections; connection != NULL; connection = connection->next)
+        {
+            if (!connection->finished) { shutdown(connection->socket, SHUT_RDWR); }
+        }
+        pthread_mutex_unlock(&server->state->lock);
+        VirtualDiskNbdReap(server, 1);
+
+        pthread_mutex_destroy(&server->state->lock);
+        pthread_rwlock_destroy(&server->state->readLock);
+        free(server->state);
+        server->state = NULL;
+    }
+    if (server->listenSocket >= 0) { close(server->listenSocket); }
+    server->listenSocket = -1;
+    if (server->unixPath[0] != '\0') { unlink(server->unixPath); }
+    server->unixPath[0] = '\0';
+#endif
+}
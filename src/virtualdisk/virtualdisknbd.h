@@ -0,0 +1,87 @@
+// Virtual Disk/File System - Network Block Device Server
+// Dan Jackson, 2013
+
+#ifndef VIRTUALDISKNBD_H
+#define VIRTUALDISKNBD_H
+
+#include "virtualdisk.h"
+
+// Plain C linkage
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// Default TCP port (as nbd-server)
+#define VIRTUALDISKNBD_DEFAULT_PORT 10809
+
+// Size of each connection's read buffer (bytes, a multiple of the sector size) -- larger reads are sent in pieces of this size
+#ifndef VIRTUALDISKNBD_BUFFER_SIZE
+#define VIRTUALDISKNBD_BUFFER_SIZE (256ul * 1024)
+#endif
+
+// Largest request length accepted (bytes, advertised as the maximum block size)
+#ifndef VIRTUALDISKNBD_MAX_REQUEST
+#define VIRTUALDISKNBD_MAX_REQUEST (32ul * 1024 * 1024)
+#endif
+
+// Maximum number of extents in a block status reply
+#ifndef VIRTUALDISKNBD_MAX_EXTENTS
+#define VIRTUALDISKNBD_MAX_EXTENTS 256
+#endif
+
+// Declaration
+struct virtualdisk_nbd_state_struct_t;
+
+// (Public) A read-only NBD server for a virtual disk (fixed newstyle negotiation, structured replies, 'base:allocation' block status), serving each connection on its own thread
+typedef struct
+{
+    virtualdisk_t *disk;                            // Disk served
+    const char *exportName;                         // Name of the export (the default export, "", is also accepted)
+    const char *description;                        // Description of the export (NULL for none)
+    char shared;                                    // Non-zero: connections read through the disk itself, one request at a time (generators need not be thread-safe); zero: each connection has its own read context (VirtualDiskCopy), so reads run in parallel
+    int listenSocket;                               // Listening socket (-1 if none)
+    char unixPath[108];                             // Path of a listening Unix socket, removed when closed (empty if none)
+    volatile char stopping;                         // Set to stop serving
+    struct virtualdisk_nbd_state_struct_t *state;   // (Private) Lock and connections
+
+    // Statistics (guarded by the server's lock)
+    unsigned long connections;                      // Number of connections accepted
+    unsigned long activeConnections;                // Number of connections being served
+    unsigned long requests;                         // Number of requests served
+    unsigned long long bytesRead;                   // Number of bytes of data sent
+} virtualdisk_nbd_t;
+
+
+// (Public) Set up a server for a disk (returns zero if not supported on this platform, or out of memory)
+char VirtualDiskNbdInit(virtualdisk_nbd_t *server, virtualdisk_t *disk, const char *exportName, const char *description, char shared);
+
+// (Public) Listen on a TCP port (address NULL for any, e.g. "127.0.0.1" for local connections only)
+char VirtualDiskNbdListenTcp(virtualdisk_nbd_t *server, const char *address, unsigned short port);
+
+// (Public) Listen on a Unix socket (e.g. "/tmp/virtualdisk.sock", replacing any existing socket there)
+char VirtualDiskNbdListenUnix(virtualdisk_nbd_t *server, const char *path);
+
+// (Public) Accept connections until stopped, serving each on a new thread (returns zero if not listening, or on an error)
+char VirtualDiskNbdServe(virtualdisk_nbd_t *server);
+
+// (Public) Serve a single connected socket on the calling thread (e.g. one end of a socket pair, or from inetd), until the client disconnects (returns zero on a protocol or socket error)
+char VirtualDiskNbdServeSocket(virtualdisk_nbd_t *server, int socket);
+
+// (Public) Lock out the connections' reads, waiting for any in progress (e.g. to update files live with VirtualDiskPartitionUpdateFile(), or to read the disk's statistics)
+void VirtualDiskNbdLock(virtualdisk_nbd_t *server);
+
+// (Public) Let the connections read again after VirtualDiskNbdLock() (each per-connection copy of the disk is made again before its next read, so sees the updates)
+void VirtualDiskNbdUnlock(virtualdisk_nbd_t *server);
+
+// (Public) Stop serving (e.g. from another thread or a signal handler): VirtualDiskNbdServe() returns, and each client is disconnected after its current request
+void VirtualDiskNbdStop(virtualdisk_nbd_t *server);
+
+// (Public) Close the server once VirtualDiskNbdServe() has returned (or if it was not called): disconnects idle clients, waits for the connection threads to end, and closes the listening socket
+void VirtualDiskNbdClose(virtualdisk_nbd_t *server);
+
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
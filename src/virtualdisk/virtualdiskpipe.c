@@ -0,0 +1,137 @@
+// Virtual Disk/File System - Generation/Transport Pipeline
+// Dan Jackson, 2013
+
+// Overlaps generating sectors with sending them: while the transport (e.g. a USB endpoint's DMA) sends one buffer, the main loop
+// generates the next into another. The producer (VirtualDiskPipeService(), in the main loop) and the completion handler
+// (VirtualDiskPipeComplete(), in the transport's interrupt) share only three counters of buffers, each written by one side at a
+// time, so no lock or interrupt masking is needed. The counters are single bytes counting modulo 256 (no more than 255 buffers are ever
+// outstanding), so they are atomic on any device; the producer keeps its own full count of the read. The transport is sending
+// while 'completed' is behind 'sent'. The completion handler chains the next ready buffer before counting the finished one, so
+// the producer only sees the transport idle when it is, and only then starts it itself (the position of the next buffer to
+// send is only used by the side starting the transport).
+
+#include <stddef.h>
+
+#include "virtualdiskpipe.h"
+
+// Shared counter access (ordered loads and stores, so a buffer's contents are written before it is counted as generated)
+#if defined(__GNUC__)
+#define PIPE_LOAD(_v) __atomic_load_n(&(_v), __ATOMIC_ACQUIRE)
+#define PIPE_STORE(_v, _x) __atomic_store_n(&(_v), (_x), __ATOMIC_RELEASE)
+#else
+#define PIPE_LOAD(_v) (*(volatile unsigned char *)&(_v))
+#define PIPE_STORE(_v, _x) { *(volatile unsigned char *)&(_v) = (_x); }
+#endif
+
+
+// (Private) Start sending the next buffer of the read
+static void VirtualDiskPipeSend(virtualdisk_pipe_t *pipe)
+{
+    unsigned short sectorSize = VirtualDiskSectorSize(pipe->disk);
+    unsigned long sectors = (pipe->unsent < pipe->bufferSectors) ? pipe->unsent : pipe->bufferSectors;
+    const unsigned char *data = pipe->buffers + (size_t)pipe->sendSlot * pipe->bufferSectors * sectorSize;
+
+    pipe->unsent -= sectors;
+    if (++pipe->sendSlot >= pipe->depth) { pipe->sendSlot = 0; }
+    PIPE_STORE(pipe->sent, (unsigned char)(PIPE_LOAD(pipe->sent) + 1));    // (counted first, in case the transport completes it before returning)
+    pipe->send(pipe->reference, data, sectors * sectorSize);
+}
+
+
+// (Public) Set up a pipeline for a disk
+char VirtualDiskPipeInit(virtualdisk_pipe_t *pipe, virtualdisk_t *disk, unsigned char *buffers, unsigned short depth, unsigned short bufferSectors, virtualdisk_pipe_send_t send, void *reference)
+{
+    pipe->disk = disk;
+    pipe->buffers = buffers;
+    pipe->depth = depth;
+    pipe->bufferSectors = bufferSectors;
+    pipe->send = send;
+    pipe->reference = reference;
+    pipe->sector = 0;
+    pipe->count = 0;
+    pipe->total = 0;
+    pipe->produced = 0;
+    pipe->generateSlot = 0;
+    pipe->unsent = 0;
+    pipe->sendSlot = 0;
+    pipe->failed = 0;
+    pipe->generated = 0;
+    pipe->sent = 0;
+    pipe->completed = 0;
+    pipe->buffersGenerated = 0;
+    pipe->stalls = 0;
+    return (depth > 0 && depth <= 255 && bufferSectors > 0);
+}
+
+
+// (Public) Start a read of the specified sectors through the pipeline
+char VirtualDiskPipeStart(virtualdisk_pipe_t *pipe, unsigned long sector, unsigned long count)
+{
+    if ((pipe->produced != pipe->total && !pipe->failed) || PIPE_LOAD(pipe->completed) != pipe->generated) { return 0; }
+    if (sector > VirtualDiskSectorCount(pipe->disk) || count > VirtualDiskSectorCount(pipe->disk) - sector) { return 0; }
+
+    // (the transport is idle, so nothing else uses the counters)
+    pipe->sector = sector;
+    pipe->count = count;
+    pipe->total = (count + pipe->bufferSectors - 1) / pipe->bufferSectors;
+    pipe->produced = 0;
+    pipe->generateSlot = 0;
+    pipe->unsent = count;
+    pipe->sendSlot = 0;
+    pipe->failed = 0;
+    pipe->generated = 0;
+    pipe->sent = 0;
+    PIPE_STORE(pipe->completed, 0);
+    return 1;
+}
+
+
+// (Public) Producer side: generate the next buffer if one is free, and start the transport if it is idle
+char VirtualDiskPipeService(virtualdisk_pipe_t *pipe)
+{
+    unsigned char generated = pipe->generated;
+    unsigned char completed, sent, outstanding;
+
+    // Generate the next buffer, if the transport has finished with the buffer it goes in (none after one that could not be generated)
+    if (!pipe->failed && pipe->produced < pipe->total && (unsigned char)(generated - PIPE_LOAD(pipe->completed)) < pipe->depth)
+    {
+        unsigned short sectorSize = VirtualDiskSectorSize(pipe->disk);
+        unsigned long sectors = pipe->count - pipe->produced * pipe->bufferSectors;
+
+        if (sectors > pipe->bufferSectors) { sectors = pipe->bufferSectors; }
+        if (VirtualDiskReadSectors(pipe->disk, pipe->sector + pipe->produced * pipe->bufferSectors, (unsigned short)sectors, pipe->buffers + (size_t)pipe->generateSlot * pipe->bufferSectors * sectorSize) != sectors)
+        {
+            pipe->failed = 1;
+        }
+        else
+        {
+            if (++pipe->generateSlot >= pipe->depth) { pipe->generateSlot = 0; }
+            pipe->buffersGenerated++;
+            pipe->produced++;
+            generated++;
+            PIPE_STORE(pipe->generated, generated);
+        }
+    }
+
+    // Start the transport if it has sent everything it was given (it cannot then be completing a buffer) and a buffer is ready -- while it is sending, the completion handler starts each following buffer itself
+    completed = PIPE_LOAD(pipe->completed);     // (loaded before 'sent': it only reaches 'sent' once nothing is being sent)
+    sent = PIPE_LOAD(pipe->sent);
+    if (completed == sent && sent != generated)
+    {
+        if (pipe->unsent < pipe->count) { pipe->stalls++; }    // (not the first buffer of the read)
+        VirtualDiskPipeSend(pipe);
+    }
+
+    // Buffers completed: those generated, less those still outstanding (after a failure, only those generated are sent)
+    outstanding = (unsigned char)(generated - PIPE_LOAD(pipe->completed));
+    if (pipe->failed) { return (outstanding != 0); }
+    return (pipe->produced - outstanding < pipe->total);
+}
+
+
+// (Public) Completion side: start sending the next buffer if one is ready, then count the one that was sent
+void VirtualDiskPipeComplete(virtualdisk_pipe_t *pipe)
+{
+    if (PIPE_LOAD(pipe->sent) != PIPE_LOAD(pipe->generated)) { VirtualDiskPipeSend(pipe); }
+    PIPE_STORE(pipe->completed, (unsigned char)(PIPE_LOAD(pipe->completed) + 1));    // (loaded after sending, as a transport that completes within its send function counts that buffer first)
+}
@@ -0,0 +1,65 @@
+// Virtual Disk/File System - Generation/Transport Pipeline
+// Dan Jackson, 2013
+
+#ifndef VIRTUALDISKPIPE_H
+#define VIRTUALDISKPIPE_H
+
+#include "virtualdisk.h"
+
+// Plain C linkage
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// (Public) Type of the transport function that starts sending a buffer (e.g. starts a DMA transfer to the USB endpoint) -- it should not wait for the transfer: the transport calls VirtualDiskPipeComplete() once it is done (which a synchronous transport may do before returning); called from VirtualDiskPipeService(), or from VirtualDiskPipeComplete() (so from the transport's interrupt handler)
+typedef void (*virtualdisk_pipe_send_t)(void *reference, const unsigned char *data, unsigned long length);
+
+// (Public) A ring of buffers between sector generation and a transport: the next buffer is generated while the transport sends the previous ones (two buffers for ping-pong)
+typedef struct
+{
+    virtualdisk_t *disk;                            // Disk
+    unsigned char *buffers;                         // Caller-supplied memory for the buffers ('depth' x 'bufferSectors' sectors)
+    unsigned short depth;                           // Number of buffers
+    unsigned short bufferSectors;                   // Sectors per buffer
+    virtualdisk_pipe_send_t send;                   // Transport function to start sending a buffer
+    void *reference;                                // Reference for the transport function
+
+    // Current read
+    unsigned long sector;                           // First sector
+    unsigned long count;                            // Number of sectors
+    unsigned long total;                            // Number of buffers
+    unsigned long produced;                         // Buffers generated (the producer's own count)
+    unsigned short generateSlot;                    // Buffer the producer generates next
+    unsigned long unsent;                           // Sectors not yet given to the transport (only used by the side starting the transport)
+    unsigned short sendSlot;                        // Buffer the transport is given next (as 'unsent')
+    char failed;                                    // Set if a buffer of the read could not be generated (it is not sent, nor anything after it, so the read ends early and should be reported as failed, e.g. in the transport's status)
+
+    // Shared buffer counters, modulo 256 (each written by one side at a time: 'generated' by the producer, 'completed' by the completion handler, and 'sent' by the side starting the transport -- the completion handler while the transport is sending, the producer only once it is idle) -- single bytes, so even an 8-bit device reads and writes each atomically
+    unsigned char generated;                        // Buffers generated
+    unsigned char sent;                             // Buffers given to the transport
+    unsigned char completed;                        // Buffers the transport has finished sending
+
+    // Statistics
+    unsigned long buffersGenerated;                 // Number of buffers generated
+    unsigned long stalls;                           // Number of times the transport finished every buffer it was given before the read was generated (it waited for generation)
+} virtualdisk_pipe_t;
+
+
+// (Public) Set up a pipeline for a disk, with caller-supplied memory for 'depth' buffers of 'bufferSectors' sectors (returns zero if either is zero, or there are more than 255 buffers)
+char VirtualDiskPipeInit(virtualdisk_pipe_t *pipe, virtualdisk_t *disk, unsigned char *buffers, unsigned short depth, unsigned short bufferSectors, virtualdisk_pipe_send_t send, void *reference);
+
+// (Public) Start a read of the specified sectors through the pipeline (returns zero if the previous read is still being sent, or it is beyond the end of the disk)
+char VirtualDiskPipeStart(virtualdisk_pipe_t *pipe, unsigned long sector, unsigned long count);
+
+// (Public) Producer side, called from the main loop: generates the next buffer if one is free, and starts the transport if it is idle with a buffer ready; returns non-zero until the whole read has been sent, or until the buffers before one that could not be generated have been (see 'failed')
+char VirtualDiskPipeService(virtualdisk_pipe_t *pipe);
+
+// (Public) Completion side, called by the transport when it has sent a buffer (e.g. from its DMA interrupt handler): starts sending the next buffer if one is ready -- does not generate anything, so is short
+void VirtualDiskPipeComplete(virtualdisk_pipe_t *pipe);
+
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,420 @@
+// Virtual Disk/File System - SCSI Block Commands
+// Dan Jackson, 2013
+
+// The SCSI commands a host uses with a (read-only) USB mass storage device, or other SCSI transport: a firmware passes each
+// command descriptor block here, then pulls the data-in phase through VirtualDiskScsiData() in pieces the size of its transfer
+// buffer. A read is not generated a sector at a time: each piece is one VirtualDiskReadSectors() call for as many whole sectors
+// as fit, and the Block Limits VPD page tells the host the transfer size that suits this. A buffer smaller than a sector (e.g.
+// a single USB endpoint packet) has each sector streamed through it with VirtualDiskReadPartial() instead.
+
+#include <string.h>
+
+#include "virtualdiskscsi.h"
+
+// Big-endian word macros
+#define SET_BE_WORD(_p, _v) { *((_p)+0) = (unsigned char)((_v) >> 8); *((_p)+1) = (unsigned char)(_v); }
+#define SET_BE_DWORD(_p, _ov) { unsigned long _v = (_ov); *((_p)+0) = (unsigned char)((_v) >> 24); *((_p)+1) = (unsigned char)((_v) >> 16); *((_p)+2) = (unsigned char)((_v) >> 8); *((_p)+3) = (unsigned char)(_v); }
+#define SET_BE_QWORD(_p, _ov) { unsigned long long _q = (_ov); SET_BE_DWORD((_p), (unsigned long)(_q >> 32)); SET_BE_DWORD((_p) + 4, (unsigned long)(_q & 0xfffffffful)); }
+#define GET_BE_WORD(_p) ( ((unsigned short)*((_p)+0) << 8) | (unsigned short)*((_p)+1) )
+#define GET_BE_DWORD(_p) ( ((unsigned long)*((_p)+0) << 24) | ((unsigned long)*((_p)+1) << 16) | ((unsigned long)*((_p)+2) << 8) | (unsigned long)*((_p)+3) )
+#define GET_BE_QWORD(_p) ( ((unsigned long long)GET_BE_DWORD(_p) << 32) | GET_BE_DWORD((_p) + 4) )
+
+// Operation codes
+#define SCSI_TEST_UNIT_READY            0x00
+#define SCSI_REQUEST_SENSE              0x03
+#define SCSI_FORMAT_UNIT                0x04
+#define SCSI_READ_6                     0x08
+#define SCSI_WRITE_6                    0x0a
+#define SCSI_INQUIRY                    0x12
+#define SCSI_MODE_SENSE_6               0x1a
+#define SCSI_START_STOP_UNIT            0x1b
+#define SCSI_PREVENT_ALLOW_REMOVAL      0x1e
+#define SCSI_READ_FORMAT_CAPACITIES     0x23
+#define SCSI_READ_CAPACITY_10           0x25
+#define SCSI_READ_10                    0x28
+#define SCSI_WRITE_10                   0x2a
+#define SCSI_WRITE_AND_VERIFY_10        0x2e
+#define SCSI_VERIFY_10                  0x2f
+#define SCSI_SYNCHRONIZE_CACHE_10       0x35
+#define SCSI_WRITE_SAME_10              0x41
+#define SCSI_UNMAP                      0x42
+#define SCSI_MODE_SENSE_10              0x5a
+#define SCSI_READ_16                    0x88
+#define SCSI_WRITE_16                   0x8a
+#define SCSI_SYNCHRONIZE_CACHE_16       0x91
+#define SCSI_WRITE_SAME_16              0x93
+#define SCSI_SERVICE_ACTION_IN_16       0x9e
+#define SCSI_READ_CAPACITY_16           0x10    // (service action)
+#define SCSI_READ_12                    0xa8
+#define SCSI_WRITE_12                   0xaa
+
+// Additional sense codes
+#define SCSI_ASC_INVALID_OPCODE         0x20
+#define SCSI_ASC_LBA_OUT_OF_RANGE       0x21
+#define SCSI_ASC_INVALID_FIELD_IN_CDB   0x24
+#define SCSI_ASC_WRITE_PROTECTED        0x27
+#define SCSI_ASC_UNRECOVERED_READ_ERROR 0x11
+#define SCSI_ASC_MEDIUM_NOT_PRESENT     0x3a
+
+// Mode pages
+#define SCSI_MODE_PAGE_CACHING          0x08
+#define SCSI_MODE_PAGE_ALL              0x3f
+#define SCSI_MODE_PAGE_CACHING_LENGTH   20
+
+// Vital product data pages
+#define SCSI_VPD_SUPPORTED_PAGES        0x00
+#define SCSI_VPD_UNIT_SERIAL_NUMBER     0x80
+#define SCSI_VPD_BLOCK_LIMITS           0xb0
+#define SCSI_VPD_BLOCK_CHARACTERISTICS  0xb1
+#define SCSI_VPD_PAGE_LENGTH            0x3c
+
+
+// (Private) Copy a string into a fixed-length field, padded with spaces
+static void VirtualDiskScsiPad(unsigned char *field, const char *value, int length)
+{
+    int i;
+    for (i = 0; i < length; i++)
+    {
+        field[i] = (value != NULL && *value != '\0') ? (unsigned char)*value++ : ' ';
+    }
+}
+
+
+// (Private) End the command with CHECK CONDITION and the specified sense
+static unsigned char VirtualDiskScsiFail(virtualdisk_scsi_t *scsi, unsigned char senseKey, unsigned char asc, unsigned char ascq)
+{
+    scsi->status = VIRTUALDISKSCSI_STATUS_CHECK_CONDITION;
+    scsi->senseKey = senseKey;
+    scsi->asc = asc;
+    scsi->ascq = ascq;
+    scsi->dataLength = 0;
+    scsi->readRemaining = 0;
+    scsi->failed++;
+    return scsi->status;
+}
+
+
+// (Private) Start a read
+static unsigned char VirtualDiskScsiRead(virtualdisk_scsi_t *scsi, unsigned long long sector, unsigned long count)
+{
+    const unsigned long sectorCount = VirtualDiskSectorCount(scsi->disk);
+    const unsigned short sectorSize = VirtualDiskSectorSize(scsi->disk);
+
+    if (sector > sectorCount || count > sectorCount - sector) { return VirtualDiskScsiFail(scsi, VIRTUALDISKSCSI_SENSE_ILLEGAL_REQUEST, SCSI_ASC_LBA_OUT_OF_RANGE, 0); }
+    if (count > 0xfffffffful / sectorSize) { return VirtualDiskScsiFail(scsi, VIRTUALDISKSCSI_SENSE_ILLEGAL_REQUEST, SCSI_ASC_INVALID_FIELD_IN_CDB, 0); }    // (longer than a transport can transfer)
+    scsi->readSector = (unsigned long)sector;
+    scsi->readOffset = 0;
+    scsi->readRemaining = count;
+    scsi->dataLength = count * sectorSize;
+    return scsi->status;
+}
+
+
+// (Private) The INQUIRY response: standard data or a vital product data page (returns its length, or zero if the page is not supported)
+static unsigned long VirtualDiskScsiInquiry(virtualdisk_scsi_t *scsi, char vpd, unsigned char page)
+{
+    unsigned char *p = scsi->response;
+
+    memset(p, 0, VIRTUALDISKSCSI_RESPONSE_SIZE);
+    if (!vpd)
+    {
+        if (page != 0) { return 0; }
+        p[0] = 0x00;                                // Direct access block device
+        p[1] = scsi->removable ? 0x80 : 0x00;
+        p[2] = 0x06;                                // SPC-4
+        p[3] = 0x02;                                // Response data format
+        p[4] = 36 - 5;                              // Additional length
+        VirtualDiskScsiPad(p + 8, scsi->vendor, 8);
+        VirtualDiskScsiPad(p + 16, scsi->product, 16);
+        VirtualDiskScsiPad(p + 32, scsi->revision, 4);
+        return 36;
+    }
+
+    p[1] = page;
+    switch (page)
+    {
+        case SCSI_VPD_SUPPORTED_PAGES:
+        {
+            unsigned char count = 0;
+            p[4 + count++] = SCSI_VPD_SUPPORTED_PAGES;
+            if (scsi->serial != NULL) { p[4 + count++] = SCSI_VPD_UNIT_SERIAL_NUMBER; }
+            p[4 + count++] = SCSI_VPD_BLOCK_LIMITS;
+            p[4 + count++] = SCSI_VPD_BLOCK_CHARACTERISTICS;
+            p[3] = count;
+            return 4ul + count;
+        }
+
+        case SCSI_VPD_UNIT_SERIAL_NUMBER:
+        {
+            unsigned long length = (scsi->serial != NULL) ? strlen(scsi->serial) : 0;
+            if (scsi->serial == NULL) { return 0; }
+            if (length > VIRTUALDISKSCSI_RESPONSE_SIZE - 4) { length = VIRTUALDISKSCSI_RESPONSE_SIZE - 4; }
+            memcpy(p + 4, scsi->serial, length);
+            p[3] = (unsigned char)length;
+            return 4 + length;
+        }
+
+        case SCSI_VPD_BLOCK_LIMITS:
+            // Transfers are best in multiples of what is generated at once
+            p[3] = SCSI_VPD_PAGE_LENGTH;
+            SET_BE_WORD(p + 6, scsi->transferSectors);                  // Optimal transfer length granularity
+            SET_BE_DWORD(p + 12, scsi->transferSectors);                // Optimal transfer length
+            return 4 + SCSI_VPD_PAGE_LENGTH;
+
+        case SCSI_VPD_BLOCK_CHARACTERISTICS:
+            p[3] = SCSI_VPD_PAGE_LENGTH;
+            SET_BE_WORD(p + 4, 0x0001);                                 // Non-rotating medium
+            return 4 + SCSI_VPD_PAGE_LENGTH;
+
+        default:
+            return 0;
+    }
+}
+
+
+// (Private) The mode pages after a MODE SENSE header (returns their length, or -1 if the page is not supported)
+static long VirtualDiskScsiModePages(unsigned char *p, unsigned char page, unsigned char subpage)
+{
+    if (subpage != 0 && !(page == SCSI_MODE_PAGE_ALL && subpage == 0xff)) { return -1; }
+    if (page != SCSI_MODE_PAGE_CACHING && page != SCSI_MODE_PAGE_ALL) { return -1; }
+
+    // Caching page: no write cache, read cache enabled (nothing is changeable, so this is also the changeable values mask)
+    memset(p, 0, SCSI_MODE_PAGE_CACHING_LENGTH);
+    p[0] = SCSI_MODE_PAGE_CACHING;
+    p[1] = SCSI_MODE_PAGE_CACHING_LENGTH - 2;
+    return SCSI_MODE_PAGE_CACHING_LENGTH;
+}
+
+
+// (Public) Set up a command processor for a disk
+void VirtualDiskScsiInit(virtualdisk_scsi_t *scsi, virtualdisk_t *disk, const char *vendor, const char *product, const char *revision, const char *serial)
+{
+    memset(scsi, 0, sizeof(virtualdisk_scsi_t));
+    scsi->disk = disk;
+    scsi->vendor = vendor;
+    scsi->product = product;
+    scsi->revision = revision;
+    scsi->serial = serial;
+    scsi->removable = 1;
+    scsi->transferSectors = VIRTUALDISKSCSI_TRANSFER_SECTORS;
+    scsi->status = VIRTUALDISKSCSI_STATUS_GOOD;
+    scsi->senseKey = VIRTUALDISKSCSI_SENSE_NO_SENSE;
+}
+
+
+// (Public) Start a command
+unsigned char VirtualDiskScsiCommand(virtualdisk_scsi_t *scsi, const unsigned char *cdb, unsigned char cdbLength, unsigned long *dataLength)
+{
+    static const unsigned char groupLength[8] = { 6, 10, 10, 0, 16, 12, 0, 0 };
+    const unsigned char opcode = (cdbLength > 0) ? cdb[0] : 0xff;
+    unsigned long allocation = 0, length = 0;
+    unsigned char senseKey = scsi->senseKey, asc = scsi->asc, ascq = scsi->ascq;
+
+    scsi->commands++;
+    scsi->status = VIRTUALDISKSCSI_STATUS_GOOD;
+    scsi->dataLength = 0;
+    scsi->dataOffset = 0;
+    scsi->readRemaining = 0;
+    scsi->senseKey = VIRTUALDISKSCSI_SENSE_NO_SENSE;        // (the sense only describes the previous command)
+    scsi->asc = 0;
+    scsi->ascq = 0;
+    if (dataLength != NULL) { *dataLength = 0; }
+
+    if (cdbLength == 0 || groupLength[opcode >> 5] == 0 || cdbLength < groupLength[opcode >> 5])
+    {
+        return VirtualDiskScsiFail(scsi, VIRTUALDISKSCSI_SENSE_ILLEGAL_REQUEST, (cdbLength == 0 || groupLength[opcode >> 5] == 0) ? SCSI_ASC_INVALID_OPCODE : SCSI_ASC_INVALID_FIELD_IN_CDB, 0);
+    }
+    if (!scsi->disk->initialized && opcode != SCSI_INQUIRY && opcode != SCSI_REQUEST_SENSE)
+    {
+        return VirtualDiskScsiFail(scsi, VIRTUALDISKSCSI_SENSE_NOT_READY, SCSI_ASC_MEDIUM_NOT_PRESENT, 0);
+    }
+
+    switch (opcode)
+    {
+        case SCSI_TEST_UNIT_READY:
+        case SCSI_START_STOP_UNIT:
+        case SCSI_PREVENT_ALLOW_REMOVAL:
+        case SCSI_SYNCHRONIZE_CACHE_10:
+        case SCSI_SYNCHRONIZE_CACHE_16:
+            break;
+
+        case SCSI_REQUEST_SENSE:
+            // Fixed format sense data for the previous command
+            memset(scsi->response, 0, 18);
+            scsi->response[0] = 0x70;
+            scsi->response[2] = senseKey;
+            scsi->response[7] = 18 - 8;
+            scsi->response[12] = asc;
+            scsi->response[13] = ascq;
+            length = 18;
+            allocation = cdb[4];
+            break;
+
+        case SCSI_INQUIRY:
+            length = VirtualDiskScsiInquiry(scsi, (char)(cdb[1] & 0x01), cdb[2]);
+            if (length == 0) { return VirtualDiskScsiFail(scsi, VIRTUALDISKSCSI_SENSE_ILLEGAL_REQUEST, SCSI_ASC_INVALID_FIELD_IN_CDB, 0); }
+            allocation = GET_BE_WORD(cdb + 3);
+            break;
+
+        case SCSI_READ_CAPACITY_10:
+        {
+            unsigned long last = VirtualDiskSectorCount(scsi->disk);
+            last = (last == 0) ? 0 : (last - 1 > 0xfffffffful ? 0xfffffffful : last - 1);      // (all ones: use READ CAPACITY (16))
+            SET_BE_DWORD(scsi->response + 0, last);
+            SET_BE_DWORD(scsi->response + 4, VirtualDiskSectorSize(scsi->disk));
+            length = allocation = 8;
+            break;
+        }
+
+        case SCSI_SERVICE_ACTION_IN_16:
+        {
+            unsigned long count = VirtualDiskSectorCount(scsi->disk);
+            if ((cdb[1] & 0x1f) != SCSI_READ_CAPACITY_16) { return VirtualDiskScsiFail(scsi, VIRTUALDISKSCSI_SENSE_ILLEGAL_REQUEST, SCSI_ASC_INVALID_FIELD_IN_CDB, 0); }
+            memset(scsi->response, 0, 32);
+            SET_BE_QWORD(scsi->response + 0, (count == 0) ? 0 : count - 1);
+            SET_BE_DWORD(scsi->response + 8, VirtualDiskSectorSize(scsi->disk));
+            length = 32;
+            allocation = GET_BE_DWORD(cdb + 10);
+            break;
+        }
+
+        case SCSI_READ_FORMAT_CAPACITIES:
+            memset(scsi->response, 0, 12);
+            scsi->response[3] = 8;                                      // Capacity list length
+            SET_BE_DWORD(scsi->response + 4, VirtualDiskSectorCount(scsi->disk));
+            SET_BE_DWORD(scsi->response + 8, VirtualDiskSectorSize(scsi->disk));
+            scsi->response[8] = 0x02;                                   // Formatted media (over the top byte of the block length)
+            length = 12;
+            allocation = GET_BE_WORD(cdb + 7);
+            break;
+
+        case SCSI_MODE_SENSE_6:
+        case SCSI_MODE_SENSE_10:
+        {
+            // Header (no block descriptors), write protected
+            const unsigned long header = (opcode == SCSI_MODE_SENSE_6) ? 4 : 8;
+            long pages = VirtualDiskScsiModePages(scsi->response + header, cdb[2] & 0x3f, cdb[3]);    // (current, changeable, default and saved values are the same)
+            if (pages < 0) { return VirtualDiskScsiFail(scsi, VIRTUALDISKSCSI_SENSE_ILLEGAL_REQUEST, SCSI_ASC_INVALID_FIELD_IN_CDB, 0); }
+            length = header + (unsigned long)pages;
+            memset(scsi->response, 0, header);
+            if (opcode == SCSI_MODE_SENSE_6)
+            {
+                scsi->response[0] = (unsigned char)(length - 1);
+                scsi->response[2] = 0x80;
+                allocation = cdb[4];
+            }
+            else
+            {
+                SET_BE_WORD(scsi->response + 0, length - 2);
+                scsi->response[3] = 0x80;
+                allocation = GET_BE_WORD(cdb + 7);
+            }
+            break;
+        }
+
+        case SCSI_READ_6:
+        case SCSI_READ_10:
+        case SCSI_READ_12:
+        case SCSI_READ_16:
+        {
+            unsigned long long sector;
+            unsigned long count;
+            if (opcode == SCSI_READ_6) { sector = ((unsigned long)(cdb[1] & 0x1f) << 16) | GET_BE_WORD(cdb + 2); count = (cdb[4] == 0) ? 256 : cdb[4]; }
+            else if (opcode == SCSI_READ_10) { sector = GET_BE_DWORD(cdb + 2); count = GET_BE_WORD(cdb + 7); }
+            else if (opcode == SCSI_READ_12) { sector = GET_BE_DWORD(cdb + 2); count = GET_BE_DWORD(cdb + 6); }
+            else { sector = GET_BE_QWORD(cdb + 2); count = GET_BE_DWORD(cdb + 10); }
+            if (VirtualDiskScsiRead(scsi, sector, count) != VIRTUALDISKSCSI_STATUS_GOOD) { return scsi->status; }
+            length = allocation = scsi->dataLength;
+            break;
+        }
+
+        case SCSI_VERIFY_10:
+        {
+            // Nothing to verify against (unless the host sends data to compare, which is not supported)
+            unsigned long long sector = GET_BE_DWORD(cdb + 2);
+            unsigned long count = GET_BE_WORD(cdb + 7);
+            if (cdb[1] & 0x06) { return VirtualDiskScsiFail(scsi, VIRTUALDISKSCSI_SENSE_ILLEGAL_REQUEST, SCSI_ASC_INVALID_FIELD_IN_CDB, 0); }
+            if (sector > VirtualDiskSectorCount(scsi->disk) || count > VirtualDiskSectorCount(scsi->disk) - sector) { return VirtualDiskScsiFail(scsi, VIRTUALDISKSCSI_SENSE_ILLEGAL_REQUEST, SCSI_ASC_LBA_OUT_OF_RANGE, 0); }
+            break;
+        }
+
+        case SCSI_FORMAT_UNIT:
+        case SCSI_WRITE_6:
+        case SCSI_WRITE_10:
+        case SCSI_WRITE_12:
+        case SCSI_WRITE_16:
+        case SCSI_WRITE_AND_VERIFY_10:
+        case SCSI_WRITE_SAME_10:
+        case SCSI_WRITE_SAME_16:
+        case SCSI_UNMAP:
+            return VirtualDiskScsiFail(scsi, VIRTUALDISKSCSI_SENSE_DATA_PROTECT, SCSI_ASC_WRITE_PROTECTED, 0);
+
+        default:
+            return VirtualDiskScsiFail(scsi, VIRTUALDISKSCSI_SENSE_ILLEGAL_REQUEST, SCSI_ASC_INVALID_OPCODE, 0);
+    }
+
+    // Responses are truncated to the allocation length
+    scsi->dataLength = (length < allocation) ? length : allocation;
+    if (dataLength != NULL) { *dataLength = scsi->dataLength; }
+    return scsi->status;
+}
+
+
+// (Public) Fill a buffer with the next part of the current command's data-in phase
+unsigned long VirtualDiskScsiData(virtualdisk_scsi_t *scsi, unsigned char *buffer, unsigned long bufferSize)
+{
+    unsigned long length;
+
+    if (scsi->status != VIRTUALDISKSCSI_STATUS_GOOD || scsi->dataOffset >= scsi->dataLength) { return 0; }
+
+    if (scsi->readRemaining > 0 && (bufferSize < VirtualDiskSectorSize(scsi->disk) || scsi->readOffset > 0))
+    {
+        // The next part of a sector, streamed through a buffer smaller than a sector
+        const unsigned short sectorSize = VirtualDiskSectorSize(scsi->disk);
+
+        length = sectorSize - scsi->readOffset;
+        if (length > bufferSize) { length = bufferSize; }
+        if (length == 0) { return 0; }
+        scsi->readCalls++;
+        if (VirtualDiskReadPartial(scsi->disk, scsi->readSector, scsi->readOffset, (unsigned short)length, buffer) != length)
+        {
+            VirtualDiskScsiFail(scsi, VIRTUALDISKSCSI_SENSE_MEDIUM_ERROR, SCSI_ASC_UNRECOVERED_READ_ERROR, 0);
+            return 0;
+        }
+        scsi->readOffset += (unsigned short)length;
+        if (scsi->readOffset >= sectorSize)
+        {
+            scsi->readOffset = 0;
+            scsi->readSector++;
+            scsi->readRemaining--;
+            scsi->sectorsRead++;
+        }
+    }
+    else if (scsi->readRemaining > 0)
+    {
+        // As many whole sectors as fit, generated in one call
+        const unsigned short sectorSize = VirtualDiskSectorSize(scsi->disk);
+        unsigned long count = bufferSize / sectorSize;
+
+        if (count > scsi->readRemaining) { count = scsi->readRemaining; }
+        if (count > 0xffff) { count = 0xffff; }
+        scsi->readCalls++;
+        if (VirtualDiskReadSectors(scsi->disk, scsi->readSector, (unsigned short)count, buffer) != count)
+        {
+            VirtualDiskScsiFail(scsi, VIRTUALDISKSCSI_SENSE_MEDIUM_ERROR, SCSI_ASC_UNRECOVERED_READ_ERROR, 0);
+            return 0;
+        }
+        scsi->readSector += count;
+        scsi->readRemaining -= count;
+        scsi->sectorsRead += count;
+        length = count * sectorSize;
+    }
+    else
+    {
+        length = scsi->dataLength - scsi->dataOffset;
+        if (length > bufferSize) { length = bufferSize; }
+        memcpy(buffer, scsi->response + scsi->dataOffset, length);
+    }
+    scsi->dataOffset += length;
+    return length;
+}
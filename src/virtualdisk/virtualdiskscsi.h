@@ -0,0 +1,80 @@
+// Virtual Disk/File System - SCSI Block Commands
+// Dan Jackson, 2013
+
+#ifndef VIRTUALDISKSCSI_H
+#define VIRTUALDISKSCSI_H
+
+#include "virtualdisk.h"
+
+// Plain C linkage
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// Default optimal transfer granularity (sectors), reported in the Block Limits VPD page -- set 'transferSectors' to the sectors that fit the transport's buffer
+#ifndef VIRTUALDISKSCSI_TRANSFER_SECTORS
+#define VIRTUALDISKSCSI_TRANSFER_SECTORS 8
+#endif
+
+// Largest response to a command other than a read (bytes)
+#define VIRTUALDISKSCSI_RESPONSE_SIZE 64
+
+// Status values
+#define VIRTUALDISKSCSI_STATUS_GOOD             0x00
+#define VIRTUALDISKSCSI_STATUS_CHECK_CONDITION  0x02
+
+// Sense keys
+#define VIRTUALDISKSCSI_SENSE_NO_SENSE          0x00
+#define VIRTUALDISKSCSI_SENSE_NOT_READY         0x02
+#define VIRTUALDISKSCSI_SENSE_MEDIUM_ERROR      0x03
+#define VIRTUALDISKSCSI_SENSE_ILLEGAL_REQUEST   0x05
+#define VIRTUALDISKSCSI_SENSE_DATA_PROTECT      0x07
+
+// (Public) A SCSI block device (SBC) command processor for a virtual disk (read-only), independent of the transport (e.g. USB mass storage bulk-only transport)
+typedef struct
+{
+    virtualdisk_t *disk;                            // Disk
+    const char *vendor;                             // Vendor identification (up to 8 characters)
+    const char *product;                            // Product identification (up to 16 characters)
+    const char *revision;                           // Product revision level (up to 4 characters)
+    const char *serial;                             // Unit serial number (NULL for none)
+    char removable;                                 // Report removable media
+    unsigned short transferSectors;                 // Optimal transfer granularity (sectors) reported to the host
+
+    // Current command
+    unsigned char status;                           // Status of the current command (a failed read becomes CHECK CONDITION during its data phase)
+    unsigned long dataLength;                       // Length of the current command's data-in phase (bytes)
+    unsigned long dataOffset;                       // Bytes of it transferred so far
+    unsigned long readSector;                       // Next sector of a read
+    unsigned short readOffset;                      // Bytes of that sector transferred so far (when streamed through a buffer smaller than a sector)
+    unsigned long readRemaining;                    // Sectors of a read still to transfer (zero for other commands)
+    unsigned char response[VIRTUALDISKSCSI_RESPONSE_SIZE];  // Response data for other commands
+
+    // Sense data (reported by REQUEST SENSE)
+    unsigned char senseKey;
+    unsigned char asc;                              // Additional sense code
+    unsigned char ascq;                             // Additional sense code qualifier
+
+    // Statistics
+    unsigned long commands;                         // Number of commands processed
+    unsigned long failed;                           // Number of commands ending in CHECK CONDITION
+    unsigned long sectorsRead;                      // Number of sectors transferred
+    unsigned long readCalls;                        // Number of VirtualDiskReadSectors() (or VirtualDiskReadPartial()) calls for them
+} virtualdisk_scsi_t;
+
+
+// (Public) Set up a command processor for a disk (strings are not copied)
+void VirtualDiskScsiInit(virtualdisk_scsi_t *scsi, virtualdisk_t *disk, const char *vendor, const char *product, const char *revision, const char *serial);
+
+// (Public) Start a command (from its command descriptor block), returning its status and the length of its data-in phase (bytes, zero for none); the transport then calls VirtualDiskScsiData() until that is transferred
+unsigned char VirtualDiskScsiCommand(virtualdisk_scsi_t *scsi, const unsigned char *cdb, unsigned char cdbLength, unsigned long *dataLength);
+
+// (Public) Fill a buffer with the next part of the current command's data-in phase, returning the length (zero once complete, or on an error, which sets the status); a read is generated as many whole sectors at a time as fit the buffer (or, for a buffer smaller than a sector, a part of a sector at a time)
+unsigned long VirtualDiskScsiData(virtualdisk_scsi_t *scsi, unsigned char *buffer, unsigned long bufferSize);
+
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,125 @@
+// Virtual Disk/File System - Splitting Oversized Sources into Part Files
+// Dan Jackson, 2013
+
+// A FAT file is smaller than 4 GiB, so a larger source is presented as parts "NAME.001", "NAME.002", ...
+// Every part but the last is the largest whole number of clusters below 4 GiB, so each part's run has no unused space, and the parts'
+// runs (which are laid out consecutively) hold the source's sectors in order. A part's generator passes the disk's buffer straight to
+// the source's generator at the part's offset, and a request never extends past the part, so is never split between two source requests.
+
+#include <stddef.h>
+#include <string.h>
+
+#include "virtualdisksplit.h"
+
+
+// (Private) Write a part's filename: the name (shortened if required), a dot, then the part number (at least three digits)
+static void VirtualDiskSplitPartName(char *filename, const char *name, unsigned long number)
+{
+    char digits[11];
+    size_t numDigits = 0, length = 0;
+
+    do
+    {
+        digits[numDigits++] = (char)('0' + number % 10);
+        number /= 10;
+    } while (number > 0 || numDigits < 3);
+
+    if (name != NULL)
+    {
+        while (length < VIRTUALDISK_MAX_FILENAME - 1 - numDigits && name[length] != '\0') { length++; }
+        memcpy(filename, name, length);
+    }
+    filename[length++] = '.';
+    while (numDigits > 0) { filename[length++] = digits[--numDigits]; }
+    filename[length] = '\0';
+}
+
+
+// (Private) Generate a part's sectors directly from the source (the part's run may end with unused sectors, which are blank)
+static unsigned short VirtualDiskSplitGenerate(void *reference, unsigned long sector, unsigned short count, unsigned char *buffer)
+{
+    const virtualdisk_fileinfo_t *fileInfo = (const virtualdisk_fileinfo_t *)reference;
+    const virtualdisk_split_part_t *part = (const virtualdisk_split_part_t *)fileInfo->reference;
+
+    if (sector >= part->numSectors)
+    {
+        memset(buffer, 0, (size_t)count * part->split->sectorSize);
+        return count;
+    }
+    if (count > part->numSectors - sector) { count = (unsigned short)(part->numSectors - sector); }
+    return part->split->contents(part->split->reference, part->firstSector + sector, count, buffer);
+}
+
+
+// (Private) Generate part of a part's sector directly from the source's partial generator (blank in the part's unused sectors)
+static unsigned short VirtualDiskSplitGeneratePartial(void *reference, unsigned long sector, unsigned short offset, unsigned short length, unsigned char *buffer)
+{
+    const virtualdisk_fileinfo_t *fileInfo = (const virtualdisk_fileinfo_t *)reference;
+    const virtualdisk_split_part_t *part = (const virtualdisk_split_part_t *)fileInfo->reference;
+
+    if (sector >= part->numSectors)
+    {
+        memset(buffer, 0, length);
+        return length;
+    }
+    return part->split->partial(part->split->reference, part->firstSector + sector, offset, length, buffer);
+}
+
+
+// (Public) Divide a source of the specified size (and upper 32 bits of its size) into parts aligned to the partition's cluster size, named from 'name' (returns zero if there is not enough capacity for the parts)
+char VirtualDiskSplitInit(virtualdisk_split_t *split, virtualdisk_split_part_t *parts, unsigned long capacity, const char *name, unsigned long size, unsigned long sizeHigh, unsigned short sectorSize, unsigned char sectorsPerCluster, virtualdisk_generator_t contents, void *reference)
+{
+    unsigned long fullSectors, tail, totalSectors, partSectors, i;
+
+    split->contents = contents;
+    split->reference = reference;
+    split->partial = NULL;
+    split->parts = parts;
+    split->capacity = capacity;
+    split->sectorSize = sectorSize;
+    split->numParts = 0;
+    if (sectorSize == 0 || sectorsPerCluster == 0 || sizeHigh > VIRTUALDISKSPLIT_MAX_SIZE_HIGH) { return 0; }
+
+    // Source length in whole sectors (the sector size is a power of two, so divides 4 GiB), then any partial sector
+    fullSectors = sizeHigh * (0xfffffffful / sectorSize + 1) + size / sectorSize;
+    tail = size % sectorSize;
+    totalSectors = fullSectors + (tail > 0 ? 1 : 0);
+
+    // Parts are the largest whole number of clusters below 4 GiB (an empty source still has one, empty, part)
+    partSectors = (0xfffffffful / ((unsigned long)sectorSize * sectorsPerCluster)) * sectorsPerCluster;
+    split->numParts = (totalSectors > 0) ? (totalSectors + partSectors - 1) / partSectors : 1;
+    if (split->numParts > capacity) { split->numParts = 0; return 0; }
+
+    for (i = 0; i < split->numParts; i++)
+    {
+        virtualdisk_split_part_t *part = &parts[i];
+        part->split = split;
+        part->firstSector = i * partSectors;
+        if (i + 1 < split->numParts)
+        {
+            part->numSectors = partSectors;
+            part->size = partSectors * sectorSize;
+        }
+        else
+        {
+            part->numSectors = totalSectors - part->firstSector;
+            part->size = (fullSectors - part->firstSector) * sectorSize + tail;
+        }
+        VirtualDiskSplitPartName(part->filename, name, i + 1);
+    }
+    return 1;
+}
+
+
+// (Public) Fill in the filename, size, attributes and contents (and partial contents, if the source has them) of the file information for the specified part (returns zero if there is no such part) -- call from a file information callback (thread-safe), the caller sets the timestamps
+char VirtualDiskSplitFileInfo(const virtualdisk_split_t *split, unsigned long part, virtualdisk_fileinfo_t *fileInfo)
+{
+    if (part >= split->numParts) { return 0; }
+    fileInfo->filename = split->parts[part].filename;
+    fileInfo->size = split->parts[part].size;
+    fileInfo->attributes = VIRTUALDISK_ATTRIB_ARCHIVE;
+    fileInfo->contents = VirtualDiskSplitGenerate;
+    fileInfo->partial = (split->partial != NULL) ? VirtualDiskSplitGeneratePartial : NULL;
+    fileInfo->reference = (void *)&split->parts[part];
+    return 1;
+}
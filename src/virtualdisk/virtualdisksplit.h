@@ -0,0 +1,55 @@
+// Virtual Disk/File System - Splitting Oversized Sources into Part Files
+// Dan Jackson, 2013
+
+#ifndef VIRTUALDISKSPLIT_H
+#define VIRTUALDISKSPLIT_H
+
+#include "virtualdisk.h"
+
+// Plain C linkage
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// Limits
+#define VIRTUALDISKSPLIT_MAX_SIZE_HIGH 0xff     // Largest source is just under 1 TiB (upper 32 bits of the size)
+
+
+// Declaration
+struct virtualdisk_split_struct_t;
+
+// (Public) One part file of a split source (caller-supplied memory, filled in by VirtualDiskSplitInit)
+typedef struct
+{
+    struct virtualdisk_split_struct_t *split;       // Source the part belongs to
+    unsigned long firstSector;                      // First sector of the part within the source
+    unsigned long numSectors;                       // Number of sectors in the part (the last may be partly used)
+    unsigned long size;                             // Size of the part (bytes)
+    char filename[VIRTUALDISK_MAX_FILENAME + 1];    // Part filename ("NAME.001", "NAME.002", ...)
+} virtualdisk_split_part_t;
+
+// (Public) A large source presented as a sequence of part files, each smaller than 4 GiB and a whole number of clusters (except the last)
+typedef struct virtualdisk_split_struct_t
+{
+    virtualdisk_generator_t contents;               // Generator for the source's sectors (sector numbers are from the start of the source)
+    void *reference;                                // Reference passed to the source's generator
+    virtualdisk_partial_generator_t partial;        // Optional partial generator for the source's sectors, with the same reference (set after VirtualDiskSplitInit, NULL if none), so the parts can be streamed in pieces
+    unsigned short sectorSize;                      // Size of each sector (bytes)
+    virtualdisk_split_part_t *parts;               // Parts (caller-supplied memory)
+    unsigned long capacity;                         // Maximum number of parts
+    unsigned long numParts;                         // Number of parts
+} virtualdisk_split_t;
+
+
+// (Public) Divide a source of the specified size (and upper 32 bits of its size) into parts aligned to the partition's cluster size, named from 'name' (returns zero if there is not enough capacity for the parts)
+char VirtualDiskSplitInit(virtualdisk_split_t *split, virtualdisk_split_part_t *parts, unsigned long capacity, const char *name, unsigned long size, unsigned long sizeHigh, unsigned short sectorSize, unsigned char sectorsPerCluster, virtualdisk_generator_t contents, void *reference);
+
+// (Public) Fill in the filename, size, attributes and contents (and partial contents, if the source has them) of the file information for the specified part (returns zero if there is no such part) -- call from a file information callback (thread-safe), the caller sets the timestamps
+char VirtualDiskSplitFileInfo(const virtualdisk_split_t *split, unsigned long part, virtualdisk_fileinfo_t *fileInfo);
+
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
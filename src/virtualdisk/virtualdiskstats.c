@@ -0,0 +1,164 @@
+// Virtual Disk/File System - Statistics File
+// Dan Jackson, 2013
+
+// A text file of a disk's live statistics, formatted each time it is read, so that a slow host can be diagnosed by opening a file on
+// the drive. Only the characters within the sectors being read are written, directly into the read buffer (the whole text is never
+// held, so no stack or static memory is needed for it). Hosts may cache the file's contents: re-mount (or read the file unbuffered)
+// to see the latest statistics.
+
+#include <stddef.h>
+#include <string.h>
+
+#include "virtualdiskstats.h"
+
+// Column at which values start
+#define VIRTUALDISKSTATS_VALUE_COLUMN 24
+
+
+// (Private) The text being formatted, of which only a window is written (so a sector of the file is formatted in place)
+typedef struct
+{
+    char *window;                                   // Where the window's characters are written
+    unsigned long start;                            // Text offset of the window
+    unsigned long end;                              // Text offset after the window (the text stops here)
+    unsigned long length;                           // Length of the text so far
+} virtualdisk_stats_text_t;
+
+
+// (Private) Append a string to the text (up to the end of the window)
+static void VirtualDiskStatsAppend(virtualdisk_stats_text_t *text, const char *s)
+{
+    for (; *s != '\0' && text->length < text->end; s++, text->length++)
+    {
+        if (text->length >= text->start) { text->window[text->length - text->start] = *s; }
+    }
+}
+
+
+// (Private) Append a decimal number to the text
+static void VirtualDiskStatsAppendNumber(virtualdisk_stats_text_t *text, unsigned long value)
+{
+    char digits[12];
+    int i = (int)sizeof(digits) - 1;
+
+    digits[i] = '\0';
+    do { digits[--i] = (char)('0' + value % 10); value /= 10; } while (value > 0);
+    VirtualDiskStatsAppend(text, digits + i);
+}
+
+
+// (Private) Append a line with a label and a number
+static void VirtualDiskStatsAppendLine(virtualdisk_stats_text_t *text, const char *label, unsigned long value)
+{
+    unsigned long start = text->length;
+    VirtualDiskStatsAppend(text, label);
+    while (text->length - start < VIRTUALDISKSTATS_VALUE_COLUMN && text->length < text->end) { VirtualDiskStatsAppend(text, " "); }
+    VirtualDiskStatsAppendNumber(text, value);
+    VirtualDiskStatsAppend(text, "\r\n");
+}
+
+
+// (Private) Find the latency at or below which the specified percentage of reads completed (the upper bound of its histogram bucket)
+static unsigned long VirtualDiskStatsPercentile(const virtualdisk_stats_t *stats, unsigned long total, unsigned long percent)
+{
+    unsigned long target = (total * percent + 99) / 100, cumulative = 0;
+    int bucket;
+
+    for (bucket = 0; bucket < VIRTUALDISK_LATENCY_BUCKETS; bucket++)
+    {
+        cumulative += stats->latency[bucket];
+        if (cumulative >= target && cumulative > 0)
+        {
+            unsigned long bound = (bucket == 0) ? 0 : (((unsigned long)1 << bucket) - 1);
+            return (bound < stats->maxLatency) ? bound : stats->maxLatency;
+        }
+    }
+    return stats->maxLatency;
+}
+
+
+// (Private) Write the characters of a disk's statistics text that fall within a window, returning the text's length (up to the end of the window)
+static unsigned long VirtualDiskStatsWindow(const virtualdisk_t *disk, char *window, unsigned long start, unsigned long end)
+{
+    static const char *regionLabels[VIRTUALDISK_REGION_COUNT] =
+    {
+        "  MBR", "  Reserved", "  FAT", "  Root directory", "  Sub-directories", "  Allocation bitmap", "  Up-case table", "  File contents", "  Blank", "  Errors"
+    };
+    const virtualdisk_stats_t *stats = &disk->stats;
+    virtualdisk_stats_text_t text;
+    unsigned long total = 0, lookups;
+    int i;
+
+    text.window = window;
+    text.start = start;
+    text.end = end;
+    text.length = 0;
+
+    VirtualDiskStatsAppend(&text, "Virtual disk statistics\r\n\r\n");
+    VirtualDiskStatsAppendLine(&text, "Reads", stats->reads);
+    for (i = 0; i < VIRTUALDISK_REGION_COUNT; i++) { total += stats->sectors[i]; }
+    VirtualDiskStatsAppendLine(&text, "Sectors", total);
+    for (i = 0; i < VIRTUALDISK_REGION_COUNT; i++) { VirtualDiskStatsAppendLine(&text, regionLabels[i], stats->sectors[i]); }
+
+    // Generator cache
+    lookups = stats->generatorLookups + stats->generatorHits;
+    VirtualDiskStatsAppendLine(&text, "Generator lookups", stats->generatorLookups);
+    VirtualDiskStatsAppendLine(&text, "Generator cache hits", stats->generatorHits);
+    VirtualDiskStatsAppendLine(&text, "Generator hit rate (%)", (lookups > 0) ? (unsigned long)((unsigned long long)stats->generatorHits * 100 / lookups) : 0);
+    VirtualDiskStatsAppendLine(&text, "Enumerator resets", stats->enumeratorResets);
+    VirtualDiskStatsAppendLine(&text, "File info callbacks", stats->fileInfoCalls);
+
+    // Latency percentiles
+    if (stats->clock != NULL)
+    {
+        total = 0;
+        for (i = 0; i < VIRTUALDISK_LATENCY_BUCKETS; i++) { total += stats->latency[i]; }
+        VirtualDiskStatsAppend(&text, "Read latency (ticks, at most)\r\n");
+        VirtualDiskStatsAppendLine(&text, "  50%", VirtualDiskStatsPercentile(stats, total, 50));
+        VirtualDiskStatsAppendLine(&text, "  90%", VirtualDiskStatsPercentile(stats, total, 90));
+        VirtualDiskStatsAppendLine(&text, "  99%", VirtualDiskStatsPercentile(stats, total, 99));
+        VirtualDiskStatsAppendLine(&text, "  Maximum", stats->maxLatency);
+    }
+    else
+    {
+        VirtualDiskStatsAppend(&text, "Read latency            (no clock set)\r\n");
+    }
+    return text.length;
+}
+
+
+// (Public) Write a disk's statistics as text, returning its length (at most the specified maximum)
+unsigned long VirtualDiskStatsFormat(const virtualdisk_t *disk, char *text, unsigned long maxLength)
+{
+    return VirtualDiskStatsWindow(disk, text, 0, maxLength);
+}
+
+
+// (Public) Fill in the file information for a statistics file of a disk (e.g. as the last file in the root directory of each partition)
+void VirtualDiskStatsFileInfo(virtualdisk_t *disk, virtualdisk_fileinfo_t *fileInfo)
+{
+    fileInfo->filename = VIRTUALDISKSTATS_FILENAME;
+    fileInfo->size = VIRTUALDISKSTATS_SIZE;
+    fileInfo->attributes = VIRTUALDISK_ATTRIB_ARCHIVE | VIRTUALDISK_ATTRIB_READONLY;
+    fileInfo->contents = VirtualDiskStatsContents;
+    fileInfo->reference = disk;
+}
+
+
+// (Public) File contents generator for the statistics file, formatting the disk's current statistics (set up by VirtualDiskStatsFileInfo())
+unsigned short VirtualDiskStatsContents(void *reference, unsigned long sector, unsigned short count, unsigned char *buffer)
+{
+    const virtualdisk_fileinfo_t *fileInfo = (const virtualdisk_fileinfo_t *)reference;
+    const virtualdisk_t *disk = (const virtualdisk_t *)fileInfo->reference;
+    unsigned long length, offset = sector * disk->sectorSize, total = (unsigned long)count * disk->sectorSize, end;
+
+    // The requested part of the text, formatted in place, padded with spaces to the fixed size (ending with a new line), blank beyond it
+    memset(buffer, 0, total);
+    if (offset >= VIRTUALDISKSTATS_SIZE) { return count; }
+    end = (VIRTUALDISKSTATS_SIZE - 1 - offset < total) ? VIRTUALDISKSTATS_SIZE - 1 : offset + total;
+    length = VirtualDiskStatsWindow(disk, (char *)buffer, offset, end);
+    if (length < offset) { length = offset; }
+    memset(buffer + (length - offset), ' ', end - length);
+    if (end == VIRTUALDISKSTATS_SIZE - 1 && end - offset < total) { buffer[end - offset] = '\n'; }
+    return count;
+}
@@ -0,0 +1,39 @@
+// Virtual Disk/File System - Statistics File
+// Dan Jackson, 2013
+
+#ifndef VIRTUALDISKSTATS_H
+#define VIRTUALDISKSTATS_H
+
+#include "virtualdisk.h"
+
+// Plain C linkage
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// Name of the statistics file
+#ifndef VIRTUALDISKSTATS_FILENAME
+#define VIRTUALDISKSTATS_FILENAME "VDSTATS.TXT"
+#endif
+
+// Size of the statistics file (bytes) -- fixed, as the file size is listed before its contents are read (the text is padded with spaces)
+#ifndef VIRTUALDISKSTATS_SIZE
+#define VIRTUALDISKSTATS_SIZE 2048
+#endif
+
+
+// (Public) Write a disk's statistics as text, returning its length (at most the specified maximum)
+unsigned long VirtualDiskStatsFormat(const virtualdisk_t *disk, char *text, unsigned long maxLength);
+
+// (Public) Fill in the file information for a statistics file of a disk (e.g. as the last file in the root directory of each partition)
+void VirtualDiskStatsFileInfo(virtualdisk_t *disk, virtualdisk_fileinfo_t *fileInfo);
+
+// (Public) File contents generator for the statistics file, formatting the disk's current statistics (set up by VirtualDiskStatsFileInfo())
+unsigned short VirtualDiskStatsContents(void *reference, unsigned long sector, unsigned short count, unsigned char *buffer);
+
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,283 @@
+// Virtual Disk/File System - Compressed Block Store
+// Dan Jackson, 2013
+
+// The data is divided into fixed-size blocks, each compressed independently, with an index of block offsets -- so any sector is
+// produced by reading the two offsets of its block, then reading and decompressing just that block. The last block decoded is kept,
+// so sequential reads within it decompress nothing more.
+//
+// Block codec (LZ77, byte-oriented, no external dependency): a sequence of
+//   0x00-0x7f: a literal run of (value + 1) bytes, which follow;
+//   0x80-0xff: a match of ((value & 0x7f) + 3) bytes, copied from the 16-bit little-endian distance (1-65535) back that follows.
+// A block whose compressed form is not smaller is stored as-is (its stored length is then its uncompressed length).
+
+#include <stddef.h>
+#include <string.h>
+
+#include "virtualdiskstore.h"
+
+// Little-endian word macros
+#define SET_DWORD(_p, _ov) { unsigned long _v = (_ov); *((_p)+0) = (unsigned char)((_v)); *((_p)+1) = (unsigned char)((_v) >> 8); *((_p)+2) = (unsigned char)((_v) >> 16); *((_p)+3) = (unsigned char)((_v) >> 24); }
+#define GET_DWORD(_p) ( (unsigned long)*((_p)+0) | ((unsigned long)*((_p)+1) << 8) | ((unsigned long)*((_p)+2) << 16) | ((unsigned long)*((_p)+3) << 24) )
+
+#define VIRTUALDISKSTORE_MAGIC "VDLZ"
+#define VIRTUALDISKSTORE_NO_BLOCK 0xfffffffful
+
+// Codec limits
+#define VIRTUALDISKSTORE_MAX_LITERALS 128
+#define VIRTUALDISKSTORE_MIN_MATCH 3
+#define VIRTUALDISKSTORE_MAX_MATCH (127 + VIRTUALDISKSTORE_MIN_MATCH)
+#define VIRTUALDISKSTORE_MAX_DISTANCE 65535
+#define VIRTUALDISKSTORE_HASH_BITS 12
+
+
+// (Private) Decompress a block (returns zero if it is corrupt, or does not decompress to exactly the expected length)
+static char VirtualDiskStoreDecompress(const unsigned char *src, unsigned long srcLength, unsigned char *dest, unsigned long destLength)
+{
+    unsigned long in = 0, out = 0;
+
+    while (in < srcLength)
+    {
+        unsigned char control = src[in++];
+        if (control < 0x80)
+        {
+            unsigned long length = (unsigned long)control + 1;
+            if (length > srcLength - in || length > destLength - out) { return 0; }
+            memcpy(dest + out, src + in, length);
+            in += length;
+            out += length;
+        }
+        else
+        {
+            unsigned long length = (unsigned long)(control & 0x7f) + VIRTUALDISKSTORE_MIN_MATCH, distance;
+            const unsigned char *from;
+            if (srcLength - in < 2) { return 0; }
+            distance = (unsigned long)src[in] | ((unsigned long)src[in + 1] << 8);
+            in += 2;
+            if (distance == 0 || distance > out || length > destLength - out) { return 0; }
+            for (from = dest + out - distance; length > 0; length--) { dest[out++] = *from++; }        // Byte-by-byte, as a match may overlap itself
+        }
+    }
+    return (out == destLength);
+}
+
+
+// (Private) Compress a block, returning its compressed length (zero if it would not be smaller)
+static unsigned long VirtualDiskStoreCompress(const unsigned char *src, unsigned long length, unsigned char *dest)
+{
+    unsigned long table[1 << VIRTUALDISKSTORE_HASH_BITS];       // Last position (plus one) of each hashed 3-byte sequence
+    unsigned long in = 0, out = 0, literals = 0;
+
+    memset(table, 0, sizeof(table));
+    while (in < length)
+    {
+        unsigned long match = 0, distance = 0;
+
+        if (length - in >= VIRTUALDISKSTORE_MIN_MATCH)
+        {
+            unsigned long hash = ((((unsigned long)src[in] << 16) | ((unsigned long)src[in + 1] << 8) | src[in + 2]) * 2654435761ul & 0xfffffffful) >> (32 - VIRTUALDISKSTORE_HASH_BITS);
+            unsigned long candidate = table[hash];
+            table[hash] = in + 1;
+            if (candidate > 0 && in - (candidate - 1) <= VIRTUALDISKSTORE_MAX_DISTANCE)
+            {
+                unsigned long limit = (length - in < VIRTUALDISKSTORE_MAX_MATCH) ? length - in : VIRTUALDISKSTORE_MAX_MATCH;
+                distance = in - (candidate - 1);
+                while (match < limit && src[in + match] == src[in + match - distance]) { match++; }
+            }
+        }
+
+        if (match >= VIRTUALDISKSTORE_MIN_MATCH)
+        {
+            // Flush any literals before the match
+            if (literals > 0)
+            {
+                if (out + 1 + literals + 3 >= length) { return 0; }
+                dest[out++] = (unsigned char)(literals - 1);
+                memcpy(dest + out, src + in - literals, literals);
+                out += literals;
+                literals = 0;
+            }
+            if (out + 3 >= length) { return 0; }
+            dest[out++] = (unsigned char)(0x80 | (match - VIRTUALDISKSTORE_MIN_MATCH));
+            dest[out++] = (unsigned char)distance;
+            dest[out++] = (unsigned char)(distance >> 8);
+            in += match;
+        }
+        else
+        {
+            in++;
+            if (++literals == VIRTUALDISKSTORE_MAX_LITERALS)
+            {
+                if (out + 1 + literals >= length) { return 0; }
+                dest[out++] = (unsigned char)(literals - 1);
+                memcpy(dest + out, src + in - literals, literals);
+                out += literals;
+                literals = 0;
+            }
+        }
+    }
+    if (literals > 0)
+    {
+        if (out + 1 + literals >= length) { return 0; }
+        dest[out++] = (unsigned char)(literals - 1);
+        memcpy(dest + out, src + in - literals, literals);
+        out += literals;
+    }
+    return out;
+}
+
+
+// (Private) Decode a block into the cache (if it is not already there)
+static char VirtualDiskStoreLoad(virtualdisk_store_t *store, unsigned long blockNumber)
+{
+    unsigned char offsets[8];
+    unsigned long start, end, length;
+
+    if (store->cachedBlock == blockNumber) { return 1; }
+    store->cachedBlock = VIRTUALDISKSTORE_NO_BLOCK;
+
+    // The block's extent from the index, and its uncompressed length (the last block may be partial)
+    if (!store->read(store->reference, VIRTUALDISKSTORE_HEADER_SIZE + 4 * blockNumber, 8, offsets)) { return 0; }
+    start = GET_DWORD(offsets + 0);
+    end = GET_DWORD(offsets + 4);
+    length = (blockNumber + 1 < store->numBlocks) ? store->blockSize : store->size - blockNumber * store->blockSize;
+    if (end < start || end - start > length) { return 0; }
+
+    if (end - start == length)
+    {
+        // Stored as-is
+        if (!store->read(store->reference, start, length, store->block)) { return 0; }
+    }
+    else
+    {
+        if (!store->read(store->reference, start, end - start, store->compressed)) { return 0; }
+        if (!VirtualDiskStoreDecompress(store->compressed, end - start, store->block, length)) { return 0; }
+    }
+    store->cachedBlock = blockNumber;
+    return 1;
+}
+
+
+// (Public) Open a compressed block store, with two caller-supplied buffers of at least the store's block size (returns zero if the store is invalid or the buffers too small)
+char VirtualDiskStoreOpen(virtualdisk_store_t *store, VirtualDiskStoreReadCallback read, void *reference, unsigned short sectorSize, unsigned char *block, unsigned char *compressed, unsigned long bufferSize)
+{
+    unsigned char header[VIRTUALDISKSTORE_HEADER_SIZE];
+
+    memset(store, 0, sizeof(virtualdisk_store_t));
+    store->read = read;
+    store->reference = reference;
+    store->sectorSize = sectorSize;
+    store->block = block;
+    store->compressed = compressed;
+    store->cachedBlock = VIRTUALDISKSTORE_NO_BLOCK;
+
+    if (sectorSize == 0 || !read(reference, 0, VIRTUALDISKSTORE_HEADER_SIZE, header)) { return 0; }
+    if (memcmp(header, VIRTUALDISKSTORE_MAGIC, 4) != 0) { return 0; }
+    store->blockSize = GET_DWORD(header + 4);
+    store->size = GET_DWORD(header + 8);
+    store->numBlocks = GET_DWORD(header + 12);
+    if (store->blockSize == 0 || store->blockSize > bufferSize || store->blockSize > VIRTUALDISKSTORE_MAX_BLOCK_SIZE || store->blockSize % sectorSize != 0) { return 0; }
+    if (store->numBlocks != (store->size + store->blockSize - 1) / store->blockSize) { return 0; }
+    return 1;
+}
+
+
+// (Public) Copy uncompressed sectors to the buffer, decompressing only the blocks they are in (beyond the end, sectors are blank)
+unsigned short VirtualDiskStoreRead(virtualdisk_store_t *store, unsigned long sector, unsigned short count, unsigned char *buffer)
+{
+    unsigned short done;
+
+    for (done = 0; done < count; done++)
+    {
+        unsigned long offset = (sector + done) * store->sectorSize;
+        unsigned char *p = buffer + (size_t)done * store->sectorSize;
+        unsigned long blockOffset, available;
+
+        if (sector + done >= (store->size + store->sectorSize - 1) / store->sectorSize)
+        {
+            memset(p, 0, store->sectorSize);
+            continue;
+        }
+        if (!VirtualDiskStoreLoad(store, offset / store->blockSize)) { break; }
+        blockOffset = offset % store->blockSize;
+        available = store->size - offset;
+        if (available >= store->sectorSize)
+        {
+            memcpy(p, store->block + blockOffset, store->sectorSize);
+        }
+        else
+        {
+            memcpy(p, store->block + blockOffset, available);
+            memset(p + available, 0, store->sectorSize - available);
+        }
+    }
+    return done;
+}
+
+
+// (Public) Copy part of an uncompressed sector to the buffer ('length' bytes from byte 'offset'; blank beyond the end), decompressing its block only if it is not the one already decoded
+unsigned short VirtualDiskStoreReadPartial(virtualdisk_store_t *store, unsigned long sector, unsigned short offset, unsigned short length, unsigned char *buffer)
+{
+    unsigned long start = sector * store->sectorSize + offset, available;
+
+    if (offset >= store->sectorSize || length > store->sectorSize - offset) { return 0; }
+    if (sector >= (store->size + store->sectorSize - 1) / store->sectorSize)
+    {
+        memset(buffer, 0, length);
+        return length;
+    }
+    if (!VirtualDiskStoreLoad(store, start / store->blockSize)) { return 0; }       // (a sector lies within one block)
+    available = (start < store->size) ? store->size - start : 0;
+    if (available > length) { available = length; }
+    memcpy(buffer, store->block + start % store->blockSize, available);
+    if (available < length) { memset(buffer + available, 0, length - available); }
+    return length;
+}
+
+
+// (Public) File contents generator for a compressed block store (set the file information's 'reference' to the virtualdisk_store_t, and its 'size' to the store's)
+unsigned short VirtualDiskStoreContents(void *reference, unsigned long sector, unsigned short count, unsigned char *buffer)
+{
+    const virtualdisk_fileinfo_t *fileInfo = (const virtualdisk_fileinfo_t *)reference;
+    return VirtualDiskStoreRead((virtualdisk_store_t *)fileInfo->reference, sector, count, buffer);
+}
+
+
+// (Public) Partial file contents generator for a compressed block store, for streaming a sector in pieces (set the file information's 'partial' to it, as well as its 'contents' to VirtualDiskStoreContents)
+unsigned short VirtualDiskStorePartial(void *reference, unsigned long sector, unsigned short offset, unsigned short length, unsigned char *buffer)
+{
+    const virtualdisk_fileinfo_t *fileInfo = (const virtualdisk_fileinfo_t *)reference;
+    return VirtualDiskStoreReadPartial((virtualdisk_store_t *)fileInfo->reference, sector, offset, length, buffer);
+}
+
+
+// (Public) Compress data into a store in memory (e.g. on a host, to prepare a store), returning the length of the store (zero if it does not fit)
+unsigned long VirtualDiskStoreBuild(const unsigned char *data, unsigned long size, unsigned long blockSize, unsigned char *store, unsigned long capacity)
+{
+    unsigned long numBlocks, i, position;
+
+    if (blockSize == 0 || blockSize > VIRTUALDISKSTORE_MAX_BLOCK_SIZE) { return 0; }
+    numBlocks = (size + blockSize - 1) / blockSize;
+    position = VIRTUALDISKSTORE_HEADER_SIZE + 4 * (numBlocks + 1);
+    if (position > capacity) { return 0; }
+    memcpy(store, VIRTUALDISKSTORE_MAGIC, 4);
+    SET_DWORD(store + 4, blockSize);
+    SET_DWORD(store + 8, size);
+    SET_DWORD(store + 12, numBlocks);
+
+    for (i = 0; i < numBlocks; i++)
+    {
+        unsigned long length = (i + 1 < numBlocks) ? blockSize : size - i * blockSize;
+        unsigned long compressedLength;
+        SET_DWORD(store + VIRTUALDISKSTORE_HEADER_SIZE + 4 * i, position);
+        if (capacity - position < length) { return 0; }                     // Room for the block even if it does not compress
+        compressedLength = VirtualDiskStoreCompress(data + i * blockSize, length, store + position);
+        if (compressedLength == 0)
+        {
+            memcpy(store + position, data + i * blockSize, length);
+            compressedLength = length;
+        }
+        position += compressedLength;
+    }
+    SET_DWORD(store + VIRTUALDISKSTORE_HEADER_SIZE + 4 * numBlocks, position);
+    return position;
+}
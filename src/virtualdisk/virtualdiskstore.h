@@ -0,0 +1,65 @@
+// Virtual Disk/File System - Compressed Block Store
+// Dan Jackson, 2013
+
+#ifndef VIRTUALDISKSTORE_H
+#define VIRTUALDISKSTORE_H
+
+#include "virtualdisk.h"
+
+// Plain C linkage
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// Store format (all values little-endian):
+//   @0  Magic "VDLZ"
+//   @4  Block size (uncompressed bytes, a multiple of the sector size)
+//   @8  Uncompressed size (bytes)
+//   @12 Number of blocks (N)
+//   @16 Block offsets: N+1 dwords, from the start of the store (block i is from offset i to offset i+1)
+//   ... Blocks: each compressed independently, or stored as-is if it is its full uncompressed length
+#define VIRTUALDISKSTORE_HEADER_SIZE 16
+#define VIRTUALDISKSTORE_MAX_BLOCK_SIZE 65536
+
+// (Public) Callback to read bytes from the store (e.g. from flash) -- returns zero on error
+typedef char (*VirtualDiskStoreReadCallback)(void *reference, unsigned long offset, unsigned long length, unsigned char *buffer);
+
+// (Public) A compressed block store being read, with a one-block decode cache
+typedef struct
+{
+    VirtualDiskStoreReadCallback read;              // Reads from the store
+    void *reference;                                // Reference passed to the read callback
+    unsigned short sectorSize;                      // Size of each sector (bytes)
+    unsigned long blockSize;                        // Uncompressed size of each block (bytes)
+    unsigned long size;                             // Uncompressed size (bytes)
+    unsigned long numBlocks;                        // Number of blocks
+    unsigned char *block;                           // Decoded block (caller-supplied, at least the block size)
+    unsigned char *compressed;                      // Compressed block being decoded (caller-supplied, at least the block size)
+    unsigned long cachedBlock;                      // Number of the decoded block (0xffffffff if none)
+} virtualdisk_store_t;
+
+
+// (Public) Open a compressed block store, with two caller-supplied buffers of at least the store's block size (returns zero if the store is invalid or the buffers too small)
+char VirtualDiskStoreOpen(virtualdisk_store_t *store, VirtualDiskStoreReadCallback read, void *reference, unsigned short sectorSize, unsigned char *block, unsigned char *compressed, unsigned long bufferSize);
+
+// (Public) Copy uncompressed sectors to the buffer, decompressing only the blocks they are in (beyond the end, sectors are blank)
+unsigned short VirtualDiskStoreRead(virtualdisk_store_t *store, unsigned long sector, unsigned short count, unsigned char *buffer);
+
+// (Public) Copy part of an uncompressed sector to the buffer ('length' bytes from byte 'offset'; blank beyond the end), decompressing its block only if it is not the one already decoded
+unsigned short VirtualDiskStoreReadPartial(virtualdisk_store_t *store, unsigned long sector, unsigned short offset, unsigned short length, unsigned char *buffer);
+
+// (Public) File contents generator for a compressed block store (set the file information's 'reference' to the virtualdisk_store_t, and its 'size' to the store's)
+unsigned short VirtualDiskStoreContents(void *reference, unsigned long sector, unsigned short count, unsigned char *buffer);
+
+// (Public) Partial file contents generator for a compressed block store, for streaming a sector in pieces (set the file information's 'partial' to it, as well as its 'contents' to VirtualDiskStoreContents)
+unsigned short VirtualDiskStorePartial(void *reference, unsigned long sector, unsigned short offset, unsigned short length, unsigned char *buffer);
+
+// (Public) Compress data into a store in memory (e.g. on a host, to prepare a store), returning the length of the store (zero if it does not fit)
+unsigned long VirtualDiskStoreBuild(const unsigned char *data, unsigned long size, unsigned long blockSize, unsigned char *store, unsigned long capacity);
+
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
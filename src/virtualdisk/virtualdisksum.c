@@ -0,0 +1,320 @@
+// Virtual Disk/File System - Checksum Sidecar Files
+// Dan Jackson, 2013
+
+// A sidecar file holding a data file's checksum has a size known in advance (the length of the hex digest and the name), so it can
+// be listed without reading the data file. The checksum is computed incrementally, over the data file's sectors in order: reading
+// the data file in order feeds its sectors through the hash as they are generated, and VirtualDiskSumStep() hashes further sectors in
+// large blocks (e.g. when idle). If the sidecar is read before the checksum is complete, each read hashes a bounded number of further
+// sectors and fails (rather than stalling the host on the whole of a large file), until a retried read finds the checksum complete.
+
+#include <stddef.h>
+#include <string.h>
+
+#include "virtualdisksum.h"
+
+// Big-endian word macros (SHA-256)
+#define SET_DWORD_BE(_p, _ov) { unsigned long _v = (_ov); *((_p)+0) = (unsigned char)((_v) >> 24); *((_p)+1) = (unsigned char)((_v) >> 16); *((_p)+2) = (unsigned char)((_v) >> 8); *((_p)+3) = (unsigned char)((_v)); }
+#define GET_DWORD_BE(_p) ( ((unsigned long)*((_p)+0) << 24) | ((unsigned long)*((_p)+1) << 16) | ((unsigned long)*((_p)+2) << 8) | (unsigned long)*((_p)+3) )
+
+// 32-bit rotate right (unsigned long may be wider than 32 bits)
+#define ROTR(_x, _n) ((((_x) >> (_n)) | ((_x) << (32 - (_n)))) & 0xfffffffful)
+
+// Separator between the digest and the name, and the line ending
+#define VIRTUALDISKSUM_SEPARATOR "  "
+#define VIRTUALDISKSUM_NEWLINE "\n"
+
+// CRC-32 table (built on first use)
+static unsigned long virtualDiskSumCrcTable[256];
+static char virtualDiskSumCrcTableBuilt = 0;
+
+// SHA-256 round constants
+static const unsigned long virtualDiskSumSha256K[64] =
+{
+    0x428a2f98ul, 0x71374491ul, 0xb5c0fbcful, 0xe9b5dba5ul, 0x3956c25bul, 0x59f111f1ul, 0x923f82a4ul, 0xab1c5ed5ul,
+    0xd807aa98ul, 0x12835b01ul, 0x243185beul, 0x550c7dc3ul, 0x72be5d74ul, 0x80deb1feul, 0x9bdc06a7ul, 0xc19bf174ul,
+    0xe49b69c1ul, 0xefbe4786ul, 0x0fc19dc6ul, 0x240ca1ccul, 0x2de92c6ful, 0x4a7484aaul, 0x5cb0a9dcul, 0x76f988daul,
+    0x983e5152ul, 0xa831c66dul, 0xb00327c8ul, 0xbf597fc7ul, 0xc6e00bf3ul, 0xd5a79147ul, 0x06ca6351ul, 0x14292967ul,
+    0x27b70a85ul, 0x2e1b2138ul, 0x4d2c6dfcul, 0x53380d13ul, 0x650a7354ul, 0x766a0abbul, 0x81c2c92eul, 0x92722c85ul,
+    0xa2bfe8a1ul, 0xa81a664bul, 0xc24b8b70ul, 0xc76c51a3ul, 0xd192e819ul, 0xd6990624ul, 0xf40e3585ul, 0x106aa070ul,
+    0x19a4c116ul, 0x1e376c08ul, 0x2748774cul, 0x34b0bcb5ul, 0x391c0cb3ul, 0x4ed8aa4aul, 0x5b9cca4ful, 0x682e6ff3ul,
+    0x748f82eeul, 0x78a5636ful, 0x84c87814ul, 0x8cc70208ul, 0x90befffaul, 0xa4506cebul, 0xbef9a3f7ul, 0xc67178f2ul
+};
+
+
+// (Private) Process a 64-byte SHA-256 block
+static void VirtualDiskSumSha256Block(unsigned long *state, const unsigned char *p)
+{
+    unsigned long w[64], a, b, c, d, e, f, g, h;
+    int i;
+
+    for (i = 0; i < 16; i++) { w[i] = GET_DWORD_BE(p + 4 * i); }
+    for (i = 16; i < 64; i++)
+    {
+        unsigned long s0 = ROTR(w[i - 15], 7) ^ ROTR(w[i - 15], 18) ^ (w[i - 15] >> 3);
+        unsigned long s1 = ROTR(w[i - 2], 17) ^ ROTR(w[i - 2], 19) ^ (w[i - 2] >> 10);
+        w[i] = (w[i - 16] + s0 + w[i - 7] + s1) & 0xfffffffful;
+    }
+
+    a = state[0]; b = state[1]; c = state[2]; d = state[3]; e = state[4]; f = state[5]; g = state[6]; h = state[7];
+    for (i = 0; i < 64; i++)
+    {
+        unsigned long t1 = h + (ROTR(e, 6) ^ ROTR(e, 11) ^ ROTR(e, 25)) + ((e & f) ^ (~e & g)) + virtualDiskSumSha256K[i] + w[i];
+        unsigned long t2 = (ROTR(a, 2) ^ ROTR(a, 13) ^ ROTR(a, 22)) + ((a & b) ^ (a & c) ^ (b & c));
+        h = g; g = f; f = e;
+        e = (d + t1) & 0xfffffffful;
+        d = c; c = b; b = a;
+        a = (t1 + t2) & 0xfffffffful;
+    }
+    state[0] = (state[0] + a) & 0xfffffffful; state[1] = (state[1] + b) & 0xfffffffful;
+    state[2] = (state[2] + c) & 0xfffffffful; state[3] = (state[3] + d) & 0xfffffffful;
+    state[4] = (state[4] + e) & 0xfffffffful; state[5] = (state[5] + f) & 0xfffffffful;
+    state[6] = (state[6] + g) & 0xfffffffful; state[7] = (state[7] + h) & 0xfffffffful;
+}
+
+
+// (Private) Add data to the hash
+static void VirtualDiskSumUpdate(virtualdisk_sum_t *sum, const unsigned char *data, unsigned long length)
+{
+    if (sum->type == VIRTUALDISKSUM_CRC32)
+    {
+        unsigned long crc = sum->crc, i;
+        for (i = 0; i < length; i++) { crc = virtualDiskSumCrcTable[(crc ^ data[i]) & 0xff] ^ (crc >> 8); }
+        sum->crc = crc;
+        sum->length += length;
+    }
+    else
+    {
+        unsigned long used = (unsigned long)(sum->length & 63);
+
+        // Complete a partial block
+        if (used > 0)
+        {
+            unsigned long copy = (length < 64 - used) ? length : 64 - used;
+            memcpy(sum->block + used, data, copy);
+            data += copy;
+            length -= copy;
+            sum->length += copy;
+            if (used + copy < 64) { return; }
+            VirtualDiskSumSha256Block(sum->state, sum->block);
+        }
+
+        // Whole blocks directly, then keep any remainder
+        for (; length >= 64; data += 64, length -= 64, sum->length += 64) { VirtualDiskSumSha256Block(sum->state, data); }
+        memcpy(sum->block, data, length);
+        sum->length += length;
+    }
+}
+
+
+// (Private) Finish the hash
+static void VirtualDiskSumFinish(virtualdisk_sum_t *sum)
+{
+    if (sum->type == VIRTUALDISKSUM_CRC32)
+    {
+        SET_DWORD_BE(sum->digest, sum->crc ^ 0xfffffffful);
+    }
+    else
+    {
+        static const unsigned char padding[64] = { 0x80 };
+        unsigned long long bits = sum->length * 8;
+        unsigned char lengthBytes[8];
+        int i;
+
+        SET_DWORD_BE(lengthBytes + 0, (unsigned long)(bits >> 32));
+        SET_DWORD_BE(lengthBytes + 4, (unsigned long)bits);
+        VirtualDiskSumUpdate(sum, padding, (unsigned long)(((119 - (sum->length & 63)) & 63) + 1));     // To 56 bytes into a block
+        VirtualDiskSumUpdate(sum, lengthBytes, 8);
+        for (i = 0; i < 8; i++) { SET_DWORD_BE(sum->digest + 4 * i, sum->state[i]); }
+    }
+    sum->complete = 1;
+}
+
+
+// (Private) Hash data file sectors that follow those already hashed (only the bytes within the file)
+static void VirtualDiskSumHashSectors(virtualdisk_sum_t *sum, const unsigned char *data, unsigned long count)
+{
+    unsigned long long size = ((unsigned long long)sum->sizeHigh << 32) | sum->size;
+    unsigned long long remaining = size - (unsigned long long)sum->hashedSectors * sum->sectorSize;
+    unsigned long long length = (unsigned long long)count * sum->sectorSize;
+
+    if (count > sum->numSectors - sum->hashedSectors) { count = sum->numSectors - sum->hashedSectors; length = (unsigned long long)count * sum->sectorSize; }
+    if (length > remaining) { length = remaining; }
+    VirtualDiskSumUpdate(sum, data, (unsigned long)length);
+    sum->hashedSectors += count;
+    if (sum->hashedSectors >= sum->numSectors) { VirtualDiskSumFinish(sum); }
+}
+
+
+// (Private) Length of the data file name in the sidecar (capped, as for the sidecar file name)
+static unsigned long VirtualDiskSumNameLength(const virtualdisk_sum_t *sum)
+{
+    size_t nameLength = strlen(sum->filename);
+    if (nameLength > VIRTUALDISK_MAX_FILENAME) { nameLength = VIRTUALDISK_MAX_FILENAME; }
+    return (unsigned long)nameLength;
+}
+
+
+// (Private) Generate data file sectors, calling its contents generator with file information that refers to its own reference
+static unsigned short VirtualDiskSumSource(virtualdisk_sum_t *sum, const virtualdisk_fileinfo_t *fileInfo, unsigned long sector, unsigned short count, unsigned char *buffer)
+{
+    virtualdisk_fileinfo_t source;
+
+    if (fileInfo != NULL) { source = *fileInfo; } else { memset(&source, 0, sizeof(source)); }
+    source.filename = sum->filename;
+    source.size = sum->size;
+    source.sizeHigh = sum->sizeHigh;
+    source.contents = sum->contents;
+    source.reference = sum->reference;
+    return sum->contents(&source, sector, count, buffer);
+}
+
+
+// (Public) Set up a data file with a checksum sidecar, with a caller-supplied buffer for hashing blocks of it (at least one sector; larger blocks are hashed faster)
+char VirtualDiskSumInit(virtualdisk_sum_t *sum, VIRTUALDISKSUM_TYPE type, const char *filename, unsigned long size, unsigned long sizeHigh, unsigned short sectorSize, virtualdisk_generator_t contents, void *reference, unsigned char *buffer, unsigned long bufferSize)
+{
+    static const unsigned long sha256Initial[8] = { 0x6a09e667ul, 0xbb67ae85ul, 0x3c6ef372ul, 0xa54ff53aul, 0x510e527ful, 0x9b05688cul, 0x1f83d9abul, 0x5be0cd19ul };
+    unsigned long long totalSize = ((unsigned long long)sizeHigh << 32) | size;
+    size_t nameLength;
+
+    memset(sum, 0, sizeof(virtualdisk_sum_t));
+    sum->type = type;
+    sum->contents = contents;
+    sum->reference = reference;
+    sum->filename = filename;
+    sum->size = size;
+    sum->sizeHigh = sizeHigh;
+    sum->sectorSize = sectorSize;
+    sum->buffer = buffer;
+    if (sectorSize == 0 || filename == NULL || contents == NULL) { return 0; }
+    sum->bufferSectors = (bufferSize / sectorSize > 0xffff) ? 0xffff : (unsigned short)(bufferSize / sectorSize);
+    sum->numSectors = (unsigned long)((totalSize + sectorSize - 1) / sectorSize);
+    if (sum->bufferSectors == 0) { return 0; }
+
+    // Hash state
+    sum->crc = 0xfffffffful;
+    memcpy(sum->state, sha256Initial, sizeof(sum->state));
+    if (!virtualDiskSumCrcTableBuilt)
+    {
+        unsigned long i;
+        for (i = 0; i < 256; i++)
+        {
+            unsigned long c = i;
+            int k;
+            for (k = 0; k < 8; k++) { c = (c & 1) ? (0xedb88320ul ^ (c >> 1)) : (c >> 1); }
+            virtualDiskSumCrcTable[i] = c;
+        }
+        virtualDiskSumCrcTableBuilt = 1;
+    }
+    if (sum->numSectors == 0) { VirtualDiskSumFinish(sum); }
+
+    // Sidecar name
+    nameLength = strlen(filename);
+    if (nameLength > VIRTUALDISK_MAX_FILENAME) { nameLength = VIRTUALDISK_MAX_FILENAME; }
+    memcpy(sum->sumFilename, filename, nameLength);
+    strcpy(sum->sumFilename + nameLength, (type == VIRTUALDISKSUM_CRC32) ? ".CRC" : ".SHA256");
+    return 1;
+}
+
+
+// (Public) Fill in the file information for the data file (its contents pass through the hash, so reading it in order computes the checksum at no extra cost)
+void VirtualDiskSumDataFileInfo(virtualdisk_sum_t *sum, virtualdisk_fileinfo_t *fileInfo)
+{
+    fileInfo->filename = sum->filename;
+    fileInfo->size = sum->size;
+    fileInfo->sizeHigh = sum->sizeHigh;
+    fileInfo->attributes = VIRTUALDISK_ATTRIB_ARCHIVE;
+    fileInfo->contents = VirtualDiskSumDataContents;
+    fileInfo->reference = sum;
+}
+
+
+// (Public) Fill in the file information for the sidecar file (its size is known without reading the data file)
+void VirtualDiskSumFileInfo(virtualdisk_sum_t *sum, virtualdisk_fileinfo_t *fileInfo)
+{
+    fileInfo->filename = sum->sumFilename;
+    fileInfo->size = (unsigned long)(((sum->type == VIRTUALDISKSUM_CRC32) ? 4 : 32) * 2 + strlen(VIRTUALDISKSUM_SEPARATOR) + VirtualDiskSumNameLength(sum) + strlen(VIRTUALDISKSUM_NEWLINE));
+    fileInfo->sizeHigh = 0;
+    fileInfo->attributes = VIRTUALDISK_ATTRIB_ARCHIVE;
+    fileInfo->contents = VirtualDiskSumContents;
+    fileInfo->reference = sum;
+}
+
+
+// (Public) Hash up to the specified number of further data file sectors (e.g. from an idle loop or worker, not at the same time as reads of the files), returns non-zero once the checksum is complete
+char VirtualDiskSumStep(virtualdisk_sum_t *sum, unsigned long maxSectors)
+{
+    while (!sum->complete && maxSectors > 0)
+    {
+        unsigned long count = sum->numSectors - sum->hashedSectors;
+        unsigned short generated;
+
+        if (count > sum->bufferSectors) { count = sum->bufferSectors; }
+        if (count > maxSectors) { count = maxSectors; }
+        generated = VirtualDiskSumSource(sum, NULL, sum->hashedSectors, (unsigned short)count, sum->buffer);
+        if (generated == 0) { return 0; }
+        if (generated > count) { generated = (unsigned short)count; }
+        VirtualDiskSumHashSectors(sum, sum->buffer, generated);
+        maxSectors -= generated;
+    }
+    return sum->complete;
+}
+
+
+// (Public) Returns non-zero once the checksum is complete (until then, reads of the sidecar hash a bounded number of further sectors, and fail)
+char VirtualDiskSumReady(virtualdisk_sum_t *sum)
+{
+    return sum->complete;
+}
+
+
+// (Public) File contents generator for the data file (set up by VirtualDiskSumDataFileInfo())
+unsigned short VirtualDiskSumDataContents(void *reference, unsigned long sector, unsigned short count, unsigned char *buffer)
+{
+    const virtualdisk_fileinfo_t *fileInfo = (const virtualdisk_fileinfo_t *)reference;
+    virtualdisk_sum_t *sum = (virtualdisk_sum_t *)fileInfo->reference;
+    unsigned short generated = VirtualDiskSumSource(sum, fileInfo, sector, count, buffer);
+
+    if (generated > count) { generated = count; }
+
+    // Sectors that continue the hash (including a re-read that overlaps its end)
+    if (!sum->complete && sector <= sum->hashedSectors && sum->hashedSectors < sector + generated)
+    {
+        unsigned long skip = sum->hashedSectors - sector;
+        VirtualDiskSumHashSectors(sum, buffer + (size_t)skip * sum->sectorSize, generated - skip);
+    }
+    return generated;
+}
+
+
+// (Public) File contents generator for the sidecar file, hashing up to VIRTUALDISKSUM_STEP_SECTORS further sectors of the data file if needed, and failing until the checksum is complete (set up by VirtualDiskSumFileInfo())
+unsigned short VirtualDiskSumContents(void *reference, unsigned long sector, unsigned short count, unsigned char *buffer)
+{
+    static const char hex[] = "0123456789abcdef";
+    const virtualdisk_fileinfo_t *fileInfo = (const virtualdisk_fileinfo_t *)reference;
+    virtualdisk_sum_t *sum = (virtualdisk_sum_t *)fileInfo->reference;
+    char text[32 * 2 + sizeof(VIRTUALDISKSUM_SEPARATOR) + VIRTUALDISK_MAX_FILENAME + sizeof(VIRTUALDISKSUM_NEWLINE)];
+    unsigned long length = 0, offset, i;
+    unsigned long digestLength = (sum->type == VIRTUALDISKSUM_CRC32) ? 4 : 32;
+    unsigned long nameLength = VirtualDiskSumNameLength(sum);
+
+    if (!sum->complete && !VirtualDiskSumStep(sum, VIRTUALDISKSUM_STEP_SECTORS)) { return 0; }      // Not ready (a bounded step per read)
+
+    // 'HEX  NAME\n'
+    for (i = 0; i < digestLength; i++)
+    {
+        text[length++] = hex[sum->digest[i] >> 4];
+        text[length++] = hex[sum->digest[i] & 0x0f];
+    }
+    memcpy(text + length, VIRTUALDISKSUM_SEPARATOR, strlen(VIRTUALDISKSUM_SEPARATOR));
+    length += (unsigned long)strlen(VIRTUALDISKSUM_SEPARATOR);
+    memcpy(text + length, sum->filename, nameLength);
+    length += nameLength;
+    memcpy(text + length, VIRTUALDISKSUM_NEWLINE, strlen(VIRTUALDISKSUM_NEWLINE));
+    length += (unsigned long)strlen(VIRTUALDISKSUM_NEWLINE);
+
+    // The requested sectors of the text (blank beyond it)
+    memset(buffer, 0, (size_t)count * sum->sectorSize);
+    offset = sector * sum->sectorSize;
+    if (offset < length) { memcpy(buffer, text + offset, (length - offset < (unsigned long)count * sum->sectorSize) ? length - offset : (unsigned long)count * sum->sectorSize); }
+    return count;
+}
@@ -0,0 +1,79 @@
+// Virtual Disk/File System - Checksum Sidecar Files
+// Dan Jackson, 2013
+
+#ifndef VIRTUALDISKSUM_H
+#define VIRTUALDISKSUM_H
+
+#include "virtualdisk.h"
+
+// Plain C linkage
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// Most data file sectors hashed by each read of the sidecar before the checksum is complete (reads fail until then, and the host retries them)
+#ifndef VIRTUALDISKSUM_STEP_SECTORS
+#define VIRTUALDISKSUM_STEP_SECTORS 256
+#endif
+
+// Checksum type
+typedef enum
+{
+    VIRTUALDISKSUM_CRC32,                           // CRC-32 (as zip/PNG), sidecar 'NAME.CRC'
+    VIRTUALDISKSUM_SHA256                           // SHA-256, sidecar 'NAME.SHA256'
+} VIRTUALDISKSUM_TYPE;
+
+// (Public) A data file with a checksum sidecar file ('HEX  NAME\n', as sha256sum), computed when first needed
+typedef struct
+{
+    VIRTUALDISKSUM_TYPE type;                       // Checksum type
+    virtualdisk_generator_t contents;               // Data file contents generator
+    void *reference;                                // Reference for the data file contents generator
+    const char *filename;                           // Data file name
+    unsigned long size;                             // Data file size (bytes)
+    unsigned long sizeHigh;                         // (exFAT) Upper 32 bits of the data file size
+    unsigned short sectorSize;                      // Size of each sector (bytes)
+    unsigned long numSectors;                       // Number of data file sectors
+    unsigned char *buffer;                          // Buffer for hashing blocks of the data file (caller-supplied)
+    unsigned short bufferSectors;                   // Size of the buffer (sectors)
+
+    // Incremental hash
+    unsigned long hashedSectors;                    // Number of data file sectors hashed so far (in order)
+    char complete;                                  // Non-zero once the whole data file is hashed
+    unsigned long crc;                              // CRC-32 state
+    unsigned long state[8];                         // SHA-256 state
+    unsigned char block[64];                        // SHA-256 partial block
+    unsigned long long length;                      // Number of bytes hashed
+    unsigned char digest[32];                       // Checksum, once complete
+
+    char sumFilename[VIRTUALDISK_MAX_FILENAME + 8]; // Sidecar file name
+} virtualdisk_sum_t;
+
+
+// (Public) Set up a data file with a checksum sidecar, with a caller-supplied buffer for hashing blocks of it (at least one sector; larger blocks are hashed faster)
+char VirtualDiskSumInit(virtualdisk_sum_t *sum, VIRTUALDISKSUM_TYPE type, const char *filename, unsigned long size, unsigned long sizeHigh, unsigned short sectorSize, virtualdisk_generator_t contents, void *reference, unsigned char *buffer, unsigned long bufferSize);
+
+// (Public) Fill in the file information for the data file (its contents pass through the hash, so reading it in order computes the checksum at no extra cost)
+void VirtualDiskSumDataFileInfo(virtualdisk_sum_t *sum, virtualdisk_fileinfo_t *fileInfo);
+
+// (Public) Fill in the file information for the sidecar file (its size is known without reading the data file)
+void VirtualDiskSumFileInfo(virtualdisk_sum_t *sum, virtualdisk_fileinfo_t *fileInfo);
+
+// (Public) Hash up to the specified number of further data file sectors (e.g. from an idle loop or worker, not at the same time as reads of the files), returns non-zero once the checksum is complete
+char VirtualDiskSumStep(virtualdisk_sum_t *sum, unsigned long maxSectors);
+
+// (Public) Returns non-zero once the checksum is complete (until then, reads of the sidecar hash a bounded number of further sectors, and fail)
+char VirtualDiskSumReady(virtualdisk_sum_t *sum);
+
+// (Public) File contents generator for the data file (set up by VirtualDiskSumDataFileInfo())
+unsigned short VirtualDiskSumDataContents(void *reference, unsigned long sector, unsigned short count, unsigned char *buffer);
+
+// (Public) File contents generator for the sidecar file, hashing up to VIRTUALDISKSUM_STEP_SECTORS further sectors of the data file if needed, and failing until the checksum is complete (set up by VirtualDiskSumFileInfo())
+unsigned short VirtualDiskSumContents(void *reference, unsigned long sector, unsigned short count, unsigned char *buffer);
+
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,166 @@
+// Virtual Disk/File System - Synthetic File Contents
+// Dan Jackson, 2013
+
+// Contents that cost almost nothing to generate, so that benchmarks measure the disk rather than the generator, and that can be
+// checked when read back. A whole request is generated at once: a fill is a single memset(); a pattern is copied once, then
+// doubled with memcpy(); a stamp or random stream is a loop of independent 8-byte words (no carried state, so the compiler can
+// vectorize it, and any position in the file is generated directly). The random stream is a counter-based generator: each word is
+// the SplitMix64 xorshift-multiply finalizer of its word number (rather than a sequential xorshift state, which cannot seek).
+
+#include <stddef.h>
+#include <string.h>
+
+#include "virtualdisksynth.h"
+
+// Little-endian 64-bit word macro (compilers combine the byte stores into a single store on little-endian machines)
+#define SET_QWORD(_p, _ov) { unsigned long long _v = (_ov); *((_p)+0) = (unsigned char)(_v); *((_p)+1) = (unsigned char)((_v) >> 8); *((_p)+2) = (unsigned char)((_v) >> 16); *((_p)+3) = (unsigned char)((_v) >> 24); *((_p)+4) = (unsigned char)((_v) >> 32); *((_p)+5) = (unsigned char)((_v) >> 40); *((_p)+6) = (unsigned char)((_v) >> 48); *((_p)+7) = (unsigned char)((_v) >> 56); }
+
+// Size of the expected contents generated at a time to verify against (bytes, a multiple of 8)
+#define VIRTUALDISKSYNTH_VERIFY_CHUNK 512
+
+
+// (Private) Generate the contents at a byte offset in the file (the offset and length are multiples of 8)
+static void VirtualDiskSynthGenerate(const virtualdisk_synth_t *synth, unsigned long long offset, unsigned long length, unsigned char *out)
+{
+    unsigned long long seed = synth->seed;
+    unsigned long i;
+
+    switch (synth->type)
+    {
+        case VIRTUALDISKSYNTH_FILL:
+            memset(out, (int)(seed & 0xff), length);
+            break;
+
+        case VIRTUALDISKSYNTH_PATTERN:
+        {
+            unsigned long phase = (unsigned long)(offset % synth->patternLength);
+            unsigned long filled = synth->patternLength - phase, more;
+
+            // One period of the pattern, from the phase of the offset
+            if (filled > length) { filled = length; }
+            memcpy(out, synth->pattern + phase, filled);
+            more = (length - filled < phase) ? length - filled : phase;
+            memcpy(out + filled, synth->pattern, more);
+            filled += more;
+
+            // Double it (the filled part is a whole number of periods)
+            while (filled < length)
+            {
+                unsigned long copy = (length - filled < filled) ? length - filled : filled;
+                memcpy(out + filled, out, copy);
+                filled += copy;
+            }
+            break;
+        }
+
+        case VIRTUALDISKSYNTH_STAMP:
+            for (i = 0; i < length / 8; i++)
+            {
+                SET_QWORD(out + 8 * i, (offset + 8 * i) ^ seed);
+            }
+            break;
+
+        case VIRTUALDISKSYNTH_RANDOM:
+        {
+            unsigned long long word = offset / 8;
+            for (i = 0; i < length / 8; i++)
+            {
+                unsigned long long z = seed + (word + i + 1) * 0x9e3779b97f4a7c15ull;
+                z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ull;
+                z = (z ^ (z >> 27)) * 0x94d049bb133111ebull;
+                SET_QWORD(out + 8 * i, z ^ (z >> 31));
+            }
+            break;
+        }
+    }
+}
+
+
+// (Public) Set up synthetic contents (returns zero if the sector size is not a multiple of 8 bytes, or a pattern is empty)
+char VirtualDiskSynthInit(virtualdisk_synth_t *synth, VIRTUALDISKSYNTH_TYPE type, unsigned short sectorSize, unsigned long long seed, const unsigned char *pattern, unsigned short patternLength)
+{
+    memset(synth, 0, sizeof(virtualdisk_synth_t));
+    synth->type = type;
+    synth->sectorSize = sectorSize;
+    synth->seed = seed;
+    synth->pattern = pattern;
+    synth->patternLength = patternLength;
+    if (sectorSize == 0 || sectorSize % 8 != 0) { return 0; }
+    if (type == VIRTUALDISKSYNTH_PATTERN && (pattern == NULL || patternLength == 0)) { return 0; }
+    return 1;
+}
+
+
+// (Public) Generate sectors of the contents
+unsigned short VirtualDiskSynthRead(const virtualdisk_synth_t *synth, unsigned long sector, unsigned short count, unsigned char *buffer)
+{
+    VirtualDiskSynthGenerate(synth, (unsigned long long)sector * synth->sectorSize, (unsigned long)count * synth->sectorSize, buffer);
+    return count;
+}
+
+
+// (Public) Check sectors read back against the contents, returning the number of sectors that match before the first that does not
+unsigned short VirtualDiskSynthVerify(const virtualdisk_synth_t *synth, unsigned long sector, unsigned short count, const unsigned char *buffer)
+{
+    unsigned char expected[VIRTUALDISKSYNTH_VERIFY_CHUNK];
+    unsigned short done;
+
+    for (done = 0; done < count; done++)
+    {
+        unsigned long long offset = (unsigned long long)(sector + done) * synth->sectorSize;
+        const unsigned char *p = buffer + (size_t)done * synth->sectorSize;
+        unsigned long position;
+
+        for (position = 0; position < synth->sectorSize; position += VIRTUALDISKSYNTH_VERIFY_CHUNK)
+        {
+            unsigned long length = synth->sectorSize - position;
+            if (length > VIRTUALDISKSYNTH_VERIFY_CHUNK) { length = VIRTUALDISKSYNTH_VERIFY_CHUNK; }
+            VirtualDiskSynthGenerate(synth, offset + position, length, expected);
+            if (memcmp(p + position, expected, length) != 0) { return done; }
+        }
+    }
+    return done;
+}
+
+
+// (Public) File contents generator for synthetic contents (set the file information's 'reference' to the virtualdisk_synth_t)
+unsigned short VirtualDiskSynthContents(void *reference, unsigned long sector, unsigned short count, unsigned char *buffer)
+{
+    const virtualdisk_fileinfo_t *fileInfo = (const virtualdisk_fileinfo_t *)reference;
+    return VirtualDiskSynthRead((const virtualdisk_synth_t *)fileInfo->reference, sector, count, buffer);
+}
+
+
+// (Public) Partial file contents generator for synthetic contents -- whole 8-byte words directly into the buffer, and the part of a word at either end through a single word
+unsigned short VirtualDiskSynthPartial(void *reference, unsigned long sector, unsigned short offset, unsigned short length, unsigned char *buffer)
+{
+    const virtualdisk_fileinfo_t *fileInfo = (const virtualdisk_fileinfo_t *)reference;
+    const virtualdisk_synth_t *synth = (const virtualdisk_synth_t *)fileInfo->reference;
+    unsigned long long position = (unsigned long long)sector * synth->sectorSize + offset;
+    unsigned short done = 0;
+
+    while (done < length)
+    {
+        unsigned short within = (unsigned short)(position % 8);
+        unsigned short remaining = length - done;
+
+        if (within == 0 && remaining >= 8)
+        {
+            unsigned short whole = remaining & ~7u;
+            VirtualDiskSynthGenerate(synth, position, whole, buffer + done);
+            position += whole;
+            done += whole;
+        }
+        else
+        {
+            unsigned char word[8];
+            unsigned short part = 8 - within;
+            if (part > remaining) { part = remaining; }
+            VirtualDiskSynthGenerate(synth, position - within, 8, word);
+            memcpy(buffer + done, word + within, part);
+            position += part;
+            done += part;
+        }
+    }
+    return length;
+}
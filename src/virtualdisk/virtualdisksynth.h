@@ -0,0 +1,54 @@
+// Virtual Disk/File System - Synthetic File Contents
+// Dan Jackson, 2013
+
+#ifndef VIRTUALDISKSYNTH_H
+#define VIRTUALDISKSYNTH_H
+
+#include "virtualdisk.h"
+
+// Plain C linkage
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// Synthetic contents type
+typedef enum
+{
+    VIRTUALDISKSYNTH_FILL,                          // Every byte is the seed's low byte
+    VIRTUALDISKSYNTH_PATTERN,                       // A caller-supplied pattern, repeated from the start of the file
+    VIRTUALDISKSYNTH_STAMP,                         // Each 8-byte word is its own offset in the file, exclusive-or the seed (little-endian)
+    VIRTUALDISKSYNTH_RANDOM                         // Each 8-byte word is a pseudo-random function of its offset in the file and the seed (little-endian), so any position is generated directly
+} VIRTUALDISKSYNTH_TYPE;
+
+// (Public) Synthetic file contents (e.g. for benchmarks and capacity tests)
+typedef struct
+{
+    VIRTUALDISKSYNTH_TYPE type;                     // Type of contents
+    unsigned short sectorSize;                      // Size of each sector (bytes)
+    unsigned long long seed;                        // Fill byte or stream seed
+    const unsigned char *pattern;                   // Pattern (VIRTUALDISKSYNTH_PATTERN)
+    unsigned short patternLength;                   // Length of the pattern (bytes)
+} virtualdisk_synth_t;
+
+
+// (Public) Set up synthetic contents (returns zero if the sector size is not a multiple of 8 bytes, or a pattern is empty)
+char VirtualDiskSynthInit(virtualdisk_synth_t *synth, VIRTUALDISKSYNTH_TYPE type, unsigned short sectorSize, unsigned long long seed, const unsigned char *pattern, unsigned short patternLength);
+
+// (Public) Generate sectors of the contents
+unsigned short VirtualDiskSynthRead(const virtualdisk_synth_t *synth, unsigned long sector, unsigned short count, unsigned char *buffer);
+
+// (Public) Check sectors read back against the contents, returning the number of sectors that match before the first that does not
+unsigned short VirtualDiskSynthVerify(const virtualdisk_synth_t *synth, unsigned long sector, unsigned short count, const unsigned char *buffer);
+
+// (Public) File contents generator for synthetic contents (set the file information's 'reference' to the virtualdisk_synth_t)
+unsigned short VirtualDiskSynthContents(void *reference, unsigned long sector, unsigned short count, unsigned char *buffer);
+
+// (Public) Partial file contents generator for synthetic contents, for streaming a sector in pieces (set the file information's 'partial' to it, as well as its 'contents' to VirtualDiskSynthContents)
+unsigned short VirtualDiskSynthPartial(void *reference, unsigned long sector, unsigned short offset, unsigned short length, unsigned char *buffer);
+
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
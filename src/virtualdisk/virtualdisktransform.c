@@ -0,0 +1,173 @@
+// Virtual Disk/File System - Record-to-Text Transform
+// Dan Jackson, 2013
+
+// A text file (e.g. CSV) derived from binary records is generated on demand, rather than converted in advance: any sector is
+// produced by formatting only the records that overlap it. Where every record's text is the same width, the record at any offset
+// is found directly. Otherwise, the records are formatted once when the file is set up -- finding the file size, and filling a
+// sparse index of the text offset of every N-th record -- so that a sector is found by a binary search of the index, then
+// formatting forward from the nearest indexed record (or from the last record formatted, when reading sequentially). The index is
+// filled by that pass rather than on first access, as the file size is needed before any read and takes formatting every record.
+
+#include <stddef.h>
+#include <string.h>
+
+#include "virtualdisktransform.h"
+
+
+// (Private) Format a record's text (padded with spaces to the fixed width, if there is one), returning its length
+static unsigned short VirtualDiskTransformFormat(virtualdisk_transform_t *transform, unsigned long record, char *text)
+{
+    unsigned short length = transform->format(transform->reference, record, text, VIRTUALDISKTRANSFORM_MAX_RECORD);
+    if (length > VIRTUALDISKTRANSFORM_MAX_RECORD) { length = VIRTUALDISKTRANSFORM_MAX_RECORD; }
+    if (transform->fixedWidth > 0)
+    {
+        if (length < transform->fixedWidth) { memset(text + length, ' ', transform->fixedWidth - length); }
+        length = transform->fixedWidth;
+    }
+    return length;
+}
+
+
+// (Private) Find a record at or before a text offset (after the header), and the text offset it starts at
+static void VirtualDiskTransformSeek(virtualdisk_transform_t *transform, unsigned long offset, unsigned long *record, unsigned long *start)
+{
+    unsigned long low, high;
+
+    if (transform->fixedWidth > 0)
+    {
+        *record = (offset - transform->headerLength) / transform->fixedWidth;
+        *start = transform->headerLength + *record * transform->fixedWidth;
+        return;
+    }
+
+    // Binary search for the last checkpoint at or before the offset
+    low = 0;
+    high = transform->numCheckpoints;
+    while (high - low > 1)
+    {
+        unsigned long middle = low + (high - low) / 2;
+        if (transform->checkpoints[middle] <= offset) { low = middle; } else { high = middle; }
+    }
+    *record = low * transform->interval;
+    *start = transform->checkpoints[low];
+
+    // Continue from the last record formatted instead, if it is nearer
+    if (transform->cursorOffset <= offset && transform->cursorOffset >= *start && transform->cursorRecord < transform->numRecords)
+    {
+        *record = transform->cursorRecord;
+        *start = transform->cursorOffset;
+    }
+}
+
+
+// (Public) Set up a text file from records: of a fixed width (no index needed), or, with a fixed width of zero, formatting every record once to find the file size and fill the caller-supplied index (returns zero if the text would be 4 GiB or more, or there is no index for variable-width records)
+char VirtualDiskTransformInit(virtualdisk_transform_t *transform, VirtualDiskTransformFormatCallback format, void *reference, unsigned long numRecords, unsigned short sectorSize, const char *header, unsigned short fixedWidth, unsigned long *checkpoints, unsigned long capacity)
+{
+    unsigned long record, offset;
+
+    memset(transform, 0, sizeof(virtualdisk_transform_t));
+    transform->format = format;
+    transform->reference = reference;
+    transform->numRecords = numRecords;
+    transform->sectorSize = sectorSize;
+    transform->header = header;
+    transform->headerLength = (header != NULL) ? (unsigned long)strlen(header) : 0;
+    transform->fixedWidth = fixedWidth;
+    transform->cursorRecord = 0;
+    transform->cursorOffset = transform->headerLength;
+
+    if (sectorSize == 0 || fixedWidth > VIRTUALDISKTRANSFORM_MAX_RECORD) { return 0; }
+
+    if (fixedWidth > 0)
+    {
+        if (numRecords > (0xfffffffful - transform->headerLength) / fixedWidth) { return 0; }
+        transform->size = transform->headerLength + numRecords * fixedWidth;
+        return 1;
+    }
+
+    // Variable-width records: format each once, noting the offset of every 'interval'-th record
+    if (checkpoints == NULL || capacity == 0) { return 0; }
+    transform->checkpoints = checkpoints;
+    transform->interval = numRecords / capacity + (numRecords % capacity != 0);      // Rounded up (without overflowing for any number of records), so there are at most 'capacity' checkpoints
+    if (transform->interval == 0) { transform->interval = 1; }
+    offset = transform->headerLength;
+    for (record = 0; record < numRecords; record++)
+    {
+        char text[VIRTUALDISKTRANSFORM_MAX_RECORD];
+        unsigned short length;
+
+        if (record % transform->interval == 0) { checkpoints[transform->numCheckpoints++] = offset; }
+        length = VirtualDiskTransformFormat(transform, record, text);
+        if (length > 0xfffffffful - offset) { return 0; }
+        offset += length;
+    }
+    if (transform->numCheckpoints == 0) { checkpoints[transform->numCheckpoints++] = offset; }     // No records
+    transform->size = offset;
+    return 1;
+}
+
+
+// (Public) Generate sectors of the text, formatting only the records that overlap them (beyond the end, sectors are blank)
+unsigned short VirtualDiskTransformRead(virtualdisk_transform_t *transform, unsigned long sector, unsigned short count, unsigned char *buffer)
+{
+    unsigned long numSectors = (transform->size + transform->sectorSize - 1) / transform->sectorSize;
+    unsigned long offset, length, fill, done = 0;
+
+    length = (unsigned long)count * transform->sectorSize;
+    if (sector >= numSectors)
+    {
+        memset(buffer, 0, length);
+        return count;
+    }
+    offset = sector * transform->sectorSize;
+    fill = transform->size - offset;
+    if (fill > length) { fill = length; }
+
+    // Header text
+    if (offset < transform->headerLength)
+    {
+        done = transform->headerLength - offset;
+        if (done > fill) { done = fill; }
+        memcpy(buffer, transform->header + offset, done);
+    }
+
+    // Records overlapping the rest
+    if (done < fill)
+    {
+        unsigned long position = offset + done, record, start;
+
+        VirtualDiskTransformSeek(transform, position, &record, &start);
+        while (done < fill && record < transform->numRecords)
+        {
+            char text[VIRTUALDISKTRANSFORM_MAX_RECORD];
+            unsigned short textLength = VirtualDiskTransformFormat(transform, record, text);
+
+            if (start + textLength > position)
+            {
+                unsigned long skip = position - start, copy = textLength - skip;
+                if (copy > fill - done) { copy = fill - done; }
+                memcpy(buffer + done, text + skip, copy);
+                done += copy;
+                position += copy;
+            }
+
+            // The record containing the last byte generated is where a sequential read will continue
+            transform->cursorRecord = record;
+            transform->cursorOffset = start;
+            start += textLength;
+            record++;
+        }
+    }
+
+    // Beyond the end of the text (or, if the records did not format as they did when indexed, the rest)
+    if (done < length) { memset(buffer + done, 0, length - done); }
+    return count;
+}
+
+
+// (Public) File contents generator for a text file derived from records (set the file information's 'reference' to the virtualdisk_transform_t, and its 'size' to the transform's)
+unsigned short VirtualDiskTransformContents(void *reference, unsigned long sector, unsigned short count, unsigned char *buffer)
+{
+    const virtualdisk_fileinfo_t *fileInfo = (const virtualdisk_fileinfo_t *)reference;
+    return VirtualDiskTransformRead((virtualdisk_transform_t *)fileInfo->reference, sector, count, buffer);
+}
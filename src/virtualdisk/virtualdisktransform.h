@@ -0,0 +1,59 @@
+// Virtual Disk/File System - Record-to-Text Transform
+// Dan Jackson, 2013
+
+#ifndef VIRTUALDISKTRANSFORM_H
+#define VIRTUALDISKTRANSFORM_H
+
+#include "virtualdisk.h"
+
+// Plain C linkage
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// Maximum length of a record's text (bytes)
+#ifndef VIRTUALDISKTRANSFORM_MAX_RECORD
+#define VIRTUALDISKTRANSFORM_MAX_RECORD 256
+#endif
+
+// (Public) Callback to format a record as text (e.g. a CSV line), returning its length (at most the maximum) -- the same record must always give the same text
+typedef unsigned short (*VirtualDiskTransformFormatCallback)(void *reference, unsigned long record, char *text, unsigned short maxLength);
+
+// (Public) A text file derived from a sequence of records, with a sparse index of the text offsets of records
+typedef struct
+{
+    VirtualDiskTransformFormatCallback format;      // Formats a record
+    void *reference;                                // Reference passed to the format callback
+    unsigned long numRecords;                       // Number of records
+    unsigned short sectorSize;                      // Size of each sector (bytes)
+    const char *header;                             // Text before the first record (e.g. CSV column names), or NULL
+    unsigned long headerLength;                     // Length of the header text (bytes)
+    unsigned short fixedWidth;                      // Length of every record's text (bytes), or zero if they vary (then the index is used)
+    unsigned long size;                             // Length of the text (bytes)
+
+    // Sparse index (variable-width records): the text offset of every 'interval'-th record
+    unsigned long *checkpoints;                     // Text offsets (caller-supplied)
+    unsigned long numCheckpoints;                   // Number of text offsets
+    unsigned long interval;                         // Records between checkpoints
+
+    // The last record formatted by a read (the one holding its last byte), and its text offset, so the next sequential read continues from it rather than searching
+    unsigned long cursorRecord;
+    unsigned long cursorOffset;
+} virtualdisk_transform_t;
+
+
+// (Public) Set up a text file from records: of a fixed width (no index needed), or, with a fixed width of zero, formatting every record once to find the file size and fill the caller-supplied index (returns zero if the text would be 4 GiB or more, or there is no index for variable-width records)
+char VirtualDiskTransformInit(virtualdisk_transform_t *transform, VirtualDiskTransformFormatCallback format, void *reference, unsigned long numRecords, unsigned short sectorSize, const char *header, unsigned short fixedWidth, unsigned long *checkpoints, unsigned long capacity);
+
+// (Public) Generate sectors of the text, formatting only the records that overlap them (beyond the end, sectors are blank)
+unsigned short VirtualDiskTransformRead(virtualdisk_transform_t *transform, unsigned long sector, unsigned short count, unsigned char *buffer);
+
+// (Public) File contents generator for a text file derived from records (set the file information's 'reference' to the virtualdisk_transform_t, and its 'size' to the transform's)
+unsigned short VirtualDiskTransformContents(void *reference, unsigned long sector, unsigned short count, unsigned char *buffer);
+
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
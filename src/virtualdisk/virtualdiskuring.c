@@ -0,0 +1,392 @@
+// Virtual Disk/File System - Asynchronous File Contents (io_uring)
+// Dan Jackson, 2013
+
+// Source files are read in fixed-size, aligned blocks into a pool of buffers, through an io_uring driven by raw system calls (no
+// library). A read first queues every block it covers (and, if it continues a sequential run, the next VIRTUALDISKURING_DEPTH
+// blocks), submits them together, then waits for and copies each block in turn -- so the storage device sees a queue of reads rather
+// than one at a time, and a host's sequential copy usually finds its next blocks already read. Blocks stay in the pool until their
+// buffer is reused (least-recently used first). Without io_uring (e.g. an older kernel), blocks are read synchronously with pread(),
+// as are queued reads if submitting them fails.
+
+#ifdef __linux__
+#define _GNU_SOURCE
+#define _FILE_OFFSET_BITS 64
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <linux/io_uring.h>
+#endif
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "virtualdiskuring.h"
+
+// Alignment of the buffers (for direct I/O)
+#define VIRTUALDISKURING_ALIGN 4096
+
+// Number of blocks that may be in flight for one read (the rest of the pool holds blocks that are ready)
+#define VIRTUALDISKURING_WINDOW (VIRTUALDISKURING_BUFFERS / 2)
+
+
+#ifdef __linux__
+
+// (Private) Wait for reads to complete (or just collect those that have), marking their buffers ready
+static void VirtualDiskUringComplete(virtualdisk_uring_t *ring, char wait)
+{
+    unsigned int head, tail;
+
+    if (ring->fd < 0) { return; }
+    if (wait) { syscall(__NR_io_uring_enter, ring->fd, 0, 1, IORING_ENTER_GETEVENTS, NULL, 0); }
+    head = *ring->cqHead;
+    tail = __atomic_load_n(ring->cqTail, __ATOMIC_ACQUIRE);
+    while (head != tail)
+    {
+        const struct io_uring_cqe *cqe = &((const struct io_uring_cqe *)ring->cqes)[head & *ring->cqMask];
+        if (cqe->user_data < VIRTUALDISKURING_BUFFERS)
+        {
+            ring->buffers[cqe->user_data].state = 2;
+            ring->buffers[cqe->user_data].result = cqe->res;
+        }
+        head++;
+    }
+    __atomic_store_n(ring->cqHead, head, __ATOMIC_RELEASE);
+}
+
+
+// (Private) Withdraw the queued reads the kernel has not taken from the submission queue, and read them synchronously instead (the kernel only takes entries while being entered, so they cannot be in use)
+static void VirtualDiskUringFallback(virtualdisk_uring_t *ring)
+{
+    unsigned int first = __atomic_load_n(ring->sqHead, __ATOMIC_ACQUIRE), head;
+
+    for (head = first; head != *ring->sqTail; head++)
+    {
+        const struct io_uring_sqe *sqe = &((const struct io_uring_sqe *)ring->sqes)[ring->sqArray[head & *ring->sqMask]];
+        virtualdisk_uring_buffer_t *buffer = &ring->buffers[sqe->user_data];
+        ssize_t n = pread(sqe->fd, buffer->data, sqe->len, (off_t)sqe->off);
+        buffer->result = (n < 0) ? -errno : (int)n;
+        buffer->state = 2;
+    }
+    __atomic_store_n(ring->sqTail, first, __ATOMIC_RELEASE);
+    ring->pending = 0;
+}
+
+
+// (Private) Count the submitted reads still in flight (buffers waiting for a read, less those queued but not yet submitted)
+static unsigned int VirtualDiskUringInFlight(const virtualdisk_uring_t *ring)
+{
+    unsigned int count = 0;
+    int i;
+    for (i = 0; i < VIRTUALDISKURING_BUFFERS; i++)
+    {
+        if (ring->buffers[i].state == 1) { count++; }
+    }
+    return count - ring->pending;
+}
+
+
+// (Private) Submit the queued reads (any that cannot be submitted are read synchronously)
+static void VirtualDiskUringSubmit(virtualdisk_uring_t *ring)
+{
+    while (ring->pending > 0)
+    {
+        long submitted = syscall(__NR_io_uring_enter, ring->fd, ring->pending, 0, 0, NULL, 0);
+        if (submitted < 0)
+        {
+            if (errno == EINTR) { continue; }
+            if ((errno == EAGAIN || errno == EBUSY) && VirtualDiskUringInFlight(ring) > 0) { VirtualDiskUringComplete(ring, 1); continue; }     // Out of resources until reads in flight complete (with none in flight, waiting would never return)
+            VirtualDiskUringFallback(ring);         // Otherwise, their buffers would wait forever
+            break;
+        }
+        ring->pending -= (unsigned int)submitted;
+    }
+}
+
+
+// (Private) Find a file's block in the buffer pool
+static virtualdisk_uring_buffer_t *VirtualDiskUringFind(virtualdisk_uring_t *ring, unsigned long id, unsigned long long block)
+{
+    int i;
+    for (i = 0; i < VIRTUALDISKURING_BUFFERS; i++)
+    {
+        if (ring->buffers[i].state != 0 && ring->buffers[i].file == id && ring->buffers[i].block == block) { return &ring->buffers[i]; }
+    }
+    return NULL;
+}
+
+
+// (Private) Queue a read of a file's block into a free buffer, or the least-recently used ready buffer outside the file's blocks still to be copied (returns zero if none)
+static char VirtualDiskUringQueue(virtualdisk_uring_file_t *file, unsigned long long block, unsigned long long keepFirst, unsigned long long keepLast)
+{
+    virtualdisk_uring_t *ring = file->ring;
+    virtualdisk_uring_buffer_t *buffer = NULL;
+    int i;
+
+    for (i = 0; i < VIRTUALDISKURING_BUFFERS; i++)
+    {
+        virtualdisk_uring_buffer_t *candidate = &ring->buffers[i];
+        if (candidate->state == 1) { continue; }
+        if (candidate->state == 2 && candidate->file == file->id && candidate->block >= keepFirst && candidate->block <= keepLast) { continue; }
+        if (candidate->state == 0) { buffer = candidate; break; }
+        if (buffer == NULL || candidate->lastUse < buffer->lastUse) { buffer = candidate; }
+    }
+    if (buffer == NULL) { return 0; }
+
+    buffer->file = file->id;
+    buffer->block = block;
+    buffer->lastUse = ++ring->useCounter;
+    if (ring->fd < 0)
+    {
+        ssize_t n = pread(file->fd, buffer->data, VIRTUALDISKURING_BLOCK_SIZE, (off_t)(block * VIRTUALDISKURING_BLOCK_SIZE));
+        buffer->result = (n < 0) ? -errno : (int)n;
+        buffer->state = 2;
+    }
+    else
+    {
+        unsigned int tail = *ring->sqTail, index = tail & *ring->sqMask;
+        struct io_uring_sqe *sqe = &((struct io_uring_sqe *)ring->sqes)[index];
+        memset(sqe, 0, sizeof(*sqe));
+        sqe->opcode = IORING_OP_READ;
+        sqe->fd = file->fd;
+        sqe->addr = (unsigned long long)(size_t)buffer->data;
+        sqe->len = VIRTUALDISKURING_BLOCK_SIZE;
+        sqe->off = block * VIRTUALDISKURING_BLOCK_SIZE;
+        sqe->user_data = (unsigned long long)(buffer - ring->buffers);
+        ring->sqArray[index] = index;
+        __atomic_store_n(ring->sqTail, tail + 1, __ATOMIC_RELEASE);
+        buffer->state = 1;
+        ring->pending++;
+    }
+    return 1;
+}
+
+#endif
+
+
+// (Public) Create a ring and its buffer pool (falls back to synchronous reads if io_uring is not available; returns zero if out of memory)
+char VirtualDiskUringInit(virtualdisk_uring_t *ring, char direct)
+{
+    int i;
+
+    memset(ring, 0, sizeof(virtualdisk_uring_t));
+    ring->fd = -1;
+    ring->direct = direct;
+    ring->nextFileId = 1;
+
+#ifdef __linux__
+    {
+        void *pool;
+        struct io_uring_params params;
+
+        if (posix_memalign(&pool, VIRTUALDISKURING_ALIGN, (size_t)VIRTUALDISKURING_BUFFERS * VIRTUALDISKURING_BLOCK_SIZE) != 0) { return 0; }
+        ring->pool = (unsigned char *)pool;
+        for (i = 0; i < VIRTUALDISKURING_BUFFERS; i++) { ring->buffers[i].data = ring->pool + (size_t)i * VIRTUALDISKURING_BLOCK_SIZE; }
+
+        // Set up the ring and map its queues (submission and completion rings share a mapping on newer kernels)
+        memset(&params, 0, sizeof(params));
+        ring->fd = (int)syscall(__NR_io_uring_setup, 2 * VIRTUALDISKURING_BUFFERS, &params);
+        if (ring->fd < 0) { ring->fd = -1; return 1; }
+        ring->sqRingSize = params.sq_off.array + params.sq_entries * sizeof(unsigned int);
+        ring->cqRingSize = params.cq_off.cqes + params.cq_entries * sizeof(struct io_uring_cqe);
+        if (params.features & IORING_FEAT_SINGLE_MMAP)
+        {
+            if (ring->cqRingSize > ring->sqRingSize) { ring->sqRingSize = ring->cqRingSize; }
+            ring->cqRingSize = ring->sqRingSize;
+        }
+        ring->sqesSize = params.sq_entries * sizeof(struct io_uring_sqe);
+        ring->sqRing = mmap(NULL, ring->sqRingSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring->fd, IORING_OFF_SQ_RING);
+        if (params.features & IORING_FEAT_SINGLE_MMAP) { ring->cqRing = ring->sqRing; }
+        else { ring->cqRing = mmap(NULL, ring->cqRingSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring->fd, IORING_OFF_CQ_RING); }
+        ring->sqes = mmap(NULL, ring->sqesSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring->fd, IORING_OFF_SQES);
+        if (ring->sqRing == MAP_FAILED || ring->cqRing == MAP_FAILED || ring->sqes == MAP_FAILED)
+        {
+            // Use synchronous reads instead
+            if (ring->sqes != MAP_FAILED) { munmap(ring->sqes, ring->sqesSize); }
+            if (ring->cqRing != MAP_FAILED && ring->cqRing != ring->sqRing) { munmap(ring->cqRing, ring->cqRingSize); }
+            if (ring->sqRing != MAP_FAILED) { munmap(ring->sqRing, ring->sqRingSize); }
+            ring->sqRing = ring->cqRing = ring->sqes = NULL;
+            close(ring->fd);
+            ring->fd = -1;
+            return 1;
+        }
+        ring->sqHead = (unsigned int *)((unsigned char *)ring->sqRing + params.sq_off.head);
+        ring->sqTail = (unsigned int *)((unsigned char *)ring->sqRing + params.sq_off.tail);
+        ring->sqMask = (unsigned int *)((unsigned char *)ring->sqRing + params.sq_off.ring_mask);
+        ring->sqArray = (unsigned int *)((unsigned char *)ring->sqRing + params.sq_off.array);
+        ring->cqHead = (unsigned int *)((unsigned char *)ring->cqRing + params.cq_off.head);
+        ring->cqTail = (unsigned int *)((unsigned char *)ring->cqRing + params.cq_off.tail);
+        ring->cqMask = (unsigned int *)((unsigned char *)ring->cqRing + params.cq_off.ring_mask);
+        ring->cqes = (unsigned char *)ring->cqRing + params.cq_off.cqes;
+    }
+    return 1;
+#else
+    (void)i;
+    return 0;       // Not supported
+#endif
+}
+
+
+// (Public) Wait for any reads in flight, and free the ring and its buffers (close its files first)
+void VirtualDiskUringClose(virtualdisk_uring_t *ring)
+{
+#ifdef __linux__
+    int i;
+    for (i = 0; i < VIRTUALDISKURING_BUFFERS; i++)
+    {
+        while (ring->buffers[i].state == 1) { VirtualDiskUringComplete(ring, 1); }
+    }
+    if (ring->fd >= 0)
+    {
+        munmap(ring->sqes, ring->sqesSize);
+        if (ring->cqRing != ring->sqRing) { munmap(ring->cqRing, ring->cqRingSize); }
+        munmap(ring->sqRing, ring->sqRingSize);
+        close(ring->fd);
+    }
+#endif
+    free(ring->pool);
+    memset(ring, 0, sizeof(virtualdisk_uring_t));
+    ring->fd = -1;
+}
+
+
+// (Public) Open a source file to read through a ring
+char VirtualDiskUringFileOpen(virtualdisk_uring_file_t *file, virtualdisk_uring_t *ring, const char *filename, unsigned short sectorSize)
+{
+    memset(file, 0, sizeof(virtualdisk_uring_file_t));
+    file->ring = ring;
+    file->fd = -1;
+    file->sectorSize = sectorSize;
+#ifdef __linux__
+    {
+        struct stat st;
+        if (ring->pool == NULL || sectorSize == 0) { return 0; }
+        if (ring->direct) { file->fd = open(filename, O_RDONLY | O_DIRECT); }       // Not all file-systems support direct I/O
+        if (file->fd < 0) { file->fd = open(filename, O_RDONLY); }
+        if (file->fd < 0) { return 0; }
+        if (fstat(file->fd, &st) != 0) { close(file->fd); file->fd = -1; return 0; }
+        file->size = (unsigned long long)st.st_size;
+        file->id = ring->nextFileId++;
+        if (ring->nextFileId == 0) { ring->nextFileId = 1; }
+    }
+    return 1;
+#else
+    (void)filename;
+    return 0;
+#endif
+}
+
+
+// (Public) Close a source file (waiting for any of its reads in flight)
+void VirtualDiskUringFileClose(virtualdisk_uring_file_t *file)
+{
+#ifdef __linux__
+    virtualdisk_uring_t *ring = file->ring;
+    int i;
+
+    if (file->fd < 0) { return; }
+    for (i = 0; i < VIRTUALDISKURING_BUFFERS; i++)
+    {
+        if (ring->buffers[i].file != file->id) { continue; }
+        while (ring->buffers[i].state == 1) { VirtualDiskUringComplete(ring, 1); }
+        ring->buffers[i].state = 0;
+        ring->buffers[i].file = 0;
+    }
+    close(file->fd);
+#endif
+    file->fd = -1;
+}
+
+
+// (Public) Copy sectors of the source file to the buffer (beyond the end of the file, sectors are blank), with the blocks of a large or sequential read in flight together
+unsigned short VirtualDiskUringRead(virtualdisk_uring_file_t *file, unsigned long sector, unsigned short count, unsigned char *buffer)
+{
+#ifdef __linux__
+    virtualdisk_uring_t *ring = file->ring;
+    unsigned long long offset = (unsigned long long)sector * file->sectorSize;
+    unsigned long long end = offset + (unsigned long long)count * file->sectorSize;
+    unsigned long long dataEnd = (end < file->size) ? end : file->size;
+    unsigned long long block, lastBlock, aheadBlock, position;
+    char sequential = (offset == file->nextOffset && offset > 0);
+
+    if (file->fd < 0) { return 0; }
+    file->nextOffset = end;
+    if (offset >= dataEnd)
+    {
+        memset(buffer, 0, (size_t)(end - offset));
+        return count;
+    }
+
+    // Blocks covering the read, and those to read ahead of a sequential run
+    block = offset / VIRTUALDISKURING_BLOCK_SIZE;
+    lastBlock = (dataEnd - 1) / VIRTUALDISKURING_BLOCK_SIZE;
+    aheadBlock = lastBlock + (sequential ? VIRTUALDISKURING_DEPTH : 0);
+    if (aheadBlock > (file->size - 1) / VIRTUALDISKURING_BLOCK_SIZE) { aheadBlock = (file->size - 1) / VIRTUALDISKURING_BLOCK_SIZE; }
+
+    for (position = offset; block <= lastBlock; block++)
+    {
+        virtualdisk_uring_buffer_t *current;
+        unsigned long long queue, blockStart = block * VIRTUALDISKURING_BLOCK_SIZE, copyEnd;
+
+        // Queue this block (once a buffer is free, if all are in flight for earlier read-ahead), and the following ones (up to the window) that are not already read or in flight, and submit them together
+        while (VirtualDiskUringFind(ring, file->id, block) == NULL && !VirtualDiskUringQueue(file, block, block, block + VIRTUALDISKURING_WINDOW - 1))
+        {
+            VirtualDiskUringSubmit(ring);
+            VirtualDiskUringComplete(ring, 1);
+        }
+        for (queue = block + 1;queue <= aheadBlock && queue < block + VIRTUALDISKURING_WINDOW; queue++)
+        {
+            if (VirtualDiskUringFind(ring, file->id, queue) != NULL) { continue; }
+            if (!VirtualDiskUringQueue(file, queue, block, block + VIRTUALDISKURING_WINDOW - 1)) { break; }
+        }
+        if (ring->fd >= 0) { VirtualDiskUringSubmit(ring); }
+
+        // Wait for this block, then copy from it
+        if ((current = VirtualDiskUringFind(ring, file->id, block)) == NULL) { break; }
+        while (current->state == 1) { VirtualDiskUringComplete(ring, 1); }
+        current->lastUse = ++ring->useCounter;
+        if (current->result < 0)
+        {
+            current->state = 0;         // Retry on a later read
+            current->file = 0;
+            break;
+        }
+        copyEnd = (dataEnd < blockStart + VIRTUALDISKURING_BLOCK_SIZE) ? dataEnd : blockStart + VIRTUALDISKURING_BLOCK_SIZE;
+        if (blockStart + (unsigned long long)current->result < copyEnd)
+        {
+            // Short read (the file is shorter than when opened): the rest is blank
+            unsigned long long available = blockStart + (unsigned long long)current->result;
+            if (available > position) { memcpy(buffer + (position - offset), current->data + (position - blockStart), (size_t)(available - position)); }
+            else { available = position; }
+            memset(buffer + (available - offset), 0, (size_t)(copyEnd - available));
+        }
+        else
+        {
+            memcpy(buffer + (position - offset), current->data + (position - blockStart), (size_t)(copyEnd - position));
+        }
+        position = copyEnd;
+    }
+
+    // A failed read returns the whole sectors copied before it
+    if (position < dataEnd)
+    {
+        file->nextOffset = 0;
+        return (unsigned short)((position - offset) / file->sectorSize);
+    }
+    if (dataEnd < end) { memset(buffer + (dataEnd - offset), 0, (size_t)(end - dataEnd)); }
+    return count;
+#else
+    (void)file; (void)sector; (void)buffer;
+    return 0;
+#endif
+}
+
+
+// (Public) File contents generator for a file read through a ring (set the file information's 'reference' to the virtualdisk_uring_file_t)
+unsigned short VirtualDiskUringContents(void *reference, unsigned long sector, unsigned short count, unsigned char *buffer)
+{
+    const virtualdisk_fileinfo_t *fileInfo = (const virtualdisk_fileinfo_t *)reference;
+    return VirtualDiskUringRead((virtualdisk_uring_file_t *)fileInfo->reference, sector, count, buffer);
+}
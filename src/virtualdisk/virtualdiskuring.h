@@ -0,0 +1,100 @@
+// Virtual Disk/File System - Asynchronous File Contents (io_uring)
+// Dan Jackson, 2013
+
+#ifndef VIRTUALDISKURING_H
+#define VIRTUALDISKURING_H
+
+#include <stddef.h>
+
+#include "virtualdisk.h"
+
+// Plain C linkage
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// Size of each read from a source file (bytes, a multiple of 4096 so that direct I/O is aligned)
+#ifndef VIRTUALDISKURING_BLOCK_SIZE
+#define VIRTUALDISKURING_BLOCK_SIZE (128ul * 1024)
+#endif
+
+// Number of blocks in the buffer pool
+#ifndef VIRTUALDISKURING_BUFFERS
+#define VIRTUALDISKURING_BUFFERS 32
+#endif
+
+// Number of blocks read ahead of a sequential run (at most half of the buffers)
+#ifndef VIRTUALDISKURING_DEPTH
+#define VIRTUALDISKURING_DEPTH 8
+#endif
+
+
+// Declaration
+struct virtualdisk_uring_struct_t;
+
+// (Public) A source file read through a ring
+typedef struct
+{
+    struct virtualdisk_uring_struct_t *ring;        // Ring the file is read through
+    int fd;                                         // Open file (-1 if not open)
+    unsigned long id;                               // Identifier of the file's blocks in the buffer pool
+    unsigned short sectorSize;                      // Size of each sector (bytes)
+    unsigned long long size;                        // Length of the file (bytes)
+    unsigned long long nextOffset;                  // Offset following the previous read (a read from here continues a sequential run)
+} virtualdisk_uring_file_t;
+
+// (Public) A block buffer in the pool
+typedef struct
+{
+    unsigned char *data;                            // Block data (aligned)
+    unsigned long file;                             // Identifier of the file the block is from (0 if none)
+    unsigned long long block;                       // Block number within the file
+    char state;                                     // 0 = free, 1 = read in flight, 2 = ready
+    int result;                                     // Number of bytes read (or a negative error)
+    unsigned long lastUse;                          // Use counter value when last used
+} virtualdisk_uring_buffer_t;
+
+// (Public) An io_uring (used through raw system calls) with a pool of aligned block buffers
+typedef struct virtualdisk_uring_struct_t
+{
+    int fd;                                         // Ring (-1 if io_uring is not available: blocks are then read synchronously)
+    char direct;                                    // Open files for direct I/O (O_DIRECT), bypassing the page cache where supported
+    unsigned char *pool;                            // Aligned memory for the buffers
+    virtualdisk_uring_buffer_t buffers[VIRTUALDISKURING_BUFFERS];
+    unsigned long useCounter;                       // Incremented on each use of a buffer
+    unsigned long nextFileId;                       // Identifier for the next file opened
+    unsigned int pending;                           // Number of queued reads not yet submitted
+
+    // Ring mappings
+    void *sqRing, *cqRing, *sqes;
+    size_t sqRingSize, cqRingSize, sqesSize;
+    unsigned int *sqHead, *sqTail, *sqMask, *sqArray;
+    unsigned int *cqHead, *cqTail, *cqMask;
+    void *cqes;
+} virtualdisk_uring_t;
+
+
+// (Public) Create a ring and its buffer pool (falls back to synchronous reads if io_uring is not available; returns zero if out of memory)
+char VirtualDiskUringInit(virtualdisk_uring_t *ring, char direct);
+
+// (Public) Wait for any reads in flight, and free the ring and its buffers (close its files first)
+void VirtualDiskUringClose(virtualdisk_uring_t *ring);
+
+// (Public) Open a source file to read through a ring
+char VirtualDiskUringFileOpen(virtualdisk_uring_file_t *file, virtualdisk_uring_t *ring, const char *filename, unsigned short sectorSize);
+
+// (Public) Close a source file (waiting for any of its reads in flight)
+void VirtualDiskUringFileClose(virtualdisk_uring_file_t *file);
+
+// (Public) Copy sectors of the source file to the buffer (beyond the end of the file, sectors are blank), with the blocks of a large or sequential read in flight together
+unsigned short VirtualDiskUringRead(virtualdisk_uring_file_t *file, unsigned long sector, unsigned short count, unsigned char *buffer);
+
+// (Public) File contents generator for a file read through a ring (set the file information's 'reference' to the virtualdisk_uring_file_t)
+unsigned short VirtualDiskUringContents(void *reference, unsigned long sector, unsigned short count, unsigned char *buffer);
+
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
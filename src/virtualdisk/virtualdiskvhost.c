@@ -0,0 +1,832 @@
+// Virtual Disk/File System - vhost-user Block Device Back-End
+// Dan Jackson, 2013
+
+// A read-only virtio-blk device for a VM, served over the vhost-user protocol (as QEMU's vhost-user-blk-pci device, with its
+// '-object memory-backend-memfd,share=on' guest memory). The front-end (VMM) passes the guest memory as file descriptors, which are
+// mapped here, and the virtqueues' locations in it; the guest's requests are then taken straight from the rings, and each read's
+// sectors are generated by VirtualDiskReadSectors() directly into the guest's buffers -- with no copy between the generator and the
+// guest. Only the parts of a request that are not whole sectors of the disk (e.g. a 512-byte read of a disk of 4096-byte sectors, or
+// a buffer split mid-sector) go through a one-sector bounce buffer. Requests are served one at a time, on the serving thread, as
+// each queue is kicked. The rings are split virtqueues in the host's byte order, so this back-end expects a little-endian host
+// (as virtio 1.0 devices are little-endian).
+
+#ifdef __linux__
+#define _GNU_SOURCE
+#include <errno.h>
+#include <poll.h>
+#include <unistd.h>
+#include <sys/eventfd.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#endif
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "virtualdiskvhost.h"
+
+// Little-endian word macros
+#define SET_DWORD(_p, _ov) { unsigned long _v = (_ov); *((_p)+0) = (unsigned char)((_v)); *((_p)+1) = (unsigned char)((_v) >> 8); *((_p)+2) = (unsigned char)((_v) >> 16); *((_p)+3) = (unsigned char)((_v) >> 24); }
+#define GET_DWORD(_p) ( (unsigned long)*((_p)+0) | ((unsigned long)*((_p)+1) << 8) | ((unsigned long)*((_p)+2) << 16) | ((unsigned long)*((_p)+3) << 24) )
+#define SET_QWORD(_p, _ov) { unsigned long long _q = (_ov); SET_DWORD((_p), (unsigned long)(_q & 0xfffffffful)); SET_DWORD((_p) + 4, (unsigned long)(_q >> 32)); }
+#define GET_QWORD(_p) ( (unsigned long long)GET_DWORD(_p) | ((unsigned long long)GET_DWORD((_p) + 4) << 32) )
+
+// vhost-user messages
+#define VHOST_USER_GET_FEATURES             1
+#define VHOST_USER_SET_FEATURES             2
+#define VHOST_USER_SET_OWNER                3
+#define VHOST_USER_RESET_OWNER              4
+#define VHOST_USER_SET_MEM_TABLE            5
+#define VHOST_USER_SET_VRING_NUM            8
+#define VHOST_USER_SET_VRING_ADDR           9
+#define VHOST_USER_SET_VRING_BASE           10
+#define VHOST_USER_GET_VRING_BASE           11
+#define VHOST_USER_SET_VRING_KICK           12
+#define VHOST_USER_SET_VRING_CALL           13
+#define VHOST_USER_SET_VRING_ERR            14
+#define VHOST_USER_GET_PROTOCOL_FEATURES    15
+#define VHOST_USER_SET_PROTOCOL_FEATURES    16
+#define VHOST_USER_GET_QUEUE_NUM            17
+#define VHOST_USER_SET_VRING_ENABLE         18
+#define VHOST_USER_GET_CONFIG               24
+#define VHOST_USER_SET_CONFIG               25
+
+#define VHOST_USER_VERSION                  0x1
+#define VHOST_USER_REPLY_MASK               0x4
+#define VHOST_USER_NEED_REPLY_MASK          0x8
+#define VHOST_USER_HEADER_SIZE              12
+#define VHOST_USER_MAX_PAYLOAD              512
+#define VHOST_USER_VRING_NOFD_MASK          0x100
+
+#define VHOST_USER_PROTOCOL_F_MQ            0
+#define VHOST_USER_PROTOCOL_F_REPLY_ACK     3
+#define VHOST_USER_PROTOCOL_F_CONFIG        9
+#define VHOST_USER_F_PROTOCOL_FEATURES      30
+
+// Virtio block device
+#define VIRTIO_BLK_F_SEG_MAX                2
+#define VIRTIO_BLK_F_RO                     5
+#define VIRTIO_BLK_F_BLK_SIZE               6
+#define VIRTIO_BLK_F_FLUSH                  9
+#define VIRTIO_BLK_F_MQ                     12
+#define VIRTIO_RING_F_INDIRECT_DESC         28
+#define VIRTIO_F_VERSION_1                  32
+
+#define VIRTIO_BLK_T_IN                     0
+#define VIRTIO_BLK_T_OUT                    1
+#define VIRTIO_BLK_T_FLUSH                  4
+#define VIRTIO_BLK_T_GET_ID                 8
+#define VIRTIO_BLK_T_DISCARD                11
+#define VIRTIO_BLK_T_WRITE_ZEROES           13
+#define VIRTIO_BLK_S_OK                     0
+#define VIRTIO_BLK_S_IOERR                  1
+#define VIRTIO_BLK_S_UNSUPP                 2
+#define VIRTIO_BLK_ID_BYTES                 20
+#define VIRTIO_BLK_CONFIG_SIZE              60
+#define VIRTIO_BLK_SECTOR_SIZE              512         // Request sectors and the capacity are in 512-byte units, whatever the block size
+
+#define VRING_DESC_F_NEXT                   1
+#define VRING_DESC_F_WRITE                  2
+#define VRING_DESC_F_INDIRECT               4
+#define VRING_AVAIL_F_NO_INTERRUPT          1
+
+// Features offered
+#define VIRTUALDISKVHOST_FEATURES ( (1ull << VIRTIO_BLK_F_SEG_MAX) | (1ull << VIRTIO_BLK_F_RO) | (1ull << VIRTIO_BLK_F_BLK_SIZE) | (1ull << VIRTIO_BLK_F_FLUSH) | (1ull << VIRTIO_BLK_F_MQ) | (1ull << VIRTIO_RING_F_INDIRECT_DESC) | (1ull << VIRTIO_F_VERSION_1) | (1ull << VHOST_USER_F_PROTOCOL_FEATURES) )
+#define VIRTUALDISKVHOST_PROTOCOL_FEATURES ( (1ull << VHOST_USER_PROTOCOL_F_MQ) | (1ull << VHOST_USER_PROTOCOL_F_REPLY_ACK) | (1ull << VHOST_USER_PROTOCOL_F_CONFIG) )
+
+
+#ifdef __linux__
+
+// (Private) Split virtqueue structures (little-endian)
+typedef struct { unsigned long long addr; unsigned int len; unsigned short flags; unsigned short next; } virtualdisk_vhost_desc_t;
+typedef struct { unsigned short flags; unsigned short idx; unsigned short ring[1]; } virtualdisk_vhost_avail_t;
+typedef struct { unsigned int id; unsigned int len; } virtualdisk_vhost_used_elem_t;
+typedef struct { unsigned short flags; unsigned short idx; virtualdisk_vhost_used_elem_t ring[1]; } virtualdisk_vhost_used_t;
+
+
+// (Private) Map a range of guest physical memory (returns NULL unless it lies within one region)
+static unsigned char *VirtualDiskVhostGuest(virtualdisk_vhost_t *vhost, unsigned long long address, unsigned long long length)
+{
+    int i;
+    for (i = 0; i < vhost->numRegions; i++)
+    {
+        const virtualdisk_vhost_region_t *region = &vhost->regions[i];
+        if (address >= region->guestAddress && address - region->guestAddress <= region->size && length <= region->size - (address - region->guestAddress))
+        {
+            return region->data + (address - region->guestAddress);
+        }
+    }
+    return NULL;
+}
+
+
+// (Private) Map a range of the front-end's address space (as the ring addresses are given)
+static void *VirtualDiskVhostUser(virtualdisk_vhost_t *vhost, unsigned long long address, unsigned long long length)
+{
+    int i;
+    for (i = 0; i < vhost->numRegions; i++)
+    {
+        const virtualdisk_vhost_region_t *region = &vhost->regions[i];
+        if (address >= region->userAddress && address - region->userAddress <= region->size && length <= region->size - (address - region->userAddress))
+        {
+            return region->data + (address - region->userAddress);
+        }
+    }
+    return NULL;
+}
+
+
+// (Private) Translate a queue's rings from their front-end addresses to this process, for the current memory table (returns zero, and leaves the queue stopped, if they are not all mapped)
+static char VirtualDiskVhostTranslateQueue(virtualdisk_vhost_t *vhost, virtualdisk_vhost_queue_t *queue)
+{
+    unsigned short num = queue->num;
+
+    queue->desc = VirtualDiskVhostUser(vhost, queue->descAddress, 16ull * num);
+    queue->used = VirtualDiskVhostUser(vhost, queue->usedAddress, 6 + 8ull * num);
+    queue->avail = VirtualDiskVhostUser(vhost, queue->availAddress, 6 + 2ull * num);
+    if (num == 0 || queue->desc == NULL || queue->used == NULL || queue->avail == NULL) { queue->desc = queue->used = queue->avail = NULL; return 0; }
+    return 1;
+}
+
+
+// (Private) Unmap the guest memory
+static void VirtualDiskVhostUnmap(virtualdisk_vhost_t *vhost)
+{
+    int i;
+    for (i = 0; i < vhost->numRegions; i++)
+    {
+        munmap(vhost->regions[i].mapping, vhost->regions[i].mappingSize);
+    }
+    vhost->numRegions = 0;
+}
+
+
+// (Private) Stop the queues, closing their eventfds
+static void VirtualDiskVhostResetQueues(virtualdisk_vhost_t *vhost)
+{
+    int i;
+    for (i = 0; i < VIRTUALDISKVHOST_MAX_QUEUES; i++)
+    {
+        virtualdisk_vhost_queue_t *queue = &vhost->queues[i];
+        if (queue->kickFd >= 0) { close(queue->kickFd); }
+        if (queue->callFd >= 0) { close(queue->callFd); }
+        memset(queue, 0, sizeof(virtualdisk_vhost_queue_t));
+        queue->kickFd = -1;
+        queue->callFd = -1;
+    }
+}
+
+
+// (Private) Read a byte range of the disk into guest memory: whole sectors in place, any partial sectors through the bounce sector (returns zero if any sector could not be generated)
+static char VirtualDiskVhostReadBytes(virtualdisk_vhost_t *vhost, unsigned long long offset, unsigned char *buffer, unsigned long length)
+{
+    const unsigned short sectorSize = VirtualDiskSectorSize(vhost->disk);
+
+    vhost->bytesRead += length;
+    while (length > 0)
+    {
+        unsigned long sector = (unsigned long)(offset / sectorSize);
+        unsigned long skip = (unsigned long)(offset % sectorSize);
+        unsigned long part;
+
+        if (skip == 0 && length >= sectorSize)
+        {
+            unsigned long count = length / sectorSize;
+            if (count > 0xffff) { count = 0xffff; }
+            if (VirtualDiskReadSectors(vhost->disk, sector, (unsigned short)count, buffer) != count) { return 0; }
+            part = count * sectorSize;
+        }
+        else
+        {
+            if (VirtualDiskReadSectors(vhost->disk, sector, 1, vhost->bounce) != 1) { return 0; }
+            part = sectorSize - skip;
+            if (part > length) { part = length; }
+            memcpy(buffer, vhost->bounce + skip, part);
+            vhost->bytesBounced += part;
+        }
+        buffer += part;
+        offset += part;
+        length -= part;
+    }
+    return 1;
+}
+
+
+// (Private) Serve a request (a descriptor chain), returning the number of bytes written to its device-writable buffers
+static unsigned long VirtualDiskVhostRequest(virtualdisk_vhost_t *vhost, virtualdisk_vhost_queue_t *queue, unsigned short head)
+{
+    const virtualdisk_vhost_desc_t *table = (const virtualdisk_vhost_desc_t *)queue->desc;
+    unsigned long tableSize = queue->num, steps = 0, readable = 0, writable = 0, written = 1, i;
+    unsigned short index = head;
+    int numSegments = 0, s;
+    char indirect = 0, status = VIRTIO_BLK_S_OK;
+    unsigned char header[16], *statusByte = NULL;
+    unsigned long type;
+    unsigned long long sector;
+
+    // Gather the chain's buffers (device-readable ones first, then device-writable ones)
+    for (;;)
+    {
+        virtualdisk_vhost_desc_t desc;
+
+        if (index >= tableSize || steps++ >= tableSize) { vhost->errors++; return 0; }      // Out of range, or a loop
+        memcpy(&desc, &table[index], sizeof(desc));                                         // (read once: the guest may change it)
+        if (desc.flags & VRING_DESC_F_INDIRECT)
+        {
+            if (indirect || !(vhost->features & (1ull << VIRTIO_RING_F_INDIRECT_DESC)) || desc.len == 0 || desc.len % sizeof(virtualdisk_vhost_desc_t) != 0) { vhost->errors++; return 0; }
+            table = (const virtualdisk_vhost_desc_t *)VirtualDiskVhostGuest(vhost, desc.addr, desc.len);
+            if (table == NULL) { vhost->errors++; return 0; }
+            tableSize = desc.len / sizeof(virtualdisk_vhost_desc_t);
+            index = 0;
+            steps = 0;
+            indirect = 1;
+            continue;
+        }
+        if (numSegments >= VIRTUALDISKVHOST_MAX_SEGMENTS + 2) { vhost->errors++; return 0; }
+        vhost->segments[numSegments].data = VirtualDiskVhostGuest(vhost, desc.addr, desc.len);
+        vhost->segments[numSegments].length = desc.len;
+        vhost->segments[numSegments].writable = (desc.flags & VRING_DESC_F_WRITE) != 0;
+        if (vhost->segments[numSegments].data == NULL || (!vhost->segments[numSegments].writable && writable > 0)) { vhost->errors++; return 0; }
+        if (vhost->segments[numSegments].writable) { writable += desc.len; } else { readable += desc.len; }
+        numSegments++;
+        if (!(desc.flags & VRING_DESC_F_NEXT)) { break; }
+        index = desc.next;
+    }
+
+    // The status is the last device-writable byte
+    for (s = numSegments - 1; s >= 0 && vhost->segments[s].writable; s--)
+    {
+        if (vhost->segments[s].length > 0) { statusByte = vhost->segments[s].data + vhost->segments[s].length - 1; break; }
+    }
+    if (statusByte == NULL || readable < sizeof(header)) { vhost->errors++; if (statusByte != NULL) { *statusByte = VIRTIO_BLK_S_IOERR; } return (statusByte != NULL) ? 1 : 0; }
+
+    // Request header (type, reserved, sector)
+    for (s = 0, i = 0; i < sizeof(header); s++)
+    {
+        unsigned long part = sizeof(header) - i;
+        if (part > vhost->segments[s].length) { part = vhost->segments[s].length; }
+        memcpy(header + i, vhost->segments[s].data, part);
+        i += part;
+    }
+    type = GET_DWORD(header + 0);
+    sector = GET_QWORD(header + 8);
+
+    switch (type)
+    {
+        case VIRTIO_BLK_T_IN:
+        {
+            const unsigned long long capacity = (unsigned long long)VirtualDiskSectorCount(vhost->disk) * VirtualDiskSectorSize(vhost->disk) / VIRTIO_BLK_SECTOR_SIZE;
+            unsigned long long offset = sector * VIRTIO_BLK_SECTOR_SIZE;
+            unsigned long remaining = writable - 1;
+
+            if ((writable - 1) % VIRTIO_BLK_SECTOR_SIZE != 0 || sector > capacity || (writable - 1) / VIRTIO_BLK_SECTOR_SIZE > capacity - sector) { status = VIRTIO_BLK_S_IOERR; break; }
+            for (s = 0; s < numSegments && remaining > 0; s++)
+            {
+                unsigned long part = vhost->segments[s].length;
+                if (!vhost->segments[s].writable) { continue; }
+                if (part > remaining) { part = remaining; }        // (the status byte follows)
+                if (!VirtualDiskVhostReadBytes(vhost, offset, vhost->segments[s].data, part)) { status = VIRTIO_BLK_S_IOERR; break; }
+                offset += part;
+                remaining -= part;
+            }
+            written = writable;
+            break;
+        }
+
+        case VIRTIO_BLK_T_GET_ID:
+        {
+            unsigned char id[VIRTIO_BLK_ID_BYTES];
+            unsigned long length = (writable - 1 < VIRTIO_BLK_ID_BYTES) ? writable - 1 : VIRTIO_BLK_ID_BYTES, done = 0;
+
+            memset(id, 0, sizeof(id));
+            if (vhost->serial != NULL) { memcpy(id, vhost->serial, (strlen(vhost->serial) < sizeof(id)) ? strlen(vhost->serial) : sizeof(id)); }
+            for (s = 0; s < numSegments && done < length; s++)
+            {
+                unsigned long part = vhost->segments[s].length;
+                if (!vhost->segments[s].writable) { continue; }
+                if (part > length - done) { part = length - done; }
+                memcpy(vhost->segments[s].data, id + done, part);
+                done += part;
+            }
+            written = length + 1;
+            break;
+        }
+
+        case VIRTIO_BLK_T_FLUSH:
+            break;                                      // Nothing is written
+
+        case VIRTIO_BLK_T_OUT:
+        case VIRTIO_BLK_T_DISCARD:
+        case VIRTIO_BLK_T_WRITE_ZEROES:
+            status = VIRTIO_BLK_S_IOERR;                // Read-only
+            break;
+
+        default:
+            status = VIRTIO_BLK_S_UNSUPP;
+            break;
+    }
+
+    if (status != VIRTIO_BLK_S_OK) { vhost->errors++; written = 1; }
+    *statusByte = (unsigned char)status;
+    vhost->requests++;
+    return written;
+}
+
+
+// (Private) Serve the requests available on a queue, then notify the front-end
+static void VirtualDiskVhostProcessQueue(virtualdisk_vhost_t *vhost, virtualdisk_vhost_queue_t *queue)
+{
+    virtualdisk_vhost_avail_t *avail = (virtualdisk_vhost_avail_t *)queue->avail;
+    virtualdisk_vhost_used_t *used = (virtualdisk_vhost_used_t *)queue->used;
+    const unsigned short mask = (unsigned short)(queue->num - 1);
+    unsigned short availIdx;
+    char served = 0;
+
+    if (!queue->enabled || queue->kickFd < 0 || queue->desc == NULL || avail == NULL || used == NULL) { return; }
+
+    // The front-end can only have made up to a ring's worth of requests available (otherwise its index is corrupt: none are served)
+    availIdx = __atomic_load_n(&avail->idx, __ATOMIC_ACQUIRE);
+    if ((unsigned short)(availIdx - queue->lastAvail) > queue->num) { vhost->errors++; return; }
+
+    while (queue->lastAvail != availIdx)
+    {
+        unsigned short head = avail->ring[queue->lastAvail & mask];
+        unsigned short usedIdx = used->idx;
+        unsigned long written = VirtualDiskVhostRequest(vhost, queue, head);
+
+        used->ring[usedIdx & mask].id = head;
+        used->ring[usedIdx & mask].len = (unsigned int)written;
+        __atomic_store_n(&used->idx, (unsigned short)(usedIdx + 1), __ATOMIC_RELEASE);
+        queue->lastAvail++;
+        served = 1;
+    }
+
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+    if (served && queue->callFd >= 0 && !(__atomic_load_n(&avail->flags, __ATOMIC_RELAXED) & VRING_AVAIL_F_NO_INTERRUPT))
+    {
+        eventfd_write(queue->callFd, 1);
+        vhost->notifications++;
+    }
+}
+
+
+// (Private) Send a reply to a message
+static char VirtualDiskVhostReply(virtualdisk_vhost_t *vhost, unsigned long request, const unsigned char *payload, unsigned long size)
+{
+    unsigned char message[VHOST_USER_HEADER_SIZE + VHOST_USER_MAX_PAYLOAD];
+    const unsigned char *p = message;
+    size_t length = VHOST_USER_HEADER_SIZE + size;
+
+    SET_DWORD(message + 0, request);
+    SET_DWORD(message + 4, VHOST_USER_VERSION | VHOST_USER_REPLY_MASK);
+    SET_DWORD(message + 8, size);
+    memcpy(message + VHOST_USER_HEADER_SIZE, payload, size);
+    while (length > 0)
+    {
+        ssize_t sent = send(vhost->socket, p, length, MSG_NOSIGNAL);
+        if (sent < 0 && errno == EINTR) { continue; }
+        if (sent <= 0) { return 0; }
+        p += sent;
+        length -= (size_t)sent;
+    }
+    return 1;
+}
+
+
+// (Private) Reply with a 64-bit value
+static char VirtualDiskVhostReplyValue(virtualdisk_vhost_t *vhost, unsigned long request, unsigned long long value)
+{
+    unsigned char payload[8];
+    SET_QWORD(payload, value);
+    return VirtualDiskVhostReply(vhost, request, payload, 8);
+}
+
+
+// (Private) Receive a message and any file descriptors passed with it (returns the number of bytes of payload, or -1 on disconnection or an error)
+static long VirtualDiskVhostReceive(virtualdisk_vhost_t *vhost, unsigned char *message, int *fds, int *numFds)
+{
+    union { struct cmsghdr header; char buffer[CMSG_SPACE(sizeof(int) * VIRTUALDISKVHOST_MAX_REGIONS)]; } control;
+    struct msghdr msg;
+    struct iovec iov;
+    struct cmsghdr *cmsg;
+    unsigned long size, received;
+    ssize_t n;
+
+    *numFds = 0;
+    memset(&msg, 0, sizeof(msg));
+    iov.iov_base = message;
+    iov.iov_len = VHOST_USER_HEADER_SIZE;
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    msg.msg_control = control.buffer;
+    msg.msg_controllen = sizeof(control.buffer);
+    do { n = recvmsg(vhost->socket, &msg, MSG_CMSG_CLOEXEC); } while (n < 0 && errno == EINTR);
+    if (n <= 0) { return -1; }
+
+    for (cmsg = CMSG_FIRSTHDR(&msg); cmsg != NULL; cmsg = CMSG_NXTHDR(&msg, cmsg))
+    {
+        if (cmsg->cmsg_level == SOL_SOCKET && cmsg->cmsg_type == SCM_RIGHTS)
+        {
+            int count = (int)((cmsg->cmsg_len - CMSG_LEN(0)) / sizeof(int)), j;
+            for (j = 0; j < count; j++)
+            {
+                int fd;
+                memcpy(&fd, CMSG_DATA(cmsg) + j * sizeof(int), sizeof(int));
+                if (*numFds < VIRTUALDISKVHOST_MAX_REGIONS) { fds[(*numFds)++] = fd; } else { close(fd); }
+            }
+        }
+    }
+
+    // Rest of the header, then the payload
+    received = (unsigned long)n;
+    size = VHOST_USER_HEADER_SIZE;
+    for (;;)
+    {
+        while (received < size)
+        {
+            n = recv(vhost->socket, message + received, size - received, 0);
+            if (n < 0 && errno == EINTR) { continue; }
+            if (n <= 0) { return -1; }
+            received += (unsigned long)n;
+        }
+        if (size > VHOST_USER_HEADER_SIZE) { break; }
+        size = VHOST_USER_HEADER_SIZE + GET_DWORD(message + 8);
+        if (size > VHOST_USER_HEADER_SIZE + VHOST_USER_MAX_PAYLOAD) { return -1; }
+        if (size == VHOST_USER_HEADER_SIZE) { break; }
+    }
+    return (long)(size - VHOST_USER_HEADER_SIZE);
+}
+
+
+// (Private) Map the guest memory regions passed with SET_MEM_TABLE, then translate the queues' rings again (their mappings are replaced)
+static char VirtualDiskVhostSetMemTable(virtualdisk_vhost_t *vhost, const unsigned char *payload, long size, const int *fds, int numFds)
+{
+    unsigned long count = (size >= 8) ? GET_DWORD(payload) : 0, i;
+
+    VirtualDiskVhostUnmap(vhost);
+    for (i = 0; i < VIRTUALDISKVHOST_MAX_QUEUES; i++) { vhost->queues[i].desc = vhost->queues[i].used = vhost->queues[i].avail = NULL; }
+    if (count > VIRTUALDISKVHOST_MAX_REGIONS || (unsigned long)numFds != count || (unsigned long)size < 8 + 32 * count) { return 0; }
+    for (i = 0; i < count; i++)
+    {
+        const unsigned char *p = payload + 8 + 32 * i;
+        virtualdisk_vhost_region_t *region = &vhost->regions[vhost->numRegions];
+        unsigned long long mmapOffset = GET_QWORD(p + 24);
+
+        region->guestAddress = GET_QWORD(p + 0);
+        region->size = GET_QWORD(p + 8);
+        region->userAddress = GET_QWORD(p + 16);
+        region->mappingSize = (size_t)(mmapOffset + region->size);
+        region->mapping = mmap(NULL, region->mappingSize, PROT_READ | PROT_WRITE, MAP_SHARED, fds[i], 0);
+        if (region->mapping == MAP_FAILED) { return 0; }
+        region->data = (unsigned char *)region->mapping + mmapOffset;
+        vhost->numRegions++;
+    }
+    for (i = 0; i < VIRTUALDISKVHOST_MAX_QUEUES; i++) { if (vhost->queues[i].descAddress != 0) { VirtualDiskVhostTranslateQueue(vhost, &vhost->queues[i]); } }     // (a queue whose rings are not in the new table stays stopped until SET_VRING_ADDR)
+    return 1;
+}
+
+
+// (Private) The device configuration space (struct virtio_blk_config)
+static void VirtualDiskVhostConfig(virtualdisk_vhost_t *vhost, unsigned char *config)
+{
+    const unsigned short sectorSize = VirtualDiskSectorSize(vhost->disk);
+
+    memset(config, 0, VIRTIO_BLK_CONFIG_SIZE);
+    SET_QWORD(config + 0, (unsigned long long)VirtualDiskSectorCount(vhost->disk) * sectorSize / VIRTIO_BLK_SECTOR_SIZE);      // capacity
+    SET_DWORD(config + 12, VIRTUALDISKVHOST_MAX_SEGMENTS);             // seg_max
+    SET_DWORD(config + 20, sectorSize);                                 // blk_size
+    config[34] = VIRTUALDISKVHOST_MAX_QUEUES & 0xff;                    // num_queues
+    config[35] = (VIRTUALDISKVHOST_MAX_QUEUES >> 8) & 0xff;
+}
+
+
+// (Private) Handle a message from the front-end (returns zero once it disconnects, or on an error)
+static char VirtualDiskVhostMessage(virtualdisk_vhost_t *vhost)
+{
+    unsigned char message[VHOST_USER_HEADER_SIZE + VHOST_USER_MAX_PAYLOAD], *payload = message + VHOST_USER_HEADER_SIZE;
+    int fds[VIRTUALDISKVHOST_MAX_REGIONS], numFds, i;
+    unsigned long request, flags, index = 0;
+    virtualdisk_vhost_queue_t *queue = NULL;
+    char ok = 1, replied = 0;
+    long size;
+
+    size = VirtualDiskVhostReceive(vhost, message, fds, &numFds);
+    if (size < 0) { for (i = 0; i < numFds; i++) { close(fds[i]); } return 0; }
+    request = GET_DWORD(message + 0);
+    flags = GET_DWORD(message + 4);
+
+    // Messages for a queue start with its index
+    if (request == VHOST_USER_SET_VRING_NUM || request == VHOST_USER_SET_VRING_ADDR || request == VHOST_USER_SET_VRING_BASE || request == VHOST_USER_GET_VRING_BASE || request == VHOST_USER_SET_VRING_ENABLE || request == VHOST_USER_SET_VRING_KICK || request == VHOST_USER_SET_VRING_CALL || request == VHOST_USER_SET_VRING_ERR)
+    {
+        index = (size >= 4) ? GET_DWORD(payload) & 0xff : 0xff;
+        if (index < VIRTUALDISKVHOST_MAX_QUEUES) { queue = &vhost->queues[index]; }
+        else { for (i = 0; i < numFds; i++) { close(fds[i]); } return 0; }
+    }
+
+    switch (request)
+    {
+        case VHOST_USER_GET_FEATURES:
+            replied = 1;
+            ok = VirtualDiskVhostReplyValue(vhost, request, VIRTUALDISKVHOST_FEATURES);
+            break;
+
+        case VHOST_USER_SET_FEATURES:
+            vhost->features = (size >= 8) ? GET_QWORD(payload) & VIRTUALDISKVHOST_FEATURES : 0;
+            break;
+
+        case VHOST_USER_GET_PROTOCOL_FEATURES:
+            replied = 1;
+            ok = VirtualDiskVhostReplyValue(vhost, request, VIRTUALDISKVHOST_PROTOCOL_FEATURES);
+            break;
+
+        case VHOST_USER_SET_PROTOCOL_FEATURES:
+            vhost->protocolFeatures = (size >= 8) ? GET_QWORD(payload) & VIRTUALDISKVHOST_PROTOCOL_FEATURES : 0;
+            break;
+
+        case VHOST_USER_GET_QUEUE_NUM:
+            replied = 1;
+            ok = VirtualDiskVhostReplyValue(vhost, request, VIRTUALDISKVHOST_MAX_QUEUES);
+            break;
+
+        case VHOST_USER_SET_OWNER:
+            break;
+
+        case VHOST_USER_RESET_OWNER:
+            VirtualDiskVhostResetQueues(vhost);
+            vhost->features = 0;
+            break;
+
+        case VHOST_USER_SET_MEM_TABLE:
+            ok = VirtualDiskVhostSetMemTable(vhost, payload, size, fds, numFds);
+            for (i = 0; i < numFds; i++) { close(fds[i]); }     // (the mappings remain)
+            numFds = 0;
+            break;
+
+        case VHOST_USER_SET_VRING_NUM:
+        {
+            unsigned long num = (size >= 8) ? GET_DWORD(payload + 4) : 0;
+            ok = (num > 0 && num <= 32768 && (num & (num - 1)) == 0);
+            queue->num = ok ? (unsigned short)num : 0;
+            break;
+        }
+
+        case VHOST_USER_SET_VRING_ADDR:
+            if (size < 40 || queue->num == 0) { ok = 0; break; }
+            queue->descAddress = GET_QWORD(payload + 8);
+            queue->usedAddress = GET_QWORD(payload + 16);
+            queue->availAddress = GET_QWORD(payload + 24);
+            ok = VirtualDiskVhostTranslateQueue(vhost, queue);
+            break;
+
+        case VHOST_USER_SET_VRING_BASE:
+            queue->lastAvail = (size >= 8) ? (unsigned short)GET_DWORD(payload + 4) : 0;
+            break;
+
+        case VHOST_USER_GET_VRING_BASE:
+        {
+            // Stops the queue, returning where it stopped
+            unsigned char state[8];
+            if (queue->kickFd >= 0) { close(queue->kickFd); }
+            queue->kickFd = -1;
+            SET_DWORD(state + 0, index);
+            SET_DWORD(state + 4, queue->lastAvail);
+            replied = 1;
+            ok = VirtualDiskVhostReply(vhost, request, state, 8);
+            break;
+        }
+
+        case VHOST_USER_SET_VRING_KICK:
+        case VHOST_USER_SET_VRING_CALL:
+        case VHOST_USER_SET_VRING_ERR:
+        {
+            int fd = (numFds > 0 && size >= 8 && !(GET_QWORD(payload) & VHOST_USER_VRING_NOFD_MASK)) ? fds[0] : -1;
+            if (numFds > 0 && fd < 0) { close(fds[0]); }
+            numFds = 0;
+            if (request == VHOST_USER_SET_VRING_KICK)
+            {
+                // Starts the queue (enabled now, unless the front-end enables queues itself)
+                if (queue->kickFd >= 0) { close(queue->kickFd); }
+                queue->kickFd = fd;
+                if (!(vhost->features & (1ull << VHOST_USER_F_PROTOCOL_FEATURES))) { queue->enabled = 1; }
+                VirtualDiskVhostProcessQueue(vhost, queue);
+            }
+            else if (request == VHOST_USER_SET_VRING_CALL)
+            {
+                if (queue->callFd >= 0) { close(queue->callFd); }
+                queue->callFd = fd;
+            }
+            else if (fd >= 0)
+            {
+                close(fd);                              // Errors are not reported
+            }
+            break;
+        }
+
+        case VHOST_USER_SET_VRING_ENABLE:
+            queue->enabled = (size >= 8 && GET_DWORD(payload + 4) != 0);
+            VirtualDiskVhostProcessQueue(vhost, queue);
+            break;
+
+        case VHOST_USER_GET_CONFIG:
+        {
+            unsigned char config[VIRTIO_BLK_CONFIG_SIZE];
+            unsigned long offset = (size >= 12) ? GET_DWORD(payload + 0) : 0, length = (size >= 12) ? GET_DWORD(payload + 4) : 0;
+            if (size < 12 || length > VHOST_USER_MAX_PAYLOAD - 12 || (unsigned long)size < 12 + length) { return 0; }
+            VirtualDiskVhostConfig(vhost, config);
+            memset(payload + 12, 0, length);
+            if (offset < VIRTIO_BLK_CONFIG_SIZE) { memcpy(payload + 12, config + offset, (length < VIRTIO_BLK_CONFIG_SIZE - offset) ? length : VIRTIO_BLK_CONFIG_SIZE - offset); }
+            replied = 1;
+            ok = VirtualDiskVhostReply(vhost, request, payload, 12 + length);
+            break;
+        }
+
+        case VHOST_USER_SET_CONFIG:
+            ok = 0;                                     // The configuration is read-only
+            break;
+
+        default:
+            ok = 0;                                     // Not supported
+            break;
+    }
+    for (i = 0; i < numFds; i++) { close(fds[i]); }
+
+    // Acknowledge, if asked to
+    if (replied) { return ok; }
+    if ((flags & VHOST_USER_NEED_REPLY_MASK) && (vhost->protocolFeatures & (1ull << VHOST_USER_PROTOCOL_F_REPLY_ACK)))
+    {
+        return VirtualDiskVhostReplyValue(vhost, request, ok ? 0 : 1);
+    }
+    return 1;
+}
+
+#endif
+
+
+// (Public) Set up a back-end for a disk
+char VirtualDiskVhostInit(virtualdisk_vhost_t *vhost, virtualdisk_t *disk, const char *serial)
+{
+    memset(vhost, 0, sizeof(virtualdisk_vhost_t));
+    vhost->disk = disk;
+    vhost->serial = serial;
+    vhost->listenSocket = -1;
+    vhost->socket = -1;
+    vhost->stopFd = -1;
+#ifdef __linux__
+    VirtualDiskVhostResetQueues(vhost);
+    vhost->bounce = (unsigned char *)malloc(VirtualDiskSectorSize(disk));
+    vhost->stopFd = eventfd(0, EFD_CLOEXEC);
+    if (vhost->bounce == NULL || vhost->stopFd < 0 || VirtualDiskSectorSize(disk) == 0) { VirtualDiskVhostClose(vhost); return 0; }
+    return 1;
+#else
+    return 0;
+#endif
+}
+
+
+// (Public) Listen on a Unix socket for the front-end
+char VirtualDiskVhostListen(virtualdisk_vhost_t *vhost, const char *path)
+{
+#ifdef __linux__
+    struct sockaddr_un address;
+    int s;
+
+    if (vhost->bounce == NULL || vhost->listenSocket >= 0 || strlen(path) >= sizeof(address.sun_path) || strlen(path) >= sizeof(vhost->unixPath)) { return 0; }
+    memset(&address, 0, sizeof(address));
+    address.sun_family = AF_UNIX;
+    strcpy(address.sun_path, path);
+    s = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (s < 0) { return 0; }
+    unlink(path);
+    if (bind(s, (struct sockaddr *)&address, sizeof(address)) != 0 || listen(s, 1) != 0) { close(s); return 0; }
+    strcpy(vhost->unixPath, path);
+    vhost->listenSocket = s;
+    return 1;
+#else
+    return 0;
+#endif
+}
+
+
+// (Public) Accept front-end connections, one at a time, until stopped
+char VirtualDiskVhostServe(virtualdisk_vhost_t *vhost)
+{
+#ifdef __linux__
+    if (vhost->bounce == NULL || vhost->listenSocket < 0) { return 0; }
+
+    while (!vhost->stopping)
+    {
+        struct pollfd fds[2];
+        int s;
+
+        fds[0].fd = vhost->listenSocket;
+        fds[0].events = POLLIN;
+        fds[1].fd = vhost->stopFd;
+        fds[1].events = POLLIN;
+        if (poll(fds, 2, -1) < 0)
+        {
+            if (errno == EINTR) { continue; }
+            return 0;
+        }
+        if (vhost->stopping || fds[1].revents) { break; }
+        s = accept4(vhost->listenSocket, NULL, NULL, SOCK_CLOEXEC);
+        if (s < 0)
+        {
+            if (errno == EINTR || errno == ECONNABORTED) { continue; }
+            return 0;
+        }
+        VirtualDiskVhostServeSocket(vhost, s);
+        close(s);
+    }
+    return 1;
+#else
+    return 0;
+#endif
+}
+
+
+// (Public) Serve a single connected front-end socket until it disconnects or the back-end is stopped
+char VirtualDiskVhostServeSocket(virtualdisk_vhost_t *vhost, int socket)
+{
+#ifdef __linux__
+    char result = 1;
+
+    if (vhost->bounce == NULL) { return 0; }
+    vhost->socket = socket;
+    vhost->features = 0;
+    vhost->protocolFeatures = 0;
+    VirtualDiskVhostResetQueues(vhost);
+
+    while (!vhost->stopping)
+    {
+        struct pollfd fds[2 + VIRTUALDISKVHOST_MAX_QUEUES];
+        int queueOf[2 + VIRTUALDISKVHOST_MAX_QUEUES];
+        int numFds = 0, i;
+
+        // Wait for a message, a kick of a started queue, or a stop
+        fds[numFds].fd = vhost->socket; fds[numFds].events = POLLIN; queueOf[numFds++] = -1;
+        fds[numFds].fd = vhost->stopFd; fds[numFds].events = POLLIN; queueOf[numFds++] = -1;
+        for (i = 0; i < VIRTUALDISKVHOST_MAX_QUEUES; i++)
+        {
+            if (vhost->queues[i].kickFd >= 0 && vhost->queues[i].enabled) { fds[numFds].fd = vhost->queues[i].kickFd; fds[numFds].events = POLLIN; queueOf[numFds++] = i; }
+        }
+        if (poll(fds, (nfds_t)numFds, -1) < 0)
+        {
+            if (errno == EINTR) { continue; }
+            result = 0;
+            break;
+        }
+        if (fds[1].revents) { break; }
+
+        // Kicked queues
+        for (i = 2; i < numFds; i++)
+        {
+            if (fds[i].revents & POLLIN)
+            {
+                eventfd_t value;
+                eventfd_read(fds[i].fd, &value);
+                VirtualDiskVhostProcessQueue(vhost, &vhost->queues[queueOf[i]]);
+            }
+        }
+
+        // Messages (the front-end disconnecting ends the session)
+        if (fds[0].revents && !VirtualDiskVhostMessage(vhost)) { break; }
+    }
+
+    VirtualDiskVhostResetQueues(vhost);
+    VirtualDiskVhostUnmap(vhost);
+    VirtualDiskEndSession(vhost->disk);
+    vhost->socket = -1;
+    return result;
+#else
+    return 0;
+#endif
+}
+
+
+// (Public) Stop serving
+void VirtualDiskVhostStop(virtualdisk_vhost_t *vhost)
+{
+    vhost->stopping = 1;
+#ifdef __linux__
+    if (vhost->stopFd >= 0) { eventfd_write(vhost->stopFd, 1); }
+#endif
+}
+
+
+// (Public) Close the back-end
+void VirtualDiskVhostClose(virtualdisk_vhost_t *vhost)
+{
+#ifdef __linux__
+    VirtualDiskVhostResetQueues(vhost);
+    VirtualDiskVhostUnmap(vhost);
+    if (vhost->listenSocket >= 0) { close(vhost->listenSocket); }
+    if (vhost->unixPath[0] != '\0') { unlink(vhost->unixPath); }
+    if (vhost->stopFd >= 0) { close(vhost->stopFd); }
+#endif
+    vhost->listenSocket = -1;
+    vhost->unixPath[0] = '\0';
+    vhost->stopFd = -1;
+    free(vhost->bounce);
+    vhost->bounce = NULL;
+}
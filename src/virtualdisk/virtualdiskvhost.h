@@ -0,0 +1,117 @@
+// Virtual Disk/File System - vhost-user Block Device Back-End
+// Dan Jackson, 2013
+
+#ifndef VIRTUALDISKVHOST_H
+#define VIRTUALDISKVHOST_H
+
+#include <stddef.h>
+
+#include "virtualdisk.h"
+
+// Plain C linkage
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// Maximum number of guest memory regions (as the vhost-user protocol)
+#define VIRTUALDISKVHOST_MAX_REGIONS 8
+
+// Maximum number of virtqueues
+#ifndef VIRTUALDISKVHOST_MAX_QUEUES
+#define VIRTUALDISKVHOST_MAX_QUEUES 4
+#endif
+
+// Maximum number of data segments in a request (advertised as seg_max, plus the header and status)
+#ifndef VIRTUALDISKVHOST_MAX_SEGMENTS
+#define VIRTUALDISKVHOST_MAX_SEGMENTS 254
+#endif
+
+
+// (Public) A guest memory region, mapped from the front-end's shared memory
+typedef struct
+{
+    unsigned long long guestAddress;                // Guest physical address of the region
+    unsigned long long size;                        // Size of the region (bytes)
+    unsigned long long userAddress;                 // Address of the region in the front-end's (VMM's) address space
+    unsigned char *data;                            // Address of the region in this process
+    void *mapping;                                  // Mapping (from the start of the shared memory file, which may be before the region)
+    size_t mappingSize;                             // Size of the mapping (bytes)
+} virtualdisk_vhost_region_t;
+
+// (Public) A split virtqueue
+typedef struct
+{
+    unsigned short num;                             // Number of descriptors
+    unsigned long long descAddress;                 // Front-end (VMM) address of the descriptor table, as set by SET_VRING_ADDR
+    unsigned long long availAddress;                // Front-end address of the available ring
+    unsigned long long usedAddress;                 // Front-end address of the used ring
+    void *desc;                                     // Descriptor table (translated from its front-end address for the current memory table, NULL if not mapped)
+    void *avail;                                    // Available ring
+    void *used;                                     // Used ring
+    unsigned short lastAvail;                       // Next available ring entry to process
+    int kickFd;                                     // Eventfd the front-end signals when requests are available (-1 if none)
+    int callFd;                                     // Eventfd to signal when requests are used (-1 if none)
+    char enabled;                                   // Enabled by the front-end
+} virtualdisk_vhost_queue_t;
+
+// (Public) A data segment of a request (guest memory mapped in this process)
+typedef struct
+{
+    unsigned char *data;
+    unsigned long length;
+    char writable;                                  // Device-writable (the rest are device-readable)
+} virtualdisk_vhost_segment_t;
+
+// (Public) A vhost-user block device back-end for a virtual disk (read-only), reading sectors directly into the guest's buffers
+typedef struct
+{
+    virtualdisk_t *disk;                            // Disk served (through a single read context: requests are served one at a time)
+    const char *serial;                             // Device serial number for VIRTIO_BLK_T_GET_ID (up to 20 characters)
+    int listenSocket;                               // Listening socket (-1 if none)
+    char unixPath[108];                             // Path of the listening socket, removed when closed (empty if none)
+    int socket;                                     // Connected front-end (-1 if none)
+    int stopFd;                                     // Eventfd to wake the back-end to stop
+    volatile char stopping;                         // Set to stop serving
+    unsigned char *bounce;                          // One sector, for the parts of a request that are not whole sectors of the disk
+
+    // Negotiated state
+    unsigned long long features;                    // Virtio (and vhost-user) features acknowledged
+    unsigned long long protocolFeatures;            // vhost-user protocol features acknowledged
+    virtualdisk_vhost_region_t regions[VIRTUALDISKVHOST_MAX_REGIONS];
+    int numRegions;
+    virtualdisk_vhost_queue_t queues[VIRTUALDISKVHOST_MAX_QUEUES];
+    virtualdisk_vhost_segment_t segments[VIRTUALDISKVHOST_MAX_SEGMENTS + 2];
+
+    // Statistics
+    unsigned long requests;                         // Number of requests served
+    unsigned long errors;                           // Number of requests failed (malformed, out of range, or a write)
+    unsigned long long bytesRead;                   // Number of bytes read into guest buffers
+    unsigned long long bytesBounced;                // Number of those bytes copied through the bounce sector (the rest are generated in place)
+    unsigned long notifications;                    // Number of times the front-end was notified
+} virtualdisk_vhost_t;
+
+
+// (Public) Set up a back-end for a disk (returns zero if not supported on this platform, or out of memory)
+char VirtualDiskVhostInit(virtualdisk_vhost_t *vhost, virtualdisk_t *disk, const char *serial);
+
+// (Public) Listen on a Unix socket for the front-end (e.g. QEMU's '-chardev socket,path=...' with '-device vhost-user-blk-pci')
+char VirtualDiskVhostListen(virtualdisk_vhost_t *vhost, const char *path);
+
+// (Public) Accept front-end connections, one at a time, until stopped (returns zero if not listening, or on an error)
+char VirtualDiskVhostServe(virtualdisk_vhost_t *vhost);
+
+// (Public) Serve a single connected front-end socket until it disconnects or the back-end is stopped (returns zero on a protocol or socket error)
+char VirtualDiskVhostServeSocket(virtualdisk_vhost_t *vhost, int socket);
+
+// (Public) Stop serving (e.g. from another thread or a signal handler)
+void VirtualDiskVhostStop(virtualdisk_vhost_t *vhost);
+
+// (Public) Close the back-end once VirtualDiskVhostServe() has returned (or if it was not called)
+void VirtualDiskVhostClose(virtualdisk_vhost_t *vhost);
+
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif